@@ -0,0 +1,137 @@
+/*
+ *  video_tiles.h - Tile based screen diff for the static refresh modes
+ *
+ *  Basilisk II (C) 1997-2008 Christian Bauer
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef VIDEO_TILES_H
+#define VIDEO_TILES_H
+
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+// Size of the tiles the screen is cut into, in pixels
+const uint32 VIDEO_TILE_SIZE = 32;
+
+// Maximum number of rects video_update_tiles() returns for a screen
+static inline uint32 video_max_tile_rects(uint32 width, uint32 height)
+{
+	return ((width + VIDEO_TILE_SIZE - 1) / VIDEO_TILE_SIZE) * ((height + VIDEO_TILE_SIZE - 1) / VIDEO_TILE_SIZE);
+}
+
+// Compare one row of a tile against its copy
+static inline bool video_tile_row_differs(const uint8 *p, const uint8 *p2, uint32 len)
+{
+	uint32 i = 0;
+#ifdef __AVX2__
+	for (; i + 32 <= len; i += 32) {
+		__m256i a = _mm256_loadu_si256((const __m256i *)(p + i));
+		__m256i b = _mm256_loadu_si256((const __m256i *)(p2 + i));
+		if ((uint32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, b)) != 0xffffffff)
+			return true;
+	}
+#endif
+#ifdef __SSE2__
+	for (; i + 16 <= len; i += 16) {
+		__m128i a = _mm_loadu_si128((const __m128i *)(p + i));
+		__m128i b = _mm_loadu_si128((const __m128i *)(p2 + i));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) != 0xffff)
+			return true;
+	}
+#endif
+	return i < len && memcmp(p + i, p2 + i, len - i) != 0;
+}
+
+// Add a run of dirty tiles to the rect list. Rects of the previous row of
+// tiles are in [cand_start, cand_end), those of the current row follow;
+// a run with the same horizontal position as a previous one extends it.
+template <class Rect>
+static inline void video_add_tile_run(Rect *rects, uint32 &nr_rects, uint32 cand_start, uint32 &cand_end,
+	uint32 x, uint32 y, uint32 w, uint32 h)
+{
+	for (uint32 i = cand_start; i < cand_end; i++) {
+		if ((uint32)rects[i].x == x && (uint32)rects[i].w == w) {
+			Rect r = rects[i];
+			r.h += h;
+			rects[i] = rects[--cand_end];
+			rects[cand_end] = r;
+			return;
+		}
+	}
+	Rect &r = rects[nr_rects++];
+	r.x = x;
+	r.y = y;
+	r.w = w;
+	r.h = h;
+}
+
+/*
+ *  Compare buffer with copy in tiles of VIDEO_TILE_SIZE x VIDEO_TILE_SIZE
+ *  pixels. Changed rows of each tile are copied to copy and, if dst is
+ *  given, converted to dst with Screen_blit(). Dirty tiles are returned
+ *  in rects (which must hold video_max_tile_rects() entries): tiles next
+ *  to each other on a row are joined, and so are runs of the same width
+ *  on consecutive rows. Returns the number of rects.
+ */
+
+template <class Rect>
+static uint32 video_update_tiles(const uint8 *buffer, uint8 *copy, uint32 width, uint32 height,
+	uint32 bytes_per_row, uint32 bits_per_pixel, uint8 *dst, uint32 dst_bytes_per_row,
+	uint32 dst_bytes_per_pixel, Rect *rects)
+{
+	uint32 nr_rects = 0;
+	uint32 cand_start = 0, cand_end = 0;
+	for (uint32 y = 0; y < height; y += VIDEO_TILE_SIZE) {
+		const uint32 h = height - y < VIDEO_TILE_SIZE ? height - y : VIDEO_TILE_SIZE;
+		uint32 run_x = 0, run_w = 0;
+		for (uint32 x = 0; x < width; x += VIDEO_TILE_SIZE) {
+			const uint32 w = width - x < VIDEO_TILE_SIZE ? width - x : VIDEO_TILE_SIZE;
+			const uint32 xb = x * bits_per_pixel / 8;
+			const uint32 xs = (w * bits_per_pixel + 7) / 8;
+			bool dirty = false;
+			for (uint32 j = y; j < y + h; j++) {
+				const uint32 yb = j * bytes_per_row;
+				if (video_tile_row_differs(buffer + yb + xb, copy + yb + xb, xs)) {
+					memcpy(copy + yb + xb, buffer + yb + xb, xs);
+					if (dst)
+						Screen_blit(dst + j * dst_bytes_per_row + x * dst_bytes_per_pixel, buffer + yb + xb, xs);
+					dirty = true;
+				}
+			}
+			if (dirty) {
+				if (run_w == 0)
+					run_x = x;
+				run_w += w;
+			} else if (run_w) {
+				video_add_tile_run(rects, nr_rects, cand_start, cand_end, run_x, y, run_w, h);
+				run_w = 0;
+			}
+		}
+		if (run_w)
+			video_add_tile_run(rects, nr_rects, cand_start, cand_end, run_x, y, run_w, h);
+		cand_start = cand_end;
+		cand_end = nr_rects;
+	}
+	return nr_rects;
+}
+
+#endif /* VIDEO_TILES_H */
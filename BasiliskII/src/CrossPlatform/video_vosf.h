@@ -219,6 +219,171 @@ static uint32 page_extend(uint32 size)
 }
 
 
+/*
+ *  Parallel conversion of dirty lines to the host frame buffer
+ */
+
+// Dirty lines are split into chunks of VOSF_CHUNK_LINES lines that the
+// worker threads and the refresh thread convert concurrently. Updates of
+// less than VOSF_PARALLEL_LINES lines are not worth waking the workers.
+const int VOSF_MAX_THREADS = 8;
+const uint32 VOSF_CHUNK_LINES = 16;
+const uint32 VOSF_PARALLEL_LINES = 64;
+
+struct vosf_lines {
+	uint32 y1, y2;				// First and last (inclusive) line
+};
+
+static vosf_lines *vosf_spans;			// Dirty line spans of the current frame
+static uint32 vosf_n_spans;
+static vosf_lines *vosf_chunks;			// Work items of the current frame
+static uint32 vosf_n_chunks;
+static uint32 vosf_next_chunk;			// Next work item to be taken
+static uint32 vosf_src_bytes_per_row;
+static uint32 vosf_dst_bytes_per_row;
+static int vosf_stats_interval = 0;		// Seconds between conversion statistics log lines, 0 = disabled
+
+static void vosf_convert_chunks(void)
+{
+	for (;;) {
+#ifdef HAVE_PTHREADS
+		const uint32 c = __atomic_fetch_add(&vosf_next_chunk, 1, __ATOMIC_RELAXED);
+#else
+		const uint32 c = vosf_next_chunk++;
+#endif
+		if (c >= vosf_n_chunks)
+			break;
+		uint32 i1 = vosf_chunks[c].y1 * vosf_src_bytes_per_row;
+		uint32 i2 = vosf_chunks[c].y1 * vosf_dst_bytes_per_row;
+		for (uint32 j = vosf_chunks[c].y1; j <= vosf_chunks[c].y2; j++) {
+			Screen_blit(the_host_buffer + i2, the_buffer + i1, vosf_src_bytes_per_row);
+			i1 += vosf_src_bytes_per_row;
+			i2 += vosf_dst_bytes_per_row;
+		}
+	}
+}
+
+#ifdef HAVE_PTHREADS
+static pthread_t vosf_workers[VOSF_MAX_THREADS];
+static int vosf_n_workers = 0;			// Number of worker threads running
+static pthread_mutex_t vosf_work_lock = PTHREAD_MUTEX_INITIALIZER;	// Protects the fields below
+static pthread_cond_t vosf_work_cond = PTHREAD_COND_INITIALIZER;	// Signalled when a frame is ready for conversion
+static pthread_cond_t vosf_done_cond = PTHREAD_COND_INITIALIZER;	// Signalled when the last worker is done
+static uint32 vosf_work_generation = 0;	// Incremented for every frame handed to the workers
+static int vosf_workers_busy = 0;		// Number of workers still converting the current frame
+static bool vosf_workers_quit = false;	// Flag: Worker threads should exit
+
+static void *vosf_worker_func(void *arg)
+{
+	uint32 generation = 0;
+	pthread_mutex_lock(&vosf_work_lock);
+	for (;;) {
+		while (!vosf_workers_quit && vosf_work_generation == generation)
+			pthread_cond_wait(&vosf_work_cond, &vosf_work_lock);
+		if (vosf_workers_quit)
+			break;
+		generation = vosf_work_generation;
+		pthread_mutex_unlock(&vosf_work_lock);
+		vosf_convert_chunks();
+		pthread_mutex_lock(&vosf_work_lock);
+		if (--vosf_workers_busy == 0)
+			pthread_cond_signal(&vosf_done_cond);
+	}
+	pthread_mutex_unlock(&vosf_work_lock);
+	return NULL;
+}
+
+static void vosf_start_workers(void)
+{
+	// "vosfthreads" is the total number of converting threads, including
+	// the refresh thread, 0 picks one per CPU (leaving one to the emulator)
+	int n_threads = PrefsFindInt32("vosfthreads");
+	if (n_threads <= 0) {
+		n_threads = sysconf(_SC_NPROCESSORS_ONLN) - 1;
+		if (n_threads > 4)
+			n_threads = 4;
+	}
+	if (n_threads > VOSF_MAX_THREADS)
+		n_threads = VOSF_MAX_THREADS;
+
+	vosf_work_generation = 0;
+	vosf_workers_quit = false;
+	for (vosf_n_workers = 0; vosf_n_workers < n_threads - 1; vosf_n_workers++) {
+		pthread_attr_t attr;
+		Set_pthread_attr(&attr, 0);
+		int err = pthread_create(&vosf_workers[vosf_n_workers], &attr, vosf_worker_func, NULL);
+		pthread_attr_destroy(&attr);
+		if (err != 0)
+			break;
+	}
+	D(bug("VOSF: %d conversion worker threads\n", vosf_n_workers));
+}
+
+static void vosf_stop_workers(void)
+{
+	pthread_mutex_lock(&vosf_work_lock);
+	vosf_workers_quit = true;
+	pthread_cond_broadcast(&vosf_work_cond);
+	pthread_mutex_unlock(&vosf_work_lock);
+	for (int i = 0; i < vosf_n_workers; i++)
+		pthread_join(vosf_workers[i], NULL);
+	vosf_n_workers = 0;
+}
+#endif
+
+// Convert all chunks of the current frame, in parallel if it's worth it
+static void vosf_convert(uint32 n_lines)
+{
+	vosf_next_chunk = 0;
+#ifdef HAVE_PTHREADS
+	if (vosf_n_workers > 0 && n_lines >= VOSF_PARALLEL_LINES) {
+		pthread_mutex_lock(&vosf_work_lock);
+		vosf_workers_busy = vosf_n_workers;
+		vosf_work_generation++;
+		pthread_cond_broadcast(&vosf_work_cond);
+		pthread_mutex_unlock(&vosf_work_lock);
+
+		vosf_convert_chunks();
+
+		pthread_mutex_lock(&vosf_work_lock);
+		while (vosf_workers_busy > 0)
+			pthread_cond_wait(&vosf_done_cond, &vosf_work_lock);
+		pthread_mutex_unlock(&vosf_work_lock);
+		return;
+	}
+#endif
+	vosf_convert_chunks();
+}
+
+// Log conversion statistics every vosf_stats_interval seconds
+static void vosf_stats(uint32 n_lines, uint32 duration)
+{
+	static uint64 last_time = 0;
+	static uint32 frames = 0;
+	static uint64 lines = 0, usecs = 0;
+
+	frames++;
+	lines += n_lines;
+	usecs += duration;
+
+	uint64 now = GetTicks_usec();
+	if (last_time == 0)
+		last_time = now;
+	else if (now - last_time >= (uint64)vosf_stats_interval * 1000000) {
+#ifdef HAVE_PTHREADS
+		const int n_threads = vosf_n_workers + 1;
+#else
+		const int n_threads = 1;
+#endif
+		printf("vosf: %u frames, %.1f lines/frame, %.1f usec/frame conversion (%d threads)\n",
+			   frames, (double)lines / frames, (double)usecs / frames, n_threads);
+		last_time = now;
+		frames = 0;
+		lines = usecs = 0;
+	}
+}
+
+
 /*
  *  Check if VOSF acceleration is profitable on this platform
  */
@@ -322,6 +487,20 @@ static bool video_vosf_init(MONITOR_INIT)
 		if (a > mainBuffer.memLength)
 			a = mainBuffer.memLength;
 	}
+
+	// Allocate work lists for update_display_window_vosf(), every span of
+	// n lines yields at most n / VOSF_CHUNK_LINES + 1 chunks
+	vosf_spans = (vosf_lines *) malloc(mainBuffer.pageCount * sizeof(vosf_lines));
+	if (vosf_spans == NULL)
+		return false;
+	const uint32 max_chunks = mainBuffer.pageCount + (VIDEO_MODE_Y + mainBuffer.pageCount) / VOSF_CHUNK_LINES + 1;
+	vosf_chunks = (vosf_lines *) malloc(max_chunks * sizeof(vosf_lines));
+	if (vosf_chunks == NULL)
+		return false;
+	vosf_stats_interval = PrefsFindInt32("videostats");
+#ifdef HAVE_PTHREADS
+	vosf_start_workers();
+#endif
 	
 	// We can now write-protect the frame buffer
 	if (vm_protect((char *)mainBuffer.memStart, mainBuffer.memLength, VM_PAGE_READ) != 0)
@@ -339,6 +518,17 @@ static bool video_vosf_init(MONITOR_INIT)
 
 static void video_vosf_exit(void)
 {
+#ifdef HAVE_PTHREADS
+	vosf_stop_workers();
+#endif
+	if (vosf_chunks) {
+		free(vosf_chunks);
+		vosf_chunks = NULL;
+	}
+	if (vosf_spans) {
+		free(vosf_spans);
+		vosf_spans = NULL;
+	}
 	if (mainBuffer.pageInfo) {
 		free(mainBuffer.pageInfo);
 		mainBuffer.pageInfo = NULL;
@@ -488,6 +678,8 @@ static void update_display_window_vosf(VIDEO_DRV_WIN_INIT)
 {
 	VIDEO_MODE_INIT;
 
+	// Collect all dirty pages first, as spans of lines
+	vosf_n_spans = 0;
 	unsigned page = 0;
 	for (;;) {
 		const unsigned first_page = find_next_page_set(page);
@@ -502,23 +694,50 @@ static void update_display_window_vosf(VIDEO_DRV_WIN_INIT)
 		const uint32 length = (page - first_page) << mainBuffer.pageBits;
 		vm_protect((char *)mainBuffer.memStart + offset, length, VM_PAGE_READ);
 		
-		// There is at least one line to update
-		const int y1 = mainBuffer.pageInfo[first_page].top;
-		const int y2 = mainBuffer.pageInfo[page - 1].bottom;
-		const int height = y2 - y1 + 1;
+		// There is at least one line to update, merge it with the previous
+		// span if they touch so that no line is converted twice
+		const uint32 y1 = mainBuffer.pageInfo[first_page].top;
+		const uint32 y2 = mainBuffer.pageInfo[page - 1].bottom;
+		if (vosf_n_spans && y1 <= vosf_spans[vosf_n_spans - 1].y2 + 1)
+			vosf_spans[vosf_n_spans - 1].y2 = y2;
+		else {
+			vosf_spans[vosf_n_spans].y1 = y1;
+			vosf_spans[vosf_n_spans].y2 = y2;
+			vosf_n_spans++;
+		}
+	}
+	mainBuffer.dirty = false;
+	if (vosf_n_spans == 0)
+		return;
 
-		// Update the_host_buffer
-		VIDEO_DRV_LOCK_PIXELS;
-		const int src_bytes_per_row = VIDEO_MODE_ROW_BYTES;
-		const int dst_bytes_per_row = VIDEO_DRV_ROW_BYTES;
-		int i1 = y1 * src_bytes_per_row, i2 = y1 * dst_bytes_per_row, j;
-		for (j = y1; j <= y2; j++) {
-			Screen_blit(the_host_buffer + i2, the_buffer + i1, src_bytes_per_row);
-			i1 += src_bytes_per_row;
-			i2 += dst_bytes_per_row;
+	// Cut the spans into chunks
+	uint32 n_lines = 0;
+	vosf_n_chunks = 0;
+	for (uint32 i = 0; i < vosf_n_spans; i++) {
+		for (uint32 y = vosf_spans[i].y1; y <= vosf_spans[i].y2; y += VOSF_CHUNK_LINES) {
+			vosf_chunks[vosf_n_chunks].y1 = y;
+			vosf_chunks[vosf_n_chunks].y2 = y + VOSF_CHUNK_LINES - 1;
+			if (vosf_chunks[vosf_n_chunks].y2 > vosf_spans[i].y2)
+				vosf_chunks[vosf_n_chunks].y2 = vosf_spans[i].y2;
+			vosf_n_chunks++;
 		}
-		VIDEO_DRV_UNLOCK_PIXELS;
+		n_lines += vosf_spans[i].y2 - vosf_spans[i].y1 + 1;
+	}
 
+	// Update the_host_buffer
+	VIDEO_DRV_LOCK_PIXELS;
+	vosf_src_bytes_per_row = VIDEO_MODE_ROW_BYTES;
+	vosf_dst_bytes_per_row = VIDEO_DRV_ROW_BYTES;
+	const uint64 start = GetTicks_usec();
+	vosf_convert(n_lines);
+	const uint32 duration = uint32(GetTicks_usec() - start);
+	VIDEO_DRV_UNLOCK_PIXELS;
+	if (vosf_stats_interval > 0)
+		vosf_stats(n_lines, duration);
+
+	for (uint32 i = 0; i < vosf_n_spans; i++) {
+		const int y1 = vosf_spans[i].y1;
+		const int height = vosf_spans[i].y2 - y1 + 1;
 #ifdef USE_SDL_VIDEO
 		update_sdl_video(drv->s, 0, y1, VIDEO_MODE_X, height);
 #else
@@ -528,7 +747,6 @@ static void update_display_window_vosf(VIDEO_DRV_WIN_INIT)
 			XPutImage(x_display, VIDEO_DRV_WINDOW, VIDEO_DRV_GC, VIDEO_DRV_IMAGE, 0, y1, 0, y1, VIDEO_MODE_X, height);
 #endif
 	}
-	mainBuffer.dirty = false;
 }
 #endif
 
@@ -0,0 +1,264 @@
+/*
+ *  audio_resample.h - Sample conversion and resampling for SDL audio
+ *
+ *  Basilisk II (C) 1997-2008 Christian Bauer
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef AUDIO_RESAMPLE_H
+#define AUDIO_RESAMPLE_H
+
+// Note: this file must be #include'd only in audio_sdl.cpp (and its benchmark,
+// bench_audio_resample.cpp), which define device_rate, device_channels and
+// device_frames
+
+#include <math.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Polyphase windowed-sinc resampler
+const int RESAMPLE_TAPS = 16;						// Filter length in input samples
+const int RESAMPLE_PHASES = 256;					// Number of fractional positions
+
+struct resampler {
+	uint64 step;									// Input frames per output frame (32.32 fixed point)
+	uint64 pos;										// Position of next output frame in input buffer (32.32)
+	int frames;										// Input frames in buffer
+	int max_frames;
+	float *in;										// Input buffer, interleaved device channels (room for stereo input)
+	float *coeffs;									// RESAMPLE_PHASES * RESAMPLE_TAPS filter coefficients
+};
+
+
+/*
+ *  Sample conversion and resampling
+ *  (SSE2 where the compiler targets it, plain loops otherwise and for the
+ *  remaining samples)
+ */
+
+// Set up resampler from given input rate to device rate
+static void resampler_init(resampler &rs, int in_rate)
+{
+	rs.step = ((uint64)in_rate << 32) / device_rate;
+	rs.pos = (uint64)(RESAMPLE_TAPS / 2 - 1) << 32;
+	rs.frames = RESAMPLE_TAPS;
+	rs.max_frames = (int)(((uint64)device_frames * rs.step) >> 32) + 2 * RESAMPLE_TAPS + 2;
+	rs.in = (float *)calloc(rs.max_frames * 2, sizeof(float));
+	rs.coeffs = (float *)malloc(RESAMPLE_PHASES * RESAMPLE_TAPS * sizeof(float));
+
+	// Cutoff below the lower of both Nyquist frequencies, relative to input rate
+	double cutoff = 0.45 * (in_rate > device_rate ? (double)device_rate / in_rate : 1.0);
+	for (int p = 0; p < RESAMPLE_PHASES; p++) {
+		float *c = rs.coeffs + p * RESAMPLE_TAPS;
+		double sum = 0;
+		for (int k = 0; k < RESAMPLE_TAPS; k++) {
+			double x = k - (RESAMPLE_TAPS / 2 - 1) - (double)p / RESAMPLE_PHASES;
+			double sinc = x == 0 ? 1.0 : sin(2 * M_PI * cutoff * x) / (2 * M_PI * cutoff * x);
+			double w = (k + 1 - (double)p / RESAMPLE_PHASES) / RESAMPLE_TAPS;	// Blackman window over the taps
+			double window = 0.42 - 0.5 * cos(2 * M_PI * w) + 0.08 * cos(4 * M_PI * w);
+			c[k] = sinc * window;
+			sum += c[k];
+		}
+		for (int k = 0; k < RESAMPLE_TAPS; k++)
+			c[k] /= sum;
+	}
+}
+
+static void resampler_exit(resampler &rs)
+{
+	free(rs.in);
+	rs.in = NULL;
+	free(rs.coeffs);
+	rs.coeffs = NULL;
+}
+
+// Number of input frames still needed to produce the given number of output frames
+static int resampler_needed(const resampler &rs, int out_frames)
+{
+	int needed = (int)((rs.pos + (out_frames - 1) * rs.step) >> 32) + RESAMPLE_TAPS / 2 + 1 - rs.frames;
+	return needed > 0 ? needed : 0;
+}
+
+// Filter one stereo output frame from RESAMPLE_TAPS interleaved input frames, adding to out[0..1]
+static inline void resample_stereo(const float *in, const float *c, float *out)
+{
+#ifdef __SSE2__
+	// Two frames per vector, each coefficient duplicated for both channels
+	__m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+	for (int k = 0; k < RESAMPLE_TAPS; k += 4) {
+		__m128 cv = _mm_loadu_ps(c + k);
+		acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(in + 2 * k), _mm_unpacklo_ps(cv, cv)));
+		acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(in + 2 * k + 4), _mm_unpackhi_ps(cv, cv)));
+	}
+	acc0 = _mm_add_ps(acc0, acc1);
+	acc0 = _mm_add_ps(acc0, _mm_movehl_ps(acc0, acc0));	// Left and right sums in the low half
+	__m128 o = _mm_loadl_pi(_mm_setzero_ps(), (const __m64 *)out);
+	_mm_storel_pi((__m64 *)out, _mm_add_ps(o, acc0));
+#else
+	float l = 0, r = 0;
+	for (int k = 0; k < RESAMPLE_TAPS; k++) {
+		l += in[2 * k] * c[k];
+		r += in[2 * k + 1] * c[k];
+	}
+	out[0] += l;
+	out[1] += r;
+#endif
+}
+
+// Filter one mono output frame, adding to out[0]
+static inline void resample_mono(const float *in, const float *c, float *out)
+{
+#ifdef __SSE2__
+	__m128 acc = _mm_setzero_ps();
+	for (int k = 0; k < RESAMPLE_TAPS; k += 4)
+		acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(in + k), _mm_loadu_ps(c + k)));
+	acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+	acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 1));
+	out[0] += _mm_cvtss_f32(acc);
+#else
+	float m = 0;
+	for (int k = 0; k < RESAMPLE_TAPS; k++)
+		m += in[k] * c[k];
+	out[0] += m;
+#endif
+}
+
+// Resample buffered input, adding to out[], and discard consumed input
+static void resampler_run(resampler &rs, float *out, int out_frames)
+{
+	const int ch = device_channels;
+	if (rs.step == (uint64)1 << 32) {
+
+		// Same rate, just add the samples (contiguous, which compilers vectorize)
+		const float *in = rs.in + (rs.pos >> 32) * ch;
+		for (int i = 0; i < out_frames * ch; i++)
+			out[i] += in[i];
+	} else {
+		uint64 pos = rs.pos;
+		for (int i = 0; i < out_frames; i++) {
+			const float *in = rs.in + ((pos >> 32) - (RESAMPLE_TAPS / 2 - 1)) * ch;
+			const float *c = rs.coeffs + ((uint32)pos >> (32 - 8)) * RESAMPLE_TAPS;	// 8 = log2(RESAMPLE_PHASES)
+			if (ch == 2)
+				resample_stereo(in, c, out + 2 * i);
+			else
+				resample_mono(in, c, out + i);
+			pos += rs.step;
+		}
+	}
+	rs.pos += out_frames * rs.step;
+
+	// Keep the filter history
+	int consumed = (int)(rs.pos >> 32) - (RESAMPLE_TAPS / 2 - 1);
+	if (consumed > rs.frames)
+		consumed = rs.frames;
+	memmove(rs.in, rs.in + consumed * ch, (rs.frames - consumed) * ch * sizeof(float));
+	rs.frames -= consumed;
+	rs.pos -= (uint64)consumed << 32;
+}
+
+// Convert MacOS/CD samples to float with device channel count, appending to resampler input
+static void convert_input(resampler &rs, const uint8 *src, int frames, int sample_size, int channels, float gain)
+{
+	float *dst = rs.in + rs.frames * device_channels;
+	int n = frames * channels;
+	float *tmp = dst;
+	if (channels < device_channels)
+		tmp = dst + frames;		// Mono samples go to the second half, expanded in place below
+
+	int i = 0;
+	if (sample_size == 16) {
+		// Byte swap big-endian samples
+		gain *= 1.0f / 32768;
+#ifdef __SSE2__
+		const __m128 g = _mm_set1_ps(gain);
+		for (; i + 8 <= n; i += 8) {
+			__m128i v = _mm_loadu_si128((const __m128i *)(src + 2 * i));
+			v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+			__m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);	// Sign extend
+			__m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+			_mm_storeu_ps(tmp + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), g));
+			_mm_storeu_ps(tmp + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), g));
+		}
+#endif
+		for (; i < n; i++)
+			tmp[i] = (int16)((src[2 * i] << 8) | src[2 * i + 1]) * gain;
+	} else {
+		// Unsigned 8-bit samples
+		gain *= 1.0f / 128;
+#ifdef __SSE2__
+		const __m128 g = _mm_set1_ps(gain);
+		for (; i + 16 <= n; i += 16) {
+			__m128i v = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(src + i)), _mm_set1_epi8((char)0x80));
+			__m128i w0 = _mm_srai_epi16(_mm_unpacklo_epi8(v, v), 8);	// Sign extend
+			__m128i w1 = _mm_srai_epi16(_mm_unpackhi_epi8(v, v), 8);
+			_mm_storeu_ps(tmp + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(w0, w0), 16)), g));
+			_mm_storeu_ps(tmp + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(w0, w0), 16)), g));
+			_mm_storeu_ps(tmp + i + 8, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(w1, w1), 16)), g));
+			_mm_storeu_ps(tmp + i + 12, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(w1, w1), 16)), g));
+		}
+#endif
+		for (; i < n; i++)
+			tmp[i] = (src[i] - 128) * gain;
+	}
+
+	// Both loops run forward in place, each vector is read before it is overwritten
+	i = 0;
+	if (channels == 1 && device_channels == 2) {
+#ifdef __SSE2__
+		for (; i + 4 <= frames; i += 4) {
+			__m128 v = _mm_loadu_ps(tmp + i);
+			_mm_storeu_ps(dst + 2 * i, _mm_unpacklo_ps(v, v));
+			_mm_storeu_ps(dst + 2 * i + 4, _mm_unpackhi_ps(v, v));
+		}
+#endif
+		for (; i < frames; i++)
+			dst[2 * i] = dst[2 * i + 1] = tmp[i];
+	} else if (channels == 2 && device_channels == 1) {
+#ifdef __SSE2__
+		const __m128 half = _mm_set1_ps(0.5f);
+		for (; i + 4 <= frames; i += 4) {
+			__m128 a = _mm_loadu_ps(tmp + 2 * i), b = _mm_loadu_ps(tmp + 2 * i + 4);
+			__m128 l = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+			__m128 r = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+			_mm_storeu_ps(dst + i, _mm_mul_ps(_mm_add_ps(l, r), half));
+		}
+#endif
+		for (; i < frames; i++)
+			dst[i] = (tmp[2 * i] + tmp[2 * i + 1]) * 0.5f;
+	}
+	rs.frames += frames;
+}
+
+// Append silence to resampler input
+static void convert_silence(resampler &rs, int frames)
+{
+	memset(rs.in + rs.frames * device_channels, 0, frames * device_channels * sizeof(float));
+	rs.frames += frames;
+}
+
+// Convert mixed samples to device format (contiguous, which compilers vectorize)
+static void convert_output(int16 *dst, const float *src, int n)
+{
+	for (int i = 0; i < n; i++) {
+		float x = src[i] * 32767.0f;
+		x = x > 32767.0f ? 32767.0f : (x < -32768.0f ? -32768.0f : x);
+		dst[i] = (int16)x;
+	}
+}
+
+#endif
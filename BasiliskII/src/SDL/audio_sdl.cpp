@@ -29,6 +29,8 @@
 #include <SDL_mutex.h>
 #include <SDL_audio.h>
 #include <SDL_version.h>
+#include <atomic>
+#include <math.h>
 
 #define DEBUG 0
 #include "debug.h"
@@ -46,12 +48,42 @@ static int audio_sample_size_index = 0;
 static int audio_channel_count_index = 0;
 
 // Global variables
-static SDL_sem *audio_irq_done_sem = NULL;			// Signal from interrupt to streaming thread: data block read
 static uint8 silence_byte;							// Byte value to use to fill sound buffers with silence
-static uint8 *audio_mix_buf = NULL;
 static int audio_volume = SDL_MIX_MAXVOLUME;
 static bool audio_mute = false;
 
+// Ring buffer between AudioInterrupt() (producer) and stream_func() (consumer),
+// so the audio callback never has to wait for MacOS. It holds MacOS sample data.
+const int AUDIO_PREFETCH_MIN = 1;					// Limits of prefetch depth, in blocks
+const int AUDIO_PREFETCH_MAX = 4;
+const int AUDIO_PREFETCH_RELAX = 256;				// Blocks without underrun before prefetching less
+
+static uint8 *audio_ring = NULL;
+static uint32 audio_ring_size;						// Power of two
+static uint32 audio_block_size;						// Size of one MacOS block in bytes
+static std::atomic<uint32> audio_ring_head(0);		// Write position (AudioInterrupt())
+static std::atomic<uint32> audio_ring_tail(0);		// Read position (stream_func())
+static std::atomic<int> audio_prefetch(AUDIO_PREFETCH_MIN);	// Blocks to keep buffered
+static std::atomic<bool> audio_irq_pending(false);	// Flag: INTFLAG_AUDIO raised, AudioInterrupt() not yet run
+static std::atomic<bool> audio_streaming(false);	// Flag: MacOS is producing data
+static int audio_good_blocks = 0;					// Blocks played since last underrun
+static uint32 audio_underruns = 0;					// Number of blocks not completely filled in time
+
+// The host device is always opened in its preferred rate with 16-bit native
+// samples. MacOS (and CD audio) data is converted to float, resampled and
+// mixed in stream_func().
+static int device_rate;								// Device sample rate (Hz)
+static int device_channels;							// Device channel count (1 or 2)
+static int device_frames;							// Frames per device callback
+static float *mix_buf = NULL;						// Mixed output, device_frames * device_channels
+
+#include "audio_resample.h"
+
+static resampler mac_resampler;						// For MacOS sound
+#if defined(BINCUE)
+static resampler cd_resampler;						// For CD audio (44.1kHz, 16-bit big-endian stereo)
+#endif
+
 // Prototypes
 static void stream_func(void *arg, uint8 *stream, int stream_len);
 
@@ -71,7 +103,7 @@ static void set_audio_status_format(void)
 // Init SDL audio system
 static bool open_sdl_audio(void)
 {
-	// SDL supports a variety of twisted little audio formats, all different
+	// MacOS formats are converted by us, so offer everything the Sound Manager knows
 	if (audio_sample_sizes.empty()) {
 		audio_sample_rates.push_back(11025 << 16);
 		audio_sample_rates.push_back(22050 << 16);
@@ -87,32 +119,38 @@ static bool open_sdl_audio(void)
 		audio_channel_count_index = audio_channel_counts.size() - 1;
 	}
 
-	SDL_AudioSpec audio_spec;
+	SDL_AudioSpec audio_spec, obtained;
 	memset(&audio_spec, 0, sizeof(audio_spec));
-	audio_spec.freq = audio_sample_rates[audio_sample_rate_index] >> 16;
-	audio_spec.format = (audio_sample_sizes[audio_sample_size_index] == 8) ? AUDIO_U8 : AUDIO_S16MSB;
-	audio_spec.channels = audio_channel_counts[audio_channel_count_index];
+	audio_ring_head = audio_ring_tail = 0;
+	audio_irq_pending = false;
+	audio_streaming = false;
+	audio_spec.freq = 44100;
+	audio_spec.format = AUDIO_S16SYS;
+	audio_spec.channels = 2;
 	audio_spec.samples = 4096;
 	audio_spec.callback = stream_func;
 	audio_spec.userdata = NULL;
 
-	// Open the audio device, forcing the desired format
-	if (SDL_OpenAudio(&audio_spec, NULL) < 0) {
+	// Open the audio device, letting it choose its rate and channel count
+	if (SDL_OpenAudio(&audio_spec, &obtained) < 0) {
 		fprintf(stderr, "WARNING: Cannot open audio: %s\n", SDL_GetError());
 		return false;
 	}
-	
-#if SDL_VERSION_ATLEAST(2,0,0)
-	// HACK: workaround a bug in SDL pre-2.0.6 (reported via https://bugzilla.libsdl.org/show_bug.cgi?id=3710 )
-	// whereby SDL does not update audio_spec.size
-	if (audio_spec.size == 0) {
-		audio_spec.size = (SDL_AUDIO_BITSIZE(audio_spec.format) / 8) * audio_spec.channels * audio_spec.samples;
+	if (obtained.format != AUDIO_S16SYS || obtained.channels < 1 || obtained.channels > 2) {
+		// Have SDL convert anything else
+		SDL_CloseAudio();
+		if (SDL_OpenAudio(&audio_spec, NULL) < 0) {
+			fprintf(stderr, "WARNING: Cannot open audio: %s\n", SDL_GetError());
+			return false;
+		}
+		obtained = audio_spec;
 	}
-#endif
+	device_rate = obtained.freq;
+	device_channels = obtained.channels;
+	device_frames = obtained.samples;
 
 #if defined(BINCUE)
-	OpenAudio_bincue(audio_spec.freq, audio_spec.format, audio_spec.channels,
-	audio_spec.silence);
+	OpenAudio_bincue(44100, AUDIO_S16MSB, 2, 0);
 #endif
 
 #if SDL_VERSION_ATLEAST(2,0,0)
@@ -121,13 +159,24 @@ static bool open_sdl_audio(void)
 	char driver_name[32];
 	SDL_AudioDriverName(driver_name, sizeof(driver_name) - 1);
 #endif
-	printf("Using SDL/%s audio output\n", driver_name ? driver_name : "");
-	silence_byte = audio_spec.silence;
-	SDL_PauseAudio(0);
+	printf("Using SDL/%s audio output (%d Hz, %d channels)\n", driver_name ? driver_name : "", device_rate, device_channels);
+	silence_byte = obtained.silence;
+
+	// Sound buffer size = MacOS frames played per device buffer
+	int rate = audio_sample_rates[audio_sample_rate_index] >> 16;
+	audio_frames_per_block = (device_frames * rate + device_rate - 1) / device_rate;
+	audio_block_size = audio_frames_per_block * (audio_sample_sizes[audio_sample_size_index] >> 3) * audio_channel_counts[audio_channel_count_index];
+	for (audio_ring_size = 1; audio_ring_size < (AUDIO_PREFETCH_MAX + 2) * audio_block_size; audio_ring_size <<= 1) ;
+	audio_ring = (uint8 *)malloc(audio_ring_size);
+
+	// Set up conversion
+	mix_buf = (float *)malloc(device_frames * device_channels * sizeof(float));
+	resampler_init(mac_resampler, rate);
+#if defined(BINCUE)
+	resampler_init(cd_resampler, 44100);
+#endif
 
-	// Sound buffer size = 4096 frames
-	audio_frames_per_block = audio_spec.samples;
-	audio_mix_buf = (uint8*)malloc(audio_spec.size);
+	SDL_PauseAudio(0);
 	return true;
 }
 
@@ -161,9 +210,6 @@ void AudioInit(void)
 	if (PrefsFindBool("nosound"))
 		return;
 
-	// Init semaphore
-	audio_irq_done_sem = SDL_CreateSemaphore(0);
-
 	// Open and initialize audio device
 	open_audio();
 }
@@ -177,8 +223,14 @@ static void close_audio(void)
 {
 	// Close audio device
 	SDL_CloseAudio();
-	free(audio_mix_buf);
-	audio_mix_buf = NULL;
+	free(audio_ring);
+	audio_ring = NULL;
+	free(mix_buf);
+	mix_buf = NULL;
+	resampler_exit(mac_resampler);
+#if defined(BINCUE)
+	resampler_exit(cd_resampler);
+#endif
 	audio_open = false;
 }
 
@@ -186,10 +238,7 @@ void AudioExit(void)
 {
 	// Close audio device
 	close_audio();
-
-	// Delete semaphore
-	if (audio_irq_done_sem)
-		SDL_DestroySemaphore(audio_irq_done_sem);
+	D(bug("Audio: %u underruns, prefetch depth %d blocks\n", audio_underruns, (int)audio_prefetch));
 }
 
 
@@ -215,45 +264,79 @@ void audio_exit_stream()
  *  Streaming function
  */
 
-static void stream_func(void *arg, uint8 *stream, int stream_len)
+// Ask MacOS for more audio data unless a request is outstanding
+static void request_audio_data(void)
 {
-	if (AudioStatus.num_sources) {
-		// Trigger audio interrupt to get new buffer
-		D(bug("stream: triggering irq\n"));
+	if (!audio_irq_pending.exchange(true)) {
 		SetInterruptFlag(INTFLAG_AUDIO);
 		TriggerInterrupt();
-		D(bug("stream: waiting for ack\n"));
-		SDL_SemWait(audio_irq_done_sem);
-		D(bug("stream: ack received\n"));
-
-		// Get size of audio data
-		uint32 apple_stream_info = ReadMacInt32(audio_data + adatStreamInfo);
-		if (apple_stream_info && !audio_mute) {
-			int work_size = ReadMacInt32(apple_stream_info + scd_sampleCount) * (AudioStatus.sample_size >> 3) * AudioStatus.channels;
-			D(bug("stream: work_size %d\n", work_size));
-			if (work_size > stream_len)
-				work_size = stream_len;
-			if (work_size == 0)
-				goto silence;
-
-			// Send data to audio device
-			Mac2Host_memcpy(audio_mix_buf, ReadMacInt32(apple_stream_info + scd_buffer), work_size);
-			memset((uint8 *)stream, silence_byte, stream_len);
-			SDL_MixAudio(stream, audio_mix_buf, work_size, audio_volume);
-
-			D(bug("stream: data written\n"));
-
-		} else
-			goto silence;
+	}
+}
+
+static void stream_func(void *arg, uint8 *stream, int stream_len)
+{
+	int frames = stream_len / (device_channels * 2);
+	if (frames > device_frames)
+		frames = device_frames;
+	memset(mix_buf, 0, frames * device_channels * sizeof(float));
+
+	if (AudioStatus.num_sources) {
+
+		// Take as much data from the ring as is needed and there
+		uint32 frame_size = (AudioStatus.sample_size >> 3) * AudioStatus.channels;
+		uint32 needed = resampler_needed(mac_resampler, frames) * frame_size;
+		uint32 tail = audio_ring_tail.load(std::memory_order_relaxed);
+		uint32 avail = audio_ring_head.load(std::memory_order_acquire) - tail;
+		uint32 work_size = avail < needed ? avail : needed;
+		uint32 offset = tail & (audio_ring_size - 1);
+		uint32 first = work_size < audio_ring_size - offset ? work_size : audio_ring_size - offset;
+		float gain = audio_mute ? 0.0f : (float)audio_volume / SDL_MIX_MAXVOLUME;
+		convert_input(mac_resampler, audio_ring + offset, first / frame_size, AudioStatus.sample_size, AudioStatus.channels, gain);
+		convert_input(mac_resampler, audio_ring, (work_size - first) / frame_size, AudioStatus.sample_size, AudioStatus.channels, gain);
+		audio_ring_tail.store(tail + work_size, std::memory_order_release);
+		D(bug("stream: work_size %d\n", work_size));
+
+		// Resample to device rate, pad with silence
+		convert_silence(mac_resampler, (needed - work_size) / frame_size);
+		resampler_run(mac_resampler, mix_buf, frames);
+
+		// MacOS didn't keep up? Then buffer more from now on
+		if (audio_streaming && work_size < needed) {
+			audio_underruns++;
+			audio_good_blocks = 0;
+			if (audio_prefetch < AUDIO_PREFETCH_MAX)
+				audio_prefetch++;
+		} else if (++audio_good_blocks >= AUDIO_PREFETCH_RELAX) {
+			audio_good_blocks = 0;
+			if (audio_prefetch > AUDIO_PREFETCH_MIN)
+				audio_prefetch--;
+		}
+
+		// Fetch more data ahead
+		if (avail - work_size < (audio_prefetch + 1) * audio_block_size)
+			request_audio_data();
 
 	} else {
 
 		// Audio not active, play silence
-silence: memset(stream, silence_byte, stream_len);
+		audio_ring_tail.store(audio_ring_head.load(std::memory_order_acquire), std::memory_order_release);
+		audio_streaming = false;
 	}
+
 #if defined(BINCUE)
-	MixAudio_bincue(stream, stream_len);
+	// Mix in CD audio
+	int cd_frames = resampler_needed(cd_resampler, frames);
+	uint8 *cd = GetAudio_bincue(cd_frames * 4);
+	if (cd) {
+		convert_input(cd_resampler, cd, cd_frames, 16, 2, 1.0f);
+		resampler_run(cd_resampler, mix_buf, frames);
+	}
 #endif
+
+	// Send data to audio device
+	convert_output((int16 *)stream, mix_buf, frames * device_channels);
+	if (frames * device_channels * 2 < stream_len)
+		memset(stream + frames * device_channels * 2, silence_byte, stream_len - frames * device_channels * 2);
 }
 
 
@@ -275,8 +358,30 @@ void AudioInterrupt(void)
 	} else
 		WriteMacInt32(audio_data + adatStreamInfo, 0);
 
-	// Signal stream function
-	SDL_SemPost(audio_irq_done_sem);
+	// Append data to ring buffer
+	uint32 head = audio_ring_head.load(std::memory_order_relaxed);
+	uint32 level = head - audio_ring_tail.load(std::memory_order_acquire);
+	uint32 apple_stream_info = ReadMacInt32(audio_data + adatStreamInfo);
+	uint32 work_size = 0;
+	if (apple_stream_info && audio_ring) {
+		work_size = ReadMacInt32(apple_stream_info + scd_sampleCount) * (AudioStatus.sample_size >> 3) * AudioStatus.channels;
+		if (work_size > audio_ring_size - level)
+			work_size = audio_ring_size - level;
+		uint32 offset = head & (audio_ring_size - 1);
+		uint32 first = work_size < audio_ring_size - offset ? work_size : audio_ring_size - offset;
+		uint32 buffer = ReadMacInt32(apple_stream_info + scd_buffer);
+		Mac2Host_memcpy(audio_ring + offset, buffer, first);
+		Mac2Host_memcpy(audio_ring, buffer + first, work_size - first);
+		head += work_size;
+		level += work_size;
+		audio_ring_head.store(head, std::memory_order_release);
+	}
+
+	// Keep fetching until the prefetch depth is reached
+	audio_streaming = (work_size != 0);
+	audio_irq_pending = false;
+	if (AudioStatus.num_sources && work_size && level < (audio_prefetch + 1) * audio_block_size)
+		request_audio_data();
 	D(bug("AudioInterrupt done\n"));
 }
 
@@ -0,0 +1,271 @@
+/*
+ *  bench_audio_resample.cpp - Benchmark of the SDL audio conversion and resampling kernels
+ *
+ *  Basilisk II (C) 1997-2008 Christian Bauer
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ *  Each kernel of audio_resample.h is run against a plain C++ reference
+ *  version on the same data. The program prints the output samples per
+ *  second of both and the largest difference between their results, and
+ *  fails if that exceeds the expected rounding error.
+ *
+ *  Build with "make bench_audio_resample" in the Unix directory.
+ */
+
+#include "sysdeps.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+static int device_rate = 48000;
+static int device_channels = 2;
+static int device_frames = 1024;
+
+#include "audio_resample.h"
+
+const double BENCH_SECONDS = 0.5;					// Minimum run time of each kernel
+const float MAX_ERROR = 1e-5f;						// Allowed difference from the reference
+
+static double now(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+
+/*
+ *  Reference versions (the loops used before the SSE2 paths were added)
+ */
+
+static void ref_resampler_run(resampler &rs, float *out, int out_frames)
+{
+	const int ch = device_channels;
+	uint64 pos = rs.pos;
+	for (int i = 0; i < out_frames; i++) {
+		const float *in = rs.in + ((pos >> 32) - (RESAMPLE_TAPS / 2 - 1)) * ch;
+		const float *c = rs.coeffs + ((uint32)pos >> (32 - 8)) * RESAMPLE_TAPS;
+		if (ch == 2) {
+			float l = 0, r = 0;
+			for (int k = 0; k < RESAMPLE_TAPS; k++) {
+				l += in[2 * k] * c[k];
+				r += in[2 * k + 1] * c[k];
+			}
+			out[2 * i] += l;
+			out[2 * i + 1] += r;
+		} else {
+			float m = 0;
+			for (int k = 0; k < RESAMPLE_TAPS; k++)
+				m += in[k] * c[k];
+			out[i] += m;
+		}
+		pos += rs.step;
+	}
+}
+
+static void ref_convert_input(float *dst, const uint8 *src, int frames, int sample_size, int channels, float gain)
+{
+	float *tmp = dst;
+	if (channels < device_channels)
+		tmp = dst + frames;
+	int n = frames * channels;
+	if (sample_size == 16) {
+		gain *= 1.0f / 32768;
+		for (int i = 0; i < n; i++)
+			tmp[i] = (int16)((src[2 * i] << 8) | src[2 * i + 1]) * gain;
+	} else {
+		gain *= 1.0f / 128;
+		for (int i = 0; i < n; i++)
+			tmp[i] = (src[i] - 128) * gain;
+	}
+	if (channels == 1 && device_channels == 2) {
+		for (int i = 0; i < frames; i++)
+			dst[2 * i] = dst[2 * i + 1] = tmp[i];
+	} else if (channels == 2 && device_channels == 1) {
+		for (int i = 0; i < frames; i++)
+			dst[i] = (tmp[2 * i] + tmp[2 * i + 1]) * 0.5f;
+	}
+}
+
+
+/*
+ *  Benchmarks
+ */
+
+static bool failed = false;
+
+static void report(const char *name, double samples, double secs, double ref_samples, double ref_secs, float max_diff)
+{
+	bool ok = max_diff <= MAX_ERROR;
+	printf("%-36s %8.1f Msamples/s  reference %8.1f Msamples/s  %5.2fx  max diff %g%s\n",
+		   name, samples / secs * 1e-6, ref_samples / ref_secs * 1e-6,
+		   (samples / secs) / (ref_samples / ref_secs), max_diff, ok ? "" : "  FAILED");
+	if (!ok)
+		failed = true;
+}
+
+// Resample device_frames output frames from in_rate, over and over again
+static void bench_resampler(int in_rate, int channels)
+{
+	device_channels = channels;
+	resampler rs;
+	resampler_init(rs, in_rate);
+	for (int i = 0; i < rs.max_frames * channels; i++)
+		rs.in[i] = sinf(i * 0.01f) * 0.5f;
+	int needed = resampler_needed(rs, device_frames);
+	rs.frames += needed;
+	const resampler start = rs;
+
+	float *out = (float *)calloc(device_frames * channels, sizeof(float));
+	float *ref_out = (float *)calloc(device_frames * channels, sizeof(float));
+	float *saved_in = (float *)malloc(rs.max_frames * channels * sizeof(float));
+	memcpy(saved_in, rs.in, rs.max_frames * channels * sizeof(float));
+
+	// Compare one run, resampler_run() discards consumed input so restore it afterwards
+	ref_resampler_run(rs, ref_out, device_frames);
+	resampler_run(rs, out, device_frames);
+	float max_diff = 0;
+	for (int i = 0; i < device_frames * channels; i++)
+		max_diff = fmaxf(max_diff, fabsf(out[i] - ref_out[i]));
+
+	double iters = 0, t = now(), secs;
+	do {
+		memcpy(rs.in, saved_in, rs.max_frames * channels * sizeof(float));
+		rs.pos = start.pos;
+		rs.frames = start.frames;
+		resampler_run(rs, out, device_frames);
+		iters++;
+	} while ((secs = now() - t) < BENCH_SECONDS);
+
+	double ref_iters = 0, ref_secs;
+	t = now();
+	do {
+		memcpy(rs.in, saved_in, rs.max_frames * channels * sizeof(float));
+		rs.pos = start.pos;
+		ref_resampler_run(rs, ref_out, device_frames);
+		ref_iters++;
+	} while ((ref_secs = now() - t) < BENCH_SECONDS);
+
+	char name[64];
+	sprintf(name, "resampler_run %d->%d %s", in_rate, device_rate, channels == 2 ? "stereo" : "mono");
+	report(name, iters * device_frames * channels, secs, ref_iters * device_frames * channels, ref_secs, max_diff);
+
+	free(saved_in);
+	free(ref_out);
+	free(out);
+	resampler_exit(rs);
+}
+
+// Convert device_frames MacOS frames, over and over again
+static void bench_convert_input(int sample_size, int channels, int dev_channels)
+{
+	device_channels = dev_channels;
+	const int frames = device_frames;
+	uint8 *src = (uint8 *)malloc(frames * channels * sample_size / 8);
+	for (int i = 0; i < frames * channels * sample_size / 8; i++)
+		src[i] = rand();
+
+	resampler rs;
+	rs.in = (float *)malloc(frames * 2 * sizeof(float));
+	float *ref = (float *)malloc(frames * 2 * sizeof(float));
+	rs.frames = 0;
+	convert_input(rs, src, frames, sample_size, channels, 0.75f);
+	ref_convert_input(ref, src, frames, sample_size, channels, 0.75f);
+	float max_diff = 0;
+	for (int i = 0; i < frames * dev_channels; i++)
+		max_diff = fmaxf(max_diff, fabsf(rs.in[i] - ref[i]));
+
+	double iters = 0, t = now(), secs;
+	do {
+		rs.frames = 0;
+		convert_input(rs, src, frames, sample_size, channels, 0.75f);
+		iters++;
+	} while ((secs = now() - t) < BENCH_SECONDS);
+
+	double ref_iters = 0, ref_secs;
+	t = now();
+	do {
+		ref_convert_input(ref, src, frames, sample_size, channels, 0.75f);
+		ref_iters++;
+	} while ((ref_secs = now() - t) < BENCH_SECONDS);
+
+	char name[64];
+	sprintf(name, "convert_input %d-bit %s->%s", sample_size, channels == 2 ? "stereo" : "mono", dev_channels == 2 ? "stereo" : "mono");
+	report(name, iters * frames * channels, secs, ref_iters * frames * channels, ref_secs, max_diff);
+
+	free(ref);
+	free(rs.in);
+	free(src);
+}
+
+// Convert device_frames mixed stereo frames to device format, over and over again
+static void bench_convert_output(void)
+{
+	const int n = device_frames * 2;
+	float *src = (float *)malloc(n * sizeof(float));
+	for (int i = 0; i < n; i++)
+		src[i] = sinf(i * 0.01f) * 1.5f;	// Some samples clip
+	int16 *dst = (int16 *)malloc(n * sizeof(int16));
+	int16 *ref = (int16 *)malloc(n * sizeof(int16));
+
+	double iters = 0, t = now(), secs;
+	do {
+		convert_output(dst, src, n);
+		iters++;
+	} while ((secs = now() - t) < BENCH_SECONDS);
+
+	double ref_iters = 0, ref_secs;
+	t = now();
+	do {
+		for (int i = 0; i < n; i++) {
+			float x = src[i] * 32767.0f;
+			ref[i] = x > 32767.0f ? 32767 : (x < -32768.0f ? -32768 : (int16)x);
+		}
+		ref_iters++;
+	} while ((ref_secs = now() - t) < BENCH_SECONDS);
+
+	float max_diff = 0;
+	for (int i = 0; i < n; i++)
+		max_diff = fmaxf(max_diff, fabsf((float)(dst[i] - ref[i])));
+	report("convert_output", iters * n, secs, ref_iters * n, ref_secs, max_diff);
+
+	free(ref);
+	free(dst);
+	free(src);
+}
+
+int main(void)
+{
+#ifdef __SSE2__
+	printf("Kernels use SSE2\n");
+#else
+	printf("Kernels use plain loops\n");
+#endif
+
+	bench_convert_input(16, 2, 2);
+	bench_convert_input(16, 1, 2);
+	bench_convert_input(16, 2, 1);
+	bench_convert_input(8, 1, 2);
+	bench_convert_input(8, 2, 2);
+	bench_resampler(22050, 2);
+	bench_resampler(44100, 2);
+	bench_resampler(22050, 1);
+	bench_convert_output();
+	return failed ? 1 : 0;
+}
@@ -63,6 +63,7 @@
 #include "video.h"
 #include "video_defs.h"
 #include "video_blit.h"
+#include "video_tiles.h"
 #include "vm_alloc.h"
 
 #define DEBUG 0
@@ -1865,212 +1866,28 @@ static void handle_events(void)
  *  Window display update
  */
 
-// Static display update (fixed frame rate, but incremental)
+// Static display update (fixed frame rate, tile based, see video_tiles.h)
 static void update_display_static(driver_base *drv)
 {
-	// Incremental update code
-	int wide = 0, high = 0;
-	uint32 x1, x2, y1, y2;
 	const VIDEO_MODE &mode = drv->mode;
-	int bytes_per_row = VIDEO_MODE_ROW_BYTES;
-	uint8 *p, *p2;
-
-	// Check for first line from top and first line from bottom that have changed
-	y1 = 0;
-	for (uint32 j = 0; j < VIDEO_MODE_Y; j++) {
-		if (memcmp(&the_buffer[j * bytes_per_row], &the_buffer_copy[j * bytes_per_row], bytes_per_row)) {
-			y1 = j;
-			break;
-		}
-	}
-	y2 = y1 - 1;
-	for (uint32 j = VIDEO_MODE_Y; j-- > y1; ) {
-		if (memcmp(&the_buffer[j * bytes_per_row], &the_buffer_copy[j * bytes_per_row], bytes_per_row)) {
-			y2 = j;
-			break;
-		}
-	}
-	high = y2 - y1 + 1;
-
-	// Check for first column from left and first column from right that have changed
-	if (high) {
-		if (VIDEO_MODE_DEPTH < VIDEO_DEPTH_8BIT) {
-			const int src_bytes_per_row = bytes_per_row;
-			const int dst_bytes_per_row = drv->s->pitch;
-			const int pixels_per_byte = VIDEO_MODE_X / src_bytes_per_row;
-
-			x1 = VIDEO_MODE_X / pixels_per_byte;
-			for (uint32 j = y1; j <= y2; j++) {
-				p = &the_buffer[j * bytes_per_row];
-				p2 = &the_buffer_copy[j * bytes_per_row];
-				for (uint32 i = 0; i < x1; i++) {
-					if (*p != *p2) {
-						x1 = i;
-						break;
-					}
-					p++; p2++;
-				}
-			}
-			x2 = x1;
-			for (uint32 j = y1; j <= y2; j++) {
-				p = &the_buffer[j * bytes_per_row];
-				p2 = &the_buffer_copy[j * bytes_per_row];
-				p += bytes_per_row;
-				p2 += bytes_per_row;
-				for (uint32 i = (VIDEO_MODE_X / pixels_per_byte); i > x2; i--) {
-					p--; p2--;
-					if (*p != *p2) {
-						x2 = i;
-						break;
-					}
-				}
-			}
-			x1 *= pixels_per_byte;
-			x2 *= pixels_per_byte;
-			wide = (x2 - x1 + pixels_per_byte - 1) & -pixels_per_byte;
-
-			// Update copy of the_buffer
-			if (high && wide) {
-
-				// Lock surface, if required
-				if (SDL_MUSTLOCK(drv->s))
-					SDL_LockSurface(drv->s);
-
-				// Blit to screen surface
-				int si = y1 * src_bytes_per_row + (x1 / pixels_per_byte);
-				int di = y1 * dst_bytes_per_row + x1;
-				for (uint32 j = y1; j <= y2; j++) {
-					memcpy(the_buffer_copy + si, the_buffer + si, wide / pixels_per_byte);
-					Screen_blit((uint8 *)drv->s->pixels + di, the_buffer + si, wide / pixels_per_byte);
-					si += src_bytes_per_row;
-					di += dst_bytes_per_row;
-				}
-
-				// Unlock surface, if required
-				if (SDL_MUSTLOCK(drv->s))
-					SDL_UnlockSurface(drv->s);
-
-				// Refresh display
-				SDL_UpdateRect(drv->s, x1, y1, wide, high);
-			}
-
-		} else {
-			const int bytes_per_pixel = VIDEO_MODE_ROW_BYTES / VIDEO_MODE_X;
-			const int dst_bytes_per_row = drv->s->pitch;
-
-			x1 = VIDEO_MODE_X;
-			for (uint32 j = y1; j <= y2; j++) {
-				p = &the_buffer[j * bytes_per_row];
-				p2 = &the_buffer_copy[j * bytes_per_row];
-				for (uint32 i = 0; i < x1 * bytes_per_pixel; i++) {
-					if (*p != *p2) {
-						x1 = i / bytes_per_pixel;
-						break;
-					}
-					p++; p2++;
-				}
-			}
-			x2 = x1;
-			for (uint32 j = y1; j <= y2; j++) {
-				p = &the_buffer[j * bytes_per_row];
-				p2 = &the_buffer_copy[j * bytes_per_row];
-				p += bytes_per_row;
-				p2 += bytes_per_row;
-				for (uint32 i = VIDEO_MODE_X * bytes_per_pixel; i > x2 * bytes_per_pixel; i--) {
-					p--;
-					p2--;
-					if (*p != *p2) {
-						x2 = i / bytes_per_pixel;
-						break;
-					}
-				}
-			}
-			wide = x2 - x1;
-
-			// Update copy of the_buffer
-			if (high && wide) {
-
-				// Lock surface, if required
-				if (SDL_MUSTLOCK(drv->s))
-					SDL_LockSurface(drv->s);
-
-				// Blit to screen surface
-				for (uint32 j = y1; j <= y2; j++) {
-					uint32 i = j * bytes_per_row + x1 * bytes_per_pixel;
-					int dst_i = j * dst_bytes_per_row + x1 * bytes_per_pixel;
-					memcpy(the_buffer_copy + i, the_buffer + i, bytes_per_pixel * wide);
-					Screen_blit((uint8 *)drv->s->pixels + dst_i, the_buffer + i, bytes_per_pixel * wide);
-				}
-
-				// Unlock surface, if required
-				if (SDL_MUSTLOCK(drv->s))
-					SDL_UnlockSurface(drv->s);
-
-				// Refresh display
-				SDL_UpdateRect(drv->s, x1, y1, wide, high);
-			}
-		}
-	}
-}
-
-// Static display update (fixed frame rate, bounding boxes based)
-// XXX use NQD bounding boxes to help detect dirty areas?
-static void update_display_static_bbox(driver_base *drv)
-{
-	const VIDEO_MODE &mode = drv->mode;
-
-	// Allocate bounding boxes for SDL_UpdateRects()
-	const uint32 N_PIXELS = 64;
-	const uint32 n_x_boxes = (VIDEO_MODE_X + N_PIXELS - 1) / N_PIXELS;
-	const uint32 n_y_boxes = (VIDEO_MODE_Y + N_PIXELS - 1) / N_PIXELS;
-	SDL_Rect *boxes = (SDL_Rect *)alloca(sizeof(SDL_Rect) * n_x_boxes * n_y_boxes);
-	uint32 nr_boxes = 0;
+	SDL_Rect *rects = (SDL_Rect *)alloca(sizeof(SDL_Rect) * video_max_tile_rects(VIDEO_MODE_X, VIDEO_MODE_Y));
 
 	// Lock surface, if required
 	if (SDL_MUSTLOCK(drv->s))
 		SDL_LockSurface(drv->s);
 
 	// Update the surface from Mac screen
-	const uint32 bytes_per_row = VIDEO_MODE_ROW_BYTES;
-	const uint32 bytes_per_pixel = bytes_per_row / VIDEO_MODE_X;
-	const uint32 dst_bytes_per_row = drv->s->pitch;
-	for (uint32 y = 0; y < VIDEO_MODE_Y; y += N_PIXELS) {
-		uint32 h = N_PIXELS;
-		if (h > VIDEO_MODE_Y - y)
-			h = VIDEO_MODE_Y - y;
-		for (uint32 x = 0; x < VIDEO_MODE_X; x += N_PIXELS) {
-			uint32 w = N_PIXELS;
-			if (w > VIDEO_MODE_X - x)
-				w = VIDEO_MODE_X - x;
-			const int xs = w * bytes_per_pixel;
-			const int xb = x * bytes_per_pixel;
-			bool dirty = false;
-			for (uint32 j = y; j < (y + h); j++) {
-				const uint32 yb = j * bytes_per_row;
-				const uint32 dst_yb = j * dst_bytes_per_row;
-				if (memcmp(&the_buffer[yb + xb], &the_buffer_copy[yb + xb], xs) != 0) {
-					memcpy(&the_buffer_copy[yb + xb], &the_buffer[yb + xb], xs);
-					Screen_blit((uint8 *)drv->s->pixels + dst_yb + xb, the_buffer + yb + xb, xs);
-					dirty = true;
-				}
-			}
-			if (dirty) {
-				boxes[nr_boxes].x = x;
-				boxes[nr_boxes].y = y;
-				boxes[nr_boxes].w = w;
-				boxes[nr_boxes].h = h;
-				nr_boxes++;
-			}
-		}
-	}
+	uint32 nr_rects = video_update_tiles(the_buffer, the_buffer_copy, VIDEO_MODE_X, VIDEO_MODE_Y,
+		VIDEO_MODE_ROW_BYTES, mac_depth_of_video_depth(VIDEO_MODE_DEPTH),
+		(uint8 *)drv->s->pixels, drv->s->pitch, drv->s->format->BytesPerPixel, rects);
 
 	// Unlock surface, if required
 	if (SDL_MUSTLOCK(drv->s))
 		SDL_UnlockSurface(drv->s);
 
 	// Refresh display
-	if (nr_boxes)
-		SDL_UpdateRects(drv->s, nr_boxes, boxes);
+	if (nr_rects)
+		SDL_UpdateRects(drv->s, nr_rects, rects);
 }
 
 
@@ -2170,11 +1987,7 @@ static void video_refresh_window_static(void)
 	static uint32 tick_counter = 0;
 	if (++tick_counter >= frame_skip) {
 		tick_counter = 0;
-		const VIDEO_MODE &mode = drv->mode;
-		if ((int)VIDEO_MODE_DEPTH >= VIDEO_DEPTH_8BIT)
-			update_display_static_bbox(drv);
-		else
-			update_display_static(drv);
+		update_display_static(drv);
 	}
 }
 
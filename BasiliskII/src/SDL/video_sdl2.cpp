@@ -63,6 +63,7 @@
 #include "video.h"
 #include "video_defs.h"
 #include "video_blit.h"
+#include "video_tiles.h"
 #include "vm_alloc.h"
 
 #define DEBUG 0
@@ -139,8 +140,12 @@ static SDL_Surface * guest_surface = NULL;			// Surface in guest-OS display form
 static SDL_Renderer * sdl_renderer = NULL;			// Handle to SDL2 renderer
 static SDL_threadID sdl_renderer_thread_id = 0;		// Thread ID where the SDL_renderer was created, and SDL_renderer ops should run (for compatibility w/ d3d9)
 static SDL_Texture * sdl_texture = NULL;			// Handle to a GPU texture, with which to draw guest_surface to
-static SDL_Rect sdl_update_video_rect = {0,0,0,0};  // Union of all rects to update, when updating sdl_texture
-static SDL_mutex * sdl_update_video_mutex = NULL;   // Mutex to protect sdl_update_video_rect
+static const int MAX_UPDATE_RECTS = 64;			// Size of damage list before it collapses into a single rect
+static SDL_Rect sdl_update_video_rects[MAX_UPDATE_RECTS];	// Damaged areas of guest_surface, to be uploaded to sdl_texture
+static int sdl_update_video_nrects = 0;				// Number of entries in sdl_update_video_rects
+static SDL_mutex * sdl_update_video_mutex = NULL;   // Mutex to protect sdl_update_video_rects
+static uint32 sdl_upload_bytes = 0;					// Bytes uploaded to sdl_texture in the last frame
+static int video_stats_interval = 0;				// Seconds between upload statistics log lines, 0 = disabled
 static int screen_depth;							// Depth of current screen
 static SDL_Cursor *sdl_cursor = NULL;				// Copy of Mac cursor
 static SDL_Palette *sdl_palette = NULL;				// Color palette to be used as CLUT and gamma table
@@ -788,10 +793,7 @@ static SDL_Surface * init_sdl_video(int width, int height, int bpp, Uint32 flags
         shutdown_sdl_video();
         return NULL;
     }
-    sdl_update_video_rect.x = 0;
-    sdl_update_video_rect.y = 0;
-    sdl_update_video_rect.w = 0;
-    sdl_update_video_rect.h = 0;
+    sdl_update_video_nrects = 0;
 
 	SDL_assert(guest_surface == NULL);
 	SDL_assert(host_surface == NULL);
@@ -851,9 +853,32 @@ static SDL_Surface * init_sdl_video(int width, int height, int bpp, Uint32 flags
     return guest_surface;
 }
 
+// Log texture upload statistics every video_stats_interval seconds
+static void video_stats(int nrects)
+{
+	static uint64 last_time = 0;
+	static uint32 frames = 0, rects = 0;
+	static uint64 bytes = 0;
+
+	frames++;
+	rects += nrects;
+	bytes += sdl_upload_bytes;
+
+	uint64 now = GetTicks_usec();
+	if (last_time == 0)
+		last_time = now;
+	else if (now - last_time >= (uint64)video_stats_interval * 1000000) {
+		printf("video: %u frames, %.1f rects/frame, %.1f KB/frame uploaded\n",
+			   frames, (double)rects / frames, (double)bytes / frames / 1024.0);
+		last_time = now;
+		frames = rects = 0;
+		bytes = 0;
+	}
+}
+
 static int present_sdl_video()
 {
-	if (SDL_RectEmpty(&sdl_update_video_rect)) return 0;
+	if (sdl_update_video_nrects == 0) return 0;
 	
 	if (!sdl_renderer || !sdl_texture || !guest_surface) {
 		printf("WARNING: A video mode does not appear to have been set.\n");
@@ -875,7 +900,7 @@ static int present_sdl_video()
 	SDL_SetRenderDrawColor(sdl_renderer, 0, 0, 0, 0);	// Use black
 	SDL_RenderClear(sdl_renderer);						// Clear the display
 	
-	// We're about to work with sdl_update_video_rect, so stop other threads from
+	// We're about to work with sdl_update_video_rects, so stop other threads from
 	// modifying it!
 	LOCK_PALETTE;
 	SDL_LockMutex(sdl_update_video_mutex);
@@ -884,34 +909,43 @@ static int present_sdl_video()
 		host_surface != NULL &&
 		guest_surface != NULL)
 	{
-		SDL_Rect destRect = sdl_update_video_rect;
-		int result = SDL_BlitSurface(guest_surface, &sdl_update_video_rect, host_surface, &destRect);
-		if (result != 0) {
-			SDL_UnlockMutex(sdl_update_video_mutex);
-			UNLOCK_PALETTE;
-			return -1;
+		for (int i = 0; i < sdl_update_video_nrects; i++) {
+			SDL_Rect destRect = sdl_update_video_rects[i];
+			int result = SDL_BlitSurface(guest_surface, &sdl_update_video_rects[i], host_surface, &destRect);
+			if (result != 0) {
+				SDL_UnlockMutex(sdl_update_video_mutex);
+				UNLOCK_PALETTE;
+				return -1;
+			}
 		}
 	}
 	UNLOCK_PALETTE; // passed potential deadlock, can unlock palette
 	
-    // Update the host OS' texture
-    void * srcPixels = (void *)((uint8_t *)host_surface->pixels +
-        sdl_update_video_rect.y * host_surface->pitch +
-        sdl_update_video_rect.x * host_surface->format->BytesPerPixel);
-
-    if (SDL_UpdateTexture(sdl_texture, &sdl_update_video_rect, srcPixels, host_surface->pitch) != 0) {
-        SDL_UnlockMutex(sdl_update_video_mutex);
-		return -1;
+    // Update the host OS' texture, one damaged rect at a time
+	const int bytes_per_pixel = host_surface->format->BytesPerPixel;
+	sdl_upload_bytes = 0;
+	for (int i = 0; i < sdl_update_video_nrects; i++) {
+		const SDL_Rect &r = sdl_update_video_rects[i];
+		void * srcPixels = (void *)((uint8_t *)host_surface->pixels +
+			r.y * host_surface->pitch +
+			r.x * bytes_per_pixel);
+
+		if (SDL_UpdateTexture(sdl_texture, &r, srcPixels, host_surface->pitch) != 0) {
+			SDL_UnlockMutex(sdl_update_video_mutex);
+			return -1;
+		}
+		sdl_upload_bytes += r.w * r.h * bytes_per_pixel;
 	}
+	int nrects = sdl_update_video_nrects;
 
-    // We are done working with pixels in host_surface.  Reset sdl_update_video_rect, then let
+    // We are done working with pixels in host_surface.  Reset sdl_update_video_rects, then let
     // other threads modify it, as-needed.
-    sdl_update_video_rect.x = 0;
-    sdl_update_video_rect.y = 0;
-    sdl_update_video_rect.w = 0;
-    sdl_update_video_rect.h = 0;
+    sdl_update_video_nrects = 0;
     SDL_UnlockMutex(sdl_update_video_mutex);
 
+	if (video_stats_interval > 0)
+		video_stats(nrects);
+
     // Copy the texture to the display
     if (SDL_RenderCopy(sdl_renderer, sdl_texture, NULL, NULL) != 0) {
 		return -1;
@@ -924,6 +958,50 @@ static int present_sdl_video()
     return 0;
 }
 
+// Add rect to the damage list. Rects already covered by the list are
+// dropped, rects that can be joined with a list entry without covering
+// any extra area (the union is no larger than both rects minus their
+// overlap, e.g. when they share a full edge) are merged, and if the list
+// overflows it collapses into its bounding box.
+static void add_update_rect(const SDL_Rect &rect)
+{
+	if (SDL_RectEmpty(&rect))
+		return;
+
+	SDL_Rect r = rect;
+	for (int i = 0; i < sdl_update_video_nrects; ) {
+		SDL_Rect u;
+		SDL_UnionRect(&r, &sdl_update_video_rects[i], &u);
+		if (SDL_RectEquals(&u, &sdl_update_video_rects[i]))
+			return;
+		if (SDL_RectEquals(&u, &r))
+			sdl_update_video_rects[i] = sdl_update_video_rects[--sdl_update_video_nrects];
+		else
+			i++;
+	}
+
+	const int area = r.w * r.h;
+	for (int i = 0; i < sdl_update_video_nrects; i++) {
+		SDL_Rect &other = sdl_update_video_rects[i];
+		SDL_Rect u, overlap;
+		SDL_UnionRect(&r, &other, &u);
+		int overlap_area = SDL_IntersectRect(&r, &other, &overlap) ? overlap.w * overlap.h : 0;
+		if (u.w * u.h <= area + other.w * other.h - overlap_area) {
+			other = u;
+			return;
+		}
+	}
+
+	if (sdl_update_video_nrects == MAX_UPDATE_RECTS) {
+		for (int i = 1; i < sdl_update_video_nrects; i++)
+			SDL_UnionRect(&sdl_update_video_rects[0], &sdl_update_video_rects[i], &sdl_update_video_rects[0]);
+		sdl_update_video_nrects = 1;
+		SDL_UnionRect(&sdl_update_video_rects[0], &r, &sdl_update_video_rects[0]);
+		return;
+	}
+	sdl_update_video_rects[sdl_update_video_nrects++] = r;
+}
+
 void update_sdl_video(SDL_Surface *s, int numrects, SDL_Rect *rects)
 {
     // TODO: make sure SDL_Renderer resources get displayed, if and when
@@ -931,7 +1009,7 @@ void update_sdl_video(SDL_Surface *s, int numrects, SDL_Rect *rects)
     
     SDL_LockMutex(sdl_update_video_mutex);
     for (int i = 0; i < numrects; ++i) {
-        SDL_UnionRect(&sdl_update_video_rect, &rects[i], &sdl_update_video_rect);
+        add_update_rect(rects[i]);
     }
     SDL_UnlockMutex(sdl_update_video_mutex);
 }
@@ -1026,12 +1104,7 @@ void driver_base::adapt_to_video_mode() {
 	if (private_data)
 		private_data->cursorHardware = hardware_cursor;
 #endif
-	SDL_LockMutex(sdl_update_video_mutex);
-	sdl_update_video_rect.x = 0;
-	sdl_update_video_rect.y = 0;
-	sdl_update_video_rect.w = VIDEO_MODE_X;
-	sdl_update_video_rect.h = VIDEO_MODE_Y;
-	SDL_UnlockMutex(sdl_update_video_mutex);
+	update_sdl_video(s, 0, 0, VIDEO_MODE_X, VIDEO_MODE_Y);
 	
 	// Hide cursor
 	SDL_ShowCursor(hardware_cursor);
@@ -1094,12 +1167,7 @@ void driver_base::update_palette(void)
 
 	if ((int)VIDEO_MODE_DEPTH <= VIDEO_DEPTH_8BIT) {
 		SDL_SetSurfacePalette(s, sdl_palette);
-		SDL_LockMutex(sdl_update_video_mutex);
-		sdl_update_video_rect.x = 0;
-		sdl_update_video_rect.y = 0;
-		sdl_update_video_rect.w = VIDEO_MODE_X;
-		sdl_update_video_rect.h = VIDEO_MODE_Y;
-		SDL_UnlockMutex(sdl_update_video_mutex);
+		update_sdl_video(s, 0, 0, VIDEO_MODE_X, VIDEO_MODE_Y);
 	}
 }
 
@@ -1316,6 +1384,7 @@ bool VideoInit(bool classic)
 	frame_skip = PrefsFindInt32("frameskip");
 	mouse_wheel_mode = PrefsFindInt32("mousewheelmode");
 	mouse_wheel_lines = PrefsFindInt32("mousewheellines");
+	video_stats_interval = PrefsFindInt32("videostats");
 
 	// Get screen mode from preferences
 	migrate_screen_prefs();
@@ -2275,212 +2344,28 @@ static void handle_events(void)
  *  Window display update
  */
 
-// Static display update (fixed frame rate, but incremental)
+// Static display update (fixed frame rate, tile based, see video_tiles.h)
 static void update_display_static(driver_base *drv)
 {
-	// Incremental update code
-	int wide = 0, high = 0;
-	uint32 x1, x2, y1, y2;
 	const VIDEO_MODE &mode = drv->mode;
-	int bytes_per_row = VIDEO_MODE_ROW_BYTES;
-	uint8 *p, *p2;
-
-	// Check for first line from top and first line from bottom that have changed
-	y1 = 0;
-	for (uint32 j = 0; j < VIDEO_MODE_Y; j++) {
-		if (memcmp(&the_buffer[j * bytes_per_row], &the_buffer_copy[j * bytes_per_row], bytes_per_row)) {
-			y1 = j;
-			break;
-		}
-	}
-	y2 = y1 - 1;
-	for (uint32 j = VIDEO_MODE_Y; j-- > y1; ) {
-		if (memcmp(&the_buffer[j * bytes_per_row], &the_buffer_copy[j * bytes_per_row], bytes_per_row)) {
-			y2 = j;
-			break;
-		}
-	}
-	high = y2 - y1 + 1;
-
-	// Check for first column from left and first column from right that have changed
-	if (high) {
-		if ((int)VIDEO_MODE_DEPTH < (int)VIDEO_DEPTH_8BIT) {
-			const int src_bytes_per_row = bytes_per_row;
-			const int dst_bytes_per_row = drv->s->pitch;
-			const int pixels_per_byte = VIDEO_MODE_X / src_bytes_per_row;
-
-			x1 = VIDEO_MODE_X / pixels_per_byte;
-			for (uint32 j = y1; j <= y2; j++) {
-				p = &the_buffer[j * bytes_per_row];
-				p2 = &the_buffer_copy[j * bytes_per_row];
-				for (uint32 i = 0; i < x1; i++) {
-					if (*p != *p2) {
-						x1 = i;
-						break;
-					}
-					p++; p2++;
-				}
-			}
-			x2 = x1;
-			for (uint32 j = y1; j <= y2; j++) {
-				p = &the_buffer[j * bytes_per_row];
-				p2 = &the_buffer_copy[j * bytes_per_row];
-				p += bytes_per_row;
-				p2 += bytes_per_row;
-				for (uint32 i = (VIDEO_MODE_X / pixels_per_byte); i > x2; i--) {
-					p--; p2--;
-					if (*p != *p2) {
-						x2 = i;
-						break;
-					}
-				}
-			}
-			x1 *= pixels_per_byte;
-			x2 *= pixels_per_byte;
-			wide = (x2 - x1 + pixels_per_byte - 1) & -pixels_per_byte;
-
-			// Update copy of the_buffer
-			if (high && wide) {
-
-				// Lock surface, if required
-				if (SDL_MUSTLOCK(drv->s))
-					SDL_LockSurface(drv->s);
-
-				// Blit to screen surface
-				int si = y1 * src_bytes_per_row + (x1 / pixels_per_byte);
-				int di = y1 * dst_bytes_per_row + x1;
-				for (uint32 j = y1; j <= y2; j++) {
-					memcpy(the_buffer_copy + si, the_buffer + si, wide / pixels_per_byte);
-					Screen_blit((uint8 *)drv->s->pixels + di, the_buffer + si, wide / pixels_per_byte);
-					si += src_bytes_per_row;
-					di += dst_bytes_per_row;
-				}
-
-				// Unlock surface, if required
-				if (SDL_MUSTLOCK(drv->s))
-					SDL_UnlockSurface(drv->s);
-
-				// Refresh display
-				update_sdl_video(drv->s, x1, y1, wide, high);
-			}
-
-		} else {
-			const int bytes_per_pixel = VIDEO_MODE_ROW_BYTES / VIDEO_MODE_X;
-			const int dst_bytes_per_row = drv->s->pitch;
-
-			x1 = VIDEO_MODE_X;
-			for (uint32 j = y1; j <= y2; j++) {
-				p = &the_buffer[j * bytes_per_row];
-				p2 = &the_buffer_copy[j * bytes_per_row];
-				for (uint32 i = 0; i < x1 * bytes_per_pixel; i++) {
-					if (*p != *p2) {
-						x1 = i / bytes_per_pixel;
-						break;
-					}
-					p++; p2++;
-				}
-			}
-			x2 = x1;
-			for (uint32 j = y1; j <= y2; j++) {
-				p = &the_buffer[j * bytes_per_row];
-				p2 = &the_buffer_copy[j * bytes_per_row];
-				p += bytes_per_row;
-				p2 += bytes_per_row;
-				for (uint32 i = VIDEO_MODE_X * bytes_per_pixel; i > x2 * bytes_per_pixel; i--) {
-					p--;
-					p2--;
-					if (*p != *p2) {
-						x2 = i / bytes_per_pixel;
-						break;
-					}
-				}
-			}
-			wide = x2 - x1;
-
-			// Update copy of the_buffer
-			if (high && wide) {
-
-				// Lock surface, if required
-				if (SDL_MUSTLOCK(drv->s))
-					SDL_LockSurface(drv->s);
-
-				// Blit to screen surface
-				for (uint32 j = y1; j <= y2; j++) {
-					uint32 i = j * bytes_per_row + x1 * bytes_per_pixel;
-					int dst_i = j * dst_bytes_per_row + x1 * bytes_per_pixel;
-					memcpy(the_buffer_copy + i, the_buffer + i, bytes_per_pixel * wide);
-					Screen_blit((uint8 *)drv->s->pixels + dst_i, the_buffer + i, bytes_per_pixel * wide);
-				}
-
-				// Unlock surface, if required
-				if (SDL_MUSTLOCK(drv->s))
-					SDL_UnlockSurface(drv->s);
-
-				// Refresh display
-				update_sdl_video(drv->s, x1, y1, wide, high);
-			}
-		}
-	}
-}
-
-// Static display update (fixed frame rate, bounding boxes based)
-// XXX use NQD bounding boxes to help detect dirty areas?
-static void update_display_static_bbox(driver_base *drv)
-{
-	const VIDEO_MODE &mode = drv->mode;
-
-	// Allocate bounding boxes for SDL_UpdateRects()
-	const uint32 N_PIXELS = 64;
-	const uint32 n_x_boxes = (VIDEO_MODE_X + N_PIXELS - 1) / N_PIXELS;
-	const uint32 n_y_boxes = (VIDEO_MODE_Y + N_PIXELS - 1) / N_PIXELS;
-	SDL_Rect *boxes = (SDL_Rect *)alloca(sizeof(SDL_Rect) * n_x_boxes * n_y_boxes);
-	uint32 nr_boxes = 0;
+	SDL_Rect *rects = (SDL_Rect *)alloca(sizeof(SDL_Rect) * video_max_tile_rects(VIDEO_MODE_X, VIDEO_MODE_Y));
 
 	// Lock surface, if required
 	if (SDL_MUSTLOCK(drv->s))
 		SDL_LockSurface(drv->s);
 
 	// Update the surface from Mac screen
-	const uint32 bytes_per_row = VIDEO_MODE_ROW_BYTES;
-	const uint32 bytes_per_pixel = bytes_per_row / VIDEO_MODE_X;
-	const uint32 dst_bytes_per_row = drv->s->pitch;
-	for (uint32 y = 0; y < VIDEO_MODE_Y; y += N_PIXELS) {
-		uint32 h = N_PIXELS;
-		if (h > VIDEO_MODE_Y - y)
-			h = VIDEO_MODE_Y - y;
-		for (uint32 x = 0; x < VIDEO_MODE_X; x += N_PIXELS) {
-			uint32 w = N_PIXELS;
-			if (w > VIDEO_MODE_X - x)
-				w = VIDEO_MODE_X - x;
-			const int xs = w * bytes_per_pixel;
-			const int xb = x * bytes_per_pixel;
-			bool dirty = false;
-			for (uint32 j = y; j < (y + h); j++) {
-				const uint32 yb = j * bytes_per_row;
-				const uint32 dst_yb = j * dst_bytes_per_row;
-				if (memcmp(&the_buffer[yb + xb], &the_buffer_copy[yb + xb], xs) != 0) {
-					memcpy(&the_buffer_copy[yb + xb], &the_buffer[yb + xb], xs);
-					Screen_blit((uint8 *)drv->s->pixels + dst_yb + xb, the_buffer + yb + xb, xs);
-					dirty = true;
-				}
-			}
-			if (dirty) {
-				boxes[nr_boxes].x = x;
-				boxes[nr_boxes].y = y;
-				boxes[nr_boxes].w = w;
-				boxes[nr_boxes].h = h;
-				nr_boxes++;
-			}
-		}
-	}
+	uint32 nr_rects = video_update_tiles(the_buffer, the_buffer_copy, VIDEO_MODE_X, VIDEO_MODE_Y,
+		VIDEO_MODE_ROW_BYTES, mac_depth_of_video_depth(VIDEO_MODE_DEPTH),
+		(uint8 *)drv->s->pixels, drv->s->pitch, drv->s->format->BytesPerPixel, rects);
 
 	// Unlock surface, if required
 	if (SDL_MUSTLOCK(drv->s))
 		SDL_UnlockSurface(drv->s);
 
 	// Refresh display
-	if (nr_boxes)
-		update_sdl_video(drv->s, nr_boxes, boxes);
+	if (nr_rects)
+		update_sdl_video(drv->s, nr_rects, rects);
 }
 
 
@@ -2580,11 +2465,7 @@ static void video_refresh_window_static(void)
 	static uint32 tick_counter = 0;
 	if (++tick_counter >= frame_skip) {
 		tick_counter = 0;
-		const VIDEO_MODE &mode = drv->mode;
-		if ((int)VIDEO_MODE_DEPTH >= VIDEO_DEPTH_8BIT)
-			update_display_static_bbox(drv);
-		else
-			update_display_static(drv);
+		update_display_static(drv);
 	}
 }
 
@@ -24,7 +24,7 @@
 #include <unistd.h>
 #include <errno.h>
 #include <pthread.h>
-#include <semaphore.h>
+#include <atomic>
 
 #ifdef __linux__
 #include <linux/soundcard.h>
@@ -58,8 +58,6 @@ static int audio_channel_count_index = 0;
 static bool is_dsp_audio = false;					// Flag: is DSP audio
 static int audio_fd = -1;							// fd of dsp or ESD
 static int mixer_fd = -1;							// fd of mixer
-static sem_t audio_irq_done_sem;					// Signal from interrupt to streaming thread: data block read
-static bool sem_inited = false;						// Flag: audio_irq_done_sem initialized
 static int sound_buffer_size;						// Size of sound buffer in bytes
 static bool little_endian = false;					// Flag: DSP accepts only little-endian 16-bit sound data
 static uint8 silence_byte;							// Byte value to use to fill sound buffers with silence
@@ -68,6 +66,21 @@ static pthread_attr_t stream_thread_attr;			// Streaming thread attributes
 static bool stream_thread_active = false;			// Flag: streaming thread installed
 static volatile bool stream_thread_cancel = false;	// Flag: cancel streaming thread
 
+// Ring buffer between AudioInterrupt() (producer) and the streaming thread
+// (consumer), so the device is fed even when MacOS is late
+const int AUDIO_PREFETCH_MIN = 1;					// Limits of prefetch depth, in blocks
+const int AUDIO_PREFETCH_MAX = 4;
+const int AUDIO_PREFETCH_RELAX = 256;				// Blocks without underrun before prefetching less
+
+static uint8 *audio_ring = NULL;
+static uint32 audio_ring_size;						// Power of two
+static std::atomic<uint32> audio_ring_head(0);		// Write position (AudioInterrupt())
+static std::atomic<uint32> audio_ring_tail(0);		// Read position (stream_func())
+static std::atomic<int> audio_prefetch(AUDIO_PREFETCH_MIN);	// Blocks to keep buffered
+static std::atomic<bool> audio_irq_pending(false);	// Flag: INTFLAG_AUDIO raised, AudioInterrupt() not yet run
+static std::atomic<bool> audio_streaming(false);	// Flag: MacOS is producing data
+static uint32 audio_underruns = 0;					// Number of blocks not completely filled in time
+
 // Prototypes
 static void *stream_func(void *arg);
 
@@ -266,6 +279,13 @@ dev_opened:
 	sound_buffer_size = (audio_sample_sizes[audio_sample_size_index] >> 3) * audio_channel_counts[audio_channel_count_index] * audio_frames_per_block;
 	set_audio_status_format();
 
+	// Allocate ring buffer
+	for (audio_ring_size = 1; audio_ring_size < (uint32)(AUDIO_PREFETCH_MAX + 1) * sound_buffer_size; audio_ring_size <<= 1) ;
+	audio_ring = (uint8 *)malloc(audio_ring_size);
+	audio_ring_head = audio_ring_tail = 0;
+	audio_irq_pending = false;
+	audio_streaming = false;
+
 	// Start streaming thread
 	Set_pthread_attr(&stream_thread_attr, 0);
 	stream_thread_active = (pthread_create(&stream_thread, &stream_thread_attr, stream_func, NULL) == 0);
@@ -289,11 +309,6 @@ void AudioInit(void)
 	if (PrefsFindBool("nosound"))
 		return;
 
-	// Init semaphore
-	if (sem_init(&audio_irq_done_sem, 0, 0) < 0)
-		return;
-	sem_inited = true;
-
 	// Try to open the mixer device
 	const char *mixer = PrefsFindString("mixer");
 	mixer_fd = open(mixer, O_RDWR);
@@ -327,6 +342,8 @@ static void close_audio(void)
 		audio_fd = -1;
 	}
 
+	free(audio_ring);
+	audio_ring = NULL;
 	audio_open = false;
 }
 
@@ -339,12 +356,7 @@ void AudioExit(void)
 
 	// Close audio device
 	close_audio();
-
-	// Delete semaphore
-	if (sem_inited) {
-		sem_destroy(&audio_irq_done_sem);
-		sem_inited = false;
-	}
+	D(bug("Audio: %u underruns, prefetch depth %d blocks\n", audio_underruns, (int)audio_prefetch));
 
 	// Close mixer device
 	if (mixer_fd >= 0) {
@@ -378,59 +390,70 @@ void audio_exit_stream()
  *  Streaming function
  */
 
+// Ask MacOS for more audio data unless a request is outstanding
+static void request_audio_data(void)
+{
+	if (!audio_irq_pending.exchange(true)) {
+		SetInterruptFlag(INTFLAG_AUDIO);
+		TriggerInterrupt();
+	}
+}
+
 static void *stream_func(void *arg)
 {
-	int16 *silent_buffer = new int16[sound_buffer_size / 2];
-	int16 *last_buffer = new int16[sound_buffer_size / 2];
-	memset(silent_buffer, silence_byte, sound_buffer_size);
+	uint8 *buffer = new uint8[sound_buffer_size];
+	int good_blocks = 0;
 
 	while (!stream_thread_cancel) {
 		if (AudioStatus.num_sources) {
 
-			// Trigger audio interrupt to get new buffer
-			D(bug("stream: triggering irq\n"));
-			SetInterruptFlag(INTFLAG_AUDIO);
-			TriggerInterrupt();
-			D(bug("stream: waiting for ack\n"));
-			sem_wait(&audio_irq_done_sem);
-			D(bug("stream: ack received\n"));
-
-			// Get size of audio data
-			uint32 apple_stream_info = ReadMacInt32(audio_data + adatStreamInfo);
-			if (apple_stream_info) {
-				int work_size = ReadMacInt32(apple_stream_info + scd_sampleCount) * (AudioStatus.sample_size >> 3) * AudioStatus.channels;
-				D(bug("stream: work_size %d\n", work_size));
-				if (work_size > sound_buffer_size)
-					work_size = sound_buffer_size;
-				if (work_size == 0)
-					goto silence;
-
-				// Send data to DSP
-				if (work_size == sound_buffer_size && !little_endian)
-					write(audio_fd, Mac2HostAddr(ReadMacInt32(apple_stream_info + scd_buffer)), sound_buffer_size);
-				else {
-					// Last buffer or little-endian DSP
-					if (little_endian) {
-						int16 *p = (int16 *)Mac2HostAddr(ReadMacInt32(apple_stream_info + scd_buffer));
-						for (int i=0; i<work_size/2; i++)
-							last_buffer[i] = ntohs(p[i]);
-					} else
-						Mac2Host_memcpy(last_buffer, ReadMacInt32(apple_stream_info + scd_buffer), work_size);
-					memset((uint8 *)last_buffer + work_size, silence_byte, sound_buffer_size - work_size);
-					write(audio_fd, last_buffer, sound_buffer_size);
-				}
-				D(bug("stream: data written\n"));
-			} else
-				goto silence;
+			// Take as much data from the ring as is there
+			uint32 tail = audio_ring_tail.load(std::memory_order_relaxed);
+			uint32 avail = audio_ring_head.load(std::memory_order_acquire) - tail;
+			uint32 work_size = avail < (uint32)sound_buffer_size ? avail : sound_buffer_size;
+			uint32 offset = tail & (audio_ring_size - 1);
+			uint32 first = work_size < audio_ring_size - offset ? work_size : audio_ring_size - offset;
+			memcpy(buffer, audio_ring + offset, first);
+			memcpy(buffer + first, audio_ring, work_size - first);
+			audio_ring_tail.store(tail + work_size, std::memory_order_release);
+			D(bug("stream: work_size %d\n", work_size));
+
+			// MacOS didn't keep up? Then buffer more from now on
+			if (audio_streaming && work_size < (uint32)sound_buffer_size) {
+				audio_underruns++;
+				good_blocks = 0;
+				if (audio_prefetch < AUDIO_PREFETCH_MAX)
+					audio_prefetch++;
+			} else if (++good_blocks >= AUDIO_PREFETCH_RELAX) {
+				good_blocks = 0;
+				if (audio_prefetch > AUDIO_PREFETCH_MIN)
+					audio_prefetch--;
+			}
+
+			// Fetch more data ahead while this block plays
+			if (avail - work_size < (audio_prefetch + 1) * (uint32)sound_buffer_size)
+				request_audio_data();
+
+			// Send data to DSP
+			if (little_endian) {
+				uint16 *p = (uint16 *)buffer;
+				for (uint32 i=0; i<work_size/2; i++)
+					p[i] = ntohs(p[i]);
+			}
+			memset(buffer + work_size, silence_byte, sound_buffer_size - work_size);
+			write(audio_fd, buffer, sound_buffer_size);
+			D(bug("stream: data written\n"));
 
 		} else {
 
 			// Audio not active, play silence
-silence:	write(audio_fd, silent_buffer, sound_buffer_size);
+			audio_ring_tail.store(audio_ring_head.load(std::memory_order_acquire), std::memory_order_release);
+			audio_streaming = false;
+			memset(buffer, silence_byte, sound_buffer_size);
+			write(audio_fd, buffer, sound_buffer_size);
 		}
 	}
-	delete[] silent_buffer;
-	delete[] last_buffer;
+	delete[] buffer;
 	return NULL;
 }
 
@@ -453,8 +476,30 @@ void AudioInterrupt(void)
 	} else
 		WriteMacInt32(audio_data + adatStreamInfo, 0);
 
-	// Signal stream function
-	sem_post(&audio_irq_done_sem);
+	// Append data to ring buffer
+	uint32 head = audio_ring_head.load(std::memory_order_relaxed);
+	uint32 level = head - audio_ring_tail.load(std::memory_order_acquire);
+	uint32 apple_stream_info = ReadMacInt32(audio_data + adatStreamInfo);
+	uint32 work_size = 0;
+	if (apple_stream_info && audio_ring) {
+		work_size = ReadMacInt32(apple_stream_info + scd_sampleCount) * (AudioStatus.sample_size >> 3) * AudioStatus.channels;
+		if (work_size > audio_ring_size - level)
+			work_size = audio_ring_size - level;
+		uint32 offset = head & (audio_ring_size - 1);
+		uint32 first = work_size < audio_ring_size - offset ? work_size : audio_ring_size - offset;
+		uint32 buffer = ReadMacInt32(apple_stream_info + scd_buffer);
+		Mac2Host_memcpy(audio_ring + offset, buffer, first);
+		Mac2Host_memcpy(audio_ring, buffer + first, work_size - first);
+		head += work_size;
+		level += work_size;
+		audio_ring_head.store(head, std::memory_order_release);
+	}
+
+	// Keep fetching until the prefetch depth is reached
+	audio_streaming = (work_size != 0);
+	audio_irq_pending = false;
+	if (AudioStatus.num_sources && work_size && level < (audio_prefetch + 1) * (uint32)sound_buffer_size)
+		request_audio_data();
 	D(bug("AudioInterrupt done\n"));
 }
 
@@ -0,0 +1,288 @@
+/*
+ *  bench_disk_io.cpp - Replay a disk I/O trace through Sys_read()/Sys_write()
+ *
+ *  Basilisk II (C) 1997-2008 Christian Bauer
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ *  The image is opened with Sys_open() and the trace is replayed with
+ *  Sys_read()/Sys_write() of sys_unix.cpp, which are linked in together
+ *  with the disk backends. So the backend that the emulator would use
+ *  for the image (VHD, sparsebundle, copy-on-write overlay, mmap() for
+ *  read-only images, or positional I/O on the file) is what is measured.
+ *  Requests per second and throughput are printed. The image is normally
+ *  in the page cache, so this measures the cost per request of the
+ *  backend and its system calls rather than that of the disk.
+ *
+ *  Options: "-r" opens the image read-only (writes in the trace are
+ *  skipped), "-o <directory>" sets "diskoverlaydir" so that writes go
+ *  to an overlay in that directory, which is left there.
+ *
+ *  A trace has one request per line, "r <offset> <length>" or
+ *  "w <offset> <length>" (decimal or 0x hex, in bytes), lines starting
+ *  with '#' are ignored. Writes put back the data that was on the disk
+ *  before, so its contents don't change. Without a trace, a synthetic one
+ *  is used: 20000 requests, 80% reads, 512 bytes to 64 KB each, at random
+ *  block offsets within the disk.
+ *
+ *  Build with "make bench_disk_io" in the Unix directory, run with
+ *  "bench_disk_io [-r] [-o <directory>] <image file> [<trace file>]".
+ */
+
+#include "sysdeps.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <vector>
+
+#include "main.h"
+#include "sys.h"
+#include "prefs.h"
+#include "macos_util.h"
+#include "user_strings.h"
+
+const double BENCH_SECONDS = 1.0;					// Minimum run time
+const int SYNTHETIC_REQUESTS = 20000;
+
+struct request {
+	bool write;
+	loff_t offset;
+	size_t length;
+	uint8 *data;									// Data to write (original disk contents)
+};
+
+static std::vector<request> trace;
+static size_t max_length = 0;
+static void *fh = NULL;
+static bool read_only = false;
+static const char *overlay_dir = NULL;
+
+
+/*
+ *  What sys_unix.cpp and the disk backends need from the rest of the emulator
+ */
+
+const char *PrefsFindString(const char *name, int index)
+{
+	if (strcmp(name, "diskoverlaydir") == 0 && index == 0)
+		return overlay_dir;
+	return NULL;
+}
+
+bool PrefsFindBool(const char *name)
+{
+	return false;
+}
+
+void PrefsAddString(const char *name, const char *s)
+{
+}
+
+void PrefsReplaceString(const char *name, const char *s, int index)
+{
+}
+
+const char *GetString(int num)
+{
+	return "";
+}
+
+void WarningAlert(const char *text)
+{
+	fprintf(stderr, "WARNING: %s\n", text);
+}
+
+void MountVolume(void *fh)
+{
+}
+
+// Plain images only, no DiskCopy header detection
+void FileDiskLayout(loff_t size, uint8 *data, loff_t &start_byte, loff_t &real_size)
+{
+	start_byte = 0;
+	real_size = size;
+}
+
+void Set_pthread_attr(pthread_attr_t *attr, int priority)
+{
+	pthread_attr_init(attr);
+}
+
+
+static double now(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+// Read trace file, returns false on error
+static bool read_trace(const char *path)
+{
+	FILE *f = fopen(path, "r");
+	if (f == NULL) {
+		fprintf(stderr, "Can't open trace %s: %s\n", path, strerror(errno));
+		return false;
+	}
+	char line[256];
+	int line_nr = 0;
+	while (fgets(line, sizeof(line), f)) {
+		line_nr++;
+		char op;
+		long long offset, length;
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+		if (sscanf(line, " %c %lli %lli", &op, &offset, &length) != 3 || (op != 'r' && op != 'w') || length <= 0) {
+			fprintf(stderr, "%s:%d: expected \"r|w <offset> <length>\"\n", path, line_nr);
+			fclose(f);
+			return false;
+		}
+		request r = {op == 'w', (loff_t)offset, (size_t)length, NULL};
+		trace.push_back(r);
+	}
+	fclose(f);
+	return true;
+}
+
+// Make up a trace of mostly small, block aligned requests
+static void synthetic_trace(loff_t disk_size)
+{
+	srand(1);
+	for (int i = 0; i < SYNTHETIC_REQUESTS; i++) {
+		request r;
+		r.write = rand() % 5 == 0;
+		r.length = 512 << (rand() % 8);				// 512 bytes to 64 KB
+		if ((loff_t)r.length > disk_size)
+			r.length = 512;
+		r.offset = (rand() % ((disk_size - r.length) / 512 + 1)) * 512;
+		r.data = NULL;
+		trace.push_back(r);
+	}
+}
+
+static bool check(size_t actual, const request &r)
+{
+	if (actual == r.length)
+		return true;
+	fprintf(stderr, "%s of %lu bytes at %lld failed\n", r.write ? "Write" : "Read",
+			(unsigned long)r.length, (long long)r.offset);
+	return false;
+}
+
+// Replay the whole trace once
+static bool replay(uint8 *buf)
+{
+	for (size_t i = 0; i < trace.size(); i++) {
+		const request &r = trace[i];
+		if (r.write && read_only)
+			continue;
+		if (!check(r.write ? Sys_write(fh, r.data, r.offset, r.length) : Sys_read(fh, buf, r.offset, r.length), r))
+			return false;
+	}
+	return true;
+}
+
+static void usage(const char *prg_name)
+{
+	fprintf(stderr, "Usage: %s [-r] [-o <overlay directory>] <image file> [<trace file>]\n", prg_name);
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	int opt;
+	while ((opt = getopt(argc, argv, "ro:")) != -1) {
+		if (opt == 'r')
+			read_only = true;
+		else if (opt == 'o')
+			overlay_dir = optarg;
+		else
+			usage(argv[0]);
+	}
+	if (optind >= argc || argc - optind > 2)
+		usage(argv[0]);
+	const char *image = argv[optind];
+
+	fh = Sys_open(image, read_only);
+	if (fh == NULL) {
+		fprintf(stderr, "Can't open image %s\n", image);
+		return 1;
+	}
+	if (!read_only && SysIsReadOnly(fh)) {
+		fprintf(stderr, "Image %s can only be opened read-only, use -r\n", image);
+		return 1;
+	}
+	loff_t size = SysGetFileSize(fh);
+	if (size < 512) {
+		fprintf(stderr, "Image %s is too small\n", image);
+		return 1;
+	}
+	if (argc - optind > 1) {
+		if (!read_trace(argv[optind + 1]))
+			return 1;
+	} else
+		synthetic_trace(size);
+	if (trace.empty()) {
+		fprintf(stderr, "Empty trace\n");
+		return 1;
+	}
+
+	// Fetch the data writes put back, this also brings the image into the page cache
+	int n_writes = 0;
+	double bytes = 0;
+	for (size_t i = 0; i < trace.size(); i++) {
+		request &r = trace[i];
+		if (r.offset < 0 || r.offset + (loff_t)r.length > size) {
+			fprintf(stderr, "Request %lu lies outside of the disk\n", (unsigned long)i);
+			return 1;
+		}
+		if (r.length > max_length)
+			max_length = r.length;
+		if (r.write) {
+			n_writes++;
+			if (read_only)
+				continue;
+			r.data = (uint8 *)malloc(r.length);
+			if (r.data == NULL || !check(Sys_read(fh, r.data, r.offset, r.length), r))
+				return 1;
+		}
+		bytes += r.length;
+	}
+	uint8 *buf = (uint8 *)malloc(max_length);
+	if (!replay(buf))
+		return 1;
+
+	printf("%lu requests (%d writes%s), largest %lu bytes\n", (unsigned long)trace.size(), n_writes,
+		   read_only ? ", skipped" : "", (unsigned long)max_length);
+	int runs = 0;
+	double t = now(), secs;
+	do {
+		if (!replay(buf))
+			return 1;
+		runs++;
+	} while ((secs = now() - t) < BENCH_SECONDS);
+	size_t n_requests = read_only ? trace.size() - n_writes : trace.size();
+	printf("Sys_read/Sys_write%-10s %10.0f requests/s %9.1f MB/s\n", read_only ? " (ro)" : overlay_dir ? " (overlay)" : "",
+		   runs * n_requests / secs, runs * bytes / secs / (1024 * 1024));
+
+	Sys_close(fh);
+	return 0;
+}
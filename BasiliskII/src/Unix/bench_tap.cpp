@@ -0,0 +1,472 @@
+/*
+ *  bench_tap.cpp - TAP loopback throughput benchmark of ether_unix.cpp
+ *
+ *  Basilisk II (C) 1997-2008 Christian Bauer
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ *  ether_unix.cpp is linked in and opened with "ether tun", so frames go
+ *  through its transmit ring and transmission thread, and through its
+ *  reception thread, receive filter and receive ring, as in the emulator.
+ *  The benchmark plays the emulation thread: it sends frames with
+ *  ether_write() and calls EtherInterrupt() when the reception thread
+ *  triggers an interrupt. The MacOS side (RAM, WDS, protocol handler) is
+ *  a few stubs below. This program is also the "etherconfig" script, it
+ *  gives the host end of the TAP device an address.
+ *
+ *  A UDP socket bound to the host address is the other end of the
+ *  loopback. UDP datagrams are sent in both directions for a second each,
+ *  for small and full size frames, and frame rate and throughput are
+ *  printed.
+ *
+ *  Linux only. Creating the TAP device needs CAP_NET_ADMIN; without it,
+ *  or on other systems, the benchmark is skipped with exit code 77. The
+ *  device disappears when the program exits.
+ *
+ *  Build with "make bench_tap" in the Unix directory.
+ */
+
+#include "sysdeps.h"
+
+#include <stdio.h>
+
+const int SKIP_EXIT_CODE = 77;						// Test skipped (as in automake)
+
+#if defined(HAVE_LINUX_IF_H) && defined(HAVE_LINUX_IF_TUN_H) && ENABLE_TUNTAP
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <ifaddrs.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <net/if.h>
+#include <net/if_arp.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <atomic>
+
+#include "cpu_emulation.h"
+#include "main.h"
+#include "prefs.h"
+#include "macos_util.h"
+#include "user_strings.h"
+#include "ether.h"
+#include "ether_defs.h"
+#include "intflags_unix.h"
+
+const double BENCH_SECONDS = 1.0;					// Run time of each test
+const char HOST_ADDR[] = "10.77.0.1";				// Address of TAP interface
+const char MAC_ADDR[] = "10.77.0.2";				// Address of the emulated Mac
+const uint16 MAC_PORT = 40000;						// UDP port on the Mac side
+const int FRAME_MAX = 1514;
+
+// MacOS RAM layout
+const uint32 HANDLER_ADDR = 0x100;					// IP protocol handler (never executed)
+const uint32 ETHER_DATA_ADDR = 0x1000;				// Driver data
+const uint32 PACKET_ADDR = 0x2000;					// Received packet buffer
+const uint32 FRAME_ADDR = 0x3000;					// Frame to send
+const uint32 WDS_ADDR = 0x4000;						// Write data structure of that frame
+static uint8 mac_ram[0x5000];
+
+static char script_path[256];
+static char last_warning[256];
+static int udp_fd = -1;
+static uint16 host_port;
+static uint8 host_ether_addr[6];
+static pthread_mutex_t irq_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t irq_cond = PTHREAD_COND_INITIALIZER;	// Signalled by TriggerInterrupt()
+static std::atomic<bool> stop(false);
+static double frames_received;						// Frames passed to the protocol handler
+
+
+/*
+ *  What ether_unix.cpp needs from the rest of the emulator
+ */
+
+uintptr MEMBaseDiff;
+uint32 ether_data = ETHER_DATA_ADDR;
+uint8 ether_addr[6];
+
+const char *PrefsFindString(const char *name, int index)
+{
+	if (strcmp(name, "ether") == 0)
+		return "tun";
+	if (strcmp(name, "etherconfig") == 0)
+		return script_path;
+	return NULL;
+}
+
+int32 PrefsFindInt32(const char *name)
+{
+	return 0;
+}
+
+void WarningAlert(const char *text)
+{
+	snprintf(last_warning, sizeof(last_warning), "%s", text);
+}
+
+void Set_pthread_attr(pthread_attr_t *attr, int priority)
+{
+	pthread_attr_init(attr);
+}
+
+uint64 GetTicks_usec(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (uint64)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+void Delay_usec(uint64 usec)
+{
+	usleep(usec);
+}
+
+void TriggerInterrupt(void)
+{
+	pthread_mutex_lock(&irq_lock);
+	pthread_cond_signal(&irq_cond);
+	pthread_mutex_unlock(&irq_lock);
+}
+
+EthernetPacket::EthernetPacket()
+{
+	packet = PACKET_ADDR;
+}
+
+EthernetPacket::~EthernetPacket()
+{
+}
+
+void ether_udp_read(uint32 packet, int length, struct sockaddr_in *from)
+{
+}
+
+// The only 68k code called is the IP protocol handler, count our datagrams
+void Execute68k(uint32 addr, M68kRegisters *r)
+{
+	uint32 ip = r->a[0];
+	if (addr == HANDLER_ADDR && r->d[1] >= 20 + 8 && ReadMacInt8(ip + 9) == IPPROTO_UDP
+	 && ReadMacInt16(ip + 20 + 2) == MAC_PORT)
+		frames_received++;
+}
+
+
+static double now(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+// "etherconfig" script: give host end of TAP device an address, returns exit code
+static int config_script(const char *if_name, const char *action)
+{
+	if (strcmp(action, "up") != 0)
+		return 0;
+
+	struct ifreq ifr;
+	memset(&ifr, 0, sizeof(ifr));
+	strncpy(ifr.ifr_name, if_name, IFNAMSIZ - 1);
+	struct sockaddr_in *sin = (struct sockaddr_in *)&ifr.ifr_addr;
+	sin->sin_family = AF_INET;
+	int s = socket(AF_INET, SOCK_DGRAM, 0);
+	inet_aton(HOST_ADDR, &sin->sin_addr);
+	if (ioctl(s, SIOCSIFADDR, &ifr) < 0)
+		goto config_error;
+	inet_aton("255.255.255.0", &sin->sin_addr);
+	if (ioctl(s, SIOCSIFNETMASK, &ifr) < 0)
+		goto config_error;
+	if (ioctl(s, SIOCGIFFLAGS, &ifr) < 0)
+		goto config_error;
+	ifr.ifr_flags |= IFF_UP | IFF_RUNNING;
+	if (ioctl(s, SIOCSIFFLAGS, &ifr) < 0)
+		goto config_error;
+	close(s);
+	return 0;
+
+config_error:
+	fprintf(stderr, "Can't configure %s: %s\n", if_name, strerror(errno));
+	close(s);
+	return 1;
+}
+
+// Set up host side after ether_init(), returns error message or NULL
+static const char *open_host(void)
+{
+	static char msg[128];
+
+	// Find the TAP device by the address the script gave it
+	char if_name[IFNAMSIZ] = "";
+	struct ifaddrs *ifas;
+	if (getifaddrs(&ifas) == 0) {
+		for (struct ifaddrs *ifa = ifas; ifa; ifa = ifa->ifa_next) {
+			if (ifa->ifa_addr && ifa->ifa_addr->sa_family == AF_INET
+			 && strcmp(inet_ntoa(((struct sockaddr_in *)ifa->ifa_addr)->sin_addr), HOST_ADDR) == 0)
+				strncpy(if_name, ifa->ifa_name, IFNAMSIZ - 1);
+		}
+		freeifaddrs(ifas);
+	}
+	if (if_name[0] == 0)
+		return "TAP device has no host address";
+
+	int s = socket(AF_INET, SOCK_DGRAM, 0);
+	struct ifreq ifr;
+	memset(&ifr, 0, sizeof(ifr));
+	strcpy(ifr.ifr_name, if_name);
+	if (ioctl(s, SIOCGIFHWADDR, &ifr) < 0)
+		goto config_error;
+	memcpy(host_ether_addr, ifr.ifr_hwaddr.sa_data, 6);
+	{
+		// The benchmark doesn't answer ARP requests
+		struct arpreq arp;
+		memset(&arp, 0, sizeof(arp));
+		struct sockaddr_in *sin = (struct sockaddr_in *)&arp.arp_pa;
+		sin->sin_family = AF_INET;
+		inet_aton(MAC_ADDR, &sin->sin_addr);
+		arp.arp_ha.sa_family = ARPHRD_ETHER;
+		memcpy(arp.arp_ha.sa_data, ether_addr, 6);
+		arp.arp_flags = ATF_COM | ATF_PERM;
+		strcpy(arp.arp_dev, if_name);
+		if (ioctl(s, SIOCSARP, &arp) < 0)
+			goto config_error;
+	}
+	close(s);
+
+	// Host end of the loopback
+	udp_fd = socket(AF_INET, SOCK_DGRAM, 0);
+	{
+		struct sockaddr_in sa;
+		memset(&sa, 0, sizeof(sa));
+		sa.sin_family = AF_INET;
+		inet_aton(HOST_ADDR, &sa.sin_addr);
+		socklen_t len = sizeof(sa);
+		int size = 4 << 20;
+		setsockopt(udp_fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+		struct timeval tv = {0, 100000};
+		setsockopt(udp_fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+		if (bind(udp_fd, (struct sockaddr *)&sa, sizeof(sa)) < 0 || getsockname(udp_fd, (struct sockaddr *)&sa, &len) < 0) {
+			snprintf(msg, sizeof(msg), "can't bind UDP socket: %s", strerror(errno));
+			return msg;
+		}
+		host_port = ntohs(sa.sin_port);
+	}
+	printf("Using %s, host %s, Mac %s\n", if_name, HOST_ADDR, MAC_ADDR);
+	return NULL;
+
+config_error:
+	snprintf(msg, sizeof(msg), "can't configure %s: %s", if_name, strerror(errno));
+	close(s);
+	return msg;
+}
+
+static uint16 ip_checksum(const uint8 *p, int len)
+{
+	uint32 sum = 0;
+	for (int i = 0; i < len; i += 2)
+		sum += (p[i] << 8) | p[i + 1];
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+	return ~sum;
+}
+
+// Build Ethernet frame with UDP datagram from the Mac to the host in MacOS RAM,
+// and a WDS for it, returns frame length
+static int build_frame(int payload)
+{
+	uint8 *f = Mac2HostAddr(FRAME_ADDR);
+	const int ip_len = 20 + 8 + payload;
+	memcpy(f, host_ether_addr, 6);
+	memcpy(f + 6, ether_addr, 6);
+	f[12] = 0x08; f[13] = 0x00;
+
+	uint8 *ip = f + 14;
+	memset(ip, 0, 20);
+	ip[0] = 0x45;
+	ip[2] = ip_len >> 8; ip[3] = ip_len;
+	ip[6] = 0x40;						// Don't fragment
+	ip[8] = 64;
+	ip[9] = IPPROTO_UDP;
+	inet_pton(AF_INET, MAC_ADDR, ip + 12);
+	inet_pton(AF_INET, HOST_ADDR, ip + 16);
+	uint16 sum = ip_checksum(ip, 20);
+	ip[10] = sum >> 8; ip[11] = sum;
+
+	uint8 *udp = ip + 20;
+	udp[0] = MAC_PORT >> 8; udp[1] = MAC_PORT & 0xff;
+	udp[2] = host_port >> 8; udp[3] = host_port;
+	udp[4] = (8 + payload) >> 8; udp[5] = 8 + payload;
+	udp[6] = udp[7] = 0;				// No checksum
+	memset(udp + 8, 0x5a, payload);
+
+	// Header and data in separate WDS entries, as protocols pass them
+	WriteMacInt16(WDS_ADDR, 14);
+	WriteMacInt32(WDS_ADDR + 2, FRAME_ADDR);
+	WriteMacInt16(WDS_ADDR + 6, ip_len);
+	WriteMacInt32(WDS_ADDR + 8, FRAME_ADDR + 14);
+	WriteMacInt16(WDS_ADDR + 12, 0);
+	return 14 + ip_len;
+}
+
+static void report(const char *name, int frame_len, double frames, double secs, const char *extra)
+{
+	printf("%-14s %4d byte frames %9.0f frames/s %8.1f Mbit/s%s\n",
+		   name, frame_len, frames / secs, frames * frame_len * 8 / secs * 1e-6, extra);
+}
+
+// Mac -> host: queue frames with ether_write(), count datagrams arriving at the socket
+static void *host_receiver(void *arg)
+{
+	double *received = (double *)arg;
+	uint8 buf[FRAME_MAX];
+	while (!stop) {
+		if (recv(udp_fd, buf, sizeof(buf), 0) > 0)
+			(*received)++;
+	}
+	return NULL;
+}
+
+static void bench_transmit(int payload)
+{
+	int len = build_frame(payload);
+	double received = 0, queued = 0, full = 0;
+	stop = false;
+	pthread_t thread;
+	pthread_create(&thread, NULL, host_receiver, &received);
+
+	double t = now(), secs;
+	while ((secs = now() - t) < BENCH_SECONDS) {
+		for (int i = 0; i < 64; i++) {
+			if (ether_write(WDS_ADDR) == noErr)
+				queued++;
+			else {
+				full++;			// Dropped, give the transmission thread a chance
+				sched_yield();
+			}
+		}
+	}
+	usleep(100000);		// Let the last datagrams arrive
+	stop = true;
+	pthread_join(thread, NULL);
+
+	char extra[64];
+	snprintf(extra, sizeof(extra), "  (%.0f queued, %.0f ring full, %.0f delivered)", queued, full, received);
+	report("Mac -> host", len, received, secs, extra);
+}
+
+// Host -> Mac: send datagrams through the socket, handle Ethernet interrupts like the emulation thread
+static void *host_sender(void *arg)
+{
+	int payload = *(int *)arg;
+	uint8 buf[FRAME_MAX];
+	memset(buf, 0xa5, payload);
+	struct sockaddr_in sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	inet_aton(MAC_ADDR, &sa.sin_addr);
+	sa.sin_port = htons(MAC_PORT);
+	while (!stop)
+		sendto(udp_fd, buf, payload, 0, (struct sockaddr *)&sa, sizeof(sa));
+	return NULL;
+}
+
+static void bench_receive(int payload)
+{
+	double interrupts = 0;
+	frames_received = 0;
+	stop = false;
+	pthread_t thread;
+	pthread_create(&thread, NULL, host_sender, &payload);
+
+	double t = now(), secs;
+	while ((secs = now() - t) < BENCH_SECONDS) {
+		struct timespec ts;
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_nsec += 100000000;
+		if (ts.tv_nsec >= 1000000000) {
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000;
+		}
+		pthread_mutex_lock(&irq_lock);
+		if (!(InterruptFlags & INTFLAG_ETHER))
+			pthread_cond_timedwait(&irq_cond, &irq_lock, &ts);
+		pthread_mutex_unlock(&irq_lock);
+		if (InterruptFlags & INTFLAG_ETHER) {
+			ClearInterruptFlag(INTFLAG_ETHER);
+			EtherInterrupt();
+			interrupts++;
+		}
+	}
+	stop = true;
+	pthread_join(thread, NULL);
+
+	char extra[64];
+	snprintf(extra, sizeof(extra), "  (%.1f frames per interrupt)", interrupts ? frames_received / interrupts : 0);
+	report("host -> Mac", 14 + 20 + 8 + payload, frames_received, secs, extra);
+}
+
+int main(int argc, char **argv)
+{
+	// Called by ether_init() as "etherconfig" script?
+	if (argc == 3)
+		return config_script(argv[1], argv[2]);
+
+	ssize_t len = readlink("/proc/self/exe", script_path, sizeof(script_path) - 1);
+	if (len < 0) {
+		printf("TAP loopback benchmark skipped: can't find own executable\n");
+		return SKIP_EXIT_CODE;
+	}
+	script_path[len] = 0;
+
+	MEMBaseDiff = (uintptr)mac_ram;
+	ether_reset();
+	if (!ether_init()) {
+		printf("TAP loopback benchmark skipped: %s\n", last_warning[0] ? last_warning : "can't open TAP device");
+		return SKIP_EXIT_CODE;
+	}
+	ether_attach_ph(0x0800, HANDLER_ADDR);
+	const char *error = open_host();
+	if (error) {
+		printf("TAP loopback benchmark skipped: %s\n", error);
+		ether_exit();
+		return SKIP_EXIT_CODE;
+	}
+
+	static const int payloads[] = {18, FRAME_MAX - 14 - 20 - 8};	// Minimum and maximum frame size
+	for (int i = 0; i < 2; i++) {
+		bench_transmit(payloads[i]);
+		bench_receive(payloads[i]);
+	}
+	ether_exit();
+	return 0;
+}
+
+#else
+
+int main(void)
+{
+	printf("TAP loopback benchmark skipped: needs Linux TUN/TAP driver\n");
+	return SKIP_EXIT_CODE;
+}
+
+#endif
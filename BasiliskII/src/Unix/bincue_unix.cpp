@@ -40,6 +40,14 @@
 #include <unistd.h>
 #include <sys/stat.h>
 #include <errno.h>
+#include <limits.h>
+
+#ifdef HAVE_PREADV
+#include <sys/uio.h>
+#endif
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
 
 #ifdef OSX_CORE_AUDIO
 #include "../MacOSX/MacOSX_sound_if.h"
@@ -98,6 +106,8 @@ typedef struct {
 	char *binfile;			// Binary file name
 	unsigned int length;	// file length in frames
 	int binfh;				// binary file handle
+	unsigned char *binmap;	// bin file mapped into memory (or NULL)
+	size_t binmap_size;		// size of the mapping
 	int tcnt;				// number of tracks
 	Track tracks[MAXTRACK];
 } CueSheet;
@@ -405,10 +415,27 @@ static bool LoadCueSheet(const char *cuefile, CueSheet *cs)
 		cs->length = buf.st_size/RAW_SECTOR_SIZE;
 		cs->binfh = binfh;
 
+#ifdef HAVE_MMAP
+		// map bin file so that data reads become plain memory copies
+		// (the audio player keeps reading from a dup() of binfh)
+
+		if (sizeof(void *) >= 8 && buf.st_size > 0) {
+			void *map = mmap(NULL, buf.st_size, PROT_READ, MAP_SHARED, binfh, 0);
+			if (map != MAP_FAILED) {
+				cs->binmap = (unsigned char *) map;
+				cs->binmap_size = buf.st_size;
+			}
+		}
+#endif
+
 		fclose(fh);
 		return true;
 
 	  fail:
+#ifdef HAVE_MMAP
+		if (cs->binmap)
+			munmap(cs->binmap, cs->binmap_size);
+#endif
 		if (binfh >= 0)
 			close(binfh);	
 		fclose(fh);
@@ -452,8 +479,24 @@ void *open_bincue(const char *name)
 
 void close_bincue(void *fh)
 {
+	CueSheet *cs = (CueSheet *) fh;
 
+	if (cs == NULL)
+		return;
 
+	if (cs == player.cs) {
+		player.audiostatus = CDROM_AUDIO_NO_STATUS;	// stop the audio callback
+		close(player.audiofh);
+		player.audiofh = -1;
+		player.cs = NULL;
+	}
+#ifdef HAVE_MMAP
+	if (cs->binmap)
+		munmap(cs->binmap, cs->binmap_size);
+#endif
+	close(cs->binfh);
+	free(cs->binfile);
+	free(cs);
 }
 
 /*
@@ -467,10 +510,25 @@ void close_bincue(void *fh)
  * sector.  We compute the byte address of that sector (sec)
  * and the offset of the first byte we want within that sector (secoff)
  *
- * Reading is performed one raw sector at a time, extracting as many
- * valid bytes as possible from that raw sector (available)
+ * If the bin file could be mapped into memory, the cooked bytes of each
+ * raw sector are simply copied out of the mapping.  Otherwise reading
+ * is performed with positional I/O so that the audio player
+ * (which works on a dup() of the same descriptor and therefore shares
+ * its file offset) cannot interfere.  Where preadv() is available, the
+ * cooked bytes of a whole run of raw sectors are scattered straight into
+ * the target buffer with a single system call, the sector headers and
+ * trailers going to a scratch buffer.  Otherwise we fall back to reading
+ * one raw sector at a time, extracting as many valid bytes as possible
+ * from that raw sector (available)
  */
 
+#ifdef HAVE_PREADV
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+#define SECTORS_PER_PREADV	(IOV_MAX / 3)	// header, data, trailer
+#endif
+
 size_t read_bincue(void *fh, void *b, loff_t offset, size_t len)
 {
 	size_t bytes_read = 0;						// bytes read so far
@@ -487,9 +545,71 @@ size_t read_bincue(void *fh, void *b, loff_t offset, size_t len)
 
 	CueSheet *cs = (CueSheet *) fh;
 
-	if (cs == NULL || lseek(cs->binfh, sec, SEEK_SET) < 0) {
+	if (cs == NULL || sec < 0) {
 		return -1;
 	}
+
+	if (cs->binmap) {
+		while (len) {
+			size_t available = COOKED_SECTOR_SIZE - secoff;
+			available = (available > len) ? len : available;
+
+			// copy cooked bytes straight out of the mapped raw sector
+
+			if (sec + RAW_SECTOR_SIZE > (off_t) cs->binmap_size) {
+				return bytes_read;
+			}
+			memcpy(&buf[bytes_read], &cs->binmap[sec + 16 + secoff], available);
+
+			sec += RAW_SECTOR_SIZE;
+			secoff = 0;
+			bytes_read += available;
+			len -= available;
+		}
+		return bytes_read;
+	}
+
+#ifdef HAVE_PREADV
+	struct iovec iov[SECTORS_PER_PREADV * 3];
+	size_t cooked[SECTORS_PER_PREADV];
+	while (len) {
+
+		// build header/data/trailer triplets for as many sectors
+		// as fit into one preadv() call
+
+		int nsec = 0, niov = 0;
+		size_t want = 0;
+		while (len && nsec < SECTORS_PER_PREADV) {
+			size_t available = COOKED_SECTOR_SIZE - secoff;
+			available = (available > len) ? len : available;
+
+			iov[niov].iov_base = secbuf;
+			iov[niov++].iov_len = 16 + secoff;
+			iov[niov].iov_base = &buf[bytes_read + want];
+			iov[niov++].iov_len = available;
+			iov[niov].iov_base = secbuf;
+			iov[niov++].iov_len = RAW_SECTOR_SIZE - 16 - secoff - available;
+
+			cooked[nsec++] = available;
+			want += available;
+			len -= available;
+			secoff = 0;
+		}
+
+		// only complete raw sectors count, as in the one sector case
+
+		ssize_t actual = preadv(cs->binfh, iov, niov, sec);
+		if (actual < 0)
+			return bytes_read;
+		int complete = actual / RAW_SECTOR_SIZE;
+		for (int i = 0; i < complete; i++)
+			bytes_read += cooked[i];
+		if (complete < nsec)
+			return bytes_read;
+
+		sec += nsec * RAW_SECTOR_SIZE;
+	}
+#else
 	while (len) {
 
 		// bytes available in next raw sector or len (bytes)
@@ -500,7 +620,7 @@ size_t read_bincue(void *fh, void *b, loff_t offset, size_t len)
 
 		// read the next raw sector
 
-		if (read(cs->binfh, secbuf, RAW_SECTOR_SIZE) != RAW_SECTOR_SIZE) {
+		if (pread(cs->binfh, secbuf, RAW_SECTOR_SIZE, sec) != RAW_SECTOR_SIZE) {
 			return bytes_read;
 		}
 
@@ -511,6 +631,7 @@ size_t read_bincue(void *fh, void *b, loff_t offset, size_t len)
 
 		// next sector we start at the beginning
 
+		sec += RAW_SECTOR_SIZE;
 		secoff = 0;
 
 		// increment running count decrement request
@@ -518,6 +639,7 @@ size_t read_bincue(void *fh, void *b, loff_t offset, size_t len)
 		bytes_read += available;
 		len -= available;
 	}
+#endif
 	return bytes_read;
 }
 
@@ -771,17 +893,13 @@ static uint8 *fill_buffer(int stream_len)
 		if (available > (stream_len - offset))
 			available = stream_len - offset;
 
-		if (lseek(player.audiofh,
-				  player.fileoffset + player.audioposition - player.silence,
-					  SEEK_SET) < 0)
-			return NULL;
-
 		if (available < 0) {
 			player.audioposition += available; // correct end !;
 			available = 0;
 		}
 
-		if ((ret = read(player.audiofh, &buf[offset], available)) >= 0) {
+		if ((ret = pread(player.audiofh, &buf[offset], available,
+						 player.fileoffset + player.audioposition - player.silence)) >= 0) {
 			player.audioposition += ret;
 			offset += ret;
 			available -= ret;
@@ -799,13 +917,13 @@ static uint8 *fill_buffer(int stream_len)
 
 
 #ifdef USE_SDL_AUDIO
-void MixAudio_bincue(uint8 *stream, int stream_len)
+// Return next stream_len bytes of CD audio (44.1kHz, 16-bit big-endian stereo),
+// or NULL if nothing is playing. The caller mixes it into its output.
+uint8 *GetAudio_bincue(int stream_len)
 {
-	if (audio_enabled && (player.audiostatus == CDROM_AUDIO_PLAY)) {
-		uint8 *buf = fill_buffer(stream_len);
-		if (buf)
-			SDL_MixAudio(stream, buf, stream_len, SDL_MIX_MAXVOLUME);
-	}
+	if (audio_enabled && (player.audiostatus == CDROM_AUDIO_PLAY))
+		return fill_buffer(stream_len);
+	return NULL;
 }
 
 void OpenAudio_bincue(int freq, int format, int channels, uint8 silence)
@@ -0,0 +1,487 @@
+/*
+ *  disk_cow.cpp - Copy-on-write overlays for shared disk images
+ *
+ *  Basilisk II (C) Christian Bauer
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ *  An overlay file records all writes to a base image, which is only
+ *  ever opened read-only and can thus be shared by any number of
+ *  emulator instances. The overlay is a sparse file:
+ *
+ *    0                    header (magic, block size, disk size, base path)
+ *    HEADER_SIZE          allocation bitmap, one bit per block
+ *    data_offset          block data, block n at data_offset + n * block_size
+ *
+ *  Blocks that were never written are holes in the overlay and are read
+ *  from the base image. Deleting the overlay reverts the disk to the
+ *  state of the base image. Bitmap bits of new blocks are set in memory
+ *  right away and written out by a helper thread at most COW_FLUSH_DELAY
+ *  seconds later, after syncing the data they refer to. So after a crash
+ *  a block is either still read from the base or has its data, and one
+ *  sync covers all blocks allocated in that time.
+ *
+ *  Overlays created for images in "diskoverlaydir" are named after the
+ *  image file and a hash of its full path, so images with the same name
+ *  in different directories get different overlays.
+ */
+
+#include "sysdeps.h"
+#include "disk_unix.h"
+#include "macos_util.h"
+#include "prefs.h"
+
+#include <sys/stat.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <libgen.h>
+#include <time.h>
+#include <algorithm>
+#include <vector>
+
+#ifdef HAVE_PTHREADS
+#include <pthread.h>
+#endif
+
+#define DEBUG 0
+#include "debug.h"
+
+static const char COW_MAGIC[8] = {'B', '2', 'C', 'O', 'W', 'O', 'V', 'L'};
+const uint32 COW_VERSION = 1;
+const uint32 COW_BLOCK_SIZE = 4096;
+const int HEADER_SIZE = 4096;
+const int HEADER_PATH_OFFSET = 64;
+
+// Bitmap changes are written out at most this many seconds late
+const time_t COW_FLUSH_DELAY = 1;
+
+static inline uint32 get_be32(const uint8 *p)
+{
+	return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static inline void put_be32(uint8 *p, uint32 v)
+{
+	p[0] = v >> 24; p[1] = v >> 16; p[2] = v >> 8; p[3] = v;
+}
+
+struct disk_cow : disk_generic {
+	disk_cow(int base_fd, loff_t base_start, int fd, bool read_only,
+		uint32 block_size, loff_t total_size, uint8 *bitmap)
+	: base_fd(base_fd), base_start(base_start), fd(fd), read_only(read_only),
+		block_size(block_size), total_size(total_size), bitmap(bitmap),
+		dirty_lo(-1), dirty_hi(-1), dirty_since(0), flush_thread_active(false) {
+		nblocks = (total_size + block_size - 1) / block_size;
+		data_offset = data_start(nblocks, block_size);
+		block_buf = new uint8[block_size];
+#ifdef HAVE_PTHREADS
+		pthread_mutex_init(&lock, NULL);
+		pthread_cond_init(&dirty_cond, NULL);
+		flush_quit = false;
+		if (!read_only) {
+			pthread_attr_t attr;
+			Set_pthread_attr(&attr, 0);
+			flush_thread_active = (pthread_create(&flush_thread, &attr, flush_func, this) == 0);
+			pthread_attr_destroy(&attr);
+			if (!flush_thread_active)
+				fprintf(stderr, "overlay: can't start flush thread, bitmap is written from the disk thread\n");
+		}
+#endif
+	}
+
+	virtual ~disk_cow() {
+#ifdef HAVE_PTHREADS
+		if (flush_thread_active) {
+			pthread_mutex_lock(&lock);
+			flush_quit = true;
+			pthread_cond_signal(&dirty_cond);
+			pthread_mutex_unlock(&lock);
+			pthread_join(flush_thread, NULL);
+		}
+#endif
+		flush();
+#ifdef HAVE_PTHREADS
+		pthread_cond_destroy(&dirty_cond);
+		pthread_mutex_destroy(&lock);
+#endif
+		if (!read_only)
+			fsync(fd);
+		close(fd);
+		close(base_fd);
+		delete[] bitmap;
+		delete[] block_buf;
+	}
+
+	virtual bool is_read_only() { return read_only; }
+	virtual loff_t size() { return total_size; }
+
+	// Offset of the first data block
+	static loff_t data_start(loff_t nblocks, uint32 block_size) {
+		loff_t end = HEADER_SIZE + (nblocks + 7) / 8;
+		return (end + block_size - 1) / block_size * block_size;
+	}
+
+	virtual size_t read(void *buf, loff_t offset, size_t length) {
+		if (offset < 0 || offset >= total_size)
+			return 0;
+		length = std::min((loff_t)length, total_size - offset);
+
+		// Read runs of blocks that live in the same file with one call each
+		uint8 *b = (uint8 *)buf;
+		size_t done = 0;
+		while (done < length) {
+			loff_t pos = offset + done;
+			loff_t block = pos / block_size;
+			bool in_overlay = is_allocated(block);
+			loff_t end = offset + length;
+			loff_t next = block + 1;
+			while (next * block_size < end && is_allocated(next) == in_overlay)
+				++next;
+			size_t run = std::min(next * block_size, end) - pos;
+
+			ssize_t actual = in_overlay
+				? pread(fd, b + done, run, data_offset + pos)
+				: pread(base_fd, b + done, run, base_start + pos);
+			if (actual <= 0)
+				break;
+			done += actual;
+			if ((size_t)actual < run)
+				break;
+		}
+		return done;
+	}
+
+	virtual size_t write(void *buf, loff_t offset, size_t length) {
+		if (read_only || offset < 0 || offset >= total_size)
+			return 0;
+		length = std::min((loff_t)length, total_size - offset);
+
+		const uint8 *b = (const uint8 *)buf;
+		size_t done = 0;
+		while (done < length) {
+			loff_t pos = offset + done;
+			loff_t block = pos / block_size;
+			size_t start = pos % block_size;
+			size_t run = std::min((size_t)block_size - start, length - done);
+
+			// Copy partially overwritten blocks up from the base first
+			if (!is_allocated(block) && run < block_size) {
+				memset(block_buf, 0, block_size);
+				if (pread(base_fd, block_buf, block_size, base_start + block * block_size) < 0)
+					break;
+				memcpy(block_buf + start, b + done, run);
+				if (pwrite(fd, block_buf, block_size, data_offset + block * block_size) != (ssize_t)block_size)
+					break;
+			} else if (pwrite(fd, b + done, run, data_offset + pos) != (ssize_t)run)
+				break;
+
+			if (!is_allocated(block))
+				set_allocated(block);
+			done += run;
+		}
+
+		// Without the helper thread, the bitmap is written out from here
+		if (!flush_thread_active && dirty_since && time(NULL) - dirty_since >= COW_FLUSH_DELAY)
+			flush();
+		return done;
+	}
+
+protected:
+	int base_fd;			// shared base image, always read-only
+	loff_t base_start;		// size of base image file header (if any)
+	int fd;					// overlay file
+	bool read_only;
+	uint32 block_size;
+	loff_t total_size;
+	loff_t nblocks;
+	loff_t data_offset;		// offset of block 0 in overlay file
+	uint8 *bitmap;			// allocation bitmap, mirrors the one on disk
+	uint8 *block_buf;		// scratch buffer for copy-up
+	loff_t dirty_lo, dirty_hi;	// range of bitmap bytes to write out
+	time_t dirty_since;		// when the bitmap was first changed, or 0
+	bool flush_thread_active;	// bitmap is written out by flush_func()
+
+#ifdef HAVE_PTHREADS
+	pthread_mutex_t lock;		// protects the bitmap and its dirty range
+	pthread_cond_t dirty_cond;	// signalled when the bitmap becomes dirty
+	pthread_t flush_thread;
+	bool flush_quit;
+
+	// Write out bitmap changes COW_FLUSH_DELAY seconds after the first one
+	static void *flush_func(void *arg) {
+		disk_cow *cow = (disk_cow *)arg;
+		pthread_mutex_lock(&cow->lock);
+		while (!cow->flush_quit) {
+			if (!cow->dirty_since) {
+				pthread_cond_wait(&cow->dirty_cond, &cow->lock);
+				continue;
+			}
+			struct timespec deadline;
+			deadline.tv_sec = cow->dirty_since + COW_FLUSH_DELAY;
+			deadline.tv_nsec = 0;
+			if (pthread_cond_timedwait(&cow->dirty_cond, &cow->lock, &deadline) == ETIMEDOUT) {
+				loff_t from;
+				std::vector<uint8> changes;
+				cow->take_changes(from, changes);
+				pthread_mutex_unlock(&cow->lock);
+				cow->write_bitmap(from, changes);
+				pthread_mutex_lock(&cow->lock);
+			}
+		}
+		pthread_mutex_unlock(&cow->lock);
+		return NULL;
+	}
+
+	void lock_bitmap() { pthread_mutex_lock(&lock); }
+	void unlock_bitmap() { pthread_mutex_unlock(&lock); }
+#else
+	void lock_bitmap() { }
+	void unlock_bitmap() { }
+#endif
+
+	bool is_allocated(loff_t block) {
+		return block < nblocks && (bitmap[block / 8] & (1 << (block % 8)));
+	}
+
+	// Mark a block whose data has been written as allocated
+	void set_allocated(loff_t block) {
+		lock_bitmap();
+		bitmap[block / 8] |= 1 << (block % 8);
+		if (dirty_lo < 0 || block / 8 < dirty_lo)
+			dirty_lo = block / 8;
+		if (block / 8 > dirty_hi)
+			dirty_hi = block / 8;
+		if (!dirty_since) {
+			dirty_since = time(NULL);
+#ifdef HAVE_PTHREADS
+			pthread_cond_signal(&dirty_cond);
+#endif
+		}
+		unlock_bitmap();
+	}
+
+	// Take a copy of the changed bitmap bytes and mark them written, lock held
+	void take_changes(loff_t &from, std::vector<uint8> &changes) {
+		changes.clear();
+		if (dirty_lo >= 0) {
+			from = dirty_lo;
+			changes.assign(bitmap + dirty_lo, bitmap + dirty_hi + 1);
+			dirty_lo = dirty_hi = -1;
+		}
+		dirty_since = 0;
+	}
+
+	// Write out bitmap bytes, after the data they make visible is on disk
+	void write_bitmap(loff_t from, const std::vector<uint8> &changes) {
+		if (changes.empty())
+			return;
+		if (fdatasync(fd) < 0
+				|| pwrite(fd, &changes[0], changes.size(), HEADER_SIZE + from) != (ssize_t)changes.size())
+			fprintf(stderr, "overlay: can't write allocation bitmap (%s)\n", strerror(errno));
+	}
+
+	void flush() {
+		loff_t from;
+		std::vector<uint8> changes;
+		lock_bitmap();
+		take_changes(from, changes);
+		unlock_bitmap();
+		write_bitmap(from, changes);
+	}
+};
+
+
+/*
+ *  Open base image read-only and get its layout
+ */
+
+static int open_base(const char *path, loff_t *start_byte, loff_t *real_size)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	struct stat st;
+	uint8 data[256];
+	memset(data, 0, sizeof(data));
+	if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || pread(fd, data, sizeof(data), 0) < 0) {
+		close(fd);
+		return -1;
+	}
+	FileDiskLayout(st.st_size, data, *start_byte, *real_size);
+	return fd;
+}
+
+
+/*
+ *  Naming of overlays in "diskoverlaydir"
+ */
+
+// FNV-1a hash of the full path of the base image
+static uint64 path_hash(const char *path)
+{
+	uint64 h = 0xcbf29ce484222325ULL;
+	while (*path) {
+		h ^= (uint8)*path++;
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+
+
+/*
+ *  Create a new, empty overlay for the given base image
+ */
+
+static bool create_overlay(const char *path, const char *base_path, loff_t size)
+{
+	uint8 header[HEADER_SIZE];
+	memset(header, 0, sizeof(header));
+	if (strlen(base_path) >= HEADER_SIZE - HEADER_PATH_OFFSET)
+		return false;
+	memcpy(header, COW_MAGIC, sizeof(COW_MAGIC));
+	put_be32(header + 8, COW_VERSION);
+	put_be32(header + 12, COW_BLOCK_SIZE);
+	put_be32(header + 16, (uint64)size >> 32);
+	put_be32(header + 20, (uint32)size);
+	strcpy((char *)header + HEADER_PATH_OFFSET, base_path);
+
+	int fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0644);
+	if (fd < 0)
+		return false;
+	loff_t nblocks = (size + COW_BLOCK_SIZE - 1) / COW_BLOCK_SIZE;
+	bool ok = pwrite(fd, header, HEADER_SIZE, 0) == HEADER_SIZE
+		&& ftruncate(fd, disk_cow::data_start(nblocks, COW_BLOCK_SIZE)) == 0
+		&& fsync(fd) == 0;
+	close(fd);
+	if (!ok)
+		unlink(path);
+	return ok;
+}
+
+
+/*
+ *  Open an overlay file. If expected_base is given, the overlay must
+ *  belong to that base image.
+ */
+
+static disk_generic::status open_overlay(const char *path, bool read_only,
+	const char *expected_base, disk_generic **disk)
+{
+	int fd = open(path, read_only ? O_RDONLY : O_RDWR);
+	if (fd < 0 && !read_only && errno == EACCES) {
+		read_only = true;
+		fd = open(path, O_RDONLY);
+	}
+	if (fd < 0)
+		return disk_generic::DISK_UNKNOWN;
+
+	uint8 header[HEADER_SIZE];
+	if (pread(fd, header, HEADER_SIZE, 0) != HEADER_SIZE
+			|| memcmp(header, COW_MAGIC, sizeof(COW_MAGIC)) != 0) {
+		close(fd);
+		return disk_generic::DISK_UNKNOWN;
+	}
+	header[HEADER_SIZE - 1] = 0;
+	const char *base_path = (const char *)header + HEADER_PATH_OFFSET;
+	uint32 block_size = get_be32(header + 12);
+	loff_t size = ((loff_t)get_be32(header + 16) << 32) | get_be32(header + 20);
+	if (get_be32(header + 8) != COW_VERSION || block_size == 0 || size <= 0) {
+		fprintf(stderr, "overlay: %s has an unsupported format\n", path);
+		close(fd);
+		return disk_generic::DISK_INVALID;
+	}
+	if (expected_base && strcmp(base_path, expected_base) != 0) {
+		fprintf(stderr, "overlay: %s belongs to %s, not %s\n", path, base_path, expected_base);
+		close(fd);
+		return disk_generic::DISK_INVALID;
+	}
+
+	loff_t base_start, base_size;
+	int base_fd = open_base(base_path, &base_start, &base_size);
+	if (base_fd < 0) {
+		fprintf(stderr, "overlay: can't open base image %s\n", base_path);
+		close(fd);
+		return disk_generic::DISK_INVALID;
+	}
+	if (base_size != size) {
+		fprintf(stderr, "overlay: base image %s changed size\n", base_path);
+		close(base_fd);
+		close(fd);
+		return disk_generic::DISK_INVALID;
+	}
+
+	loff_t nblocks = (size + block_size - 1) / block_size;
+	size_t bitmap_size = (nblocks + 7) / 8;
+	uint8 *bitmap = new uint8[bitmap_size];
+	memset(bitmap, 0, bitmap_size);
+	if (pread(fd, bitmap, bitmap_size, HEADER_SIZE) < 0) {
+		delete[] bitmap;
+		close(base_fd);
+		close(fd);
+		return disk_generic::DISK_INVALID;
+	}
+
+	D(bug("overlay: %s on %s, %lld blocks\n", path, base_path, (long long)nblocks));
+	*disk = new disk_cow(base_fd, base_start, fd, read_only, block_size, size, bitmap);
+	return disk_generic::DISK_VALID;
+}
+
+
+disk_generic::status disk_cow_factory(const char *path,
+		bool read_only, disk_generic **disk) {
+	// Only plain files can be overlays or base images
+	struct stat s;
+	if (stat(path, &s) < 0 || !S_ISREG(s.st_mode))
+		return disk_generic::DISK_UNKNOWN;
+
+	// Is it an overlay file?
+	disk_generic::status st = open_overlay(path, read_only, NULL, disk);
+	if (st != disk_generic::DISK_UNKNOWN)
+		return st;
+
+	// No, is it an image that should get an overlay?
+	const char *dir = PrefsFindString("diskoverlaydir");
+	if (dir == NULL || *dir == 0)
+		return disk_generic::DISK_UNKNOWN;
+
+	char base_path[PATH_MAX + 1];
+	if (realpath(path, base_path) == NULL)
+		return disk_generic::DISK_UNKNOWN;
+	char name[PATH_MAX + 1];
+	strcpy(name, base_path);
+	char overlay[PATH_MAX + 1];
+	if (snprintf(overlay, PATH_MAX, "%s/%s-%016llx.overlay", dir, basename(name), (unsigned long long)path_hash(base_path)) >= PATH_MAX)
+		return disk_generic::DISK_INVALID;
+
+	if (access(overlay, F_OK) != 0) {
+		if (read_only)	// nothing will be written, use the base directly
+			return disk_generic::DISK_UNKNOWN;
+		loff_t base_start, base_size;
+		int base_fd = open_base(base_path, &base_start, &base_size);
+		if (base_fd < 0)
+			return disk_generic::DISK_UNKNOWN;
+		close(base_fd);
+		if (!create_overlay(overlay, base_path, base_size)) {
+			fprintf(stderr, "overlay: can't create %s (%s)\n", overlay, strerror(errno));
+			return disk_generic::DISK_INVALID;
+		}
+		printf("Created overlay %s for %s\n", overlay, base_path);
+	}
+	st = open_overlay(overlay, read_only, base_path, disk);
+	return st == disk_generic::DISK_UNKNOWN ? disk_generic::DISK_INVALID : st;
+}
@@ -0,0 +1,152 @@
+/*
+ *  disk_mmap.cpp - Memory-mapped read-only disk images
+ *
+ *  Basilisk II (C) Christian Bauer
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "sysdeps.h"
+#include "disk_unix.h"
+#include "macos_util.h"
+
+#include <sys/stat.h>
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
+#include <errno.h>
+#include <algorithm>
+
+#define DEBUG 0
+#include "debug.h"
+
+#ifdef HAVE_MMAP
+
+// Largest image we are willing to map on hosts with a 32-bit address space
+const loff_t MAX_MAP_SIZE_32 = 512 * 1024 * 1024;
+
+// How far ahead of a sequential reader we ask the kernel to prefetch
+const size_t READAHEAD_SIZE = 1024 * 1024;
+
+/*
+ *  Read-only images are mapped in their entirety, so a read is a single
+ *  memcpy() out of the page cache instead of a read() system call. The
+ *  access pattern is tracked to tell the kernel whether to read ahead.
+ */
+
+struct disk_mmap : disk_generic {
+	disk_mmap(int fd, uint8 *map, size_t map_size, loff_t start_byte, loff_t real_size)
+	: fd(fd), map(map), map_size(map_size), start_byte(start_byte),
+		real_size(real_size), next_offset(-1), sequential(false) {
+		page_mask = getpagesize() - 1;
+	}
+
+	virtual ~disk_mmap() {
+		munmap(map, map_size);
+		close(fd);
+	}
+
+	virtual bool is_read_only() { return true; }
+	virtual loff_t size() { return real_size; }
+
+	virtual size_t read(void *buf, loff_t offset, size_t length) {
+		if (offset < 0 || offset >= real_size)
+			return 0;
+		if ((loff_t)length > real_size - offset)
+			length = real_size - offset;
+		advise(offset, length);
+		memcpy(buf, map + start_byte + offset, length);
+		return length;
+	}
+
+	virtual size_t write(void *buf, loff_t offset, size_t length) {
+		return 0;
+	}
+
+protected:
+	int fd;
+	uint8 *map;				// whole file, including header
+	size_t map_size;
+	loff_t start_byte;		// size of file header (if any)
+	loff_t real_size;		// size of disk data
+	uintptr page_mask;
+
+	loff_t next_offset;		// where a sequential read would continue
+	bool sequential;		// current madvise() policy
+
+	// Switch between sequential and normal paging policy as the guest's
+	// access pattern changes, and prefetch ahead of sequential readers
+	void advise(loff_t offset, size_t length) {
+		bool seq = (offset == next_offset);
+		next_offset = offset + length;
+		if (seq != sequential) {
+			sequential = seq;
+			D(bug("disk_mmap: switching to %s access\n", seq ? "sequential" : "normal"));
+			madvise(map, map_size, seq ? MADV_SEQUENTIAL : MADV_NORMAL);
+		}
+		if (seq) {
+			uintptr start = (start_byte + next_offset) & ~page_mask;
+			if (start < map_size) {
+				size_t len = std::min((size_t)READAHEAD_SIZE, map_size - (size_t)start);
+				madvise(map + start, len, MADV_WILLNEED);
+			}
+		}
+	}
+};
+
+disk_generic::status disk_mmap_factory(const char *path,
+		bool read_only, disk_generic **disk) {
+	// Only plain read-only files are mapped, everything else goes
+	// through the regular read()/write() path
+	if (!read_only && access(path, W_OK) == 0)
+		return disk_generic::DISK_UNKNOWN;
+
+	struct stat st;
+	if (stat(path, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size == 0)
+		return disk_generic::DISK_UNKNOWN;
+	if (sizeof(void *) < 8 && st.st_size > MAX_MAP_SIZE_32)
+		return disk_generic::DISK_UNKNOWN;
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return disk_generic::DISK_UNKNOWN;
+
+	void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		D(bug("disk_mmap: mmap(%s) failed: %s\n", path, strerror(errno)));
+		close(fd);
+		return disk_generic::DISK_UNKNOWN;
+	}
+
+	// Detect disk image file layout
+	loff_t start_byte, real_size;
+	uint8 data[256];
+	memset(data, 0, sizeof(data));
+	memcpy(data, map, std::min((size_t)st.st_size, sizeof(data)));
+	FileDiskLayout(st.st_size, data, start_byte, real_size);
+
+	D(bug("disk_mmap: mapped %s, %lld bytes\n", path, (long long)real_size));
+	*disk = new disk_mmap(fd, (uint8 *)map, st.st_size, start_byte, real_size);
+	return disk_generic::DISK_VALID;
+}
+
+#else
+
+disk_generic::status disk_mmap_factory(const char *path,
+		bool read_only, disk_generic **disk) {
+	return disk_generic::DISK_UNKNOWN;
+}
+
+#endif
@@ -21,6 +21,7 @@
 #include "disk_unix.h"
 #include "tinyxml2.h"
 
+#include <sys/stat.h>
 #include <errno.h>
 #include <limits.h>
 #include <algorithm>
@@ -29,17 +30,25 @@
 #define __MACOSX__ 1
 #endif
 
+// Number of band files kept open at once
+const int BAND_CACHE_SIZE = 16;
+
 struct disk_sparsebundle : disk_generic {
 	disk_sparsebundle(const char *bands, int fd, bool read_only,
 		loff_t band_size, loff_t total_size)
 	: token_fd(fd), read_only(read_only), band_size(band_size),
-		total_size(total_size), band_dir(strdup(bands)),
-		band_cur(-1), band_fd(-1), band_alloc(-1) {
+		total_size(total_size), band_dir(strdup(bands)), band_clock(0) {
+		for (int i = 0; i < BAND_CACHE_SIZE; ++i) {
+			band_cache[i].band = -1;
+			band_cache[i].fd = -1;
+		}
 	}
 	
 	virtual ~disk_sparsebundle() {
-		if (band_fd != -1)
-			close(band_fd);
+		for (int i = 0; i < BAND_CACHE_SIZE; ++i) {
+			if (band_cache[i].fd != -1)
+				close(band_cache[i].fd);
+		}
 		close(token_fd);
 		free(band_dir);
 	}
@@ -61,10 +70,15 @@ protected:
 	loff_t band_size, total_size;
 	char *band_dir;			// directory containing band files
 	
-	// Currently open band
-	loff_t band_cur;		// index of the band
-	int band_fd;			// -1 if not open
-	loff_t band_alloc;		// how much space is already used?
+	// Recently used bands, including ones known not to exist yet
+	struct band_entry {
+		loff_t band;		// index of the band, -1 if slot unused
+		int fd;				// -1 if the band file doesn't exist
+		loff_t alloc;		// how much space is already used?
+		uint32 last_use;	// band_clock value at last access
+	};
+	band_entry band_cache[BAND_CACHE_SIZE];
+	uint32 band_clock;
 	
 	typedef ssize_t (disk_sparsebundle::*band_func)(char *buf, loff_t band,
 		size_t offset, size_t len);
@@ -83,7 +97,7 @@ protected:
 			ssize_t err = (this->*func)(b, band, start, segment);
 			if (err > 0)
 				done += err;
-			if (err < segment)
+			if (err < (ssize_t)segment)
 				break;
 			
 			b += segment;
@@ -94,15 +108,40 @@ protected:
 		return done;
 	}
 		
+	// Look up a band in the cache, or evict the least recently used
+	// entry to make room for it.
+	band_entry *find_band(loff_t band) {
+		band_entry *victim = &band_cache[0];
+		for (int i = 0; i < BAND_CACHE_SIZE; ++i) {
+			band_entry *e = &band_cache[i];
+			if (e->band == band) {
+				e->last_use = ++band_clock;
+				return e;
+			}
+			if (e->band == -1 || (victim->band != -1
+					&& (int32)(e->last_use - victim->last_use) < 0))
+				victim = e;
+		}
+		if (victim->fd != -1)
+			close(victim->fd);
+		victim->band = -1;
+		victim->fd = -1;
+		victim->alloc = 0;
+		victim->last_use = ++band_clock;
+		return victim;
+	}
+	
 	// Open a band by index. It's ok if the band is already open.
 	enum open_ret {
 		OPEN_FAILED = 0,
 		OPEN_NOENT,		// Band doesn't exist yet
 		OPEN_OK,
 	};
-	open_ret open_band(loff_t band, bool create) {
-		if (band_cur == band)
-			return OPEN_OK;
+	open_ret open_band(loff_t band, bool create, band_entry **entry) {
+		band_entry *e = find_band(band);
+		*entry = e;
+		if (e->band == band && (e->fd != -1 || !create))
+			return e->fd != -1 ? OPEN_OK : OPEN_NOENT;
 		
 		char path[PATH_MAX + 1];
 		if (snprintf(path, PATH_MAX, "%s/%lx", band_dir,
@@ -110,42 +149,39 @@ protected:
 			return OPEN_FAILED;
 		}
 		
-		if (band_fd != -1)
-			close(band_fd);
-		band_alloc = -1;
-		band_cur = -1;
-		
 		int oflags = read_only ? O_RDONLY : O_RDWR;
 		if (create)
 			oflags |= O_CREAT;
-		band_fd = open(path, oflags, 0644);
-		if (band_fd == -1) {
-			return (!create && errno == ENOENT) ? OPEN_NOENT : OPEN_FAILED;
+		int fd = open(path, oflags, 0644);
+		if (fd == -1) {
+			if (!create && errno == ENOENT) {
+				e->band = band;	// remember that it's missing
+				return OPEN_NOENT;
+			}
+			e->band = -1;
+			return OPEN_FAILED;
 		}
 		
-		// Get the allocated size
-		if (!read_only) {
-			band_alloc = lseek(band_fd, 0, SEEK_END);
-			if (band_alloc == -1)
-				band_alloc = band_size;
-		}
-		band_cur = band;
+		// Get the allocated size, it's tracked from here on
+		struct stat st;
+		e->alloc = fstat(fd, &st) == 0 ? st.st_size : band_size;
+		e->band = band;
+		e->fd = fd;
 		return OPEN_OK;
 	}
 	
 	ssize_t band_read(char *buf, loff_t band, size_t off, size_t len) {
-		open_ret st = open_band(band, false);
+		band_entry *e;
+		open_ret st = open_band(band, false, &e);
 		if (st == OPEN_FAILED)
 			return -1;
 		
 		// Unallocated bytes 
-		size_t want = (st == OPEN_NOENT || off >= band_alloc) ? 0
-			: std::min(len, (size_t)band_alloc - off);
+		size_t want = (st == OPEN_NOENT || (loff_t)off >= e->alloc) ? 0
+			: std::min(len, (size_t)e->alloc - off);
 		if (want) {
-			if (lseek(band_fd, off, SEEK_SET) == -1)
-				return -1;
-			ssize_t err = ::read(band_fd, buf, want);
-			if (err < want)
+			ssize_t err = pread(e->fd, buf, want, off);
+			if (err < (ssize_t)want)
 				return err;
 		}
 		memset(buf + want, 0, len - want);
@@ -160,19 +196,17 @@ protected:
 		for (; nz > 0 && !buf[nz-1]; --nz)
 			; // pass
 		
-		open_ret st = open_band(band, nz);
+		band_entry *e;
+		open_ret st = open_band(band, nz, &e);
 		if (st != OPEN_OK)
 			return st == OPEN_NOENT ? len : -1;
-
-		if (lseek(band_fd, off, SEEK_SET) == -1)
-			return -1;
 		
-		size_t space = (off >= band_alloc ? 0 : band_alloc - off);
+		size_t space = ((loff_t)off >= e->alloc ? 0 : e->alloc - off);
 		size_t want = std::max(nz, std::min(space, len));
-		ssize_t err = ::write(band_fd, buf, want);
+		ssize_t err = pwrite(e->fd, buf, want, off);
 		if (err >= 0)
-			band_alloc = std::max(band_alloc, loff_t(off + err));
-		if (err < want)
+			e->alloc = std::max(e->alloc, loff_t(off + err));
+		if (err < (ssize_t)want)
 			return err;
 		return len;
 	}
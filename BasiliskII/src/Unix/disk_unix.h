@@ -44,5 +44,7 @@ typedef disk_generic::status (disk_factory)(const char *path, bool read_only,
 
 extern disk_factory disk_sparsebundle_factory;
 extern disk_factory disk_vhd_factory;
+extern disk_factory disk_cow_factory;
+extern disk_factory disk_mmap_factory;
 
 #endif
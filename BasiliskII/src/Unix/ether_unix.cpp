@@ -48,7 +48,7 @@
 #include <errno.h>
 #include <stdio.h>
 #include <signal.h>
-#include <map>
+#include <atomic>
 
 #if defined(__FreeBSD__) || defined(sgi) || (defined(__APPLE__) && defined(__MACH__))
 #include <net/if.h>
@@ -83,10 +83,6 @@ extern "C" {
 #include "ether.h"
 #include "ether_defs.h"
 
-#ifndef NO_STD_NAMESPACE
-using std::map;
-#endif
-
 #define DEBUG 0
 #include "debug.h"
 
@@ -113,7 +109,7 @@ static int fd = -1;							// fd of sheep_net device
 static pthread_t ether_thread;				// Packet reception thread
 static pthread_attr_t ether_thread_attr;	// Packet reception thread attributes
 static bool thread_active = false;			// Flag: Packet reception thread installed
-static sem_t int_ack;						// Interrupt acknowledge semaphore
+static sem_t int_ack;						// Signals free slots in the receive ring to the reception thread
 static bool udp_tunnel;						// Flag: UDP tunnelling active, fd is the socket descriptor
 static int net_if_type = -1;				// Ethernet device type
 static char *net_if_name = NULL;			// TUN/TAP device name
@@ -121,7 +117,10 @@ static const char *net_if_script = NULL;	// Network config script
 static pthread_t slirp_thread;				// Slirp reception thread
 static bool slirp_thread_active = false;	// Flag: Slirp reception threadinstalled
 static int slirp_output_fd = -1;			// fd of slirp output pipe
-static int slirp_input_fds[2] = { -1, -1 };	// fds of slirp input pipe
+static int tx_doorbell_fds[2] = { -1, -1 };	// fds of transmit ring doorbell pipe
+static pthread_t tx_thread;					// Packet transmission thread
+static bool tx_thread_active = false;		// Flag: Packet transmission thread installed
+static bool tx_ring_active = false;		// Flag: ether_do_write() queues packets in transmit ring
 #ifdef HAVE_LIBVDEPLUG
 static VDECONN *vde_conn;
 #endif
@@ -132,11 +131,88 @@ static uint8 ether_addr[6];					// Our Ethernet address
 const bool ether_driver_opened = true;		// Flag: is the MacOS driver opened?
 #endif
 
-// Attached network protocols, maps protocol type to MacOS handler address
-static map<uint16, uint32> net_protocols;
+// Attached network protocols (type 0 is the 802.3 handler)
+const int MAX_PROTOCOLS = 16;
+
+struct net_protocol {
+	uint16 type;
+	uint32 handler;							// MacOS handler address
+};
+
+static net_protocol net_protocols[MAX_PROTOCOLS];
+static int num_net_protocols = 0;
+
+// Receive filter, consulted by the reception thread so that packets no
+// MacOS protocol handler wants don't cause Ethernet interrupts
+const int MAX_MULTICAST = 32;
+
+static std::atomic<uint32> rx_type_filter[0x10000 / 32];	// One bit per packet type with a handler
+static std::atomic<uint64> rx_multicast[MAX_MULTICAST];		// Enabled multicast addresses, 0 = unused slot
+static std::atomic<int> rx_multicast_overflow(0);			// Multicast addresses not fitting the table
+
+// Receive ring, filled by the reception thread and drained by ether_do_interrupt()
+const uint32 RX_RING_SIZE = 64;				// Must be a power of two
+const int RX_BUFFER_SIZE = 1516;
+
+struct rx_slot {
+	ssize_t length;
+	uint64 stamp;							// Arrival time (when statistics are enabled)
+	struct sockaddr_in from;				// Sender (UDP tunnel only)
+	uint8 data[RX_BUFFER_SIZE];
+};
+
+static rx_slot rx_ring[RX_RING_SIZE];
+static std::atomic<uint32> rx_head(0);		// Next slot to fill (reception thread)
+static std::atomic<uint32> rx_tail(0);		// Next slot to drain (emulation thread)
+static std::atomic<bool> rx_irq_pending(false);	// Flag: Ethernet interrupt triggered but not yet handled
+static std::atomic<bool> rx_waiting(false);	// Flag: reception thread waits for free slots
+
+// Transmit ring, filled by ether_do_write() and drained by the slirp or transmission thread
+const uint32 TX_RING_SIZE = 64;				// Must be a power of two
+
+struct tx_slot {
+	int length;
+	struct sockaddr_in to;					// Destination (UDP tunnel only)
+	uint8 data[1516];
+};
+
+static tx_slot tx_ring[TX_RING_SIZE];
+static std::atomic<uint32> tx_head(0);		// Next slot to fill (emulation thread)
+static std::atomic<uint32> tx_tail(0);		// Next slot to drain (slirp thread)
+static std::atomic<bool> tx_doorbell(false);	// Flag: draining thread was signalled and hasn't looked yet
+
+// Network statistics, each counter is only updated by one thread
+const int LATENCY_BUCKETS = 20;				// Powers of two, from 1 us to 0.5 s and above
+
+struct net_stats {
+	std::atomic<uint64> rx_frames, rx_bytes;
+	std::atomic<uint64> tx_frames, tx_bytes;
+	std::atomic<uint64> tx_dropped;			// Transmit ring full
+	std::atomic<uint64> rx_ring_full;		// Times the reception thread waited for free slots
+	std::atomic<uint64> rx_ring_wait;		// Time spent waiting (us)
+	std::atomic<uint64> rx_filtered;		// Dropped by the receive filter
+	std::atomic<uint64> latency[LATENCY_BUCKETS];	// Time from arrival to protocol handler return (us)
+};
+
+static net_stats stats;
+
+struct net_stats_snapshot {
+	uint64 time;
+	uint64 rx_frames, rx_bytes, tx_frames, tx_bytes;
+	uint64 latency[LATENCY_BUCKETS];
+};
+
+static int stats_interval = 0;				// Seconds between statistics log lines, 0 = disabled
+static pthread_t stats_thread;				// Statistics logging thread
+static bool stats_thread_active = false;	// Flag: Statistics thread installed
 
 // Prototypes
 static void *receive_func(void *arg);
+static void *stats_func(void *arg);
+static void ether_stats_string(char *str, size_t size, net_stats_snapshot *prev);
+static void *transmit_func(void *arg);
+static void tx_ring_push(uint32 head);
+static net_protocol *find_protocol(uint16 type);
 static void *slirp_receive_func(void *arg);
 static int16 ether_do_add_multicast(uint8 *addr);
 static int16 ether_do_del_multicast(uint8 *addr);
@@ -164,16 +240,33 @@ static bool start_thread(void)
 		return false;
 	}
 
+	stats_interval = PrefsFindInt32("etherstats");
+	if (stats_interval > 0)
+		stats_thread_active = (pthread_create(&stats_thread, &ether_thread_attr, stats_func, NULL) == 0);
+
 #ifdef HAVE_SLIRP
 	if (net_if_type == NET_IF_SLIRP) {
-		slirp_thread_active = (pthread_create(&slirp_thread, NULL, slirp_receive_func, NULL) == 0);
+		slirp_thread_active = (pthread_create(&slirp_thread, &ether_thread_attr, slirp_receive_func, NULL) == 0);
 		if (!slirp_thread_active) {
 			printf("WARNING: Cannot start slirp reception thread\n");
 			return false;
 		}
+		tx_ring_active = true;
+		return true;
 	}
 #endif
 
+	// Devices are written to from a separate thread, so the emulation
+	// doesn't wait for the write() calls
+	if (tx_doorbell_fds[0] >= 0) {
+		tx_thread_active = (pthread_create(&tx_thread, &ether_thread_attr, transmit_func, NULL) == 0);
+		if (!tx_thread_active) {
+			printf("WARNING: Cannot start Ethernet transmission thread\n");
+			return false;
+		}
+		tx_ring_active = true;
+	}
+
 	return true;
 }
 
@@ -184,6 +277,23 @@ static bool start_thread(void)
 
 static void stop_thread(void)
 {
+	if (stats_thread_active) {
+#ifdef HAVE_PTHREAD_CANCEL
+		pthread_cancel(stats_thread);
+#endif
+		pthread_join(stats_thread, NULL);
+		stats_thread_active = false;
+	}
+
+	tx_ring_active = false;
+	if (tx_thread_active) {
+#ifdef HAVE_PTHREAD_CANCEL
+		pthread_cancel(tx_thread);
+#endif
+		pthread_join(tx_thread, NULL);
+		tx_thread_active = false;
+	}
+
 #ifdef HAVE_SLIRP
 	if (slirp_thread_active) {
 #ifdef HAVE_PTHREAD_CANCEL
@@ -202,6 +312,13 @@ static void stop_thread(void)
 		sem_destroy(&int_ack);
 		thread_active = false;
 	}
+
+	// Discard packets not yet delivered
+	rx_tail = rx_head.load();
+	rx_irq_pending = false;
+	rx_waiting = false;
+	tx_tail = tx_head.load();
+	tx_doorbell = false;
 }
 
 
@@ -290,6 +407,8 @@ bool ether_init(void)
 #ifdef HAVE_SLIRP
 	// Initialize slirp library
 	if (net_if_type == NET_IF_SLIRP) {
+		slirp_set_tcp_buffers(PrefsFindInt32("slirpsndbuf") * 1024, PrefsFindInt32("slirprcvbuf") * 1024,
+		                      PrefsFindInt32("slirpsndbufmax") * 1024);
 		if (slirp_init() < 0) {
 			sprintf(str, "%s", GetString(STR_SLIRP_NO_DNS_FOUND_WARN));
 			WarningAlert(str);
@@ -303,10 +422,6 @@ bool ether_init(void)
 		fd = fds[0];
 		slirp_output_fd = fds[1];
 
-		// Open slirp input pipe
-		if (pipe(slirp_input_fds) < 0)
-			return false;
-
 		// Set up port redirects
 		slirp_add_redirs();
 	}
@@ -453,7 +568,11 @@ bool ether_init(void)
 		ioctl(fd, SIOCGIFADDR, ether_addr);
 	D(bug("Ethernet address %02x %02x %02x %02x %02x %02x\n", ether_addr[0], ether_addr[1], ether_addr[2], ether_addr[3], ether_addr[4], ether_addr[5]));
 
-	// Start packet reception thread
+	// Open doorbell pipe for the transmit ring
+	if (net_if_type != NET_IF_VDE && pipe(tx_doorbell_fds) < 0)
+		goto open_error;
+
+	// Start packet reception and transmission threads
 	if (!start_thread())
 		goto open_error;
 
@@ -467,13 +586,13 @@ open_error:
 		close(fd);
 		fd = -1;
 	}
-	if (slirp_input_fds[0] >= 0) {
-		close(slirp_input_fds[0]);
-		slirp_input_fds[0] = -1;
+	if (tx_doorbell_fds[0] >= 0) {
+		close(tx_doorbell_fds[0]);
+		tx_doorbell_fds[0] = -1;
 	}
-	if (slirp_input_fds[1] >= 0) {
-		close(slirp_input_fds[1]);
-		slirp_input_fds[1] = -1;
+	if (tx_doorbell_fds[1] >= 0) {
+		close(tx_doorbell_fds[1]);
+		tx_doorbell_fds[1] = -1;
 	}
 	if (slirp_output_fd >= 0) {
 		close(slirp_output_fd);
@@ -505,10 +624,10 @@ void ether_exit(void)
 		close(fd);
 
 	// Close slirp input buffer
-	if (slirp_input_fds[0] >= 0)
-		close(slirp_input_fds[0]);
-	if (slirp_input_fds[1] >= 0)
-		close(slirp_input_fds[1]);
+	if (tx_doorbell_fds[0] >= 0)
+		close(tx_doorbell_fds[0]);
+	if (tx_doorbell_fds[1] >= 0)
+		close(tx_doorbell_fds[1]);
 
 	// Close slirp output buffer
 	if (slirp_output_fd > 0)
@@ -519,6 +638,13 @@ void ether_exit(void)
 	if (net_if_type == NET_IF_VDE)
 		vde_close(vde_conn);
 #endif
+
+	// Show network statistics
+	if (stats_interval > 0) {
+		char str[256];
+		ether_stats_string(str, sizeof(str), NULL);
+		printf("Ethernet totals: %s\n", str);
+	}
 #if STATISTICS
 	// Show statistics
 	printf("%ld messages put on write queue\n", num_wput);
@@ -629,10 +755,7 @@ void EtherIRQ(void)
 	OTEnterInterrupt();
 	ether_do_interrupt();
 	OTLeaveInterrupt();
-
-	// Acknowledge interrupt to reception thread
 	D(bug(" EtherIRQ done\n"));
-	sem_post(&int_ack);
 }
 #else
 // Add multicast address
@@ -667,9 +790,10 @@ static void ether_dispatch_packet(uint32 p, uint32 length)
 
 	// Look for protocol
 	uint16 search_type = (type <= 1500 ? 0 : type);
-	if (net_protocols.find(search_type) == net_protocols.end())
+	net_protocol *proto = find_protocol(search_type);
+	if (proto == NULL)
 		return;
-	uint32 handler = net_protocols[search_type];
+	uint32 handler = proto->handler;
 
 	// No default handler
 	if (handler == 0)
@@ -695,21 +819,69 @@ void EtherInterrupt(void)
 {
 	D(bug("EtherIRQ\n"));
 	ether_do_interrupt();
-
-	// Acknowledge interrupt to reception thread
 	D(bug(" EtherIRQ done\n"));
-	sem_post(&int_ack);
 }
 #endif
 
 
+/*
+ *  Protocol and receive filter helpers
+ */
+
+static net_protocol *find_protocol(uint16 type)
+{
+	for (int i = 0; i < num_net_protocols; i++)
+		if (net_protocols[i].type == type)
+			return &net_protocols[i];
+	return NULL;
+}
+
+static inline uint64 ether_addr_to_uint64(const uint8 *addr)
+{
+	return ((uint64)addr[0] << 40) | ((uint64)addr[1] << 32) | ((uint32)addr[2] << 24) | (addr[3] << 16) | (addr[4] << 8) | addr[5];
+}
+
+// Check whether MacOS is interested in a received packet, like the
+// address filter of a real Ethernet controller does, and whether a
+// protocol handler is attached for its type
+static bool rx_filter_accepts(const uint8 *p)
+{
+#ifdef SHEEPSHAVER
+	// Open Transport does its own demultiplexing and may be promiscuous
+	return true;
+#else
+	if (p[0] & 1) {
+		if (memcmp(p, "\xff\xff\xff\xff\xff\xff", 6) != 0 && rx_multicast_overflow == 0) {
+			uint64 a = ether_addr_to_uint64(p);
+			int i;
+			for (i = 0; i < MAX_MULTICAST; i++)
+				if (rx_multicast[i].load(std::memory_order_relaxed) == a)
+					break;
+			if (i == MAX_MULTICAST)
+				return false;
+		}
+	} else if (memcmp(p, ether_addr, 6) != 0)
+		return false;
+
+	uint16 type = (p[12] << 8) | p[13];
+	uint16 search_type = (type <= 1500 ? 0 : type);
+	return (rx_type_filter[search_type / 32].load(std::memory_order_relaxed) >> (search_type % 32)) & 1;
+#endif
+}
+
+
 /*
  *  Reset
  */
 
 void ether_reset(void)
 {
-	net_protocols.clear();
+	num_net_protocols = 0;
+	for (int i = 0; i < 0x10000 / 32; i++)
+		rx_type_filter[i].store(0, std::memory_order_relaxed);
+	for (int i = 0; i < MAX_MULTICAST; i++)
+		rx_multicast[i].store(0, std::memory_order_relaxed);
+	rx_multicast_overflow = 0;
 }
 
 
@@ -719,6 +891,16 @@ void ether_reset(void)
 
 static int16 ether_do_add_multicast(uint8 *addr)
 {
+	uint64 a = ether_addr_to_uint64(addr);
+	int i;
+	for (i = 0; i < MAX_MULTICAST; i++) {
+		uint64 expected = 0;
+		if (rx_multicast[i].compare_exchange_strong(expected, a))
+			break;
+	}
+	if (i == MAX_MULTICAST)
+		rx_multicast_overflow++;
+
 	switch (net_if_type) {
 	case NET_IF_ETHERTAP:
 	case NET_IF_SHEEPNET:
@@ -743,6 +925,16 @@ static int16 ether_do_add_multicast(uint8 *addr)
 
 static int16 ether_do_del_multicast(uint8 *addr)
 {
+	uint64 a = ether_addr_to_uint64(addr);
+	int i;
+	for (i = 0; i < MAX_MULTICAST; i++) {
+		uint64 expected = a;
+		if (rx_multicast[i].compare_exchange_strong(expected, 0))
+			break;
+	}
+	if (i == MAX_MULTICAST && rx_multicast_overflow > 0)
+		rx_multicast_overflow--;
+
 	switch (net_if_type) {
 	case NET_IF_ETHERTAP:
 	case NET_IF_SHEEPNET:
@@ -763,9 +955,13 @@ static int16 ether_do_del_multicast(uint8 *addr)
 
 int16 ether_attach_ph(uint16 type, uint32 handler)
 {
-	if (net_protocols.find(type) != net_protocols.end())
+	if (find_protocol(type) != NULL || num_net_protocols == MAX_PROTOCOLS)
 		return lapProtErr;
-	net_protocols[type] = handler;
+	net_protocols[num_net_protocols].type = type;
+	net_protocols[num_net_protocols].handler = handler;
+	num_net_protocols++;
+	if (handler)
+		rx_type_filter[type / 32].fetch_or(1U << (type % 32), std::memory_order_relaxed);
 	return noErr;
 }
 
@@ -776,8 +972,11 @@ int16 ether_attach_ph(uint16 type, uint32 handler)
 
 int16 ether_detach_ph(uint16 type)
 {
-	if (net_protocols.erase(type) == 0)
+	net_protocol *proto = find_protocol(type);
+	if (proto == NULL)
 		return lapProtErr;
+	*proto = net_protocols[--num_net_protocols];
+	rx_type_filter[type / 32].fetch_and(~(1U << (type % 32)), std::memory_order_relaxed);
 	return noErr;
 }
 
@@ -788,8 +987,22 @@ int16 ether_detach_ph(uint16 type)
 
 static int16 ether_do_write(uint32 arg)
 {
-	// Copy packet to buffer
+	// Copy packet to buffer, straight into the transmit ring if there is one
 	uint8 packet[1516], *p = packet;
+	tx_slot *slot = NULL;
+	uint32 head = tx_head.load(std::memory_order_relaxed);
+	if (tx_ring_active) {
+		if (head - tx_tail.load(std::memory_order_acquire) == TX_RING_SIZE) {
+			D(bug("WARNING: transmit ring full\n"));
+			stats.tx_dropped.fetch_add(1, std::memory_order_relaxed);
+			return excessCollsns;
+		}
+		slot = &tx_ring[head & (TX_RING_SIZE - 1)];
+		p = slot->data;
+	}
+#if MONITOR
+	uint8 *start = p;
+#endif
 	int len = 0;
 #if defined(__linux__)
 	if (net_if_type == NET_IF_ETHERTAP) {
@@ -799,24 +1012,24 @@ static int16 ether_do_write(uint32 arg)
 	}
 #endif
 	len += ether_arg_to_buffer(arg, p);
+	stats.tx_frames.fetch_add(1, std::memory_order_relaxed);
+	stats.tx_bytes.fetch_add(len, std::memory_order_relaxed);
 
 #if MONITOR
 	bug("Sending Ethernet packet:\n");
 	for (int i=0; i<len; i++) {
-		bug("%02x ", packet[i]);
+		bug("%02x ", start[i]);
 	}
 	bug("\n");
 #endif
 
-	// Transmit packet
-#ifdef HAVE_SLIRP
-	if (net_if_type == NET_IF_SLIRP) {
-		const int slirp_input_fd = slirp_input_fds[1];
-		write(slirp_input_fd, &len, sizeof(len));
-		write(slirp_input_fd, packet, len);
+	if (slot) {
+		slot->length = len;
+		tx_ring_push(head);
 		return noErr;
-	} else
-#endif
+	}
+
+	// Transmit packet
 #ifdef HAVE_LIBVDEPLUG
 	if (net_if_type == NET_IF_VDE) {
 		if (fd == -1) {	// which means vde service is not running
@@ -852,6 +1065,8 @@ bool ether_start_udp_thread(int socket_fd)
 {
 	fd = socket_fd;
 	udp_tunnel = true;
+	if (pipe(tx_doorbell_fds) < 0)
+		return false;
 	return start_thread();
 }
 
@@ -864,6 +1079,44 @@ void ether_stop_udp_thread(void)
 {
 	stop_thread();
 	fd = -1;
+
+	if (tx_doorbell_fds[0] >= 0) {
+		close(tx_doorbell_fds[0]);
+		tx_doorbell_fds[0] = -1;
+	}
+	if (tx_doorbell_fds[1] >= 0) {
+		close(tx_doorbell_fds[1]);
+		tx_doorbell_fds[1] = -1;
+	}
+}
+
+
+/*
+ *  Send packet to UDP tunnel peer
+ */
+
+int16 ether_udp_write(const uint8 *packet, int length, struct sockaddr_in *to)
+{
+	if (!tx_ring_active) {
+		if (sendto(fd, packet, length, 0, (struct sockaddr *)to, sizeof(*to)) < 0)
+			return excessCollsns;
+		return noErr;
+	}
+
+	uint32 head = tx_head.load(std::memory_order_relaxed);
+	if (head - tx_tail.load(std::memory_order_acquire) == TX_RING_SIZE) {
+		D(bug("WARNING: transmit ring full\n"));
+		stats.tx_dropped.fetch_add(1, std::memory_order_relaxed);
+		return excessCollsns;
+	}
+	tx_slot *slot = &tx_ring[head & (TX_RING_SIZE - 1)];
+	memcpy(slot->data, packet, length);
+	slot->length = length;
+	slot->to = *to;
+	stats.tx_frames.fetch_add(1, std::memory_order_relaxed);
+	stats.tx_bytes.fetch_add(length, std::memory_order_relaxed);
+	tx_ring_push(head);
+	return noErr;
 }
 
 
@@ -884,29 +1137,15 @@ void slirp_output(const uint8 *packet, int len)
 
 void *slirp_receive_func(void *arg)
 {
-	const int slirp_input_fd = slirp_input_fds[0];
+	const int doorbell_fd = tx_doorbell_fds[0];
 
 	for (;;) {
-		// Wait for packets to arrive
+		// Wait for packets to arrive from the guest or from host sockets,
+		// or for the next slirp timer to expire
 		fd_set rfds, wfds, xfds;
 		int nfds;
-		struct timeval tv;
+		struct timeval tv, *tvp = &tv;
 
-		// ... in the input queue
-		FD_ZERO(&rfds);
-		FD_SET(slirp_input_fd, &rfds);
-		tv.tv_sec = 0;
-		tv.tv_usec = 0;
-		if (select(slirp_input_fd + 1, &rfds, NULL, NULL, &tv) > 0) {
-			int len;
-			read(slirp_input_fd, &len, sizeof(len));
-			uint8 packet[1516];
-			assert(len <= sizeof(packet));
-			read(slirp_input_fd, packet, len);
-			slirp_input(packet, len);
-		}
-
-		// ... in the output queue
 		nfds = -1;
 		FD_ZERO(&rfds);
 		FD_ZERO(&wfds);
@@ -915,10 +1154,44 @@ void *slirp_receive_func(void *arg)
 #if ! USE_SLIRP_TIMEOUT
 		timeout = 10000;
 #endif
-		tv.tv_sec = 0;
-		tv.tv_usec = timeout;
-		if (select(nfds + 1, &rfds, &wfds, &xfds, &tv) >= 0)
-			slirp_select_poll(&rfds, &wfds, &xfds);
+		if (timeout < 0) {
+#if USE_POLL
+			tvp = NULL;		// Nothing to time, sleep until there is traffic
+#else
+			// A NULL timeout could cause select() to block indefinitely,
+			// even if it is supposed to be a cancellation point [MacOS X]
+			timeout = 20000;
+#endif
+		}
+		tv.tv_sec = timeout / 1000000;
+		tv.tv_usec = timeout % 1000000;
+		FD_SET(doorbell_fd, &rfds);
+		if (doorbell_fd > nfds)
+			nfds = doorbell_fd;
+		int res = select(nfds + 1, &rfds, &wfds, &xfds, tvp);
+		if (res < 0)
+			continue;
+
+		// Acknowledge doorbell, packets queued from now on will ring it again
+		if (FD_ISSET(doorbell_fd, &rfds)) {
+			uint8 b;
+			read(doorbell_fd, &b, 1);
+			tx_doorbell = false;
+		}
+
+		// Handle host sockets and timers (slirp ignores the doorbell pipe)
+		slirp_select_poll(&rfds, &wfds, &xfds);
+
+		// Pass all packets queued by the guest to slirp
+		uint32 tail = tx_tail.load(std::memory_order_relaxed);
+		uint32 head = tx_head.load(std::memory_order_acquire);
+		while (tail != head) {
+			tx_slot *slot = &tx_ring[tail & (TX_RING_SIZE - 1)];
+			slirp_input(slot->data, slot->length);
+			tx_tail.store(++tail, std::memory_order_release);
+			if (tail == head)
+				head = tx_head.load(std::memory_order_acquire);
+		}
 
 #ifdef HAVE_PTHREAD_TESTCANCEL
 		// Explicit cancellation point if select() was not covered
@@ -940,14 +1213,202 @@ void slirp_output(const uint8 *packet, int len)
 #endif
 
 
+/*
+ *  Network statistics
+ */
+
+static void record_latency(uint64 usec)
+{
+	int i = 0;
+	while (usec > 1 && i < LATENCY_BUCKETS - 1) {
+		usec >>= 1;
+		i++;
+	}
+	stats.latency[i].fetch_add(1, std::memory_order_relaxed);
+}
+
+// Upper bound (us) of the bucket containing the given fraction of latency samples
+static uint64 latency_percentile(const uint64 *hist, double fraction)
+{
+	uint64 total = 0;
+	for (int i = 0; i < LATENCY_BUCKETS; i++)
+		total += hist[i];
+	uint64 sum = 0;
+	for (int i = 0; i < LATENCY_BUCKETS; i++) {
+		sum += hist[i];
+		if (total && sum >= total * fraction)
+			return (uint64)2 << i;
+	}
+	return 0;
+}
+
+// Format statistics as one line, relative to (and updating) a previous snapshot if given
+static void ether_stats_string(char *str, size_t size, net_stats_snapshot *prev)
+{
+	net_stats_snapshot cur;
+	cur.time = GetTicks_usec();
+	cur.rx_frames = stats.rx_frames;
+	cur.rx_bytes = stats.rx_bytes;
+	cur.tx_frames = stats.tx_frames;
+	cur.tx_bytes = stats.tx_bytes;
+	uint64 hist[LATENCY_BUCKETS];
+	for (int i = 0; i < LATENCY_BUCKETS; i++) {
+		cur.latency[i] = stats.latency[i];
+		hist[i] = cur.latency[i] - (prev ? prev->latency[i] : 0);
+	}
+
+	int tcp_sockets = 0, udp_sockets = 0;
+#ifdef HAVE_SLIRP
+	if (net_if_type == NET_IF_SLIRP)
+		slirp_get_socket_counts(&tcp_sockets, &udp_sockets);
+#endif
+
+	if (prev) {
+		double secs = (cur.time - prev->time) / 1000000.0;
+		if (secs <= 0)
+			secs = 1;
+		snprintf(str, size, "rx %.0f pkt/s %.0f KB/s, tx %.0f pkt/s %.0f KB/s, tx drops %llu, rx filtered %llu, rx ring full %llu (%llu ms), latency p50 %llu us p99 %llu us, slirp sockets %d tcp %d udp",
+			(cur.rx_frames - prev->rx_frames) / secs, (cur.rx_bytes - prev->rx_bytes) / secs / 1024,
+			(cur.tx_frames - prev->tx_frames) / secs, (cur.tx_bytes - prev->tx_bytes) / secs / 1024,
+			(unsigned long long)stats.tx_dropped, (unsigned long long)stats.rx_filtered,
+			(unsigned long long)stats.rx_ring_full, (unsigned long long)stats.rx_ring_wait / 1000,
+			(unsigned long long)latency_percentile(hist, 0.5), (unsigned long long)latency_percentile(hist, 0.99),
+			tcp_sockets, udp_sockets);
+		*prev = cur;
+	} else {
+		snprintf(str, size, "rx %llu pkts %llu KB, tx %llu pkts %llu KB, tx drops %llu, rx filtered %llu, rx ring full %llu (%llu ms), latency p50 %llu us p99 %llu us",
+			(unsigned long long)cur.rx_frames, (unsigned long long)cur.rx_bytes / 1024,
+			(unsigned long long)cur.tx_frames, (unsigned long long)cur.tx_bytes / 1024,
+			(unsigned long long)stats.tx_dropped, (unsigned long long)stats.rx_filtered,
+			(unsigned long long)stats.rx_ring_full, (unsigned long long)stats.rx_ring_wait / 1000,
+			(unsigned long long)latency_percentile(hist, 0.5), (unsigned long long)latency_percentile(hist, 0.99));
+	}
+}
+
+static void *stats_func(void *arg)
+{
+	net_stats_snapshot prev;
+	memset(&prev, 0, sizeof(prev));
+	prev.time = GetTicks_usec();
+
+	for (;;) {
+		Delay_usec(stats_interval * 1000000);
+		char str[256];
+		ether_stats_string(str, sizeof(str), &prev);
+		printf("Ethernet: %s\n", str);
+	}
+	return NULL;
+}
+
+
 /*
  *  Packet reception thread
  */
 
+// Read one packet from the network device into a receive ring slot
+static ssize_t read_packet(rx_slot *slot)
+{
+#ifndef SHEEPSHAVER
+	if (udp_tunnel) {
+		socklen_t from_len = sizeof(slot->from);
+		return recvfrom(fd, slot->data, 1514, 0, (struct sockaddr *)&slot->from, &from_len);
+	}
+#endif
+#ifdef HAVE_LIBVDEPLUG
+	if (net_if_type == NET_IF_VDE)
+		return vde_recv(vde_conn, slot->data, 1514, 0);
+#endif
+#if defined(__linux__)
+	return read(fd, slot->data, net_if_type == NET_IF_ETHERTAP ? 1516 : 1514);
+#else
+	return read(fd, slot->data, 1514);
+#endif
+}
+
+// Read as many pending packets as there are free slots, returns number of packets read
+static int fill_rx_ring(void)
+{
+	uint32 head = rx_head.load(std::memory_order_relaxed);
+	uint32 avail = RX_RING_SIZE - (head - rx_tail.load(std::memory_order_acquire));
+	uint32 n = 0;
+
+#if defined(HAVE_RECVMMSG) && !defined(SHEEPSHAVER)
+	if (udp_tunnel) {
+		// Fetch all datagrams with one system call
+		struct mmsghdr msgs[RX_RING_SIZE];
+		struct iovec iov[RX_RING_SIZE];
+		uint32 count = 0;
+		while (count < avail) {
+			rx_slot *slot = &rx_ring[(head + count) & (RX_RING_SIZE - 1)];
+			iov[count].iov_base = slot->data;
+			iov[count].iov_len = 1514;
+			memset(&msgs[count].msg_hdr, 0, sizeof(msgs[count].msg_hdr));
+			msgs[count].msg_hdr.msg_name = &slot->from;
+			msgs[count].msg_hdr.msg_namelen = sizeof(slot->from);
+			msgs[count].msg_hdr.msg_iov = &iov[count];
+			msgs[count].msg_hdr.msg_iovlen = 1;
+			count++;
+		}
+		int res = recvmmsg(fd, msgs, count, MSG_DONTWAIT, NULL);
+		for (int i = 0; i < res; i++) {
+			rx_slot *slot = &rx_ring[(head + i) & (RX_RING_SIZE - 1)];
+			slot->length = msgs[i].msg_len;
+			if (slot->length >= 14)
+				rx_ring[(head + n++) & (RX_RING_SIZE - 1)] = *slot;
+		}
+		avail = 0;
+	}
+#endif
+
+	while (n < avail) {
+		rx_slot *slot = &rx_ring[(head + n) & (RX_RING_SIZE - 1)];
+		slot->length = read_packet(slot);
+		if (slot->length < 14)
+			break;
+
+		// Drop unwanted packets right away, reusing the slot
+		if (!udp_tunnel) {
+			const uint8 *p = slot->data;
+#if defined(__linux__)
+			if (net_if_type == NET_IF_ETHERTAP) {
+				if (slot->length < 16)
+					continue;
+				p += 2;
+			}
+#endif
+			if (!rx_filter_accepts(p)) {
+				stats.rx_filtered.fetch_add(1, std::memory_order_relaxed);
+				continue;
+			}
+		}
+		n++;
+	}
+
+	if (n && stats_interval > 0) {
+		uint64 now = GetTicks_usec();
+		for (uint32 i = 0; i < n; i++)
+			rx_ring[(head + i) & (RX_RING_SIZE - 1)].stamp = now;
+	}
+	if (n)
+		rx_head.store(head + n, std::memory_order_release);
+	return n;
+}
+
 static void *receive_func(void *arg)
 {
 	for (;;) {
 
+		// Wait for ether_do_interrupt() to free some slots when the ring is full
+		if (rx_head - rx_tail == RX_RING_SIZE) {
+			uint64 start = GetTicks_usec();
+			rx_waiting = true;
+			if (rx_head - rx_tail == RX_RING_SIZE || !rx_waiting.exchange(false))
+				sem_wait(&int_ack);
+			stats.rx_ring_full.fetch_add(1, std::memory_order_relaxed);
+			stats.rx_ring_wait.fetch_add(GetTicks_usec() - start, std::memory_order_relaxed);
+			continue;
+		}
+
 		// Wait for packets to arrive
 #if USE_POLL
 		struct pollfd pf = {fd, POLLIN, 0};
@@ -970,13 +1431,12 @@ static void *receive_func(void *arg)
 			break;
 
 		if (ether_driver_opened) {
-			// Trigger Ethernet interrupt
-			D(bug(" packet received, triggering Ethernet interrupt\n"));
-			SetInterruptFlag(INTFLAG_ETHER);
-			TriggerInterrupt();
-
-			// Wait for interrupt acknowledge by EtherInterrupt()
-			sem_wait(&int_ack);
+			// Queue packets, and trigger Ethernet interrupt unless one is pending already
+			if (fill_rx_ring() && !rx_irq_pending.exchange(true)) {
+				D(bug(" packet received, triggering Ethernet interrupt\n"));
+				SetInterruptFlag(INTFLAG_ETHER);
+				TriggerInterrupt();
+			}
 		} else
 			Delay_usec(20000);
 	}
@@ -984,48 +1444,138 @@ static void *receive_func(void *arg)
 }
 
 
+/*
+ *  Packet transmission thread
+ */
+
+// Publish filled transmit ring slot
+static void tx_ring_push(uint32 head)
+{
+	tx_head.store(head + 1, std::memory_order_release);
+
+	// Wake up draining thread unless it has been told already
+	if (!tx_doorbell.exchange(true)) {
+		uint8 b = 0;
+		write(tx_doorbell_fds[1], &b, 1);
+	}
+}
+
+// Wait until the device or socket can take more packets
+static void wait_writable(void)
+{
+#if USE_POLL
+	struct pollfd pf = {fd, POLLOUT, 0};
+	poll(&pf, 1, 10);
+#else
+	Delay_usec(1000);
+#endif
+}
+
+static void *transmit_func(void *arg)
+{
+	const int doorbell_fd = tx_doorbell_fds[0];
+
+	for (;;) {
+
+		// Wait for ether_do_write() to queue packets
+		uint8 b;
+		if (read(doorbell_fd, &b, 1) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		tx_doorbell = false;
+
+		// Send everything queued so far, packets queued from now on will ring again
+		uint32 tail = tx_tail.load(std::memory_order_relaxed);
+		uint32 head = tx_head.load(std::memory_order_acquire);
+
+#if defined(HAVE_SENDMMSG) && !defined(SHEEPSHAVER)
+		if (udp_tunnel) {
+			// Hand all queued datagrams to the kernel with one system call
+			while (tail != head) {
+				struct mmsghdr msgs[TX_RING_SIZE];
+				struct iovec iov[TX_RING_SIZE];
+				uint32 count = 0;
+				for (uint32 i = tail; i != head; i++, count++) {
+					tx_slot *slot = &tx_ring[i & (TX_RING_SIZE - 1)];
+					iov[count].iov_base = slot->data;
+					iov[count].iov_len = slot->length;
+					memset(&msgs[count].msg_hdr, 0, sizeof(msgs[count].msg_hdr));
+					msgs[count].msg_hdr.msg_name = &slot->to;
+					msgs[count].msg_hdr.msg_namelen = sizeof(slot->to);
+					msgs[count].msg_hdr.msg_iov = &iov[count];
+					msgs[count].msg_hdr.msg_iovlen = 1;
+				}
+				int res = sendmmsg(fd, msgs, count, 0);
+				if (res < 0) {
+					if (errno == EAGAIN) {
+						wait_writable();
+						continue;
+					}
+					res = 1;	// Drop the packet that failed
+				}
+				tail += res;
+				tx_tail.store(tail, std::memory_order_release);
+				if (tail == head)
+					head = tx_head.load(std::memory_order_acquire);
+			}
+			continue;
+		}
+#endif
+
+		while (tail != head) {
+			tx_slot *slot = &tx_ring[tail & (TX_RING_SIZE - 1)];
+			ssize_t res;
+			if (udp_tunnel)
+				res = sendto(fd, slot->data, slot->length, 0, (struct sockaddr *)&slot->to, sizeof(slot->to));
+			else
+				res = write(fd, slot->data, slot->length);
+			if (res < 0 && errno == EAGAIN) {
+				// Device queue full, wait until it drains
+				wait_writable();
+				continue;
+			}
+			tx_tail.store(++tail, std::memory_order_release);
+			if (tail == head)
+				head = tx_head.load(std::memory_order_acquire);
+		}
+	}
+	return NULL;
+}
+
+
 /*
  *  Ethernet interrupt - activate deferred tasks to call IODone or protocol handlers
  */
 
 void ether_do_interrupt(void)
 {
+	// Packets queued from now on will trigger another interrupt
+	rx_irq_pending = false;
+
 	// Call protocol handler for received packets
 	EthernetPacket ether_packet;
 	uint32 packet = ether_packet.addr();
-	ssize_t length;
-	for (;;) {
+	uint32 tail = rx_tail.load(std::memory_order_relaxed);
+	uint32 head = rx_head.load(std::memory_order_acquire);
+	while (tail != head) {
+		rx_slot *slot = &rx_ring[tail & (RX_RING_SIZE - 1)];
+		ssize_t length = slot->length;
+		uint64 stamp = slot->stamp;
+		Host2Mac_memcpy(packet, slot->data, length);
+		stats.rx_frames.fetch_add(1, std::memory_order_relaxed);
+		stats.rx_bytes.fetch_add(length, std::memory_order_relaxed);
 
 #ifndef SHEEPSHAVER
 		if (udp_tunnel) {
-
-			// Read packet from socket
-			struct sockaddr_in from;
-			socklen_t from_len = sizeof(from);
-			length = recvfrom(fd, Mac2HostAddr(packet), 1514, 0, (struct sockaddr *)&from, &from_len);
-			if (length < 14)
-				break;
+			struct sockaddr_in from = slot->from;
+			rx_tail.store(++tail, std::memory_order_release);
 			ether_udp_read(packet, length, &from);
-
 		} else
 #endif
 		{
-#ifdef HAVE_LIBVDEPLUG
-			if (net_if_type == NET_IF_VDE) {
-				length = vde_recv(vde_conn, Mac2HostAddr(packet), 1514, 0);
-			} else
-#endif
-			{
-				// Read packet from sheep_net device
-#if defined(__linux__)
-				length = read(fd, Mac2HostAddr(packet), net_if_type == NET_IF_ETHERTAP ? 1516 : 1514);
-#else
-				length = read(fd, Mac2HostAddr(packet), 1514);
-#endif
-			}
-			
-			if (length < 14)
-				break;
+			rx_tail.store(++tail, std::memory_order_release);
 
 #if MONITOR
 			bug("Receiving Ethernet packet:\n");
@@ -1047,7 +1597,17 @@ void ether_do_interrupt(void)
 			// Dispatch packet
 			ether_dispatch_packet(p, length);
 		}
+
+		if (stats_interval > 0)
+			record_latency(GetTicks_usec() - stamp);
+
+		if (tail == head)
+			head = rx_head.load(std::memory_order_acquire);
 	}
+
+	// Wake up reception thread if it ran out of slots
+	if (rx_waiting.exchange(false))
+		sem_post(&int_ack);
 }
 
 // Helper function for port forwarding
@@ -0,0 +1,69 @@
+/*
+ *  intflags_unix.h - Interrupt flags, set and cleared from any thread
+ *
+ *  Basilisk II (C) 1997-2008 Christian Bauer
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef INTFLAGS_UNIX_H
+#define INTFLAGS_UNIX_H
+
+// Note: this file must be #include'd only in main_unix.cpp (and in the
+// test_intflags stress test and bench_tap, which run this very code)
+
+#if defined(HAVE_PTHREADS) && !defined(__GNUC__)
+static pthread_mutex_t intflag_lock = PTHREAD_MUTEX_INITIALIZER;	// Mutex to protect InterruptFlags
+#define LOCK_INTFLAGS pthread_mutex_lock(&intflag_lock)
+#define UNLOCK_INTFLAGS pthread_mutex_unlock(&intflag_lock)
+#else
+#define LOCK_INTFLAGS
+#define UNLOCK_INTFLAGS
+#endif
+
+
+/*
+ *  Interrupt flags (must be handled atomically!)
+ *  Producers in other threads set the flag before SPCFLAG_INT, and the
+ *  CPU clears SPCFLAG_INT before reading the flags, so none gets lost.
+ */
+
+uint32 InterruptFlags = 0;
+
+#if EMULATED_68K
+void SetInterruptFlag(uint32 flag)
+{
+#ifdef __GNUC__
+	__atomic_fetch_or(&InterruptFlags, flag, __ATOMIC_SEQ_CST);
+#else
+	LOCK_INTFLAGS;
+	InterruptFlags |= flag;
+	UNLOCK_INTFLAGS;
+#endif
+}
+
+void ClearInterruptFlag(uint32 flag)
+{
+#ifdef __GNUC__
+	__atomic_fetch_and(&InterruptFlags, ~flag, __ATOMIC_SEQ_CST);
+#else
+	LOCK_INTFLAGS;
+	InterruptFlags &= ~flag;
+	UNLOCK_INTFLAGS;
+#endif
+}
+#endif
+
+#endif /* INTFLAGS_UNIX_H */
@@ -31,12 +31,14 @@
 # include <SDL_main.h>
 #endif
 
-#ifndef USE_SDL_VIDEO
+#if !defined(USE_SDL_VIDEO) && !defined(USE_HEADLESS_VIDEO)
 # include <X11/Xlib.h>
 #endif
 
 #ifdef HAVE_PTHREADS
 # include <pthread.h>
+# include <sched.h>
+# include <sys/resource.h>
 #endif
 
 #if REAL_ADDRESSING || DIRECT_ADDRESSING
@@ -129,7 +131,7 @@ bool TwentyFourBitAddressing;
 
 
 // Global variables
-#ifndef USE_SDL_VIDEO
+#if !defined(USE_SDL_VIDEO) && !defined(USE_HEADLESS_VIDEO)
 extern char *x_display_name;						// X11 display name
 extern Display *x_display;							// X11 display handle
 #ifdef X11_LOCK_TYPE
@@ -137,31 +139,22 @@ X11_LOCK_TYPE x_display_lock = X11_LOCK_INIT;		// X11 display lock
 #endif
 #endif
 
+#ifndef HAVE_PTHREADS
 static uint8 last_xpram[XPRAM_SIZE];				// Buffer for monitoring XPRAM changes
+#endif
 
 #ifdef HAVE_PTHREADS
 #if !EMULATED_68K
 static pthread_t emul_thread;						// Handle of MacOS emulation thread (main thread)
 #endif
 
-static bool xpram_thread_active = false;			// Flag: XPRAM watchdog installed
-static volatile bool xpram_thread_cancel = false;	// Flag: Cancel XPRAM thread
-static pthread_t xpram_thread;						// XPRAM watchdog
-
+#ifdef USE_PTHREADS_SERVICES
 static bool tick_thread_active = false;				// Flag: 60Hz thread installed
 static volatile bool tick_thread_cancel = false;	// Flag: Cancel 60Hz thread
 static pthread_t tick_thread;						// 60Hz thread
 static pthread_attr_t tick_thread_attr;				// 60Hz thread attributes
-
-static pthread_mutex_t intflag_lock = PTHREAD_MUTEX_INITIALIZER;	// Mutex to protect InterruptFlags
-#define LOCK_INTFLAGS pthread_mutex_lock(&intflag_lock)
-#define UNLOCK_INTFLAGS pthread_mutex_unlock(&intflag_lock)
-
-#else
-
-#define LOCK_INTFLAGS
-#define UNLOCK_INTFLAGS
-
+static bool tickless_idle = false;					// Flag: hold back ticks while emulator thread is idle
+#endif
 #endif
 
 #if !EMULATED_68K
@@ -199,9 +192,14 @@ static const char *gui_connection_path = NULL;	// GUI connection identifier
 
 
 // Prototypes
-static void *xpram_func(void *arg);
+#ifdef USE_PTHREADS_SERVICES
 static void *tick_func(void *arg);
+#endif
 static void one_tick(...);
+#ifdef HAVE_PTHREADS
+static void init_thread_policy(void);
+static void set_emul_thread_policy(void);
+#endif
 #if !EMULATED_68K
 static void sigirq_handler(int sig, int code, struct sigcontext *scp);
 static void sigill_handler(int sig, int code, struct sigcontext *scp);
@@ -307,12 +305,78 @@ static void sigsegv_dump_state(sigsegv_info_t *sip)
  */
 
 #ifdef USE_CPU_EMUL_SERVICES
+#if DEBUG
 static uint64 n_check_ticks = 0;
+#endif
 static uint64 emulated_ticks_start = 0;
 static uint64 emulated_ticks_count = 0;
 static int64 emulated_ticks_current = 0;
 static int32 emulated_ticks_quantum = 1000;
 int32 emulated_ticks = emulated_ticks_quantum;
+static uint64 next_tick = 0;						// Host time of next 60Hz tick (usec)
+
+// Virtual clock ("cpuclock" prefs item): time advances by estimated CPU
+// cycles only, the host clock is just used to keep it from running ahead
+static uint64 virtual_hz = 0;						// Cycles per second, 0 = use host clock
+static bool virtual_paced = true;					// Flag: don't run faster than real time
+static uint64 virtual_cycles = 0;					// Cycles executed up to last countdown reload
+static int32 virtual_reload = 0;					// Value emulated_ticks was last reloaded with
+static uint64 virtual_next_tick = 0;				// Cycle count of next 60Hz tick
+static uint64 virtual_tick_cycles;					// Cycles per 60Hz tick
+
+static void virtual_clock_init(void)
+{
+	int32 mhz = PrefsFindInt32("cpuclock");
+	if (mhz <= 0)
+		return;
+	virtual_hz = (uint64)mhz * 1000000;
+	virtual_paced = !PrefsFindBool("cputurbo");
+	virtual_tick_cycles = virtual_hz * 16625 / 1000000;
+	virtual_next_tick = virtual_tick_cycles;
+	emulated_ticks = virtual_reload = virtual_tick_cycles > 0x40000000 ? 0x40000000 : virtual_tick_cycles;
+	printf("Using virtual CPU clock of %d MHz%s\n", mhz, virtual_paced ? "" : ", not paced");
+}
+
+static inline uint64 virtual_cycles_now(void)
+{
+	return virtual_cycles + (virtual_reload - emulated_ticks);
+}
+
+// Virtual time in microseconds, false if the host clock is used
+bool GetVirtualTicks_usec(uint64 &usec)
+{
+	if (virtual_hz == 0)
+		return false;
+	uint64 cycles = virtual_cycles_now();
+	usec = (cycles / virtual_hz) * 1000000 + (cycles % virtual_hz) * 1000000 / virtual_hz;
+	return true;
+}
+
+static void virtual_check_ticks(void)
+{
+	virtual_cycles = virtual_cycles_now();
+	if (virtual_cycles >= virtual_next_tick) {
+
+		// Wait for the host clock to catch up
+		if (virtual_paced) {
+			uint64 usec;
+			GetVirtualTicks_usec(usec);
+			int64 ahead = emulated_ticks_start + usec - GetTicks_usec();
+			if (ahead > 0)
+				Delay_usec(ahead);
+		}
+
+		one_tick();
+		do {
+			virtual_next_tick += virtual_tick_cycles;
+		} while (virtual_next_tick <= virtual_cycles);
+		emulated_ticks_count++;
+	}
+
+	// Count down to the next tick
+	uint64 left = virtual_next_tick - virtual_cycles;
+	emulated_ticks = virtual_reload = left > 0x40000000 ? 0x40000000 : left;
+}
 
 void cpu_do_check_ticks(void)
 {
@@ -320,29 +384,33 @@ void cpu_do_check_ticks(void)
 	n_check_ticks++;
 #endif
 
-	uint64 now;
-	static uint64 next = 0;
-	if (next == 0)
-		next = emulated_ticks_start = GetTicks_usec();
+	if (next_tick == 0)
+		next_tick = emulated_ticks_start = GetTicks_usec();
+
+	if (virtual_hz) {
+		virtual_check_ticks();
+		return;
+	}
+
+	uint64 now = GetTicks_usec();
 
-	// Update total instructions count
+	// Update total cycles count
 	if (emulated_ticks <= 0) {
 		emulated_ticks_current += (emulated_ticks_quantum - emulated_ticks);
 		// XXX: can you really have a machine fast enough to overflow
-		// a 63-bit m68k instruction counter within 16 ms?
+		// a 63-bit m68k cycle counter within 16 ms?
 		if (emulated_ticks_current < 0) {
-			printf("WARNING: Overflowed 63-bit m68k instruction counter in less than 16 ms!\n");
+			printf("WARNING: Overflowed 63-bit m68k cycle counter in less than 16 ms!\n");
 			goto recalibrate_quantum;
 		}
 	}
 
 	// Check for interrupt opportunity
-	now = GetTicks_usec();
-	if (next < now) {
+	if (next_tick < now) {
 		one_tick();
 		do {
-			next += 16625;
-		} while (next < now);
+			next_tick += 16625;
+		} while (next_tick < now);
 		emulated_ticks_count++;
 
 		// Recalibrate 1000 Hz quantum every 10 ticks
@@ -361,6 +429,22 @@ void cpu_do_check_ticks(void)
 	if (emulated_ticks <= 0)
 		emulated_ticks += emulated_ticks_quantum;
 }
+
+// MacOS is idle: skip to the next tick instead of executing idle loops
+void cpu_idle_skip(void)
+{
+	if (virtual_hz) {
+		virtual_cycles = virtual_cycles_now();
+		if (virtual_cycles < virtual_next_tick)
+			virtual_cycles = virtual_next_tick;
+		emulated_ticks = virtual_reload = 0;
+	} else {
+		int64 delay = next_tick - GetTicks_usec();
+		if (delay > 0)
+			Delay_usec(delay);
+		emulated_ticks = 0;
+	}
+}
 #endif
 
 
@@ -404,7 +488,7 @@ int main(int argc, char **argv)
 	for (int i=1; i<argc; i++) {
 		if (strcmp(argv[i], "--help") == 0) {
 			usage(argv[0]);
-#ifndef USE_SDL_VIDEO
+#if !defined(USE_SDL_VIDEO) && !defined(USE_HEADLESS_VIDEO)
 		} else if (strcmp(argv[i], "--display") == 0) {
 			i++; // don't remove the argument, gtk_init() needs it too
 			if (i < argc)
@@ -503,6 +587,9 @@ int main(int argc, char **argv)
 
 	// Read preferences
 	PrefsInit(vmdir, argc, argv);
+#ifdef HAVE_PTHREADS
+	init_thread_policy();
+#endif
 
 	// Any command line arguments left?
 	for (int i=1; i<argc; i++) {
@@ -512,7 +599,7 @@ int main(int argc, char **argv)
 		}
 	}
 
-#ifndef USE_SDL_VIDEO
+#if !defined(USE_SDL_VIDEO) && !defined(USE_HEADLESS_VIDEO)
 	// Open display
 	x_display = XOpenDisplay(x_display_name);
 	if (x_display == NULL) {
@@ -794,10 +881,16 @@ int main(int argc, char **argv)
 	sigaction(SIGINT, &sigint_sa, NULL);
 #endif
 
+#ifdef USE_CPU_EMUL_SERVICES
+	// CPU emulator triggers 60Hz interrupts, possibly from a virtual clock
+	virtual_clock_init();
+#endif
+
 #ifndef USE_CPU_EMUL_SERVICES
 #if defined(HAVE_PTHREADS)
 
 	// POSIX threads available, start 60Hz thread
+	tickless_idle = PrefsFindBool("tickless");
 	Set_pthread_attr(&tick_thread_attr, 0);
 	tick_thread_active = (pthread_create(&tick_thread, &tick_thread_attr, tick_func, NULL) == 0);
 	if (!tick_thread_active) {
@@ -860,11 +953,10 @@ int main(int argc, char **argv)
 #endif
 #endif
 
-#ifdef USE_PTHREADS_SERVICES
-	// Start XPRAM watchdog thread
-	memcpy(last_xpram, XPRAM, XPRAM_SIZE);
-	xpram_thread_active = (pthread_create(&xpram_thread, NULL, xpram_func, NULL) == 0);
-	D(bug("XPRAM thread started\n"));
+#ifdef HAVE_PTHREADS
+	// Pin emulation thread before it touches Mac RAM, so the pages are
+	// allocated on its NUMA node
+	set_emul_thread_policy();
 #endif
 
 	// Start 68k and jump to ROM boot routine
@@ -890,11 +982,13 @@ void QuitEmulator(void)
 #endif
 
 #if defined(USE_CPU_EMUL_SERVICES)
+#if DEBUG
 	// Show statistics
 	uint64 emulated_ticks_end = GetTicks_usec();
 	D(bug("%ld ticks in %ld usec = %f ticks/sec [%ld tick checks]\n",
 		  (long)emulated_ticks_count, (long)(emulated_ticks_end - emulated_ticks_start),
 		  emulated_ticks_count * 1000000.0 / (emulated_ticks_end - emulated_ticks_start), (long)n_check_ticks));
+#endif
 #elif defined(USE_PTHREADS_SERVICES)
 	// Stop 60Hz thread
 	if (tick_thread_active) {
@@ -914,17 +1008,6 @@ void QuitEmulator(void)
 	setitimer(ITIMER_REAL, &req, NULL);
 #endif
 
-#ifdef USE_PTHREADS_SERVICES
-	// Stop XPRAM watchdog thread
-	if (xpram_thread_active) {
-		xpram_thread_cancel = true;
-#ifdef HAVE_PTHREAD_CANCEL
-		pthread_cancel(xpram_thread);
-#endif
-		pthread_join(xpram_thread, NULL);
-	}
-#endif
-
 	// Deinitialize everything
 	ExitAll();
 
@@ -959,7 +1042,7 @@ void QuitEmulator(void)
 	PrefsExit();
 
 	// Close X11 server connection
-#ifndef USE_SDL_VIDEO
+#if !defined(USE_SDL_VIDEO) && !defined(USE_HEADLESS_VIDEO)
 	if (x_display)
 		XCloseDisplay(x_display);
 #endif
@@ -1012,6 +1095,164 @@ static void sigint_handler(...)
 
 
 #ifdef HAVE_PTHREADS
+/*
+ *  Scheduling policy and CPU affinity of the emulation thread and the
+ *  helper threads (60Hz, timer, video, audio, network, serial)
+ */
+
+static int emul_sched = SCHED_OTHER;				// Scheduling policy of emulation thread
+static int helper_sched = -1;						// Scheduling policy of helper threads (-1 = SCHED_FIFO for root)
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+static bool emul_cpus_valid = false;
+static cpu_set_t emul_cpus;							// CPUs for emulation thread
+#endif
+#ifdef HAVE_PTHREAD_ATTR_SETAFFINITY_NP
+static bool helper_cpus_valid = false;
+static cpu_set_t helper_cpus;						// CPUs for helper threads
+#endif
+
+// Real-time priority for helper threads, relative to the middle of the range
+static int fifo_priority(int priority)
+{
+	return (sched_get_priority_min(SCHED_FIFO) + sched_get_priority_max(SCHED_FIFO)) / 2 + priority;
+}
+
+// Parse scheduling policy prefs item
+static int parse_sched_policy(const char *item, int def)
+{
+	const char *str = PrefsFindString(item);
+	if (str == NULL || strcmp(str, "auto") == 0)
+		return def;
+	if (strcmp(str, "fifo") == 0) {
+		// Without privileges, thread creation would fail
+#ifdef RLIMIT_RTPRIO
+		struct rlimit rl;
+		if (geteuid() != 0 && (getrlimit(RLIMIT_RTPRIO, &rl) < 0 || rl.rlim_cur < (rlim_t)fifo_priority(2))) {
+#else
+		if (geteuid() != 0) {
+#endif
+			fprintf(stderr, "WARNING: Not allowed to use real-time scheduling, ignoring '%s fifo'\n", item);
+			return SCHED_OTHER;
+		}
+		return SCHED_FIFO;
+	}
+	if (strcmp(str, "other") != 0)
+		fprintf(stderr, "WARNING: Unknown scheduling policy '%s' for %s\n", str, item);
+	return SCHED_OTHER;
+}
+
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+// Parse CPU list prefs item ("0-3,8")
+static bool parse_cpu_list(const char *item, cpu_set_t *set)
+{
+	const char *str = PrefsFindString(item);
+	if (str == NULL)
+		return false;
+	CPU_ZERO(set);
+	const char *p = str;
+	while (*p) {
+		char *end;
+		long first = strtol(p, &end, 10), last = first;
+		if (end == p || first < 0)
+			break;
+		if (*end == '-') {
+			p = end + 1;
+			last = strtol(p, &end, 10);
+			if (end == p)
+				break;
+		}
+		for (long cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++)
+			CPU_SET(cpu, set);
+		p = end;
+		if (*p == ',')
+			p++;
+		else if (*p)
+			break;
+	}
+	if (*p || CPU_COUNT(set) == 0) {
+		fprintf(stderr, "WARNING: Invalid CPU list '%s' for %s\n", str, item);
+		return false;
+	}
+	return true;
+}
+
+// Format CPU set as list for the startup report
+static void cpu_list_string(const cpu_set_t *set, char *buf, size_t size)
+{
+	int len = 0;
+	buf[0] = 0;
+	for (int cpu = 0; cpu < CPU_SETSIZE && len < (int)size - 16; cpu++) {
+		if (!CPU_ISSET(cpu, set))
+			continue;
+		int last = cpu;
+		while (last + 1 < CPU_SETSIZE && CPU_ISSET(last + 1, set))
+			last++;
+		if (last == cpu)
+			len += sprintf(buf + len, "%s%d", len ? "," : "", cpu);
+		else
+			len += sprintf(buf + len, "%s%d-%d", len ? "," : "", cpu, last);
+		cpu = last;
+	}
+}
+#endif
+
+// Read prefs, must be called before any thread is created
+static void init_thread_policy(void)
+{
+	emul_sched = parse_sched_policy("emulsched", SCHED_OTHER);
+	helper_sched = parse_sched_policy("helpersched", -1);
+
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+	emul_cpus_valid = parse_cpu_list("emulcpus", &emul_cpus);
+#endif
+#ifdef HAVE_PTHREAD_ATTR_SETAFFINITY_NP
+	helper_cpus_valid = parse_cpu_list("helpercpus", &helper_cpus);
+
+	// Helpers created by the pinned emulation thread would inherit its
+	// CPUs, keep them on the ones we were started with instead
+	if (!helper_cpus_valid && emul_cpus_valid)
+		helper_cpus_valid = (pthread_getaffinity_np(pthread_self(), sizeof(helper_cpus), &helper_cpus) == 0);
+#endif
+}
+
+// Apply policy to emulation thread (the calling thread) and report it
+static void set_emul_thread_policy(void)
+{
+	char emul_str[256] = "any", helper_str[256] = "any";
+
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+	if (emul_cpus_valid) {
+		int err = pthread_setaffinity_np(pthread_self(), sizeof(emul_cpus), &emul_cpus);
+		if (err == 0)
+			cpu_list_string(&emul_cpus, emul_str, sizeof(emul_str));
+		else
+			fprintf(stderr, "WARNING: Cannot set CPU affinity of emulation thread: %s\n", strerror(err));
+	}
+#endif
+#ifdef HAVE_PTHREAD_ATTR_SETAFFINITY_NP
+	if (helper_cpus_valid)
+		cpu_list_string(&helper_cpus, helper_str, sizeof(helper_str));
+#endif
+
+#if defined(_POSIX_THREAD_PRIORITY_SCHEDULING)
+	if (emul_sched == SCHED_FIFO) {
+		struct sched_param param;
+		param.sched_priority = fifo_priority(0);
+		int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+		if (err) {
+			fprintf(stderr, "WARNING: Cannot set real-time scheduling for emulation thread: %s\n", strerror(err));
+			emul_sched = SCHED_OTHER;
+		}
+	}
+#endif
+
+	int helper = helper_sched < 0 ? (geteuid() == 0 ? SCHED_FIFO : SCHED_OTHER) : helper_sched;
+	printf("Emulation thread: CPUs %s, %s; helper threads: CPUs %s, %s\n",
+		emul_str, emul_sched == SCHED_FIFO ? "SCHED_FIFO" : "SCHED_OTHER",
+		helper_str, helper == SCHED_FIFO ? "SCHED_FIFO" : "SCHED_OTHER");
+}
+
+
 /*
  *  Pthread configuration
  */
@@ -1021,14 +1262,24 @@ void Set_pthread_attr(pthread_attr_t *attr, int priority)
 	pthread_attr_init(attr);
 #if defined(_POSIX_THREAD_PRIORITY_SCHEDULING)
 	// Some of these only work for superuser
-	if (geteuid() == 0) {
+	int policy = helper_sched;
+	if (policy < 0 && geteuid() == 0)
+		policy = SCHED_FIFO;
+	else if (policy < 0 && emul_sched == SCHED_FIFO)
+		policy = SCHED_OTHER;
+	if (policy == SCHED_FIFO) {
 		pthread_attr_setinheritsched(attr, PTHREAD_EXPLICIT_SCHED);
 		pthread_attr_setschedpolicy(attr, SCHED_FIFO);
 		struct sched_param fifo_param;
-		fifo_param.sched_priority = ((sched_get_priority_min(SCHED_FIFO) + 
-					      sched_get_priority_max(SCHED_FIFO)) / 2 +
-					     priority);
+		fifo_param.sched_priority = fifo_priority(priority);
 		pthread_attr_setschedparam(attr, &fifo_param);
+	} else if (policy == SCHED_OTHER) {
+		// Don't inherit real-time scheduling from the emulation thread
+		pthread_attr_setinheritsched(attr, PTHREAD_EXPLICIT_SCHED);
+		pthread_attr_setschedpolicy(attr, SCHED_OTHER);
+		struct sched_param other_param;
+		other_param.sched_priority = 0;
+		pthread_attr_setschedparam(attr, &other_param);
 	}
 	if (pthread_attr_setscope(attr, PTHREAD_SCOPE_SYSTEM) != 0) {
 #ifdef PTHREAD_SCOPE_BOUND_NP
@@ -1040,6 +1291,10 @@ void Set_pthread_attr(pthread_attr_t *attr, int priority)
 #endif
 	}
 #endif
+#ifdef HAVE_PTHREAD_ATTR_SETAFFINITY_NP
+	if (helper_cpus_valid)
+		pthread_attr_setaffinity_np(attr, sizeof(helper_cpus), &helper_cpus);
+#endif
 }
 #endif // HAVE_PTHREADS
 
@@ -1124,26 +1379,10 @@ void B2_delete_mutex(B2_mutex *mutex)
 
 
 /*
- *  Interrupt flags (must be handled atomically!)
+ *  Interrupt flags
  */
 
-uint32 InterruptFlags = 0;
-
-#if EMULATED_68K
-void SetInterruptFlag(uint32 flag)
-{
-	LOCK_INTFLAGS;
-	InterruptFlags |= flag;
-	UNLOCK_INTFLAGS;
-}
-
-void ClearInterruptFlag(uint32 flag)
-{
-	LOCK_INTFLAGS;
-	InterruptFlags &= ~flag;
-	UNLOCK_INTFLAGS;
-}
-#endif
+#include "intflags_unix.h"
 
 #if !EMULATED_68K
 void TriggerInterrupt(void)
@@ -1163,9 +1402,11 @@ void TriggerNMI(void)
 
 
 /*
- *  XPRAM watchdog thread (saves XPRAM every minute)
+ *  XPRAM watchdog (saves XPRAM every minute), only needed without
+ *  pthreads, otherwise xpram.cpp saves XPRAM as soon as it changes
  */
 
+#ifndef HAVE_PTHREADS
 static void xpram_watchdog(void)
 {
 	if (memcmp(last_xpram, XPRAM, XPRAM_SIZE)) {
@@ -1173,17 +1414,6 @@ static void xpram_watchdog(void)
 		SaveXPRAM();
 	}
 }
-
-#ifdef USE_PTHREADS_SERVICES
-static void *xpram_func(void *arg)
-{
-	while (!xpram_thread_cancel) {
-		for (int i=0; i<60 && !xpram_thread_cancel; i++)
-			Delay_usec(999999);		// Only wait 1 second so we quit promptly when xpram_thread_cancel becomes true
-		xpram_watchdog();
-	}
-	return NULL;
-}
 #endif
 
 
@@ -1199,7 +1429,7 @@ static void one_second(void)
 	SetInterruptFlag(INTFLAG_1HZ);
 	TriggerInterrupt();
 
-#ifndef USE_PTHREADS_SERVICES
+#ifndef HAVE_PTHREADS
 	static int second_counter = 0;
 	if (++second_counter > 60) {
 		second_counter = 0;
@@ -1208,9 +1438,10 @@ static void one_second(void)
 #endif
 }
 
+static int tick_counter = 0;	// 60Hz ticks since the last 1Hz interrupt
+
 static void one_tick(...)
 {
-	static int tick_counter = 0;
 	if (++tick_counter > 60) {
 		tick_counter = 0;
 		one_second();
@@ -1242,6 +1473,15 @@ static void *tick_func(void *arg)
 	while (!tick_thread_cancel) {
 		one_tick();
 		next += 16625;
+		if (tickless_idle) {
+			// While MacOS is idle, sleep until it is woken up, but deliver
+			// the tick of the next 1Hz interrupt on time
+			int held = idle_tick_wait(next, 16625, 61 - tick_counter);
+			if (held > 0) {
+				tick_counter += held;
+				next = GetTicks_usec();
+			}
+		}
 		int64 delay = next - GetTicks_usec();
 		if (delay > 0)
 			Delay_usec(delay);
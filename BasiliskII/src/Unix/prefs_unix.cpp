@@ -42,8 +42,32 @@ prefs_desc platform_prefs_items[] = {
 	{"ignoresegv", TYPE_BOOLEAN, false,    "ignore illegal memory accesses"},
 #endif
 	{"idlewait", TYPE_BOOLEAN, false,      "sleep when idle"},
+	{"tickless", TYPE_BOOLEAN, false,      "hold back 60Hz interrupts while MacOS is idle"},
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+	{"emulcpus", TYPE_STRING, false,       "CPUs to run emulation thread on (e.g. \"2\" or \"0-3,8\")"},
+#endif
+#ifdef HAVE_PTHREAD_ATTR_SETAFFINITY_NP
+	{"helpercpus", TYPE_STRING, false,     "CPUs to run helper threads on"},
+#endif
+	{"emulsched", TYPE_STRING, false,      "scheduling policy of emulation thread (\"other\" or \"fifo\")"},
+	{"helpersched", TYPE_STRING, false,    "scheduling policy of helper threads (\"auto\", \"other\" or \"fifo\")"},
+	{"cpuclock", TYPE_INT32, false,        "virtual CPU clock in MHz, 0 = use host clock (needs --enable-cpu-clock)"},
+	{"cputurbo", TYPE_BOOLEAN, false,      "let virtual CPU clock run faster than real time"},
+	{"diskoverlaydir", TYPE_STRING, false, "directory for copy-on-write overlays of disk images"},
+	{"etherstats", TYPE_INT32, false,     "seconds between Ethernet statistics log lines (0 = off)"},
+	{"slirpsndbuf", TYPE_INT32, false,    "initial slirp TCP buffer towards MacOS in KB (0 = default)"},
+	{"slirprcvbuf", TYPE_INT32, false,    "slirp TCP buffer from MacOS in KB (0 = default)"},
+	{"slirpsndbufmax", TYPE_INT32, false, "maximum slirp TCP buffer towards MacOS in KB (0 = default)"},
 #ifdef USE_SDL_VIDEO
 	{"sdlrender", TYPE_STRING, false,      "SDL_Renderer driver (\"auto\", \"software\" (may be faster), etc.)"},
+#endif
+#ifdef USE_HEADLESS_VIDEO
+	{"framedump", TYPE_STRING, false,      "directory to write frames to"},
+	{"framedumpticks", TYPE_INT32, false,  "ticks between written frames (0 = only on request of the input script)"},
+	{"framedumpformat", TYPE_STRING, false, "format of written frames (\"ppm\" or \"raw\")"},
+	{"inputscript", TYPE_STRING, false,    "file of keyboard and mouse events to play back"},
+	{"vncport", TYPE_INT32, false,         "TCP port of built-in VNC server (0 = off)"},
+	{"vncaddress", TYPE_STRING, false,     "IP address the VNC server listens on (default 127.0.0.1)"},
 #endif
 	{NULL, TYPE_END, false, NULL} // End of list
 };
@@ -142,4 +166,8 @@ void AddPlatformPrefsDefaults(void)
 	PrefsAddBool("ignoresegv", false);
 #endif
 	PrefsAddBool("idlewait", true);
+#ifdef USE_HEADLESS_VIDEO
+	PrefsAddInt32("framedumpticks", 60);
+	PrefsAddString("framedumpformat", "ppm");
+#endif
 }
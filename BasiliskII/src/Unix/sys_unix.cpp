@@ -70,9 +70,9 @@
 static disk_factory *disk_factories[] = {
 #ifndef STANDALONE_GUI
 	disk_sparsebundle_factory,
-#if defined(HAVE_LIBVHD)
 	disk_vhd_factory,
-#endif
+	disk_cow_factory,
+	disk_mmap_factory,	// must come last, it accepts any plain file
 #endif
 	NULL
 };
@@ -570,7 +570,10 @@ void *Sys_open(const char *name, bool read_only)
 
 	D(bug("Sys_open(%s, %s)\n", name, read_only ? "read-only" : "read/write"));
 
-	// Check if write access is allowed, set read-only flag if not
+	// Check if write access is allowed, set read-only flag if not (disk
+	// factories get the requested mode, an overlay makes read-only images
+	// writable)
+	bool requested_read_only = read_only;
 	if (!read_only && access(name, W_OK))
 		read_only = true;
 
@@ -608,7 +611,7 @@ void *Sys_open(const char *name, bool read_only)
 	for (int i = 0; disk_factories[i]; ++i) {
 		disk_factory *f = disk_factories[i];
 		disk_generic *generic;
-		disk_generic::status st = f(name, read_only, &generic);
+		disk_generic::status st = f(name, requested_read_only, &generic);
 		if (st == disk_generic::DISK_INVALID)
 			return NULL;
 		if (st == disk_generic::DISK_VALID) {
@@ -661,8 +664,7 @@ void *Sys_open(const char *name, bool read_only)
 			loff_t size = 0;
 			size = lseek(fd, 0, SEEK_END);
 			uint8 data[256];
-			lseek(fd, 0, SEEK_SET);
-			read(fd, data, 256);
+			pread(fd, data, 256, 0);
 			FileDiskLayout(size, data, fh->start_byte, fh->file_size);
 		} else {
 			struct stat st;
@@ -759,13 +761,10 @@ size_t Sys_read(void *arg, void *buffer, loff_t offset, size_t length)
 
 	if (fh->generic_disk)
 		return fh->generic_disk->read(buffer, offset, length);
-	
-	// Seek to position
-	if (lseek(fh->fd, offset + fh->start_byte, SEEK_SET) < 0)
-		return 0;
 
-	// Read data
-	return read(fh->fd, buffer, length);
+	// Read data (positional I/O, the file offset is left untouched)
+	ssize_t actual = pread(fh->fd, buffer, length, offset + fh->start_byte);
+	return actual < 0 ? 0 : actual;
 }
 
 
@@ -783,12 +782,9 @@ size_t Sys_write(void *arg, void *buffer, loff_t offset, size_t length)
 	if (fh->generic_disk)
 		return fh->generic_disk->write(buffer, offset, length);
 
-	// Seek to position
-	if (lseek(fh->fd, offset + fh->start_byte, SEEK_SET) < 0)
-		return 0;
-
-	// Write data
-	return write(fh->fd, buffer, length);
+	// Write data (positional I/O, the file offset is left untouched)
+	ssize_t actual = pwrite(fh->fd, buffer, length, offset + fh->start_byte);
+	return actual < 0 ? 0 : actual;
 }
 
 
@@ -976,12 +972,11 @@ bool SysIsDiskInserted(void *arg)
 #if defined(__linux__)
 	} else if (fh->is_floppy) {
 		char block[512];
-		lseek(fh->fd, 0, SEEK_SET);
-		ssize_t actual = read(fh->fd, block, 512);
+		ssize_t actual = pread(fh->fd, block, 512, 0);
 		if (actual < 0) {
 			close(fh->fd);	// Close and reopen so the driver will see the media change
 			fh->fd = open(fh->name, fh->read_only ? O_RDONLY : O_RDWR);
-			actual = read(fh->fd, block, 512);
+			actual = pread(fh->fd, block, 512, 0);
 		}
 		return actual == 512;
 	} else if (fh->is_cdrom) {
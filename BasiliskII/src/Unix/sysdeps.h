@@ -118,7 +118,7 @@
 #define USE_PTHREADS_SERVICES
 #endif
 #if EMULATED_68K
-#if defined(__NetBSD__)
+#if defined(__NetBSD__) || defined(ENABLE_CPU_CLOCK)
 #define USE_CPU_EMUL_SERVICES
 #endif
 #endif
@@ -126,6 +126,17 @@
 #undef USE_PTHREADS_SERVICES
 #endif
 
+/* Interrupts are triggered from other threads, update spcflags atomically */
+#ifdef HAVE_PTHREADS
+#define ENABLE_EXCLUSIVE_SPCFLAGS 1
+#endif
+
+/* Time Manager tasks are triggered by a thread at their exact deadline */
+#if defined(USE_PTHREADS_SERVICES) && defined(HAVE_CLOCK_GETTIME) && !defined(__MACH__)
+#define PRECISE_TIMING 1
+#define PRECISE_TIMING_POSIX 1
+#endif
+
 
 /* Data types */
 typedef unsigned char uint8;
@@ -220,6 +231,10 @@ typedef uae_u32 uaecptr;
 /* Timing functions */
 extern uint64 GetTicks_usec(void);
 extern void Delay_usec(uint64 usec);
+#if defined(USE_CPU_EMUL_SERVICES) && defined(__cplusplus)
+extern bool GetVirtualTicks_usec(uint64 &usec);
+extern void cpu_idle_skip(void);
+#endif
 
 /* Spinlocks */
 #ifdef __GNUC__
@@ -0,0 +1,175 @@
+/*
+ *  test_intflags.cpp - Stress test for interrupt flags and spcflags
+ *
+ *  Basilisk II (C) 1997-2008 Christian Bauer
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ *  Producer threads (like the 60Hz, Ethernet and audio threads) raise
+ *  interrupt flags and trigger interrupts, while a CPU thread runs the
+ *  protocol of m68k_do_specialties() and the interrupt handler, and keeps
+ *  setting and clearing other spcflags like the emulated CPU does.
+ *  After the producers are done, every flag must have been handled after
+ *  it was raised the last time.
+ *
+ *  Build with "make test_intflags" in the Unix directory, run with
+ *  optional thread count and raises per thread. Define
+ *  TEST_PLAIN_SPCFLAGS to see the test fail with the old non-atomic
+ *  spcflags macros.
+ */
+
+#include "sysdeps.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+#include <atomic>
+
+#ifdef TEST_PLAIN_SPCFLAGS
+#undef ENABLE_EXCLUSIVE_SPCFLAGS
+#endif
+
+// The parts of the CPU state used by spcflags.h
+struct {
+	uae_u32 spcflags;
+} regs;
+
+#include "spcflags.h"
+
+// SetInterruptFlag() and ClearInterruptFlag() of main_unix.cpp
+#include "intflags_unix.h"
+
+const int MAX_THREADS = 32;					// One interrupt flag per producer thread
+
+static std::atomic<uint32> raised[MAX_THREADS];	// Sequence number of last raise, per producer
+static uint32 handled[MAX_THREADS];				// Sequence number seen when flag was last handled (CPU thread)
+static std::atomic<bool> producers_done(false);
+
+static void TriggerInterrupt(void)
+{
+	SPCFLAGS_SET(SPCFLAG_INT);
+}
+
+struct producer {
+	pthread_t thread;
+	int index;
+	uint32 count;
+};
+
+static void *producer_func(void *arg)
+{
+	producer *p = (producer *)arg;
+	for (uint32 i = 1; i <= p->count; i++) {
+		raised[p->index] = i;
+		SetInterruptFlag(1 << p->index);
+		TriggerInterrupt();
+		if ((i & 0xff) == 0)
+			sched_yield();
+	}
+	return NULL;
+}
+
+// Handle interrupt flags, as the MacOS interrupt handler does through EMUL_OP_IRQ
+static void handle_interrupts(void)
+{
+	uint32 flags = __atomic_load_n(&InterruptFlags, __ATOMIC_SEQ_CST);
+	for (int i = 0; i < MAX_THREADS; i++) {
+		if (flags & (1 << i)) {
+			ClearInterruptFlag(1 << i);
+			handled[i] = raised[i];
+		}
+	}
+}
+
+// One round of m68k_do_specialties(), returns false if no interrupt was pending
+static bool cpu_specialties(void)
+{
+	bool pending = false;
+	if (SPCFLAGS_TEST(SPCFLAG_DOINT)) {
+		SPCFLAGS_CLEAR(SPCFLAG_DOINT);
+		if (InterruptFlags)		// intlev()
+			handle_interrupts();
+		pending = true;
+	}
+	if (SPCFLAGS_TEST(SPCFLAG_INT)) {
+		SPCFLAGS_CLEAR(SPCFLAG_INT);
+		SPCFLAGS_SET(SPCFLAG_DOINT);
+		pending = true;
+	}
+	return pending;
+}
+
+static void *cpu_func(void *arg)
+{
+	for (;;) {
+		bool done = producers_done;
+
+		// Instructions update other spcflags all the time
+		SPCFLAGS_SET(SPCFLAG_TRACE);
+		SPCFLAGS_CLEAR(SPCFLAG_TRACE);
+
+		if (!cpu_specialties() && done && !SPCFLAGS_TEST(SPCFLAG_INT | SPCFLAG_DOINT))
+			break;
+	}
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	int n_threads = argc > 1 ? atoi(argv[1]) : 8;
+	uint32 count = argc > 2 ? strtoul(argv[2], NULL, 0) : 1000000;
+	if (n_threads < 1 || n_threads > MAX_THREADS) {
+		fprintf(stderr, "Usage: %s [threads (1..%d) [raises per thread]]\n", argv[0], MAX_THREADS);
+		return 2;
+	}
+	printf("%d producer threads, %u raises each%s\n", n_threads, count,
+#if ENABLE_EXCLUSIVE_SPCFLAGS
+		   ""
+#else
+		   ", plain spcflags"
+#endif
+		   );
+
+	pthread_t cpu_thread;
+	pthread_create(&cpu_thread, NULL, cpu_func, NULL);
+	producer p[MAX_THREADS];
+	for (int i = 0; i < n_threads; i++) {
+		p[i].index = i;
+		p[i].count = count;
+		pthread_create(&p[i].thread, NULL, producer_func, &p[i]);
+	}
+	for (int i = 0; i < n_threads; i++)
+		pthread_join(p[i].thread, NULL);
+	producers_done = true;
+	pthread_join(cpu_thread, NULL);
+
+	int lost = 0;
+	for (int i = 0; i < n_threads; i++) {
+		if (handled[i] != count || (InterruptFlags & (1 << i))) {
+			printf("Thread %d: last raise %u, last handled %u, flag %s\n", i, count, handled[i],
+				   (InterruptFlags & (1 << i)) ? "still set" : "clear");
+			lost++;
+		}
+	}
+	if (lost) {
+		printf("FAILED: %d interrupts lost\n", lost);
+		return 1;
+	}
+	printf("OK: no interrupt lost\n");
+	return 0;
+}
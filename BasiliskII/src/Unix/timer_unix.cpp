@@ -19,10 +19,12 @@
  */
 
 #include "sysdeps.h"
+#include "main.h"
 #include "macos_util.h"
 #include "timer.h"
 
 #include <errno.h>
+#include <atomic>
 
 #define DEBUG 0
 #include "debug.h"
@@ -57,6 +59,14 @@ static inline void mach_current_time(tm_time_t &t) {
 void Microseconds(uint32 &hi, uint32 &lo)
 {
 	D(bug("Microseconds\n"));
+#ifdef USE_CPU_EMUL_SERVICES
+	uint64 vl;
+	if (GetVirtualTicks_usec(vl)) {
+		hi = vl >> 32;
+		lo = vl;
+		return;
+	}
+#endif
 #if defined(__MACH__)
 	tm_time_t t;
 	mach_current_time(t);
@@ -91,6 +101,18 @@ uint32 TimerDateTime(void)
 
 void timer_current_time(tm_time_t &t)
 {
+#ifdef USE_CPU_EMUL_SERVICES
+	uint64 vl;
+	if (GetVirtualTicks_usec(vl)) {
+		t.tv_sec = vl / 1000000;
+#if defined(HAVE_CLOCK_GETTIME) || defined(__MACH__)
+		t.tv_nsec = (vl % 1000000) * 1000;
+#else
+		t.tv_usec = vl % 1000000;
+#endif
+		return;
+	}
+#endif
 #if defined(__MACH__)
 	mach_current_time(t);
 #elif defined(HAVE_CLOCK_GETTIME)
@@ -335,6 +357,10 @@ void Delay_usec(uint64 usec)
 #define IDLE_USES_COND_WAIT 1
 static pthread_mutex_t idle_lock = PTHREAD_MUTEX_INITIALIZER;
 static pthread_cond_t idle_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t idle_tick_cond = PTHREAD_COND_INITIALIZER;	// Wakes 60Hz thread held back by idle_tick_wait()
+static bool idle_wakeup = false;					// Flag: idle_resume() called, protected by idle_lock
+static bool idle_sleeping = false;					// Flag: emulator thread is suspended in idle_wait(), protected by idle_lock
+static bool idle_tick_release = false;				// Flag: idle_resume() called, stop holding back ticks, protected by idle_lock
 #elif defined(HAVE_SEM_INIT)
 #define IDLE_USES_SEMAPHORE 1
 #include <semaphore.h>
@@ -352,11 +378,25 @@ static int idle_sem_ok = -1;
 #endif
 #endif
 
+// Ticks held back by idle_tick_wait() since the last delivered tick
+static std::atomic<uint32> idle_skipped(0);
+
 void idle_wait(void)
 {
+#ifdef USE_CPU_EMUL_SERVICES
+	// Nothing else drives the clock, skip ahead instead of sleeping
+	cpu_idle_skip();
+	return;
+#endif
 #ifdef IDLE_USES_COND_WAIT
 	pthread_mutex_lock(&idle_lock);
-	pthread_cond_wait(&idle_cond, &idle_lock);
+	if (!idle_wakeup) {
+		idle_sleeping = true;
+		while (!idle_wakeup)
+			pthread_cond_wait(&idle_cond, &idle_lock);
+		idle_sleeping = false;
+	}
+	idle_wakeup = false;
 	pthread_mutex_unlock(&idle_lock);
 #else
 #ifdef IDLE_USES_SEMAPHORE
@@ -385,7 +425,12 @@ void idle_wait(void)
 void idle_resume(void)
 {
 #ifdef IDLE_USES_COND_WAIT
+	pthread_mutex_lock(&idle_lock);
+	idle_wakeup = true;
 	pthread_cond_signal(&idle_cond);
+	idle_tick_release = true;
+	pthread_cond_signal(&idle_tick_cond);
+	pthread_mutex_unlock(&idle_lock);
 #else
 #ifdef IDLE_USES_SEMAPHORE
 	LOCK_IDLE;
@@ -399,3 +444,70 @@ void idle_resume(void)
 #endif
 #endif
 }
+
+
+/*
+ *  Tickless idle: called by the 60Hz thread instead of sleeping until the
+ *  next tick is due at "next" (in GetTicks_usec() time). While the emulator
+ *  thread is suspended in idle_wait(), the 60Hz thread keeps sleeping until
+ *  idle_resume() is called (by an interrupt source or the Time Manager
+ *  thread), so input still moves the cursor promptly, or "max_ticks" ticks
+ *  are due. Returns the number of ticks that
+ *  were held back; they are added to Ticks when the next one is delivered.
+ */
+
+#ifdef IDLE_USES_COND_WAIT
+static void idle_tick_cleanup(void *arg)
+{
+	pthread_mutex_unlock(&idle_lock);
+}
+#endif
+
+int idle_tick_wait(uint64 next, uint32 period, int max_ticks)
+{
+#ifdef IDLE_USES_COND_WAIT
+	bool held = false;
+	pthread_mutex_lock(&idle_lock);
+	pthread_cleanup_push(idle_tick_cleanup, NULL);
+	idle_tick_release = false;		// Covered by the tick just delivered
+	for (;;) {
+		uint64 until = next;
+		if (idle_sleeping && !idle_wakeup && !idle_tick_release && max_ticks > 1) {
+			until = next + (uint64)(max_ticks - 1) * period;
+			held = true;
+		}
+		uint64 now = GetTicks_usec();
+		if (now >= until)
+			break;
+
+		// GetTicks_usec() need not be based on CLOCK_REALTIME
+		struct timespec ts;
+		clock_gettime(CLOCK_REALTIME, &ts);
+		uint64 wakeup = (uint64)ts.tv_sec * 1000000 + ts.tv_nsec / 1000 + (until - now);
+		ts.tv_sec = wakeup / 1000000;
+		ts.tv_nsec = (wakeup % 1000000) * 1000;
+		pthread_cond_timedwait(&idle_tick_cond, &idle_lock, &ts);
+	}
+	pthread_cleanup_pop(1);
+	if (!held)
+		return 0;
+
+	int64 late = GetTicks_usec() - next;
+	int ticks = late > 0 ? late / period : 0;
+	if (ticks > max_ticks - 1)
+		ticks = max_ticks - 1;
+	idle_skipped += ticks;
+	return ticks;
+#else
+	// No way to find out whether the emulator thread sleeps, deliver every tick
+	int64 delay = next - GetTicks_usec();
+	if (delay > 0)
+		Delay_usec(delay);
+	return 0;
+#endif
+}
+
+uint32 idle_ticks_skipped(void)
+{
+	return idle_skipped.exchange(0);
+}
@@ -1,5 +1,5 @@
 /*
- * vhd_unix.cpp -- support for disk images in vhd format 
+ * vhd_unix.cpp -- support for disk images in vhd format
  *
  *	(C) 2010 Geoffrey Brown
  *
@@ -18,143 +18,546 @@
  *	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
  */
 
+/*
+ *  Fixed and dynamic VHD images are handled natively. For dynamic images
+ *  the block allocation table (BAT) and the sector bitmaps of the blocks
+ *  in use are kept in memory. Newly allocated blocks get a full sector
+ *  bitmap and read as zeros (the file is extended sparsely), so ordinary
+ *  writes never touch metadata. The only metadata changes, BAT entries
+ *  of new blocks and bitmap bits of partially used blocks created by
+ *  other tools, are collected and written out lazily by a helper thread
+ *  at most VHD_FLUSH_DELAY seconds after the first change: all data is
+ *  synced to disk before the metadata referring to it. The thread only
+ *  holds the metadata lock while it takes a copy of the changes, so disk
+ *  I/O of the emulator doesn't wait for the syncs. The footer is
+ *  moved to the end of the file right away whenever a block is added,
+ *  so the image stays valid at all times.
+ */
+
 #include "sysdeps.h"
 #include "disk_unix.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
-extern "C" {
-#include <libvhd.h>
-}
-// libvhd.h defines DEBUG
-#undef DEBUG
+#include <time.h>
+#include <errno.h>
+#include <limits.h>
+#include <algorithm>
+#include <vector>
+
+#ifdef HAVE_PTHREADS
+#include <pthread.h>
+#endif
+
+#if defined(HAVE_PREADV) || defined(HAVE_PWRITEV)
+#include <sys/uio.h>
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+#endif
+
 #define DEBUG 0
 #include "debug.h"
 
-static disk_generic::status vhd_unix_open(const char *name, int *size,
-	bool read_only, vhd_context_t **ctx)
-{
-	int amode = read_only ? R_OK : (R_OK | W_OK);
-	int fid;
-	vhd_context_t *vhd;
+const int VHD_SECTOR_SIZE = 512;
+const uint32 VHD_TYPE_FIXED = 2;
+const uint32 VHD_TYPE_DYNAMIC = 3;
+const uint32 VHD_TYPE_DIFF = 4;
+const uint32 BAT_UNUSED = 0xffffffff;
 
-	D(bug("vhd open %s\n", name));
+// Metadata changes are written out at most this many seconds late
+const time_t VHD_FLUSH_DELAY = 1;
 
-	if (access(name, amode)) {
-		D(bug("vhd open -- incorrect permissions %s\n", name));
-		return disk_generic::DISK_UNKNOWN;
+struct disk_vhd : disk_generic {
+	disk_vhd(int fd, bool read_only, const uint8 *footer)
+	: fd(fd), read_only(read_only), dynamic(false), bat_dirty_lo(-1),
+		bat_dirty_hi(-1), bitmaps_dirty(false), dirty_since(0), flush_thread_active(false) {
+		memcpy(this->footer, footer, VHD_SECTOR_SIZE);
+		file_size = get_be64(footer + 48);
+#ifdef HAVE_PTHREADS
+		pthread_mutex_init(&lock, NULL);
+		pthread_cond_init(&dirty_cond, NULL);
+		flush_quit = false;
+#endif
 	}
-  
-	if (! (fid = open(name, O_RDONLY))) { 
-		D(bug("vhd open -- couldn't open file %s\n", name));
-		return disk_generic::DISK_UNKNOWN;
-	} 
-	else {
-		char buf[9];
-		read(fid, buf, sizeof(buf)-1);
-		buf[8] = 0;
-		close(fid);
-		if (strcmp("conectix", buf) != 0) {
-			D(bug("vhd open -- not vhd magic = %s\n", buf));
-			return disk_generic::DISK_UNKNOWN;
-		}
-		if (vhd = (vhd_context_t *) malloc(sizeof(vhd_context_t))) {
-			int err;
-			if (err = vhd_open(vhd, name, read_only ? 
-								VHD_OPEN_RDONLY : VHD_OPEN_RDWR)) {
-				D(bug("vhd_open failed (%d)\n", err));
-				free(vhd);
-				return disk_generic::DISK_INVALID;
-			} 
-			else {
-				*size = (int) vhd->footer.curr_size;
-				printf("VHD Open %s\n", name);
-				*ctx = vhd;
-				return disk_generic::DISK_VALID;
-			}
-		}
-		else {
-			D(bug("vhd open -- malloc failed\n"));
-			return disk_generic::DISK_INVALID;
+
+	virtual ~disk_vhd() {
+#ifdef HAVE_PTHREADS
+		if (flush_thread_active) {
+			pthread_mutex_lock(&lock);
+			flush_quit = true;
+			pthread_cond_signal(&dirty_cond);
+			pthread_mutex_unlock(&lock);
+			pthread_join(flush_thread, NULL);
 		}
+#endif
+		flush();
+#ifdef HAVE_PTHREADS
+		pthread_cond_destroy(&dirty_cond);
+		pthread_mutex_destroy(&lock);
+#endif
+		for (size_t i = 0; i < bitmaps.size(); ++i)
+			delete[] bitmaps[i];
+		close(fd);
 	}
-}
 
-static int vhd_unix_read(vhd_context_t *ctx, void *buffer, loff_t offset,
-	size_t length)
-{
-	int err;
-	if ((offset % VHD_SECTOR_SIZE) || (length % VHD_SECTOR_SIZE)) {
-		printf("vhd read only supported on sector boundaries (%d)\n",
-				VHD_SECTOR_SIZE);
-		return 0;
-	}	
-	if (err = vhd_io_read(ctx, (char *) buffer, offset / VHD_SECTOR_SIZE, 
-							length / VHD_SECTOR_SIZE)){
-		D(bug("vhd read error %d\n", err));	
-		return err;
-	}
-	else 
-		return length;
-}
+	virtual bool is_read_only() { return read_only; }
+	virtual loff_t size() { return file_size; }
 
-static int vhd_unix_write(vhd_context_t *ctx, void *buffer, loff_t offset,
-	size_t length)
-{
-	int err;
-
-	if ((offset % VHD_SECTOR_SIZE) || (length % VHD_SECTOR_SIZE)) {
-		printf("vhd write only supported on sector boundaries (%d)\n",
-				VHD_SECTOR_SIZE);
-		return 0;
-	}	
-	if (err = vhd_io_write(ctx, (char *) buffer, offset/VHD_SECTOR_SIZE,
-							length/VHD_SECTOR_SIZE)) {
-		D(bug("vhd write error %d\n", err));
-		return err;
-	}
-	else
-		return length;
-}
+	// Load dynamic disk header and BAT
+	bool init_dynamic(loff_t header_offset, loff_t end) {
+		uint8 header[1024];
+		if (pread(fd, header, sizeof(header), header_offset) != sizeof(header)
+				|| memcmp(header, "cxsparse", 8) != 0) {
+			fprintf(stderr, "vhd: bad dynamic disk header\n");
+			return false;
+		}
+		bat_offset = get_be64(header + 16);
+		uint32 entries = get_be32(header + 28);
+		block_size = get_be32(header + 32);
+		if (block_size < VHD_SECTOR_SIZE || (block_size & (block_size - 1))
+				|| (loff_t)entries * block_size < file_size) {
+			fprintf(stderr, "vhd: bad block size or table\n");
+			return false;
+		}
+		sectors_per_block = block_size / VHD_SECTOR_SIZE;
+		bitmap_size = (sectors_per_block / 8 + VHD_SECTOR_SIZE - 1) & ~(VHD_SECTOR_SIZE - 1);
 
+		std::vector<uint8> raw((size_t)entries * 4);
+		if (pread(fd, &raw[0], raw.size(), bat_offset) != (ssize_t)raw.size()) {
+			fprintf(stderr, "vhd: can't read block allocation table\n");
+			return false;
+		}
+		bat.resize(entries);
+		bitmaps.resize(entries, NULL);
+		bitmap_dirty.resize(entries, false);
+		for (uint32 i = 0; i < entries; ++i)
+			bat[i] = get_be32(&raw[i * 4]);
 
-static void vhd_unix_close(vhd_context_t *ctx)
-{
-	D(bug("vhd close\n"));
-	vhd_close(ctx);
-	free(ctx);
-}
+		// New blocks go where the footer is now
+		next_block = end - VHD_SECTOR_SIZE;
+		dynamic = true;
 
+#ifdef HAVE_PTHREADS
+		// Metadata changes are written out by a helper thread
+		if (!read_only) {
+			pthread_attr_t attr;
+			Set_pthread_attr(&attr, 0);
+			flush_thread_active = (pthread_create(&flush_thread, &attr, flush_func, this) == 0);
+			pthread_attr_destroy(&attr);
+			if (!flush_thread_active)
+				fprintf(stderr, "vhd: can't start flush thread, metadata is written on close\n");
+		}
+#endif
+		return true;
+	}
 
-struct disk_vhd : disk_generic {
-	disk_vhd(vhd_context_t *ctx, bool read_only, loff_t size)
-	: ctx(ctx), read_only(read_only), file_size(size) { }
-	
-	virtual ~disk_vhd() { vhd_unix_close(ctx); }
-	virtual bool is_read_only() { return read_only; }
-	virtual loff_t size() { return file_size; }
-	
 	virtual size_t read(void *buf, loff_t offset, size_t length) {
-		return vhd_unix_read(ctx, buf, offset, length);
+		if (offset < 0 || offset >= file_size)
+			return 0;
+		length = std::min((loff_t)length, file_size - offset);
+		if (!dynamic) {
+			ssize_t actual = pread(fd, buf, length, offset);
+			return actual < 0 ? 0 : actual;
+		}
+
+		lock_metadata();
+		uint8 *b = (uint8 *)buf;
+		size_t done = 0;
+		while (done < length) {
+			loff_t pos = offset + done;
+			uint32 block = pos / block_size;
+			size_t start = pos % block_size;
+			size_t len = std::min((size_t)block_size - start, length - done);
+
+			if (bat[block] == BAT_UNUSED) {
+				memset(b + done, 0, len);
+			} else if (!(len = read_run(b + done, block, start, length - done))) {
+				break;
+			}
+			done += len;
+		}
+		unlock_metadata();
+		return done;
 	}
-	
+
 	virtual size_t write(void *buf, loff_t offset, size_t length) {
-		return vhd_unix_write(ctx, buf, offset, length);
+		if (read_only || offset < 0 || offset >= file_size)
+			return 0;
+		length = std::min((loff_t)length, file_size - offset);
+		if (!dynamic) {
+			ssize_t actual = pwrite(fd, buf, length, offset);
+			return actual < 0 ? 0 : actual;
+		}
+
+		lock_metadata();
+		const uint8 *b = (const uint8 *)buf;
+		size_t done = 0;
+		while (done < length) {
+			loff_t pos = offset + done;
+			uint32 block = pos / block_size;
+			size_t start = pos % block_size;
+			size_t len = std::min((size_t)block_size - start, length - done);
+
+			if (bat[block] == BAT_UNUSED) {
+				// Unallocated blocks read as zeros, don't allocate for nothing
+				if (is_zero(b + done, len)) {
+					done += len;
+					continue;
+				}
+				if (!allocate_block(block))
+					break;
+			}
+			if (!(len = write_run(b + done, block, start, length - done)))
+				break;
+			done += len;
+		}
+
+		// Without the helper thread, metadata is written out from here
+		bool flush_now = !flush_thread_active && dirty_since && time(NULL) - dirty_since >= VHD_FLUSH_DELAY;
+		unlock_metadata();
+		if (flush_now)
+			flush();
+		return done;
 	}
 
 protected:
-	vhd_context_t *ctx;
+	int fd;
 	bool read_only;
-	loff_t file_size;
+	uint8 footer[VHD_SECTOR_SIZE];	// copy of the footer, rewritten when the file grows
+	loff_t file_size;			// size of the emulated disk
+
+	// Dynamic disks only
+	bool dynamic;
+	uint32 block_size;
+	uint32 sectors_per_block;
+	uint32 bitmap_size;			// sector bitmap in front of each block, padded to sectors
+	loff_t bat_offset;
+	std::vector<uint32> bat;	// block allocation table, in sectors
+	std::vector<uint8 *> bitmaps;	// sector bitmaps of blocks used so far
+	std::vector<bool> bitmap_dirty;
+	loff_t next_block;			// where to put the next new block
+	long bat_dirty_lo, bat_dirty_hi;	// range of BAT entries to write out
+	bool bitmaps_dirty;
+	time_t dirty_since;			// when metadata was first changed, or 0
+	bool flush_thread_active;	// metadata is written out by flush_func()
+
+	// Copy of the metadata changes, written out without holding the lock
+	struct metadata_copy {
+		loff_t bat_pos;			// BAT entries and where they go
+		std::vector<uint8> bat_raw;
+		std::vector<std::pair<loff_t, std::vector<uint8> > > bitmaps;
+	};
+
+#ifdef HAVE_PTHREADS
+	pthread_mutex_t lock;		// protects the metadata of dynamic disks
+	pthread_cond_t dirty_cond;	// signalled when metadata becomes dirty
+	pthread_t flush_thread;
+	bool flush_quit;
+
+	// Write out metadata changes VHD_FLUSH_DELAY seconds after the first one
+	static void *flush_func(void *arg) {
+		disk_vhd *vhd = (disk_vhd *)arg;
+		pthread_mutex_lock(&vhd->lock);
+		while (!vhd->flush_quit) {
+			if (!vhd->dirty_since) {
+				pthread_cond_wait(&vhd->dirty_cond, &vhd->lock);
+				continue;
+			}
+			struct timespec deadline;
+			deadline.tv_sec = vhd->dirty_since + VHD_FLUSH_DELAY;
+			deadline.tv_nsec = 0;
+			if (pthread_cond_timedwait(&vhd->dirty_cond, &vhd->lock, &deadline) == ETIMEDOUT) {
+				metadata_copy changes;
+				vhd->take_changes(changes);
+				pthread_mutex_unlock(&vhd->lock);
+				vhd->write_metadata(changes);
+				pthread_mutex_lock(&vhd->lock);
+			}
+		}
+		pthread_mutex_unlock(&vhd->lock);
+		return NULL;
+	}
+
+	void lock_metadata() { pthread_mutex_lock(&lock); }
+	void unlock_metadata() { pthread_mutex_unlock(&lock); }
+#else
+	void lock_metadata() { }
+	void unlock_metadata() { }
+#endif
+
+	static uint32 get_be32(const uint8 *p) {
+		return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+	}
+
+	static uint64 get_be64(const uint8 *p) {
+		return ((uint64)get_be32(p) << 32) | get_be32(p + 4);
+	}
+
+	static void put_be32(uint8 *p, uint32 v) {
+		p[0] = v >> 24; p[1] = v >> 16; p[2] = v >> 8; p[3] = v;
+	}
+
+	static bool is_zero(const uint8 *p, size_t len) {
+		for (size_t i = 0; i < len; ++i)
+			if (p[i])
+				return false;
+		return true;
+	}
+
+	loff_t data_offset(uint32 block) {
+		return (loff_t)bat[block] * VHD_SECTOR_SIZE + bitmap_size;
+	}
+
+	// Get the sector bitmap of an allocated block
+	uint8 *get_bitmap(uint32 block) {
+		if (bitmaps[block] == NULL) {
+			uint8 *bm = new uint8[bitmap_size];
+			if (pread(fd, bm, bitmap_size, (loff_t)bat[block] * VHD_SECTOR_SIZE) != (ssize_t)bitmap_size)
+				memset(bm, 0xff, bitmap_size);
+			bitmaps[block] = bm;
+		}
+		return bitmaps[block];
+	}
+
+	bool sector_present(uint32 block, uint32 sector) {
+		return get_bitmap(block)[sector / 8] & (0x80 >> (sector % 8));
+	}
+
+	bool block_full(uint32 block) {
+		const uint8 *bm = get_bitmap(block);
+		for (uint32 i = 0; i < sectors_per_block / 8; ++i)
+			if (bm[i] != 0xff)
+				return false;
+		return true;
+	}
+
+	// Read from allocated blocks starting at the given one; physically
+	// consecutive full blocks are read with one vectored call
+	size_t read_run(uint8 *buf, uint32 block, size_t start, size_t length) {
+		if (!block_full(block)) {
+			// Sectors not present in the image read as zeros
+			size_t len = std::min((size_t)block_size - start, length);
+			size_t done = 0;
+			while (done < len) {
+				uint32 sector = (start + done) / VHD_SECTOR_SIZE;
+				size_t n = std::min((size_t)VHD_SECTOR_SIZE - (start + done) % VHD_SECTOR_SIZE, len - done);
+				if (!sector_present(block, sector))
+					memset(buf + done, 0, n);
+				else if (pread(fd, buf + done, n, data_offset(block) + start + done) != (ssize_t)n)
+					return 0;
+				done += n;
+			}
+			return len;
+		}
+
+#ifdef HAVE_PREADV
+		struct iovec iov[IOV_MAX];
+		std::vector<uint8> skip(bitmap_size);
+		int n = 0;
+		size_t len = std::min((size_t)block_size - start, length);
+		iov[n].iov_base = buf;
+		iov[n++].iov_len = len;
+		uint32 b = block;
+		while (len < length && n + 2 <= IOV_MAX && b + 1 < bat.size()
+				&& bat[b + 1] == bat[b] + (bitmap_size + block_size) / VHD_SECTOR_SIZE
+				&& block_full(b + 1)) {
+			size_t seg = std::min((size_t)block_size, length - len);
+			iov[n].iov_base = &skip[0];
+			iov[n++].iov_len = bitmap_size;
+			iov[n].iov_base = buf + len;
+			iov[n++].iov_len = seg;
+			len += seg;
+			++b;
+		}
+		ssize_t want = len + (b - block) * bitmap_size;
+		if (preadv(fd, iov, n, data_offset(block) + start) != want)
+			return 0;
+		return len;
+#else
+		size_t len = std::min((size_t)block_size - start, length);
+		if (pread(fd, buf, len, data_offset(block) + start) != (ssize_t)len)
+			return 0;
+		return len;
+#endif
+	}
+
+	// Write to allocated blocks starting at the given one; physically
+	// consecutive full blocks are written with one vectored call. Their
+	// bitmaps, which lie in between, are rewritten unchanged.
+	size_t write_run(const uint8 *buf, uint32 block, size_t start, size_t length) {
+		size_t len = std::min((size_t)block_size - start, length);
+#ifdef HAVE_PWRITEV
+		struct iovec iov[IOV_MAX];
+		int n = 0;
+		iov[n].iov_base = (void *)buf;
+		iov[n++].iov_len = len;
+		uint32 b = block;
+		while (len < length && n + 2 <= IOV_MAX && b + 1 < bat.size()) {
+			size_t seg = std::min((size_t)block_size, length - len);
+			if (bat[b + 1] == BAT_UNUSED && (is_zero(buf + len, seg) || !allocate_block(b + 1)))
+				break;
+			if (bat[b + 1] != bat[b] + (bitmap_size + block_size) / VHD_SECTOR_SIZE
+					|| !block_full(b + 1) || bitmap_dirty[b + 1])
+				break;
+			iov[n].iov_base = bitmaps[b + 1];
+			iov[n++].iov_len = bitmap_size;
+			iov[n].iov_base = (void *)(buf + len);
+			iov[n++].iov_len = seg;
+			len += seg;
+			++b;
+		}
+		ssize_t want = len + (b - block) * bitmap_size;
+		if (pwritev(fd, iov, n, data_offset(block) + start) != want)
+			return 0;
+#else
+		if (pwrite(fd, buf, len, data_offset(block) + start) != (ssize_t)len)
+			return 0;
+#endif
+		mark_sectors(block, start, std::min((size_t)block_size - start, length));
+		return len;
+	}
+
+	// Append a new block to the image
+	bool allocate_block(uint32 block) {
+		loff_t pos = next_block;
+		loff_t end = pos + bitmap_size + block_size;
+
+		// Footer first, so a crash leaves at worst an unreferenced block
+		if (pwrite(fd, footer, VHD_SECTOR_SIZE, end) != VHD_SECTOR_SIZE)
+			return false;
+		uint8 *bm = new uint8[bitmap_size];
+		memset(bm, 0xff, bitmap_size);
+		if (pwrite(fd, bm, bitmap_size, pos) != (ssize_t)bitmap_size) {
+			delete[] bm;
+			return false;
+		}
+		D(bug("vhd: block %u allocated at %lld\n", block, (long long)pos));
+
+		delete[] bitmaps[block];
+		bitmaps[block] = bm;
+		bat[block] = pos / VHD_SECTOR_SIZE;
+		next_block = end;
+		if (bat_dirty_lo < 0 || block < bat_dirty_lo)
+			bat_dirty_lo = block;
+		if ((long)block > bat_dirty_hi)
+			bat_dirty_hi = block;
+		set_dirty();
+		return true;
+	}
+
+	// Mark sectors as present in the block's bitmap
+	void mark_sectors(uint32 block, size_t start, size_t len) {
+		uint8 *bm = get_bitmap(block);
+		uint32 last = (start + len - 1) / VHD_SECTOR_SIZE;
+		for (uint32 s = start / VHD_SECTOR_SIZE; s <= last; ++s) {
+			uint8 bit = 0x80 >> (s % 8);
+			if (!(bm[s / 8] & bit)) {
+				bm[s / 8] |= bit;
+				bitmap_dirty[block] = true;
+				bitmaps_dirty = true;
+				set_dirty();
+			}
+		}
+	}
+
+	void set_dirty() {
+		if (!dirty_since) {
+			dirty_since = time(NULL);
+#ifdef HAVE_PTHREADS
+			pthread_cond_signal(&dirty_cond);
+#endif
+		}
+	}
+
+	// Take a copy of the metadata changes and mark them written, lock held
+	void take_changes(metadata_copy &changes) {
+		changes.bat_raw.clear();
+		if (bat_dirty_lo >= 0) {
+			changes.bat_pos = bat_offset + bat_dirty_lo * 4;
+			changes.bat_raw.resize((bat_dirty_hi - bat_dirty_lo + 1) * 4);
+			for (long i = bat_dirty_lo; i <= bat_dirty_hi; ++i)
+				put_be32(&changes.bat_raw[(i - bat_dirty_lo) * 4], bat[i]);
+			bat_dirty_lo = bat_dirty_hi = -1;
+		}
+		changes.bitmaps.clear();
+		if (bitmaps_dirty) {
+			for (size_t i = 0; i < bitmaps.size(); ++i) {
+				if (!bitmap_dirty[i])
+					continue;
+				changes.bitmaps.push_back(std::make_pair((loff_t)bat[i] * VHD_SECTOR_SIZE,
+					std::vector<uint8>(bitmaps[i], bitmaps[i] + bitmap_size)));
+				bitmap_dirty[i] = false;
+			}
+			bitmaps_dirty = false;
+		}
+		dirty_since = 0;
+	}
+
+	// Write out metadata, after all data it refers to is on disk. The data
+	// writes were done before the copy was taken.
+	void write_metadata(const metadata_copy &changes) {
+		if (changes.bat_raw.empty() && changes.bitmaps.empty())
+			return;
+		fsync(fd);
+		if (!changes.bat_raw.empty()
+				&& pwrite(fd, &changes.bat_raw[0], changes.bat_raw.size(), changes.bat_pos) != (ssize_t)changes.bat_raw.size())
+			fprintf(stderr, "vhd: can't write block allocation table\n");
+		for (size_t i = 0; i < changes.bitmaps.size(); ++i) {
+			const std::vector<uint8> &bm = changes.bitmaps[i].second;
+			if (pwrite(fd, &bm[0], bm.size(), changes.bitmaps[i].first) != (ssize_t)bm.size())
+				fprintf(stderr, "vhd: can't write sector bitmap\n");
+		}
+		fsync(fd);
+	}
+
+	void flush() {
+		metadata_copy changes;
+		lock_metadata();
+		take_changes(changes);
+		unlock_metadata();
+		write_metadata(changes);
+	}
 };
 
 disk_generic::status disk_vhd_factory(const char *path,
 		bool read_only, disk_generic **disk) {
-	int size;
-	vhd_context_t *ctx = NULL;
-	disk_generic::status st = vhd_unix_open(path, &size, read_only, &ctx);
-	if (st == disk_generic::DISK_VALID)
-		*disk = new disk_vhd(ctx, read_only, size);
-	return st;
+	if (!read_only && access(path, W_OK))
+		read_only = true;
+
+	int fd = open(path, read_only ? O_RDONLY : O_RDWR);
+	if (fd < 0)
+		return disk_generic::DISK_UNKNOWN;
+
+	// The footer is at the end of the file
+	uint8 footer[VHD_SECTOR_SIZE];
+	loff_t end = lseek(fd, 0, SEEK_END);
+	if (end < VHD_SECTOR_SIZE || (end % VHD_SECTOR_SIZE)
+			|| pread(fd, footer, VHD_SECTOR_SIZE, end - VHD_SECTOR_SIZE) != VHD_SECTOR_SIZE
+			|| memcmp(footer, "conectix", 8) != 0) {
+		close(fd);
+		return disk_generic::DISK_UNKNOWN;
+	}
+
+	disk_vhd *vhd = new disk_vhd(fd, read_only, footer);
+	uint32 type = (footer[60] << 24) | (footer[61] << 16) | (footer[62] << 8) | footer[63];
+	if (type == VHD_TYPE_DYNAMIC) {
+		loff_t header_offset = 0;
+		for (int i = 16; i < 24; ++i)
+			header_offset = (header_offset << 8) | footer[i];
+		if (!vhd->init_dynamic(header_offset, end)) {
+			delete vhd;
+			return disk_generic::DISK_INVALID;
+		}
+	} else if (type != VHD_TYPE_FIXED || vhd->size() > end - VHD_SECTOR_SIZE) {
+		fprintf(stderr, "vhd: %s images are not supported\n",
+			type == VHD_TYPE_DIFF ? "differencing" : "this kind of");
+		delete vhd;
+		return disk_generic::DISK_INVALID;
+	}
+
+	printf("VHD Open %s\n", path);
+	*disk = vhd;
+	return disk_generic::DISK_VALID;
 }
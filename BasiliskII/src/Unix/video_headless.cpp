@@ -0,0 +1,753 @@
+/*
+ *  video_headless.cpp - Video/graphics emulation, offscreen frame buffer
+ *
+ *  Basilisk II (C) Christian Bauer
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ *  NOTES:
+ *    The Mac frame buffer is plain host memory that is never displayed.
+ *    There is no refresh thread: the 60Hz interrupt calls VideoInterrupt()
+ *    on the emulation thread, which compares the frame buffer against the
+ *    last refreshed frame every "frameskip" ticks and converts changed
+ *    lines to 24-bit RGB, like a windowed driver would. Time is measured
+ *    in MacOS ticks, so runs driven by the CPU clock are reproducible.
+ *
+ *    Frames can be written to a directory ("framedump") and keyboard and
+ *    mouse input can be replayed from a file ("inputscript").
+ *
+ *    With "vncport", the changed lines are also compared in tiles and the
+ *    changed tiles are passed to the built-in VNC server (vnc_server.cpp),
+ *    which sends them to viewers from its own thread.
+ */
+
+#include "sysdeps.h"
+
+#include <sys/stat.h>
+#include <ctype.h>
+#include <errno.h>
+
+#include <algorithm>
+
+#include "cpu_emulation.h"
+#include "main.h"
+#include "adb.h"
+#include "prefs.h"
+#include "user_strings.h"
+#include "video.h"
+#include "vm_alloc.h"
+#include "vnc_server.h"
+
+#ifdef ENABLE_VOSF
+# include "sigsegv.h"
+#endif
+
+#define DEBUG 0
+#include "debug.h"
+
+
+// Supported video modes
+static vector<video_mode> VideoModes;
+
+// Global variables
+static int32 frame_skip;							// Prefs items
+static int video_stats_interval = 0;
+static bool classic_mode = false;					// Flag: Classic Mac video mode
+
+static uint8 *the_buffer = NULL;					// Mac frame buffer (where MacOS draws into)
+static uint8 *the_buffer_copy = NULL;				// Copy of Mac frame buffer at last refresh
+static uint32 the_buffer_size;						// Size of allocated the_buffer
+static uint8 *rgb_buffer = NULL;					// Last refreshed frame in 24-bit RGB
+
+static uint8 mac_palette[256 * 3];					// Color palette in indexed modes
+static bool palette_changed = false;				// Flag: Palette changed, convert all lines on next refresh
+static int skip_counter = 0;						// Ticks until next refresh
+
+// Frame dumps
+static const char *dump_dir = NULL;					// Directory to write frames to, NULL = disabled
+static int32 dump_ticks;							// Ticks between dumped frames, 0 = only on request
+static bool dump_raw = false;						// Flag: Write raw RGB data instead of PPM files
+static uint32 next_dump_tick;						// Tick of next dumped frame
+static uint32 dump_count = 0;						// Number of frames written
+
+// VNC server
+static bool use_vnc = false;						// Flag: VNC server running
+static uint8 *vnc_dirty = NULL;						// Changed tiles of last refresh
+static uint32 vnc_tiles_x, vnc_tiles_y;				// Size of frame in tiles
+
+// Statistics
+static uint64 total_refreshes = 0;					// Number of refreshes
+static uint64 total_frames = 0;						// Number of refreshes that found changes
+static uint64 total_lines = 0;						// Number of lines converted
+static uint64 total_usecs = 0;						// Time spent comparing and converting
+static uint64 start_time;							// Time of VideoInit()
+
+
+/*
+ *  monitor_desc subclass for offscreen frame buffer
+ */
+
+class headless_monitor_desc : public monitor_desc {
+public:
+	headless_monitor_desc(const vector<video_mode> &available_modes, video_depth default_depth, uint32 default_id) : monitor_desc(available_modes, default_depth, default_id) {}
+	~headless_monitor_desc() {}
+
+	virtual void switch_to_current_mode(void);
+	virtual void set_palette(uint8 *pal, int num);
+
+	bool video_open(void);
+	void video_close(void);
+};
+
+static headless_monitor_desc *the_monitor = NULL;	// The (only) display
+
+
+/*
+ *  Scripted input
+ *
+ *  Each line of the script holds one event, keyed to the MacOS Ticks
+ *  counter (1/60 seconds since boot):
+ *    <tick> key <Mac keycode> down|up
+ *    <tick> mouse <x> <y>
+ *    <tick> button <number (0..2)> down|up
+ *    <tick> dump
+ *    <tick> quit
+ *  Empty lines and lines starting with '#' are ignored.
+ */
+
+enum {
+	SCRIPT_KEY_DOWN,
+	SCRIPT_KEY_UP,
+	SCRIPT_MOUSE,
+	SCRIPT_BUTTON_DOWN,
+	SCRIPT_BUTTON_UP,
+	SCRIPT_DUMP,
+	SCRIPT_QUIT
+};
+
+struct script_event {
+	uint32 tick;
+	int type;
+	int a, b;
+
+	bool operator<(const script_event &other) const { return tick < other.tick; }
+};
+
+static vector<script_event> input_script;
+static size_t input_script_pos = 0;					// Next event to be played back
+
+static bool parse_script_line(const char *line, script_event &ev)
+{
+	char cmd[16], arg[16];
+	unsigned int tick;
+	int n;
+	if (sscanf(line, "%u %15s%n", &tick, cmd, &n) < 2)
+		return false;
+	ev.tick = tick;
+	ev.a = ev.b = 0;
+	line += n;
+
+	if (strcmp(cmd, "key") == 0 || strcmp(cmd, "button") == 0) {
+		char num[16];
+		if (sscanf(line, "%15s %15s", num, arg) != 2)
+			return false;
+		ev.a = strtol(num, NULL, 0);
+		bool down = (strcmp(arg, "down") == 0);
+		if (!down && strcmp(arg, "up") != 0)
+			return false;
+		if (cmd[0] == 'k') {
+			if (ev.a < 0 || ev.a > 0x7f)
+				return false;
+			ev.type = down ? SCRIPT_KEY_DOWN : SCRIPT_KEY_UP;
+		} else {
+			if (ev.a < 0 || ev.a > 2)		// adb.cpp knows three buttons
+				return false;
+			ev.type = down ? SCRIPT_BUTTON_DOWN : SCRIPT_BUTTON_UP;
+		}
+	} else if (strcmp(cmd, "mouse") == 0) {
+		if (sscanf(line, "%d %d", &ev.a, &ev.b) != 2)
+			return false;
+		ev.type = SCRIPT_MOUSE;
+	} else if (strcmp(cmd, "dump") == 0)
+		ev.type = SCRIPT_DUMP;
+	else if (strcmp(cmd, "quit") == 0)
+		ev.type = SCRIPT_QUIT;
+	else
+		return false;
+	return true;
+}
+
+static void load_input_script(const char *path)
+{
+	FILE *f = fopen(path, "r");
+	if (f == NULL) {
+		printf("WARNING: Cannot open input script %s (%s)\n", path, strerror(errno));
+		return;
+	}
+
+	char line[256];
+	int line_num = 0;
+	while (fgets(line, sizeof(line), f)) {
+		line_num++;
+		char *p = line;
+		while (isspace(*p))
+			p++;
+		if (*p == 0 || *p == '#')
+			continue;
+		script_event ev;
+		if (parse_script_line(p, ev))
+			input_script.push_back(ev);
+		else
+			printf("WARNING: Ignoring line %d of input script %s\n", line_num, path);
+	}
+	fclose(f);
+
+	// Events with the same tick are played back in file order
+	std::stable_sort(input_script.begin(), input_script.end());
+	input_script_pos = 0;
+	D(bug("%d input script events loaded\n", (int)input_script.size()));
+
+	// Script coordinates are absolute
+	if (!input_script.empty())
+		ADBSetRelMouseMode(false);
+}
+
+
+/*
+ *  Utility functions
+ */
+
+// Add mode to list of supported modes
+static void add_mode(uint32 width, uint32 height, uint32 resolution_id, uint32 bytes_per_row, video_depth depth)
+{
+	video_mode mode;
+	mode.x = width;
+	mode.y = height;
+	mode.resolution_id = resolution_id;
+	mode.bytes_per_row = bytes_per_row;
+	mode.depth = depth;
+	mode.user_data = 0;
+	VideoModes.push_back(mode);
+}
+
+// Add standard list of windowed modes for given color depth, plus the
+// requested size if it is not one of them
+static void add_window_modes(video_depth depth, int width, int height)
+{
+	static const struct {
+		int w, h;
+	} sizes[] = {
+		{512, 384}, {640, 480}, {800, 600}, {1024, 768},
+		{1152, 870}, {1280, 1024}, {1600, 1200}
+	};
+	const int num_sizes = sizeof(sizes) / sizeof(sizes[0]);
+
+	bool standard = false;
+	for (int i = 0; i < num_sizes; i++) {
+		add_mode(sizes[i].w, sizes[i].h, 0x80 + i, TrivialBytesPerRow(sizes[i].w, depth), depth);
+		if (sizes[i].w == width && sizes[i].h == height)
+			standard = true;
+	}
+	if (!standard)
+		add_mode(width, height, 0x80 + num_sizes, TrivialBytesPerRow(width, depth), depth);
+}
+
+// Set Mac frame layout and base address (uses the_buffer/MacFrameBaseMac)
+static void set_mac_frame_buffer(headless_monitor_desc &monitor)
+{
+#if !REAL_ADDRESSING && !DIRECT_ADDRESSING
+	// The frame buffer is never displayed, so keep it in Mac byte order
+	MacFrameLayout = FLAYOUT_DIRECT;
+	monitor.set_mac_frame_base(MacFrameBaseMac);
+
+	// Set variables used by UAE memory banking
+	const video_mode &mode = monitor.get_current_mode();
+	MacFrameBaseHost = the_buffer;
+	MacFrameSize = mode.bytes_per_row * mode.y;
+	InitFrameBufferMapping();
+#else
+	monitor.set_mac_frame_base(Host2MacAddr(the_buffer));
+#endif
+	D(bug("monitor.mac_frame_base = %08x\n", monitor.get_mac_frame_base()));
+}
+
+
+/*
+ *  Frame conversion
+ */
+
+// Convert one line of the Mac frame buffer (big-endian) to 24-bit RGB
+static void convert_line(const video_mode &mode, const uint8 *src, uint8 *dst)
+{
+	switch (mode.depth) {
+		case VDEPTH_1BIT:
+		case VDEPTH_2BIT:
+		case VDEPTH_4BIT:
+		case VDEPTH_8BIT: {
+			const int bits = 1 << mode.depth;
+			const int mask = (1 << bits) - 1;
+			for (uint32 x = 0; x < mode.x; x++) {
+				const uint32 bit = x * bits;
+				const int c = (src[bit >> 3] >> (8 - bits - (bit & 7))) & mask;
+				*dst++ = mac_palette[c * 3 + 0];
+				*dst++ = mac_palette[c * 3 + 1];
+				*dst++ = mac_palette[c * 3 + 2];
+			}
+			break;
+		}
+		case VDEPTH_16BIT:
+			for (uint32 x = 0; x < mode.x; x++) {
+				const uint32 p = (src[0] << 8) | src[1];	// xRRRRRGGGGGBBBBB
+				const uint32 r = (p >> 10) & 0x1f, g = (p >> 5) & 0x1f, b = p & 0x1f;
+				*dst++ = (r << 3) | (r >> 2);
+				*dst++ = (g << 3) | (g >> 2);
+				*dst++ = (b << 3) | (b >> 2);
+				src += 2;
+			}
+			break;
+		case VDEPTH_32BIT:
+			for (uint32 x = 0; x < mode.x; x++) {
+				*dst++ = src[1];							// xRGB
+				*dst++ = src[2];
+				*dst++ = src[3];
+				src += 4;
+			}
+			break;
+	}
+}
+
+// Convert all lines that changed since the last refresh
+static void video_refresh(void)
+{
+	const video_mode &mode = the_monitor->get_current_mode();
+	const uint32 bytes_per_row = mode.bytes_per_row;
+	const uint32 rgb_bytes_per_row = mode.x * 3;
+
+	// Size of a VNC tile row in the Mac frame buffer
+	const uint32 row_bytes = std::min(bytes_per_row, (mode.x << mode.depth) / 8);
+	const uint32 tile_bytes = (VNC_TILE_SIZE << mode.depth) / 8;
+
+	uint64 start = GetTicks_usec();
+	uint32 n_lines = 0;
+	const bool all = palette_changed;
+	palette_changed = false;
+	if (use_vnc)
+		memset(vnc_dirty, all ? 1 : 0, vnc_tiles_x * vnc_tiles_y);
+	for (uint32 y = 0; y < mode.y; y++) {
+		const uint8 *src = the_buffer + y * bytes_per_row;
+		uint8 *copy = the_buffer_copy + y * bytes_per_row;
+		if (!all && memcmp(src, copy, bytes_per_row) == 0)
+			continue;
+		if (use_vnc && !all) {
+			uint8 *dirty = vnc_dirty + (y / VNC_TILE_SIZE) * vnc_tiles_x;
+			for (uint32 x = 0, t = 0; x < row_bytes; x += tile_bytes, t++) {
+				if (!dirty[t] && memcmp(src + x, copy + x, std::min(tile_bytes, row_bytes - x)))
+					dirty[t] = 1;
+			}
+		}
+		memcpy(copy, src, bytes_per_row);
+		convert_line(mode, copy, rgb_buffer + y * rgb_bytes_per_row);
+		n_lines++;
+	}
+	if (use_vnc && n_lines)
+		VNCServerUpdate(rgb_buffer, rgb_bytes_per_row, vnc_dirty);
+	uint32 duration = GetTicks_usec() - start;
+
+	total_refreshes++;
+	if (n_lines) {
+		total_frames++;
+		total_lines += n_lines;
+	}
+	total_usecs += duration;
+}
+
+// Log refresh statistics every video_stats_interval seconds
+static void video_stats(void)
+{
+	static uint64 last_time = 0;
+	static uint64 last_refreshes = 0, last_frames = 0, last_lines = 0, last_usecs = 0;
+
+	uint64 now = GetTicks_usec();
+	if (last_time == 0)
+		last_time = now;
+	else if (now - last_time >= (uint64)video_stats_interval * 1000000) {
+		uint64 refreshes = total_refreshes - last_refreshes;
+		uint64 frames = total_frames - last_frames;
+		if (refreshes) {
+			printf("video: %u refreshes, %u frames, %.1f lines/frame, %.1f usec/refresh conversion\n",
+				   (uint32)refreshes, (uint32)frames,
+				   frames ? (double)(total_lines - last_lines) / frames : 0.0,
+				   (double)(total_usecs - last_usecs) / refreshes);
+		}
+		last_time = now;
+		last_refreshes = total_refreshes;
+		last_frames = total_frames;
+		last_lines = total_lines;
+		last_usecs = total_usecs;
+	}
+}
+
+
+/*
+ *  Frame dumps
+ */
+
+static void dump_frame(void)
+{
+	const video_mode &mode = the_monitor->get_current_mode();
+
+	char name[1024];
+	snprintf(name, sizeof(name), "%s/frame%06u.%s", dump_dir, dump_count, dump_raw ? "rgb" : "ppm");
+	FILE *f = fopen(name, "wb");
+	if (f == NULL) {
+		printf("WARNING: Cannot write %s (%s), frame dumps disabled\n", name, strerror(errno));
+		dump_dir = NULL;
+		return;
+	}
+	if (!dump_raw)
+		fprintf(f, "P6\n%u %u\n255\n", mode.x, mode.y);
+	fwrite(rgb_buffer, mode.x * 3, mode.y, f);
+	fclose(f);
+	dump_count++;
+}
+
+
+/*
+ *  Open display
+ */
+
+bool headless_monitor_desc::video_open(void)
+{
+	D(bug("video_open()\n"));
+	const video_mode &mode = get_current_mode();
+
+	// Allocate memory for frame buffer ("height + 2" for safety), it must
+	// be reachable from the Mac address space in direct addressing mode
+	the_buffer_size = (mode.y + 2) * mode.bytes_per_row;
+	the_buffer = (uint8 *)vm_acquire(the_buffer_size, VM_MAP_DEFAULT | VM_MAP_32BIT);
+	if (the_buffer == VM_MAP_FAILED) {
+		the_buffer = NULL;
+		ErrorAlert(STR_NO_MEM_ERR);
+		return false;
+	}
+	the_buffer_copy = (uint8 *)malloc(the_buffer_size);
+	rgb_buffer = (uint8 *)malloc(mode.x * mode.y * 3);
+	if (the_buffer_copy == NULL || rgb_buffer == NULL) {
+		ErrorAlert(STR_NO_MEM_ERR);
+		return false;
+	}
+	D(bug("the_buffer = %p, the_buffer_copy = %p, rgb_buffer = %p\n", the_buffer, the_buffer_copy, rgb_buffer));
+
+	// Tell VNC server about new frame size
+	if (use_vnc) {
+		vnc_tiles_x = (mode.x + VNC_TILE_SIZE - 1) / VNC_TILE_SIZE;
+		vnc_tiles_y = (mode.y + VNC_TILE_SIZE - 1) / VNC_TILE_SIZE;
+		vnc_dirty = (uint8 *)malloc(vnc_tiles_x * vnc_tiles_y);
+		if (vnc_dirty == NULL) {
+			ErrorAlert(STR_NO_MEM_ERR);
+			return false;
+		}
+		VNCServerResize(mode.x, mode.y);
+	}
+
+	// Convert everything on the first refresh
+	palette_changed = true;
+	skip_counter = 0;
+
+	// Set frame buffer base
+	set_mac_frame_buffer(*this);
+	return true;
+}
+
+bool VideoInit(bool classic)
+{
+	classic_mode = classic;
+	start_time = GetTicks_usec();
+
+	// MacOS sets the palette, until then 1-bit frames are black on white
+	memset(mac_palette, 0, sizeof(mac_palette));
+	mac_palette[0] = mac_palette[1] = mac_palette[2] = 0xff;
+
+	// Read prefs
+	frame_skip = PrefsFindInt32("frameskip");
+	if (frame_skip < 1)
+		frame_skip = 1;
+	video_stats_interval = PrefsFindInt32("videostats");
+
+	dump_dir = PrefsFindString("framedump");
+	if (dump_dir) {
+		if (mkdir(dump_dir, 0755) < 0 && errno != EEXIST) {
+			printf("WARNING: Cannot create frame dump directory %s (%s)\n", dump_dir, strerror(errno));
+			dump_dir = NULL;
+		}
+		dump_ticks = PrefsFindInt32("framedumpticks");
+		const char *format = PrefsFindString("framedumpformat");
+		dump_raw = (format && strcmp(format, "raw") == 0);
+		next_dump_tick = 0;
+	}
+
+	const char *script_path = PrefsFindString("inputscript");
+	if (script_path)
+		load_input_script(script_path);
+
+	int32 vnc_port = PrefsFindInt32("vncport");
+	if (vnc_port > 0)
+		use_vnc = VNCServerInit(PrefsFindString("vncaddress"), vnc_port);
+
+	// Get screen mode from preferences
+	const char *mode_str;
+	if (classic_mode)
+		mode_str = "win/512/342";
+	else
+		mode_str = PrefsFindString("screen");
+
+	// Determine default dimensions, all sizes are available offscreen
+	int default_width = 512, default_height = 384;
+	if (mode_str)
+		sscanf(mode_str, "win/%d/%d", &default_width, &default_height);
+	if (default_width <= 0)
+		default_width = 512;
+	if (default_height <= 0)
+		default_height = 384;
+
+	// There is no host display to follow, default to millions of colors
+	video_depth default_depth = VDEPTH_32BIT;
+	switch (PrefsFindInt32("displaycolordepth")) {
+		case 1:
+			default_depth = VDEPTH_1BIT;
+			break;
+		case 8:
+			default_depth = VDEPTH_8BIT;
+			break;
+		case 15: case 16:
+			default_depth = VDEPTH_16BIT;
+			break;
+	}
+
+	// Construct list of supported modes
+	if (classic)
+		add_mode(512, 342, 0x80, 64, VDEPTH_1BIT);
+	else {
+		for (unsigned d=VDEPTH_1BIT; d<=VDEPTH_32BIT; d++)
+			add_window_modes(video_depth(d), default_width, default_height);
+	}
+
+	// Find requested default mode with specified dimensions
+	uint32 default_id;
+	std::vector<video_mode>::const_iterator i, end = VideoModes.end();
+	for (i = VideoModes.begin(); i != end; ++i) {
+		if (i->x == (uint32)default_width && i->y == (uint32)default_height && i->depth == default_depth) {
+			default_id = i->resolution_id;
+			break;
+		}
+	}
+	if (i == end) { // not found, use first available mode
+		default_depth = VideoModes[0].depth;
+		default_id = VideoModes[0].resolution_id;
+	}
+
+	// Create headless_monitor_desc for this (the only) display
+	the_monitor = new headless_monitor_desc(VideoModes, default_depth, default_id);
+	VideoMonitors.push_back(the_monitor);
+
+	// Open display
+	return the_monitor->video_open();
+}
+
+
+/*
+ *  Deinitialization
+ */
+
+// Close display
+void headless_monitor_desc::video_close(void)
+{
+	D(bug("video_close()\n"));
+
+	if (the_buffer) {
+		vm_release(the_buffer, the_buffer_size);
+		the_buffer = NULL;
+	}
+	if (the_buffer_copy) {
+		free(the_buffer_copy);
+		the_buffer_copy = NULL;
+	}
+	if (rgb_buffer) {
+		free(rgb_buffer);
+		rgb_buffer = NULL;
+	}
+	if (vnc_dirty) {
+		free(vnc_dirty);
+		vnc_dirty = NULL;
+	}
+}
+
+void VideoExit(void)
+{
+	// Stop VNC server
+	if (use_vnc) {
+		VNCServerExit();
+		use_vnc = false;
+	}
+
+	// Close displays
+	vector<monitor_desc *>::iterator i, end = VideoMonitors.end();
+	for (i = VideoMonitors.begin(); i != end; ++i)
+		dynamic_cast<headless_monitor_desc *>(*i)->video_close();
+	the_monitor = NULL;
+
+	// Report what was rendered
+	double seconds = (GetTicks_usec() - start_time) / 1000000.0;
+	printf("video: %llu refreshes, %llu frames in %.1f seconds, %llu lines converted\n",
+		   (unsigned long long)total_refreshes, (unsigned long long)total_frames, seconds,
+		   (unsigned long long)total_lines);
+	if (total_refreshes)
+		printf("video: %.1f usec/refresh, %.1f usec/frame conversion\n",
+			   (double)total_usecs / total_refreshes,
+			   total_frames ? (double)total_usecs / total_frames : 0.0);
+	if (dump_count)
+		printf("video: %u frames written\n", dump_count);
+
+	input_script.clear();
+}
+
+
+/*
+ *  Close down full-screen mode (if bringing up error alerts is unsafe while in full-screen mode)
+ */
+
+void VideoQuitFullScreen(void)
+{
+}
+
+
+/*
+ *  Mac VBL interrupt
+ */
+
+void VideoInterrupt(void)
+{
+	if (the_monitor == NULL || the_buffer == NULL)
+		return;
+
+	// The Ticks counter is the emulation clock
+	const uint32 tick = ReadMacInt32(0x16a);
+
+	// Periodic frame dump due?
+	bool dump = false;
+	if (dump_dir && dump_ticks > 0 && (int32)(tick - next_dump_tick) >= 0) {
+		next_dump_tick = tick + dump_ticks;
+		dump = true;
+	}
+
+	// Play back input events that are due
+	while (input_script_pos < input_script.size() && input_script[input_script_pos].tick <= tick) {
+		const script_event &ev = input_script[input_script_pos++];
+		switch (ev.type) {
+			case SCRIPT_KEY_DOWN:
+				ADBKeyDown(ev.a);
+				break;
+			case SCRIPT_KEY_UP:
+				ADBKeyUp(ev.a);
+				break;
+			case SCRIPT_MOUSE:
+				ADBMouseMoved(ev.a, ev.b);
+				break;
+			case SCRIPT_BUTTON_DOWN:
+				ADBMouseDown(ev.a);
+				break;
+			case SCRIPT_BUTTON_UP:
+				ADBMouseUp(ev.a);
+				break;
+			case SCRIPT_DUMP:
+				if (dump_dir)
+					dump = true;
+				break;
+			case SCRIPT_QUIT:
+				QuitEmulator();
+				break;
+		}
+	}
+
+	// Refresh every frame_skip ticks, and always before dumping a frame
+	if (--skip_counter <= 0 || dump) {
+		skip_counter = frame_skip;
+		video_refresh();
+	}
+
+	if (dump)
+		dump_frame();
+
+	if (video_stats_interval > 0)
+		video_stats();
+}
+
+
+/*
+ *  Set palette
+ */
+
+void headless_monitor_desc::set_palette(uint8 *pal, int num)
+{
+	// The gamma table of direct modes is ignored
+	const video_mode &mode = get_current_mode();
+	if (IsDirectMode(mode))
+		return;
+
+	if (num > 256)
+		num = 256;
+	memcpy(mac_palette, pal, num * 3);
+
+	// The interpretation of pixel values changed, convert everything
+	palette_changed = true;
+}
+
+
+/*
+ *  Switch video mode
+ */
+
+void headless_monitor_desc::switch_to_current_mode(void)
+{
+	// Close and reopen display
+	video_close();
+	if (!video_open()) {
+		ErrorAlert(STR_OPEN_WINDOW_ERR);
+		QuitEmulator();
+	}
+}
+
+
+/*
+ *  Video refresh is done from VideoInterrupt()
+ */
+
+void VideoRefresh(void)
+{
+}
+
+
+#ifdef ENABLE_VOSF
+/*
+ *  The frame buffer is not write-protected, so screen faults never happen
+ */
+
+bool Screen_fault_handler(sigsegv_info_t *sip)
+{
+	return false;
+}
+#endif
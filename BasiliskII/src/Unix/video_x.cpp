@@ -39,6 +39,7 @@
 #include <errno.h>
 
 #include <algorithm>
+#include <vector>
 
 #ifdef HAVE_PTHREADS
 # include <pthread.h>
@@ -64,6 +65,7 @@
 #include "user_strings.h"
 #include "video.h"
 #include "video_blit.h"
+#include "video_tiles.h"
 
 #define DEBUG 0
 #include "debug.h"
@@ -2437,119 +2439,30 @@ static void update_display_dynamic(int ticker, driver_window *drv)
 	XDisplayUnlock();
 }
 
-// Static display update (fixed frame rate, but incremental)
+// Static display update (fixed frame rate, tile based, see video_tiles.h)
+struct update_rect {
+	int x, y, w, h;
+};
+
 static void update_display_static(driver_window *drv)
 {
-	// Incremental update code
-	unsigned wide = 0, high = 0, x1, x2, y1, y2, i, j;
 	const video_mode &mode = drv->monitor.get_current_mode();
-	int bytes_per_row = mode.bytes_per_row;
-	int bytes_per_pixel = mode.bytes_per_row / mode.x;
-	uint8 *p, *p2;
-
-	// Check for first line from top and first line from bottom that have changed
-	y1 = 0;
-	for (j=0; j<mode.y; j++) {
-		if (memcmp(&the_buffer[j * bytes_per_row], &the_buffer_copy[j * bytes_per_row], bytes_per_row)) {
-			y1 = j;
-			break;
-		}
-	}
-	y2 = y1 - 1;
-	for (j=mode.y-1; j>=y1; j--) {
-		if (memcmp(&the_buffer[j * bytes_per_row], &the_buffer_copy[j * bytes_per_row], bytes_per_row)) {
-			y2 = j;
-			break;
-		}
-	}
-	high = y2 - y1 + 1;
-
-	// Check for first column from left and first column from right that have changed
-	if (high) {
-		if (mode.depth == VDEPTH_1BIT) {
-			x1 = mode.x - 1;
-			for (j=y1; j<=y2; j++) {
-				p = &the_buffer[j * bytes_per_row];
-				p2 = &the_buffer_copy[j * bytes_per_row];
-				for (i=0; i<(x1>>3); i++) {
-					if (*p != *p2) {
-						x1 = i << 3;
-						break;
-					}
-					p++; p2++;
-				}
-			}
-			x2 = x1;
-			for (j=y1; j<=y2; j++) {
-				p = &the_buffer[j * bytes_per_row];
-				p2 = &the_buffer_copy[j * bytes_per_row];
-				p += bytes_per_row;
-				p2 += bytes_per_row;
-				for (i=(mode.x>>3); i>(x2>>3); i--) {
-					p--; p2--;
-					if (*p != *p2) {
-						x2 = (i << 3) + 7;
-						break;
-					}
-				}
-			}
-			wide = x2 - x1 + 1;
-
-			// Update copy of the_buffer
-			if (high && wide) {
-				for (j=y1; j<=y2; j++) {
-					i = j * bytes_per_row + (x1 >> 3);
-					memcpy(the_buffer_copy + i, the_buffer + i, wide >> 3);
-				}
-			}
-
-		} else {
-			x1 = mode.x;
-			for (j=y1; j<=y2; j++) {
-				p = &the_buffer[j * bytes_per_row];
-				p2 = &the_buffer_copy[j * bytes_per_row];
-				for (i=0; i<x1*bytes_per_pixel; i++) {
-					if (*p != *p2) {
-						x1 = i / bytes_per_pixel;
-						break;
-					}
-					p++; p2++;
-				}
-			}
-			x2 = x1;
-			for (j=y1; j<=y2; j++) {
-				p = &the_buffer[j * bytes_per_row];
-				p2 = &the_buffer_copy[j * bytes_per_row];
-				p += bytes_per_row;
-				p2 += bytes_per_row;
-				for (i=mode.x*bytes_per_pixel; i>x2*bytes_per_pixel; i--) {
-					p--;
-					p2--;
-					if (*p != *p2) {
-						x2 = i / bytes_per_pixel;
-						break;
-					}
-				}
-			}
-			wide = x2 - x1;
+	const int bits_per_pixel = mode.depth == VDEPTH_1BIT ? 1 : (mode.bytes_per_row / mode.x) * 8;
+	static std::vector<update_rect> rects;
+	rects.resize(video_max_tile_rects(mode.x, mode.y));
 
-			// Update copy of the_buffer
-			if (high && wide) {
-				for (j=y1; j<=y2; j++) {
-					i = j * bytes_per_row + x1 * bytes_per_pixel;
-					memcpy(the_buffer_copy + i, the_buffer + i, bytes_per_pixel * wide);
-				}
-			}
-		}
-	}
+	// The X image is the_buffer_copy, changed rows just need to be copied there
+	uint32 nr_rects = video_update_tiles(the_buffer, the_buffer_copy, mode.x, mode.y,
+		mode.bytes_per_row, bits_per_pixel, (uint8 *)NULL, 0, 0, &rects[0]);
 
 	// Refresh display
 	XDisplayLock();
-	if (high && wide) {
+	for (uint32 i = 0; i < nr_rects; i++) {
+		const update_rect &r = rects[i];
 		if (drv->have_shm)
-			XShmPutImage(x_display, drv->w, drv->gc, drv->img, x1, y1, x1, y1, wide, high, 0);
+			XShmPutImage(x_display, drv->w, drv->gc, drv->img, r.x, r.y, r.x, r.y, r.w, r.h, 0);
 		else
-			XPutImage(x_display, drv->w, drv->gc, drv->img, x1, y1, x1, y1, wide, high);
+			XPutImage(x_display, drv->w, drv->gc, drv->img, r.x, r.y, r.x, r.y, r.w, r.h);
 	}
 	XDisplayUnlock();
 }
@@ -0,0 +1,1599 @@
+/*
+ *  vnc_server.cpp - RFB (VNC) server for the headless video driver
+ *
+ *  Basilisk II (C) Christian Bauer
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ *  NOTES:
+ *    All sockets belong to the server thread. The emulation thread only
+ *    calls VNCServerUpdate(), which copies the changed tiles into the
+ *    server frame buffer and marks them for every client. It never waits
+ *    for the network.
+ *
+ *    For every client, the server keeps a copy of what the viewer shows.
+ *    Before an update is sent, the marked tiles are compared against that
+ *    copy. This finds vertical scrolls, which are sent as CopyRect, and
+ *    drops tiles that changed back. The remaining tiles are merged into
+ *    rectangles and sent with ZRLE encoding (if zlib is available and the
+ *    viewer supports it) or raw. All encoding happens on the server thread.
+ *
+ *    Sockets are non-blocking. Each client has an output queue that is
+ *    drained when poll() reports the socket writable, and the next update
+ *    is only built when the queue is empty, so a slow viewer only slows
+ *    down its own updates.
+ *
+ *    Pointer and keyboard events go to the ADB emulation. The "None"
+ *    security type is the only one offered, so by default the server
+ *    listens on the loopback interface only.
+ */
+
+#include "sysdeps.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#ifdef HAVE_PTHREADS
+# include <pthread.h>
+#endif
+
+#ifdef HAVE_ZLIB
+# include <zlib.h>
+#endif
+
+#include <algorithm>
+#include <vector>
+
+using std::vector;
+
+#include "adb.h"
+#include "prefs.h"
+#include "vnc_server.h"
+
+#define DEBUG 0
+#include "debug.h"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+
+#ifdef HAVE_PTHREADS
+
+const int TILE = VNC_TILE_SIZE;
+const int ZRLE_TILE = 64;							// ZRLE tile size
+const uint32 MAX_CUT_TEXT = 1024 * 1024;			// Longest clipboard text we accept
+
+// Client to server messages
+enum {
+	MSG_SET_PIXEL_FORMAT = 0,
+	MSG_SET_ENCODINGS = 2,
+	MSG_UPDATE_REQUEST = 3,
+	MSG_KEY_EVENT = 4,
+	MSG_POINTER_EVENT = 5,
+	MSG_CUT_TEXT = 6
+};
+
+// Encodings
+enum {
+	ENC_RAW = 0,
+	ENC_COPYRECT = 1,
+	ENC_ZRLE = 16,
+	ENC_DESKTOP_SIZE = -223
+};
+
+// Client connection states
+enum {
+	ST_VERSION,										// Waiting for protocol version
+	ST_SECURITY,									// Waiting for security type
+	ST_INIT,										// Waiting for ClientInit
+	ST_NORMAL										// Connected
+};
+
+// X11 keysyms of keys that are not Latin-1 characters
+enum {
+	KS_BACKSPACE = 0xff08,
+	KS_TAB = 0xff09,
+	KS_RETURN = 0xff0d,
+	KS_PAUSE = 0xff13,
+	KS_SCROLL_LOCK = 0xff14,
+	KS_ESCAPE = 0xff1b,
+	KS_HOME = 0xff50,
+	KS_LEFT = 0xff51,
+	KS_UP = 0xff52,
+	KS_RIGHT = 0xff53,
+	KS_DOWN = 0xff54,
+	KS_PAGE_UP = 0xff55,
+	KS_PAGE_DOWN = 0xff56,
+	KS_END = 0xff57,
+	KS_PRINT = 0xff61,
+	KS_INSERT = 0xff63,
+	KS_MENU = 0xff67,
+	KS_HELP = 0xff6a,
+	KS_NUM_LOCK = 0xff7f,
+	KS_KP_ENTER = 0xff8d,
+	KS_KP_HOME = 0xff95,
+	KS_KP_LEFT = 0xff96,
+	KS_KP_UP = 0xff97,
+	KS_KP_RIGHT = 0xff98,
+	KS_KP_DOWN = 0xff99,
+	KS_KP_PAGE_UP = 0xff9a,
+	KS_KP_PAGE_DOWN = 0xff9b,
+	KS_KP_END = 0xff9c,
+	KS_KP_BEGIN = 0xff9d,
+	KS_KP_INSERT = 0xff9e,
+	KS_KP_DELETE = 0xff9f,
+	KS_KP_MULTIPLY = 0xffaa,
+	KS_KP_ADD = 0xffab,
+	KS_KP_SUBTRACT = 0xffad,
+	KS_KP_DECIMAL = 0xffae,
+	KS_KP_DIVIDE = 0xffaf,
+	KS_KP_0 = 0xffb0,
+	KS_KP_9 = 0xffb9,
+	KS_KP_EQUAL = 0xffbd,
+	KS_F1 = 0xffbe,
+	KS_SHIFT_L = 0xffe1,
+	KS_SHIFT_R = 0xffe2,
+	KS_CONTROL_L = 0xffe3,
+	KS_CONTROL_R = 0xffe4,
+	KS_CAPS_LOCK = 0xffe5,
+	KS_META_L = 0xffe7,
+	KS_META_R = 0xffe8,
+	KS_ALT_L = 0xffe9,
+	KS_ALT_R = 0xffea,
+	KS_SUPER_L = 0xffeb,
+	KS_SUPER_R = 0xffec,
+	KS_DELETE = 0xffff
+};
+
+struct pixel_format {
+	uint8 bpp, depth, big_endian, true_colour;
+	uint16 red_max, green_max, blue_max;
+	uint8 red_shift, green_shift, blue_shift;
+};
+
+struct rect {
+	int x, y, w, h;
+};
+
+struct vnc_client {
+	vnc_client(int fd);
+	~vnc_client();
+
+	int fd;
+	char name[32];									// Peer address for log messages
+	int state;										// See enum above
+	int minor_version;								// Protocol version 3.x
+	bool closed;									// Flag: Connection is to be closed
+	vector<uint8> in;								// Received data not yet processed
+	uint32 skip;									// Bytes of clipboard text still to be discarded
+	vector<uint8> out;								// Output queue
+	size_t out_pos;									// Bytes of output queue already sent
+
+	pixel_format pf;								// Pixel format of viewer
+	uint32 red_map[256], green_map[256], blue_map[256];	// RGB component -> pixel value
+	int cpixel_bytes;								// Size of ZRLE CPIXEL
+	int cpixel_shift;								// Shift of CPIXEL bytes in pixel value
+	bool use_zrle, use_copyrect, use_desktop_size;	// Encodings supported by viewer
+
+	bool update_requested;							// Flag: Viewer waits for an update
+	int buttons;									// Mouse buttons held down
+
+	// Protected by vnc_lock
+	uint8 *dirty;									// Tiles changed since last update (tiles_x * tiles_y)
+	uint8 *force;									// Tiles requested by viewer (tiles_x * tiles_y)
+	bool resize_pending;							// Flag: Frame size changed, dirty is not updated
+
+	uint32 width, height;							// Frame size known to viewer
+	uint32 tiles_x, tiles_y;
+	uint8 *view;									// What the viewer shows (24-bit RGB)
+	uint8 *next;									// Frame being sent (24-bit RGB)
+	uint8 *work;									// Tiles being sent
+
+#ifdef HAVE_ZLIB
+	z_stream zs;									// ZRLE compression stream
+	bool zs_active;
+#endif
+
+	uint64 updates, copyrects, bytes_sent;			// Statistics
+};
+
+// Global variables
+static int listen_fd = -1;							// Listening socket
+static int wakeup_pipe[2] = {-1, -1};				// Wakes up server thread
+static pthread_t vnc_thread;						// Server thread
+static bool vnc_thread_active = false;				// Flag: Server thread installed
+static volatile bool vnc_quit = false;				// Flag: Server thread should exit
+static int mouse_wheel_mode;						// Prefs items
+static int mouse_wheel_lines;
+static bool caps_on = false;						// Flag: Caps Lock on
+
+static pthread_mutex_t vnc_lock = PTHREAD_MUTEX_INITIALIZER;	// Protects the fields below
+static uint8 *frame = NULL;							// Server frame buffer (24-bit RGB)
+static uint32 frame_width, frame_height;			// Size of frame
+static uint32 frame_tiles_x, frame_tiles_y;			// Size of frame in tiles
+static bool wakeup_pending = false;					// Flag: Wakeup byte written but not yet read
+static vector<vnc_client *> clients;				// Connected clients
+
+
+/*
+ *  Helper functions
+ */
+
+// Wake up server thread (must be called with vnc_lock held)
+static void wakeup(void)
+{
+	if (!wakeup_pending) {
+		char c = 0;
+		if (write(wakeup_pipe[1], &c, 1) == 1)
+			wakeup_pending = true;
+	}
+}
+
+static inline uint16 get16(const uint8 *p)
+{
+	return (p[0] << 8) | p[1];
+}
+
+static inline uint32 get32(const uint8 *p)
+{
+	return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static inline void put8(vector<uint8> &out, uint8 v)
+{
+	out.push_back(v);
+}
+
+static inline void put16(vector<uint8> &out, uint16 v)
+{
+	out.push_back(v >> 8);
+	out.push_back(v);
+}
+
+static inline void put32(vector<uint8> &out, uint32 v)
+{
+	out.push_back(v >> 24);
+	out.push_back(v >> 16);
+	out.push_back(v >> 8);
+	out.push_back(v);
+}
+
+// Append pixel value in byte order of viewer
+static inline void put_pixel(vector<uint8> &out, uint32 v, int bytes, bool big_endian)
+{
+	if (big_endian) {
+		for (int i = bytes - 1; i >= 0; i--)
+			out.push_back(v >> (i * 8));
+	} else {
+		for (int i = 0; i < bytes; i++)
+			out.push_back(v >> (i * 8));
+	}
+}
+
+static void put_pixel_format(vector<uint8> &out, const pixel_format &pf)
+{
+	put8(out, pf.bpp);
+	put8(out, pf.depth);
+	put8(out, pf.big_endian);
+	put8(out, pf.true_colour);
+	put16(out, pf.red_max);
+	put16(out, pf.green_max);
+	put16(out, pf.blue_max);
+	put8(out, pf.red_shift);
+	put8(out, pf.green_shift);
+	put8(out, pf.blue_shift);
+	put8(out, 0);
+	put8(out, 0);
+	put8(out, 0);
+}
+
+static void put_rect_header(vector<uint8> &out, const rect &r, int32 encoding)
+{
+	put16(out, r.x);
+	put16(out, r.y);
+	put16(out, r.w);
+	put16(out, r.h);
+	put32(out, encoding);
+}
+
+// Send as much of the output queue as the socket takes without blocking,
+// returns false if the connection failed
+static bool send_output(vnc_client *c)
+{
+	while (c->out_pos < c->out.size()) {
+		ssize_t n = send(c->fd, &c->out[c->out_pos], c->out.size() - c->out_pos, MSG_NOSIGNAL);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return errno == EAGAIN || errno == EWOULDBLOCK;
+		}
+		c->out_pos += n;
+		c->bytes_sent += n;
+	}
+	c->out.clear();
+	c->out_pos = 0;
+	return true;
+}
+
+static inline bool output_pending(const vnc_client *c)
+{
+	return c->out_pos < c->out.size();
+}
+
+// Copy one tile between 24-bit RGB frames of the given size
+static void copy_tile(uint8 *dst, uint32 dst_bpr, const uint8 *src, uint32 src_bpr, uint32 tx, uint32 ty, uint32 width, uint32 height)
+{
+	const uint32 x = tx * TILE, y = ty * TILE;
+	const uint32 w = std::min((uint32)TILE, width - x) * 3;
+	const uint32 h = std::min((uint32)TILE, height - y);
+	for (uint32 i = 0; i < h; i++)
+		memcpy(dst + (y + i) * dst_bpr + x * 3, src + (y + i) * src_bpr + x * 3, w);
+}
+
+// Check whether a tile differs between the viewer's and the current frame
+static bool tile_differs(const vnc_client *c, uint32 tx, uint32 ty)
+{
+	const uint32 bpr = c->width * 3;
+	const uint32 x = tx * TILE, y = ty * TILE;
+	const uint32 w = std::min((uint32)TILE, c->width - x) * 3;
+	const uint32 h = std::min((uint32)TILE, c->height - y);
+	const uint32 offset = y * bpr + x * 3;
+	for (uint32 i = 0; i < h; i++) {
+		if (memcmp(c->view + offset + i * bpr, c->next + offset + i * bpr, w))
+			return true;
+	}
+	return false;
+}
+
+
+/*
+ *  Client setup
+ */
+
+vnc_client::vnc_client(int fd) : fd(fd)
+{
+	name[0] = 0;
+	state = ST_VERSION;
+	minor_version = 3;
+	closed = false;
+	skip = 0;
+	out_pos = 0;
+	use_zrle = use_copyrect = use_desktop_size = false;
+	update_requested = false;
+	buttons = 0;
+	dirty = force = NULL;
+	resize_pending = false;
+	width = height = tiles_x = tiles_y = 0;
+	view = next = work = NULL;
+#ifdef HAVE_ZLIB
+	zs_active = false;
+#endif
+	updates = copyrects = bytes_sent = 0;
+}
+
+vnc_client::~vnc_client()
+{
+	close(fd);
+	free(dirty);
+	free(force);
+	free(view);
+	free(next);
+	free(work);
+#ifdef HAVE_ZLIB
+	if (zs_active)
+		deflateEnd(&zs);
+#endif
+}
+
+static void set_pixel_format(vnc_client *c, const pixel_format &pf)
+{
+	c->pf = pf;
+	for (int i = 0; i < 256; i++) {
+		c->red_map[i] = (uint32)((i * pf.red_max + 127) / 255) << pf.red_shift;
+		c->green_map[i] = (uint32)((i * pf.green_max + 127) / 255) << pf.green_shift;
+		c->blue_map[i] = (uint32)((i * pf.blue_max + 127) / 255) << pf.blue_shift;
+	}
+
+	// ZRLE leaves out the unused byte of 32-bit pixels with depth <= 24
+	c->cpixel_bytes = pf.bpp / 8;
+	c->cpixel_shift = 0;
+	if (pf.bpp == 32 && pf.depth <= 24) {
+		uint32 mask = ((uint32)pf.red_max << pf.red_shift) | ((uint32)pf.green_max << pf.green_shift) | ((uint32)pf.blue_max << pf.blue_shift);
+		if ((mask & 0xff000000) == 0)
+			c->cpixel_bytes = 3;
+		else if ((mask & 0x000000ff) == 0) {
+			c->cpixel_bytes = 3;
+			c->cpixel_shift = 8;
+		}
+	}
+}
+
+// Set up viewer copy of the frame (must be called with vnc_lock held)
+static void init_client_frame(vnc_client *c)
+{
+	c->width = frame_width;
+	c->height = frame_height;
+	c->tiles_x = frame_tiles_x;
+	c->tiles_y = frame_tiles_y;
+	const uint32 n_tiles = c->tiles_x * c->tiles_y;
+
+	free(c->view);
+	free(c->next);
+	free(c->work);
+	c->view = (uint8 *)calloc(c->width * c->height, 3);
+	c->next = (uint8 *)calloc(c->width * c->height, 3);
+	c->work = (uint8 *)calloc(n_tiles, 1);
+
+	// Everything has to be sent
+	c->dirty = (uint8 *)realloc(c->dirty, n_tiles);
+	c->force = (uint8 *)realloc(c->force, n_tiles);
+	memset(c->dirty, 0, n_tiles);
+	memset(c->force, 1, n_tiles);
+	c->resize_pending = false;
+}
+
+static void accept_client(void)
+{
+	struct sockaddr_in sa;
+	socklen_t sa_len = sizeof(sa);
+	int fd = accept(listen_fd, (struct sockaddr *)&sa, &sa_len);
+	if (fd < 0)
+		return;
+
+	int one = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+	vnc_client *c = new vnc_client(fd);
+	snprintf(c->name, sizeof(c->name), "%s:%d", inet_ntoa(sa.sin_addr), ntohs(sa.sin_port));
+	printf("vnc: connection from %s\n", c->name);
+
+	// Default is 32-bit little-endian xRGB
+	pixel_format pf;
+	pf.bpp = 32;
+	pf.depth = 24;
+	pf.big_endian = 0;
+	pf.true_colour = 1;
+	pf.red_max = pf.green_max = pf.blue_max = 255;
+	pf.red_shift = 16;
+	pf.green_shift = 8;
+	pf.blue_shift = 0;
+	set_pixel_format(c, pf);
+
+	const char *version = "RFB 003.008\n";
+	c->out.insert(c->out.end(), version, version + 12);
+	if (!send_output(c)) {
+		delete c;
+		return;
+	}
+
+	pthread_mutex_lock(&vnc_lock);
+	clients.push_back(c);
+	pthread_mutex_unlock(&vnc_lock);
+}
+
+static void close_client(vnc_client *c)
+{
+	printf("vnc: %s disconnected, %llu updates (%llu with CopyRect), %.1f KB sent\n",
+		   c->name, (unsigned long long)c->updates, (unsigned long long)c->copyrects, c->bytes_sent / 1024.0);
+	delete c;
+}
+
+
+/*
+ *  Input events
+ */
+
+// Translate keysym to Mac keycode, returns -1 if no keycode was found
+static int keysym_to_mac(uint32 ks)
+{
+	if (ks >= KS_KP_0 && ks <= KS_KP_9) {
+		static const int kp_codes[10] = {0x52, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5b, 0x5c};
+		return kp_codes[ks - KS_KP_0];
+	}
+	if (ks >= KS_F1 && ks < KS_F1 + 12) {
+		static const int f_codes[12] = {0x7a, 0x78, 0x63, 0x76, 0x60, 0x61, 0x62, 0x64, 0x65, 0x6d, 0x67, 0x6f};
+		return f_codes[ks - KS_F1];
+	}
+
+	switch (ks) {
+		case 'A': case 'a': return 0x00;
+		case 'B': case 'b': return 0x0b;
+		case 'C': case 'c': return 0x08;
+		case 'D': case 'd': return 0x02;
+		case 'E': case 'e': return 0x0e;
+		case 'F': case 'f': return 0x03;
+		case 'G': case 'g': return 0x05;
+		case 'H': case 'h': return 0x04;
+		case 'I': case 'i': return 0x22;
+		case 'J': case 'j': return 0x26;
+		case 'K': case 'k': return 0x28;
+		case 'L': case 'l': return 0x25;
+		case 'M': case 'm': return 0x2e;
+		case 'N': case 'n': return 0x2d;
+		case 'O': case 'o': return 0x1f;
+		case 'P': case 'p': return 0x23;
+		case 'Q': case 'q': return 0x0c;
+		case 'R': case 'r': return 0x0f;
+		case 'S': case 's': return 0x01;
+		case 'T': case 't': return 0x11;
+		case 'U': case 'u': return 0x20;
+		case 'V': case 'v': return 0x09;
+		case 'W': case 'w': return 0x0d;
+		case 'X': case 'x': return 0x07;
+		case 'Y': case 'y': return 0x10;
+		case 'Z': case 'z': return 0x06;
+
+		case '1': case '!': return 0x12;
+		case '2': case '@': return 0x13;
+		case '3': case '#': return 0x14;
+		case '4': case '$': return 0x15;
+		case '5': case '%': return 0x17;
+		case '6': case '^': return 0x16;
+		case '7': case '&': return 0x1a;
+		case '8': case '*': return 0x1c;
+		case '9': case '(': return 0x19;
+		case '0': case ')': return 0x1d;
+
+		case '`': case '~': return 0x0a;
+		case '-': case '_': return 0x1b;
+		case '=': case '+': return 0x18;
+		case '[': case '{': return 0x21;
+		case ']': case '}': return 0x1e;
+		case '\\': case '|': return 0x2a;
+		case ';': case ':': return 0x29;
+		case '\'': case '"': return 0x27;
+		case ',': case '<': return 0x2b;
+		case '.': case '>': return 0x2f;
+		case '/': case '?': return 0x2c;
+
+		case KS_TAB: return 0x30;
+		case KS_RETURN: return 0x24;
+		case ' ': return 0x31;
+		case KS_BACKSPACE: return 0x33;
+
+		case KS_DELETE: return 0x75;
+		case KS_INSERT: return 0x72;
+		case KS_HOME: case KS_HELP: return 0x73;
+		case KS_END: return 0x77;
+		case KS_PAGE_UP: return 0x74;
+		case KS_PAGE_DOWN: return 0x79;
+
+		case KS_CONTROL_L: case KS_CONTROL_R: return 0x36;
+		case KS_SHIFT_L: case KS_SHIFT_R: return 0x38;
+		case KS_ALT_L: case KS_ALT_R: return 0x37;
+		case KS_META_L: case KS_META_R: return 0x3a;
+		case KS_SUPER_L: case KS_SUPER_R: return 0x3a;
+		case KS_MENU: return 0x32;
+		case KS_CAPS_LOCK: return 0x39;
+		case KS_NUM_LOCK: return 0x47;
+
+		case KS_UP: return 0x3e;
+		case KS_DOWN: return 0x3d;
+		case KS_LEFT: return 0x3b;
+		case KS_RIGHT: return 0x3c;
+
+		case KS_ESCAPE: return 0x35;
+
+		case KS_PRINT: return 0x69;
+		case KS_SCROLL_LOCK: return 0x6b;
+		case KS_PAUSE: return 0x71;
+
+		case KS_KP_INSERT: return 0x52;
+		case KS_KP_END: return 0x53;
+		case KS_KP_DOWN: return 0x54;
+		case KS_KP_PAGE_DOWN: return 0x55;
+		case KS_KP_LEFT: return 0x56;
+		case KS_KP_BEGIN: return 0x57;
+		case KS_KP_RIGHT: return 0x58;
+		case KS_KP_HOME: return 0x59;
+		case KS_KP_UP: return 0x5b;
+		case KS_KP_PAGE_UP: return 0x5c;
+		case KS_KP_DECIMAL: case KS_KP_DELETE: return 0x41;
+		case KS_KP_ADD: return 0x45;
+		case KS_KP_SUBTRACT: return 0x4e;
+		case KS_KP_MULTIPLY: return 0x43;
+		case KS_KP_DIVIDE: return 0x4b;
+		case KS_KP_ENTER: return 0x4c;
+		case KS_KP_EQUAL: return 0x51;
+	}
+	return -1;
+}
+
+static void handle_key(bool down, uint32 keysym)
+{
+	int code = keysym_to_mac(keysym);
+	if (code < 0)
+		return;
+
+	// Caps Lock is a locking key on the Mac, don't propagate releases
+	if (code == 0x39) {
+		if (!down)
+			return;
+		if (caps_on) {
+			ADBKeyUp(code);
+			caps_on = false;
+		} else {
+			ADBKeyDown(code);
+			caps_on = true;
+		}
+		return;
+	}
+
+	if (down)
+		ADBKeyDown(code);
+	else
+		ADBKeyUp(code);
+}
+
+static void handle_pointer(vnc_client *c, int mask, int x, int y)
+{
+	ADBMouseMoved(x, y);
+
+	// Buttons 1-3 are left, middle and right
+	for (int i = 0; i < 3; i++) {
+		int bit = 1 << i;
+		if ((mask & bit) && !(c->buttons & bit))
+			ADBMouseDown(i);
+		else if (!(mask & bit) && (c->buttons & bit))
+			ADBMouseUp(i);
+	}
+
+	// Buttons 4 and 5 are the mouse wheel
+	for (int i = 3; i < 5; i++) {
+		int bit = 1 << i;
+		if (!(mask & bit) || (c->buttons & bit))
+			continue;
+		bool wheel_down = (i == 4);
+		if (mouse_wheel_mode == 0) {
+			int key = wheel_down ? 0x79 : 0x74;	// Page up/down
+			ADBKeyDown(key);
+			ADBKeyUp(key);
+		} else {
+			int key = wheel_down ? 0x3d : 0x3e;	// Cursor up/down
+			for (int j = 0; j < mouse_wheel_lines; j++) {
+				ADBKeyDown(key);
+				ADBKeyUp(key);
+			}
+		}
+	}
+
+	c->buttons = mask;
+}
+
+
+/*
+ *  Process one message from the client, returns number of bytes used,
+ *  0 if the message is incomplete or -1 to close the connection
+ */
+
+static int process_message(vnc_client *c, const uint8 *p, size_t avail)
+{
+	switch (c->state) {
+		case ST_VERSION: {
+			if (avail < 12)
+				return 0;
+			if (memcmp(p, "RFB 003.", 8) != 0)
+				return -1;
+			int minor = (p[8] - '0') * 100 + (p[9] - '0') * 10 + (p[10] - '0');
+			if (minor >= 8)
+				c->minor_version = 8;
+			else if (minor == 7)
+				c->minor_version = 7;
+			else
+				c->minor_version = 3;
+			if (c->minor_version == 3) {
+				put32(c->out, 1);			// Security type "None"
+				c->state = ST_INIT;
+			} else {
+				put8(c->out, 1);			// One security type, "None"
+				put8(c->out, 1);
+				c->state = ST_SECURITY;
+			}
+			return 12;
+		}
+
+		case ST_SECURITY:
+			if (avail < 1)
+				return 0;
+			if (p[0] != 1) {
+				if (c->minor_version == 8) {
+					static const char reason[] = "Unsupported security type";
+					put32(c->out, 1);
+					put32(c->out, sizeof(reason) - 1);
+					c->out.insert(c->out.end(), reason, reason + sizeof(reason) - 1);
+					send_output(c);
+				}
+				return -1;
+			}
+			if (c->minor_version == 8)
+				put32(c->out, 0);			// SecurityResult OK
+			c->state = ST_INIT;
+			return 1;
+
+		case ST_INIT: {
+			if (avail < 1)
+				return 0;
+			pthread_mutex_lock(&vnc_lock);
+			init_client_frame(c);
+			c->state = ST_NORMAL;
+			pthread_mutex_unlock(&vnc_lock);
+
+			static const char name[] = "Basilisk II";
+			put16(c->out, c->width);
+			put16(c->out, c->height);
+			put_pixel_format(c->out, c->pf);
+			put32(c->out, sizeof(name) - 1);
+			c->out.insert(c->out.end(), name, name + sizeof(name) - 1);
+			return 1;
+		}
+	}
+
+	if (avail < 1)
+		return 0;
+	switch (p[0]) {
+		case MSG_SET_PIXEL_FORMAT: {
+			if (avail < 20)
+				return 0;
+			pixel_format pf;
+			pf.bpp = p[4];
+			pf.depth = p[5];
+			pf.big_endian = p[6];
+			pf.true_colour = p[7];
+			pf.red_max = get16(p + 8);
+			pf.green_max = get16(p + 10);
+			pf.blue_max = get16(p + 12);
+			pf.red_shift = p[14];
+			pf.green_shift = p[15];
+			pf.blue_shift = p[16];
+			if (!pf.true_colour || (pf.bpp != 8 && pf.bpp != 16 && pf.bpp != 32)) {
+				printf("vnc: %s: unsupported pixel format (%d bits per pixel%s)\n", c->name, pf.bpp, pf.true_colour ? "" : ", colour map");
+				return -1;
+			}
+			if (pf.red_shift >= pf.bpp || pf.green_shift >= pf.bpp || pf.blue_shift >= pf.bpp) {
+				printf("vnc: %s: invalid pixel format (shifts %d/%d/%d)\n", c->name, pf.red_shift, pf.green_shift, pf.blue_shift);
+				return -1;
+			}
+			set_pixel_format(c, pf);
+			D(bug("vnc: %s: %d bpp, depth %d, shifts %d/%d/%d\n", c->name, pf.bpp, pf.depth, pf.red_shift, pf.green_shift, pf.blue_shift));
+
+			// Send everything again in the new format
+			pthread_mutex_lock(&vnc_lock);
+			memset(c->force, 1, c->tiles_x * c->tiles_y);
+			pthread_mutex_unlock(&vnc_lock);
+			return 20;
+		}
+
+		case MSG_SET_ENCODINGS: {
+			if (avail < 4)
+				return 0;
+			size_t len = 4 + 4 * get16(p + 2);
+			if (avail < len)
+				return 0;
+			c->use_zrle = c->use_copyrect = c->use_desktop_size = false;
+			for (size_t i = 4; i < len; i += 4) {
+				switch ((int32)get32(p + i)) {
+#ifdef HAVE_ZLIB
+					case ENC_ZRLE:
+						c->use_zrle = true;
+						break;
+#endif
+					case ENC_COPYRECT:
+						c->use_copyrect = true;
+						break;
+					case ENC_DESKTOP_SIZE:
+						c->use_desktop_size = true;
+						break;
+				}
+			}
+			D(bug("vnc: %s: ZRLE %d, CopyRect %d, DesktopSize %d\n", c->name, c->use_zrle, c->use_copyrect, c->use_desktop_size));
+			return len;
+		}
+
+		case MSG_UPDATE_REQUEST: {
+			if (avail < 10)
+				return 0;
+			if (!p[1]) {
+				// Non-incremental, send the requested area even if it did not change
+				int x = get16(p + 2), y = get16(p + 4), w = get16(p + 6), h = get16(p + 8);
+				pthread_mutex_lock(&vnc_lock);
+				if (w > 0 && h > 0 && x < (int)c->width && y < (int)c->height) {
+					uint32 tx1 = std::min(c->tiles_x - 1, (uint32)(x + w - 1) / TILE);
+					uint32 ty1 = std::min(c->tiles_y - 1, (uint32)(y + h - 1) / TILE);
+					for (uint32 ty = y / TILE; ty <= ty1; ty++)
+						for (uint32 tx = x / TILE; tx <= tx1; tx++)
+							c->force[ty * c->tiles_x + tx] = 1;
+				}
+				pthread_mutex_unlock(&vnc_lock);
+			}
+			c->update_requested = true;
+			return 10;
+		}
+
+		case MSG_KEY_EVENT:
+			if (avail < 8)
+				return 0;
+			handle_key(p[1] != 0, get32(p + 4));
+			return 8;
+
+		case MSG_POINTER_EVENT:
+			if (avail < 6)
+				return 0;
+			handle_pointer(c, p[1], get16(p + 2), get16(p + 4));
+			return 6;
+
+		case MSG_CUT_TEXT: {
+			if (avail < 8)
+				return 0;
+			uint32 len = get32(p + 4);
+			if (len > MAX_CUT_TEXT)
+				return -1;
+			c->skip = len;					// Clipboard sharing is not supported
+			return 8;
+		}
+
+		default:
+			printf("vnc: %s: unknown message type %d\n", c->name, p[0]);
+			return -1;
+	}
+}
+
+// Read and process data from client, returns false to close the connection
+static bool handle_input(vnc_client *c)
+{
+	uint8 buf[4096];
+	ssize_t n = recv(c->fd, buf, sizeof(buf), MSG_DONTWAIT);
+	if (n == 0)
+		return false;
+	if (n < 0)
+		return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+	c->in.insert(c->in.end(), buf, buf + n);
+
+	size_t pos = 0;
+	while (pos < c->in.size()) {
+		if (c->skip) {
+			uint32 k = std::min((size_t)c->skip, c->in.size() - pos);
+			c->skip -= k;
+			pos += k;
+			continue;
+		}
+		int used = process_message(c, &c->in[pos], c->in.size() - pos);
+		if (used < 0)
+			return false;
+		if (used == 0)
+			break;
+		pos += used;
+	}
+	c->in.erase(c->in.begin(), c->in.begin() + pos);
+	return true;
+}
+
+
+/*
+ *  Scroll detection
+ */
+
+static uint32 row_hash(const uint8 *p, uint32 len)
+{
+	uint32 h = 2166136261u;
+	while (len >= 4) {
+		uint32 v;
+		memcpy(&v, p, 4);
+		h = (h ^ v) * 16777619u;
+		p += 4;
+		len -= 4;
+	}
+	while (len--)
+		h = (h ^ *p++) * 16777619u;
+	return h;
+}
+
+// Look for a vertical scroll inside the bounding box of the tiles being
+// sent: rows of the new frame that the viewer already shows at another
+// position. Returns the destination rectangle and the source offset.
+static bool find_scroll(vnc_client *c, rect &r, int &dy)
+{
+	static vector<uint32> hash_next, hash_view;
+
+	// Bounding box of changed tiles
+	int tx0 = c->tiles_x, ty0 = c->tiles_y, tx1 = -1, ty1 = -1;
+	for (uint32 ty = 0; ty < c->tiles_y; ty++) {
+		for (uint32 tx = 0; tx < c->tiles_x; tx++) {
+			if (c->work[ty * c->tiles_x + tx]) {
+				tx0 = std::min(tx0, (int)tx);
+				tx1 = std::max(tx1, (int)tx);
+				ty0 = std::min(ty0, (int)ty);
+				ty1 = std::max(ty1, (int)ty);
+			}
+		}
+	}
+	if (tx1 < 0)
+		return false;
+	rect box;
+	box.x = tx0 * TILE;
+	box.y = ty0 * TILE;
+	box.w = std::min((tx1 + 1) * TILE, (int)c->width) - box.x;
+	box.h = std::min((ty1 + 1) * TILE, (int)c->height) - box.y;
+	if (box.w < 2 * TILE || box.h < 4 * TILE)
+		return false;
+
+	const uint32 bpr = c->width * 3;
+	const uint32 offset = box.y * bpr + box.x * 3;
+	hash_next.resize(box.h);
+	hash_view.resize(box.h);
+	for (int y = 0; y < box.h; y++) {
+		hash_next[y] = row_hash(c->next + offset + y * bpr, box.w * 3);
+		hash_view[y] = row_hash(c->view + offset + y * bpr, box.w * 3);
+	}
+
+	// Find where some of the changed rows came from
+	const int MAX_CANDIDATES = 16;
+	int candidates[MAX_CANDIDATES];
+	int n_candidates = 0;
+	for (int s = 1; s < 8; s++) {
+		int ys = box.h * s / 8;
+		if (hash_next[ys] == hash_view[ys])
+			continue;
+		int found = 0;
+		for (int d = 1; d < box.h && found < 2 && n_candidates < MAX_CANDIDATES; d++) {
+			for (int sign = -1; sign <= 1; sign += 2) {
+				int yv = ys + sign * d;
+				if (yv < 0 || yv >= box.h || hash_view[yv] != hash_next[ys])
+					continue;
+				found++;
+				int cand = sign * d;
+				if (std::find(candidates, candidates + n_candidates, cand) == candidates + n_candidates && n_candidates < MAX_CANDIDATES)
+					candidates[n_candidates++] = cand;
+			}
+		}
+	}
+
+	// Pick the offset that explains most changed rows
+	int best_dy = 0, best_count = 0;
+	for (int i = 0; i < n_candidates; i++) {
+		int d = candidates[i];
+		int count = 0;
+		for (int y = std::max(0, -d); y < std::min(box.h, box.h - d); y++) {
+			if (hash_next[y] == hash_view[y + d] && hash_next[y] != hash_view[y])
+				count++;
+		}
+		if (count > best_count) {
+			best_count = count;
+			best_dy = d;
+		}
+	}
+	if (best_count < 2 * TILE)
+		return false;
+
+	// Longest run of rows that really match
+	int run_start = 0, run_length = 0, best_start = 0, best_length = 0;
+	for (int y = std::max(0, -best_dy); y < std::min(box.h, box.h - best_dy); y++) {
+		if (hash_next[y] == hash_view[y + best_dy] &&
+			memcmp(c->next + offset + y * bpr, c->view + offset + (y + best_dy) * bpr, box.w * 3) == 0) {
+			if (run_length == 0)
+				run_start = y;
+			run_length++;
+			if (run_length > best_length) {
+				best_start = run_start;
+				best_length = run_length;
+			}
+		} else
+			run_length = 0;
+	}
+	if (best_length < 2 * TILE)
+		return false;
+
+	r.x = box.x;
+	r.y = box.y + best_start;
+	r.w = box.w;
+	r.h = best_length;
+	dy = best_dy;
+	return true;
+}
+
+// Apply CopyRect to viewer copy of the frame
+static void apply_scroll(vnc_client *c, const rect &r, int dy)
+{
+	const uint32 bpr = c->width * 3;
+	if (dy > 0) {
+		for (int y = r.y; y < r.y + r.h; y++)
+			memcpy(c->view + y * bpr + r.x * 3, c->view + (y + dy) * bpr + r.x * 3, r.w * 3);
+	} else {
+		for (int y = r.y + r.h - 1; y >= r.y; y--)
+			memcpy(c->view + y * bpr + r.x * 3, c->view + (y + dy) * bpr + r.x * 3, r.w * 3);
+	}
+
+	// The area has to be checked for differences like changed tiles
+	const uint32 tx1 = (r.x + r.w - 1) / TILE, ty1 = (r.y + r.h - 1) / TILE;
+	for (uint32 ty = r.y / TILE; ty <= ty1; ty++)
+		for (uint32 tx = r.x / TILE; tx <= tx1; tx++)
+			c->work[ty * c->tiles_x + tx] |= 1;
+}
+
+
+/*
+ *  Encoders
+ */
+
+static inline uint32 pixel_value(const vnc_client *c, const uint8 *p)
+{
+	return c->red_map[p[0]] | c->green_map[p[1]] | c->blue_map[p[2]];
+}
+
+static void encode_raw(vnc_client *c, const rect &r)
+{
+	const int bytes = c->pf.bpp / 8;
+	for (int y = r.y; y < r.y + r.h; y++) {
+		const uint8 *p = c->next + (y * c->width + r.x) * 3;
+		for (int x = 0; x < r.w; x++, p += 3)
+			put_pixel(c->out, pixel_value(c, p), bytes, c->pf.big_endian);
+	}
+}
+
+#ifdef HAVE_ZLIB
+static vector<uint8> zrle_data;						// Uncompressed ZRLE data of one rectangle
+
+static inline void put_cpixel(vnc_client *c, uint32 v)
+{
+	put_pixel(zrle_data, v >> c->cpixel_shift, c->cpixel_bytes, c->pf.big_endian);
+}
+
+// Encode one ZRLE tile as solid, packed palette, plain RLE or raw
+static void zrle_tile(vnc_client *c, const rect &t)
+{
+	uint32 pix[ZRLE_TILE * ZRLE_TILE];
+	uint8 index[ZRLE_TILE * ZRLE_TILE];
+	uint32 palette[16];
+	int n_colors = 0, n_runs = 0;
+
+	const int n = t.w * t.h;
+	for (int y = 0, i = 0; y < t.h; y++) {
+		const uint8 *p = c->next + ((t.y + y) * c->width + t.x) * 3;
+		for (int x = 0; x < t.w; x++, p += 3, i++) {
+			uint32 v = pixel_value(c, p);
+			pix[i] = v;
+			if (i > 0 && v == pix[i - 1]) {
+				index[i] = index[i - 1];
+				continue;
+			}
+			n_runs++;
+			if (n_colors > 16)
+				continue;
+			int j = 0;
+			while (j < n_colors && palette[j] != v)
+				j++;
+			if (j == n_colors) {
+				if (n_colors == 16) {
+					n_colors = 17;
+					continue;
+				}
+				palette[n_colors++] = v;
+			}
+			index[i] = j;
+		}
+	}
+
+	if (n_colors == 1) {
+		put8(zrle_data, 1);
+		put_cpixel(c, palette[0]);
+		return;
+	}
+
+	if (n_colors <= 16) {
+		put8(zrle_data, n_colors);
+		for (int i = 0; i < n_colors; i++)
+			put_cpixel(c, palette[i]);
+		const int bits = n_colors <= 2 ? 1 : (n_colors <= 4 ? 2 : 4);
+		for (int y = 0; y < t.h; y++) {
+			uint8 byte = 0;
+			int n_bits = 0;
+			for (int x = 0; x < t.w; x++) {
+				byte = (byte << bits) | index[y * t.w + x];
+				n_bits += bits;
+				if (n_bits == 8) {
+					put8(zrle_data, byte);
+					byte = 0;
+					n_bits = 0;
+				}
+			}
+			if (n_bits)
+				put8(zrle_data, byte << (8 - n_bits));
+		}
+		return;
+	}
+
+	// Plain RLE costs at least one length byte per run
+	if (n_runs * (c->cpixel_bytes + 1) < n * c->cpixel_bytes) {
+		put8(zrle_data, 128);
+		int i = 0;
+		while (i < n) {
+			int len = 1;
+			while (i + len < n && pix[i + len] == pix[i])
+				len++;
+			put_cpixel(c, pix[i]);
+			int l = len - 1;
+			while (l >= 255) {
+				put8(zrle_data, 255);
+				l -= 255;
+			}
+			put8(zrle_data, l);
+			i += len;
+		}
+		return;
+	}
+
+	put8(zrle_data, 0);
+	for (int i = 0; i < n; i++)
+		put_cpixel(c, pix[i]);
+}
+
+static bool encode_zrle(vnc_client *c, const rect &r)
+{
+	if (!c->zs_active) {
+		memset(&c->zs, 0, sizeof(c->zs));
+		if (deflateInit(&c->zs, Z_BEST_SPEED) != Z_OK)
+			return false;
+		c->zs_active = true;
+	}
+
+	zrle_data.clear();
+	for (int y = r.y; y < r.y + r.h; y += ZRLE_TILE) {
+		for (int x = r.x; x < r.x + r.w; x += ZRLE_TILE) {
+			rect t;
+			t.x = x;
+			t.y = y;
+			t.w = std::min(ZRLE_TILE, r.x + r.w - x);
+			t.h = std::min(ZRLE_TILE, r.y + r.h - y);
+			zrle_tile(c, t);
+		}
+	}
+
+	// Length, followed by the data compressed with the client's zlib stream
+	const size_t length_pos = c->out.size();
+	put32(c->out, 0);
+	c->zs.next_in = &zrle_data[0];
+	c->zs.avail_in = zrle_data.size();
+	const size_t chunk = zrle_data.size() / 2 + 1024;
+	do {
+		size_t pos = c->out.size();
+		c->out.resize(pos + chunk);
+		c->zs.next_out = &c->out[pos];
+		c->zs.avail_out = chunk;
+		if (deflate(&c->zs, Z_SYNC_FLUSH) == Z_STREAM_ERROR)
+			return false;
+		c->out.resize(pos + chunk - c->zs.avail_out);
+	} while (c->zs.avail_out == 0);
+
+	uint32 length = c->out.size() - length_pos - 4;
+	c->out[length_pos + 0] = length >> 24;
+	c->out[length_pos + 1] = length >> 16;
+	c->out[length_pos + 2] = length >> 8;
+	c->out[length_pos + 3] = length;
+	return true;
+}
+#endif
+
+
+/*
+ *  Send frame update to client, returns false to close the connection
+ */
+
+// Merge tiles to be sent into rectangles
+static void build_rects(vnc_client *c, vector<rect> &rects)
+{
+	vector<int> open, next_open;		// Rectangles ending in the previous/current tile row
+	rects.clear();
+	for (uint32 ty = 0; ty < c->tiles_y; ty++) {
+		const int y = ty * TILE;
+		const int h = std::min((uint32)TILE, c->height - y);
+		next_open.clear();
+		uint32 tx = 0;
+		while (tx < c->tiles_x) {
+			if (!c->work[ty * c->tiles_x + tx]) {
+				tx++;
+				continue;
+			}
+			uint32 tx0 = tx;
+			while (tx < c->tiles_x && c->work[ty * c->tiles_x + tx])
+				tx++;
+			const int x = tx0 * TILE;
+			const int w = std::min(tx * TILE, c->width) - x;
+
+			// Extend rectangle above if it covers the same columns
+			bool merged = false;
+			for (size_t i = 0; i < open.size(); i++) {
+				rect &r = rects[open[i]];
+				if (r.x == x && r.w == w) {
+					r.h += h;
+					next_open.push_back(open[i]);
+					merged = true;
+					break;
+				}
+			}
+			if (!merged) {
+				rect r;
+				r.x = x;
+				r.y = y;
+				r.w = w;
+				r.h = h;
+				next_open.push_back(rects.size());
+				rects.push_back(r);
+			}
+		}
+		open.swap(next_open);
+	}
+}
+
+static bool send_update(vnc_client *c)
+{
+	bool resized = false;
+
+	// Take over changed tiles from the server frame buffer
+	pthread_mutex_lock(&vnc_lock);
+	if (c->resize_pending) {
+		if (!c->use_desktop_size) {
+			pthread_mutex_unlock(&vnc_lock);
+			printf("vnc: %s cannot follow the video mode change\n", c->name);
+			return false;
+		}
+		init_client_frame(c);
+		resized = true;
+	}
+	bool changed = false;
+	const uint32 n_tiles = c->tiles_x * c->tiles_y;
+	for (uint32 t = 0; t < n_tiles; t++) {
+		c->work[t] = c->dirty[t] | (c->force[t] << 1);
+		if (c->work[t]) {
+			copy_tile(c->next, c->width * 3, frame, frame_width * 3, t % c->tiles_x, t / c->tiles_x, c->width, c->height);
+			changed = true;
+		}
+	}
+	memset(c->dirty, 0, n_tiles);
+	memset(c->force, 0, n_tiles);
+	pthread_mutex_unlock(&vnc_lock);
+	if (!changed)
+		return true;
+
+	// Scrolled area?
+	rect copy_rect;
+	int copy_dy = 0;
+	bool have_copy = c->use_copyrect && !resized && find_scroll(c, copy_rect, copy_dy);
+	if (have_copy)
+		apply_scroll(c, copy_rect, copy_dy);
+
+	// Drop tiles that did not change after all (forced tiles have bit 1 set)
+	for (uint32 t = 0; t < n_tiles; t++) {
+		if (c->work[t] == 1 && !tile_differs(c, t % c->tiles_x, t / c->tiles_x))
+			c->work[t] = 0;
+	}
+	vector<rect> rects;
+	build_rects(c, rects);
+	if (rects.empty() && !have_copy)
+		return true;
+
+	// FramebufferUpdate message
+	put8(c->out, 0);
+	put8(c->out, 0);
+	put16(c->out, rects.size() + (have_copy ? 1 : 0) + (resized ? 1 : 0));
+	if (resized) {
+		rect r;
+		r.x = r.y = 0;
+		r.w = c->width;
+		r.h = c->height;
+		put_rect_header(c->out, r, ENC_DESKTOP_SIZE);
+	}
+	if (have_copy) {
+		put_rect_header(c->out, copy_rect, ENC_COPYRECT);
+		put16(c->out, copy_rect.x);
+		put16(c->out, copy_rect.y + copy_dy);
+		c->copyrects++;
+	}
+	for (size_t i = 0; i < rects.size(); i++) {
+#ifdef HAVE_ZLIB
+		if (c->use_zrle) {
+			put_rect_header(c->out, rects[i], ENC_ZRLE);
+			if (!encode_zrle(c, rects[i]))
+				return false;
+			continue;
+		}
+#endif
+		put_rect_header(c->out, rects[i], ENC_RAW);
+		encode_raw(c, rects[i]);
+	}
+
+	// The viewer shows the new frame once the output queue is sent
+	const uint32 bpr = c->width * 3;
+	for (size_t i = 0; i < rects.size(); i++) {
+		const rect &r = rects[i];
+		for (int y = r.y; y < r.y + r.h; y++)
+			memcpy(c->view + y * bpr + r.x * 3, c->next + y * bpr + r.x * 3, r.w * 3);
+	}
+	c->update_requested = false;
+	c->updates++;
+	return true;
+}
+
+
+/*
+ *  Server thread
+ */
+
+static void *vnc_func(void *arg)
+{
+	vector<struct pollfd> fds;
+	while (!vnc_quit) {
+
+		// Don't accept connections before there is a frame to show
+		pthread_mutex_lock(&vnc_lock);
+		const bool accepting = (frame != NULL);
+		const size_t n_clients = clients.size();
+		fds.resize(2 + n_clients);
+		fds[0].fd = wakeup_pipe[0];
+		fds[1].fd = accepting ? listen_fd : -1;
+		for (size_t i = 0; i < n_clients; i++)
+			fds[2 + i].fd = clients[i]->fd;
+		pthread_mutex_unlock(&vnc_lock);
+		for (size_t i = 0; i < fds.size(); i++) {
+			fds[i].events = POLLIN;
+			fds[i].revents = 0;
+		}
+		for (size_t i = 0; i < n_clients; i++) {
+			if (output_pending(clients[i]))
+				fds[2 + i].events |= POLLOUT;
+		}
+
+		if (poll(&fds[0], fds.size(), -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			printf("vnc: poll() failed (%s), server stopped\n", strerror(errno));
+			break;
+		}
+		if (vnc_quit)
+			break;
+
+		if (fds[0].revents & POLLIN) {
+			char buf[64];
+			while (read(wakeup_pipe[0], buf, sizeof(buf)) > 0) ;
+			pthread_mutex_lock(&vnc_lock);
+			wakeup_pending = false;
+			pthread_mutex_unlock(&vnc_lock);
+		}
+
+		if (fds[1].revents & POLLIN)
+			accept_client();
+
+		for (size_t i = 0; i < n_clients; i++) {
+			vnc_client *c = clients[i];
+			if ((fds[2 + i].revents & (POLLIN | POLLHUP | POLLERR)) && !handle_input(c))
+				c->closed = true;
+		}
+
+		// Build updates for viewers that have received the previous one,
+		// then send what the sockets take
+		for (size_t i = 0; i < clients.size(); i++) {
+			vnc_client *c = clients[i];
+			if (c->closed)
+				continue;
+			if (c->state == ST_NORMAL && c->update_requested && !output_pending(c) && !send_update(c))
+				c->closed = true;
+			else if (output_pending(c) && !send_output(c))
+				c->closed = true;
+		}
+
+		// Remove closed connections
+		pthread_mutex_lock(&vnc_lock);
+		vector<vnc_client *> closed;
+		for (size_t i = 0; i < clients.size(); ) {
+			if (clients[i]->closed) {
+				closed.push_back(clients[i]);
+				clients.erase(clients.begin() + i);
+			} else
+				i++;
+		}
+		pthread_mutex_unlock(&vnc_lock);
+		for (size_t i = 0; i < closed.size(); i++)
+			close_client(closed[i]);
+	}
+	return NULL;
+}
+
+
+/*
+ *  Initialization
+ */
+
+bool VNCServerInit(const char *address, int port)
+{
+	mouse_wheel_mode = PrefsFindInt32("mousewheelmode");
+	mouse_wheel_lines = PrefsFindInt32("mousewheellines");
+
+	if (address == NULL)
+		address = "127.0.0.1";
+	struct sockaddr_in sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_port = htons(port);
+	if (inet_aton(address, &sa.sin_addr) == 0) {
+		printf("WARNING: Invalid VNC server address %s\n", address);
+		return false;
+	}
+
+	listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (listen_fd < 0) {
+		printf("WARNING: Cannot create VNC server socket (%s)\n", strerror(errno));
+		return false;
+	}
+	int one = 1;
+	setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	if (bind(listen_fd, (struct sockaddr *)&sa, sizeof(sa)) < 0 || listen(listen_fd, 4) < 0) {
+		printf("WARNING: Cannot listen on %s:%d for VNC connections (%s)\n", address, port, strerror(errno));
+		close(listen_fd);
+		listen_fd = -1;
+		return false;
+	}
+
+	if (pipe(wakeup_pipe) < 0) {
+		close(listen_fd);
+		listen_fd = -1;
+		return false;
+	}
+	fcntl(wakeup_pipe[0], F_SETFL, O_NONBLOCK);
+	fcntl(wakeup_pipe[1], F_SETFL, O_NONBLOCK);
+
+	// Start server thread
+	pthread_attr_t vnc_thread_attr;
+	Set_pthread_attr(&vnc_thread_attr, 0);
+	vnc_quit = false;
+	vnc_thread_active = (pthread_create(&vnc_thread, &vnc_thread_attr, vnc_func, NULL) == 0);
+	pthread_attr_destroy(&vnc_thread_attr);
+	if (!vnc_thread_active) {
+		printf("WARNING: Cannot start VNC server thread\n");
+		VNCServerExit();
+		return false;
+	}
+
+	printf("vnc: listening on %s:%d\n", address, port);
+	return true;
+}
+
+
+/*
+ *  Deinitialization
+ */
+
+void VNCServerExit(void)
+{
+	// Stop server thread
+	if (vnc_thread_active) {
+		vnc_quit = true;
+		pthread_mutex_lock(&vnc_lock);
+		wakeup();
+		pthread_mutex_unlock(&vnc_lock);
+		pthread_join(vnc_thread, NULL);
+		vnc_thread_active = false;
+	}
+
+	// Close connections
+	for (size_t i = 0; i < clients.size(); i++)
+		close_client(clients[i]);
+	clients.clear();
+	if (listen_fd >= 0) {
+		close(listen_fd);
+		listen_fd = -1;
+	}
+	for (int i = 0; i < 2; i++) {
+		if (wakeup_pipe[i] >= 0) {
+			close(wakeup_pipe[i]);
+			wakeup_pipe[i] = -1;
+		}
+	}
+	wakeup_pending = false;
+
+	free(frame);
+	frame = NULL;
+}
+
+
+/*
+ *  Set frame size
+ */
+
+void VNCServerResize(uint32 width, uint32 height)
+{
+	pthread_mutex_lock(&vnc_lock);
+	free(frame);
+	frame = (uint8 *)calloc(width * height, 3);
+	frame_width = width;
+	frame_height = height;
+	frame_tiles_x = (width + TILE - 1) / TILE;
+	frame_tiles_y = (height + TILE - 1) / TILE;
+
+	// Connected viewers get the new size with their next update, their
+	// tile maps keep the old size until then (see init_client_frame())
+	for (size_t i = 0; i < clients.size(); i++) {
+		vnc_client *c = clients[i];
+		if (c->state == ST_NORMAL)
+			c->resize_pending = true;
+	}
+	wakeup();
+	pthread_mutex_unlock(&vnc_lock);
+}
+
+
+/*
+ *  Pass changed tiles to the server
+ */
+
+void VNCServerUpdate(const uint8 *rgb, uint32 bytes_per_row, const uint8 *dirty)
+{
+	pthread_mutex_lock(&vnc_lock);
+	if (frame == NULL) {
+		pthread_mutex_unlock(&vnc_lock);
+		return;
+	}
+
+	bool changed = false;
+	const uint32 n_tiles = frame_tiles_x * frame_tiles_y;
+	for (uint32 t = 0; t < n_tiles; t++) {
+		if (dirty[t]) {
+			copy_tile(frame, frame_width * 3, rgb, bytes_per_row, t % frame_tiles_x, t / frame_tiles_x, frame_width, frame_height);
+			changed = true;
+		}
+	}
+
+	if (changed) {
+		for (size_t i = 0; i < clients.size(); i++) {
+			vnc_client *c = clients[i];
+			if (c->state != ST_NORMAL || c->resize_pending)
+				continue;
+			for (uint32 t = 0; t < n_tiles; t++)
+				c->dirty[t] |= (dirty[t] != 0);
+		}
+		wakeup();
+	}
+	pthread_mutex_unlock(&vnc_lock);
+}
+
+#else
+
+bool VNCServerInit(const char *address, int port)
+{
+	printf("WARNING: The VNC server needs pthreads\n");
+	return false;
+}
+
+void VNCServerExit(void)
+{
+}
+
+void VNCServerResize(uint32 width, uint32 height)
+{
+}
+
+void VNCServerUpdate(const uint8 *rgb, uint32 bytes_per_row, const uint8 *dirty)
+{
+}
+
+#endif
@@ -0,0 +1,38 @@
+/*
+ *  vnc_server.h - RFB (VNC) server for the headless video driver
+ *
+ *  Basilisk II (C) Christian Bauer
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef VNC_SERVER_H
+#define VNC_SERVER_H
+
+// Frame updates are passed in tiles of this many pixels square
+const int VNC_TILE_SIZE = 16;
+
+// Start/stop server thread
+extern bool VNCServerInit(const char *address, int port);
+extern void VNCServerExit(void);
+
+// Set frame size (all tiles are considered changed afterwards)
+extern void VNCServerResize(uint32 width, uint32 height);
+
+// Pass changed tiles of a 24-bit RGB frame to the server, "dirty" holds one
+// byte per tile (non-zero = changed), row by row
+extern void VNCServerUpdate(const uint8 *rgb, uint32 bytes_per_row, const uint8 *dirty);
+
+#endif
@@ -67,16 +67,27 @@ void LoadXPRAM(const char *vmdir)
 
 
 /*
- *  Save XPRAM to settings file
+ *  Save XPRAM to settings file (written to a temporary file first and
+ *  renamed over the old one, so a crash never leaves a truncated file)
  */
 
 void SaveXPRAM(void)
 {
+	if (xpram_path[0] == 0)
+		return;
+
+	char tmp_path[sizeof(xpram_path) + 4];
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", xpram_path);
+
 	int fd;
-	if ((fd = open(xpram_path, O_WRONLY | O_CREAT, 0666)) >= 0) {
-		write(fd, XPRAM, XPRAM_SIZE);
-		close(fd);
-	}
+	if ((fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0)
+		return;
+	bool ok = (write(fd, XPRAM, XPRAM_SIZE) == XPRAM_SIZE);
+	if (ok)
+		ok = (fsync(fd) == 0);
+	close(fd);
+	if (!ok || rename(tmp_path, xpram_path) < 0)
+		unlink(tmp_path);
 }
 
 
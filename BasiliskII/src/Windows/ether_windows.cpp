@@ -1368,6 +1368,8 @@ unsigned int WINAPI slirp_receive_func(void *arg)
 #if ! USE_SLIRP_TIMEOUT
 		timeout = 10000;
 #endif
+		if (timeout < 0)	// nothing to time, but guest packets aren't waited for here
+			timeout = 2000;
 		if (nfds < 0) {
 			/* Windows does not honour the timeout if there is not
 			   descriptor to wait for */
@@ -266,3 +266,21 @@ void idle_resume(void)
 	}
 	UNLOCK_IDLE;
 }
+
+
+/*
+ *  Tickless idle is not supported, always deliver 60Hz ticks
+ */
+
+int idle_tick_wait(uint64 next, uint32 period, int max_ticks)
+{
+	int64 delay = next - GetTicks_usec();
+	if (delay > 0)
+		Delay_usec(delay);
+	return 0;
+}
+
+uint32 idle_ticks_skipped(void)
+{
+	return 0;
+}
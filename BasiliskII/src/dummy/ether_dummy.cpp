@@ -155,6 +155,22 @@ void ether_stop_udp_thread(void)
 }
 
 
+/*
+ *  Send packet to UDP tunnel peer
+ */
+
+int16 ether_udp_write(const uint8 *packet, int length, struct sockaddr_in *to)
+{
+#if SUPPORTS_UDP_TUNNEL
+	if (sendto(fd, packet, length, 0, (struct sockaddr *)to, sizeof(*to)) < 0)
+		return excessCollsns;
+	return noErr;
+#else
+	return excessCollsns;
+#endif
+}
+
+
 /*
  *  Ethernet interrupt - activate deferred tasks to call IODone or protocol handlers
  */
@@ -149,6 +149,7 @@ void EmulOp(uint16 opcode, M68kRegisters *r)
 					if (reg == 0x8a && !TwentyFourBitAddressing)
 						r->d[2] |= 0x05;	// 32bit mode is always enabled if possible
 					XPRAM[reg] = r->d[2];
+					XPRAMChanged();
 				}
 			} else {
 				// PRAM, RTC and other clock registers
@@ -160,6 +161,7 @@ void EmulOp(uint16 opcode, M68kRegisters *r)
 					} else {
 						D(bug("Write PRAM %02x<-%02lx\n", reg, r->d[2]));
 						XPRAM[reg] = r->d[2];
+						XPRAMChanged();
 					}
 				} else if (reg < 0x08 && is_read) {
 					uint32 t = TimerDateTime();
@@ -447,8 +449,8 @@ void EmulOp(uint16 opcode, M68kRegisters *r)
 			if (InterruptFlags & INTFLAG_60HZ) {
 				ClearInterruptFlag(INTFLAG_60HZ);
 
-				// Increment Ticks variable
-				WriteMacInt32(0x16a, ReadMacInt32(0x16a) + 1);
+				// Increment Ticks variable, including ticks folded while idle
+				WriteMacInt32(0x16a, ReadMacInt32(0x16a) + 1 + idle_ticks_skipped());
 
 				if (HasMacStarted()) {
 
@@ -476,6 +478,12 @@ void EmulOp(uint16 opcode, M68kRegisters *r)
 				}
 			}
 
+			if (InterruptFlags & INTFLAG_TIMER) {
+				ClearInterruptFlag(INTFLAG_TIMER);
+				if (HasMacStarted())
+					TimerInterrupt();
+			}
+
 			if (InterruptFlags & INTFLAG_SERIAL) {
 				ClearInterruptFlag(INTFLAG_SERIAL);
 				SerialInterrupt();
@@ -73,6 +73,13 @@ uint32 ether_data = 0;
 // Attached network protocols for UDP tunneling, maps protocol type to MacOS handler address
 static map<uint16, uint32> udp_protocols;
 
+#if SUPPORTS_UDP_TUNNEL
+// Known UDP tunneling peers, maps IP address from "B2" Ethernet address to
+// the socket address its packets actually came from
+static map<uint32, struct sockaddr_in> udp_peers;
+const size_t MAX_UDP_PEERS = 256;
+#endif
+
 
 /*
  *  Initialization
@@ -180,6 +187,9 @@ void EtherExit(void)
 void EtherReset(void)
 {
 	udp_protocols.clear();
+#if SUPPORTS_UDP_TUNNEL
+	udp_peers.clear();
+#endif
 	ether_reset();
 }
 
@@ -318,11 +328,13 @@ int16 EtherControl(uint32 pb, uint32 dce)
 
 					// Extract destination address
 					uint32 dest_ip;
+					bool broadcast = false;
 					if (len >= 6 && packet[0] == 'B' && packet[1] == '2')
 						dest_ip = (packet[2] << 24) | (packet[3] << 16) | (packet[4] << 8) | packet[5];
-					else if (is_apple_talk_broadcast(packet) || is_ethernet_broadcast(packet))
+					else if (is_apple_talk_broadcast(packet) || is_ethernet_broadcast(packet)) {
 						dest_ip = INADDR_BROADCAST;
-					else
+						broadcast = true;
+					} else
 						return eMultiErr;
 
 #if MONITOR
@@ -333,14 +345,26 @@ int16 EtherControl(uint32 pb, uint32 dce)
 					bug("\n");
 #endif
 
-					// Send packet
+					// Send packet, to where the peer was last heard from if it is known
 					struct sockaddr_in sa;
+					memset(&sa, 0, sizeof(sa));
 					sa.sin_family = AF_INET;
 					sa.sin_addr.s_addr = htonl(dest_ip);
 					sa.sin_port = htons(udp_port);
-					if (sendto(udp_socket, packet, len, 0, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+					map<uint32, struct sockaddr_in>::const_iterator peer = udp_peers.find(dest_ip);
+					if (peer != udp_peers.end())
+						sa = peer->second;
+					int16 res = ether_udp_write(packet, len, &sa);
+					if (res != noErr) {
 						D(bug("WARNING: Couldn't transmit packet\n"));
-						return excessCollsns;
+						return res;
+					}
+
+					// Peers on other ports don't see the broadcast, send it to them directly
+					if (broadcast) {
+						for (peer = udp_peers.begin(); peer != udp_peers.end(); ++peer)
+							if (peer->second.sin_port != htons(udp_port))
+								ether_udp_write(packet, len, (struct sockaddr_in *)&peer->second);
 					}
 				} else
 #endif
@@ -401,9 +425,17 @@ void EtherReadPacket(uint32 &src, uint32 &dest, uint32 &len, uint32 &remaining)
 void ether_udp_read(uint32 packet, int length, struct sockaddr_in *from)
 {
 	// Drop packets sent by us
-	if (memcmp(Mac2HostAddr(packet) + 6, ether_addr, 6) == 0)
+	uint8 *src = Mac2HostAddr(packet) + 6;
+	if (memcmp(src, ether_addr, 6) == 0)
 		return;
 
+	// Remember where the sender can be reached
+	if (src[0] == 'B' && src[1] == '2') {
+		uint32 src_ip = (src[2] << 24) | (src[3] << 16) | (src[4] << 8) | src[5];
+		if (udp_peers.size() < MAX_UDP_PEERS || udp_peers.find(src_ip) != udp_peers.end())
+			udp_peers[src_ip] = *from;
+	}
+
 #if MONITOR
 	bug("Receiving Ethernet packet:\n");
 	for (int i=0; i<length; i++) {
@@ -45,6 +45,7 @@ extern int16 ether_write(uint32 wds);
 extern bool ether_start_udp_thread(int socket_fd);
 extern void ether_stop_udp_thread(void);
 extern void ether_udp_read(uint32 packet, int length, struct sockaddr_in *from);
+extern int16 ether_udp_write(const uint8 *packet, int length, struct sockaddr_in *to);
 
 extern uint8 ether_addr[6];	// Ethernet address (set by ether_init())
 
@@ -46,4 +46,8 @@ extern int32 timer_host2mac_time(tm_time_t hosttime);
 extern void idle_wait(void);
 extern void idle_resume(void);
 
+// Tickless idle: hold back 60Hz ticks while the emulator thread sleeps
+extern int idle_tick_wait(uint64 next, uint32 period, int max_ticks);
+extern uint32 idle_ticks_skipped(void);
+
 #endif
@@ -31,6 +31,7 @@ extern uint8 XPRAM[XPRAM_SIZE];
 
 extern void XPRAMInit(const char *vmdir);
 extern void XPRAMExit(void);
+extern void XPRAMChanged(void);
 
 // System specific and internal functions/data
 extern void LoadXPRAM(const char *vmdir);
@@ -130,6 +130,7 @@ bool InitAll(const char *vmdir)
 		XPRAM[0x0b] = 0xcc;
 		XPRAM[0x76] = 0x00;	// OSDefault = MacOS
 		XPRAM[0x77] = 0x01;
+		XPRAMChanged();
 	}
 
 	// Set boot volume
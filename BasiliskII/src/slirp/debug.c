@@ -233,6 +233,9 @@ tcpstats()
 	lprint("  %6d correct ACK header predictions\r\n", tcpstat.tcps_predack);
 	lprint("  %6d correct data packet header predictions\n", tcpstat.tcps_preddat);
 	lprint("  %6d TCP cache misses\r\n", tcpstat.tcps_socachemiss);
+	lprint("  %6d times send buffer was full (%d enlarged)\r\n",
+			tcpstat.tcps_sndbuf_full, tcpstat.tcps_sndbuf_grown);
+	lprint("  %6d zero windows advertised\r\n", tcpstat.tcps_rcvwin_zero);
 	
 	
 /*	lprint("    Packets received too short:		%d\r\n", tcpstat.tcps_rcvshort); */
@@ -278,6 +281,8 @@ mbufstats()
 	lprint("Mbuf stats:\r\n");
 
 	lprint("  %6d mbufs allocated (%d max)\r\n", mbuf_alloced, mbuf_max);
+	lprint("  %6d mbufs handed out from %d slabs\r\n", mbstat.mbs_alloced, mbstat.mbs_slabs);
+	lprint("  %6d mbufs needed external storage\r\n", mbstat.mbs_ext);
 	
 	i = 0;
 	for (m = m_freelist.m_next; m != &m_freelist; m = m->m_next)
@@ -22,6 +22,7 @@ int inet_aton(const char *cp, struct in_addr *ia);
 extern "C" {
 #endif
 
+void slirp_set_tcp_buffers(int sndspace, int rcvspace, int sndspace_max);
 int slirp_init(void);
 
 int slirp_select_fill(int *pnfds, 
@@ -31,6 +32,8 @@ void slirp_select_poll(fd_set *readfds, fd_set *writefds, fd_set *xfds);
 
 void slirp_input(const uint8 *pkt, int pkt_len);
 
+void slirp_get_socket_counts(int *tcp, int *udp);
+
 /* you must provide the following functions: */
 int slirp_can_output(void);
 void slirp_output(const uint8 *pkt, int pkt_len);
@@ -22,9 +22,12 @@ struct	mbuf *mbutl;
 char	*mclrefcnt;
 int mbuf_alloced = 0;
 struct mbuf m_freelist, m_usedlist;
-int mbuf_thresh = 30;
 int mbuf_max = 0;
 int msize;
+struct mbstat mbstat;
+
+#define MBUF_SLAB_COUNT	32	/* Number of mbufs allocated at a time */
+#define MBUF_ALIGN	64	/* Cache line size */
 
 void
 m_init()
@@ -43,40 +46,57 @@ msize_init()
 	 */
 	msize = (if_mtu>if_mru?if_mtu:if_mru) + 
 			if_maxlinkhdr + sizeof(struct m_hdr ) + 6;
+	msize = (msize + MBUF_ALIGN - 1) & ~(MBUF_ALIGN - 1);
+}
+
+/*
+ * Allocate a slab of cache-aligned mbufs and put them on the free
+ * list. Slabs are never given back, so the free list only grows to
+ * the peak number of mbufs in use and there is no fragmentation.
+ */
+static int
+m_slab_alloc()
+{
+	char *slab;
+	int i;
+
+	slab = (char *)malloc(MBUF_SLAB_COUNT * msize + MBUF_ALIGN - 1);
+	if (slab == NULL)
+		return -1;
+	slab = (char *)(((uintptr_t)slab + MBUF_ALIGN - 1) & ~(uintptr_t)(MBUF_ALIGN - 1));
+
+	for (i = 0; i < MBUF_SLAB_COUNT; i++) {
+		struct mbuf *m = (struct mbuf *)(slab + i * msize);
+		insque(m,&m_freelist);
+		m->m_flags = M_FREELIST;
+	}
+	mbuf_alloced += MBUF_SLAB_COUNT;
+	if (mbuf_alloced > mbuf_max)
+		mbuf_max = mbuf_alloced;
+	mbstat.mbs_slabs++;
+	return 0;
 }
 
 /*
  * Get an mbuf from the free list, if there are none
- * malloc one
- * 
- * Because fragmentation can occur if we alloc new mbufs and
- * free old mbufs, we mark all mbufs above mbuf_thresh as M_DOFREE,
- * which tells m_free to actually free() it
+ * allocate another slab
  */
 struct mbuf *
 m_get()
 {
-	register struct mbuf *m;
-	int flags = 0;
+	register struct mbuf *m = NULL;
 	
 	DEBUG_CALL("m_get");
 	
-	if (m_freelist.m_next == &m_freelist) {
-		m = (struct mbuf *)malloc(msize);
-		if (m == NULL) goto end_error;
-		mbuf_alloced++;
-		if (mbuf_alloced > mbuf_thresh)
-			flags = M_DOFREE;
-		if (mbuf_alloced > mbuf_max)
-			mbuf_max = mbuf_alloced;
-	} else {
-		m = m_freelist.m_next;
-		remque(m);
-	}
+	if (m_freelist.m_next == &m_freelist && m_slab_alloc() < 0)
+		goto end_error;
+	m = m_freelist.m_next;
+	remque(m);
+	mbstat.mbs_alloced++;
 	
 	/* Insert it in the used list */
 	insque(m,&m_usedlist);
-	m->m_flags = (flags | M_USEDLIST);
+	m->m_flags = M_USEDLIST;
 	
 	/* Initialise it */
 	m->m_size = msize - sizeof(struct m_hdr);
@@ -107,12 +127,9 @@ m_free(m)
 	   free(m->m_ext);
 
 	/*
-	 * Either free() it or put it on the free list
+	 * Put it back on the free list
 	 */
-	if (m->m_flags & M_DOFREE) {
-		free(m);
-		mbuf_alloced--;
-	} else if ((m->m_flags & M_FREELIST) == 0) {
+	if ((m->m_flags & M_FREELIST) == 0) {
 		insque(m,&m_freelist);
 		m->m_flags = M_FREELIST; /* Clobber other flags */
 	}
@@ -167,6 +184,7 @@ m_inc(m, size)
  *			return (struct mbuf *)NULL;
  */
 	  memcpy(dat, m->m_dat, m->m_size);
+	  mbstat.mbs_ext++;
 	  
 	  m->m_ext = dat;
 	  m->m_data = m->m_ext + datasize;
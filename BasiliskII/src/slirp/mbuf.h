@@ -113,16 +113,15 @@ struct mbuf {
 #define M_EXT			0x01	/* m_ext points to more (malloced) data */
 #define M_FREELIST		0x02	/* mbuf is on free list */
 #define M_USEDLIST		0x04	/* XXX mbuf is on used list (for dtom()) */
-#define M_DOFREE		0x08	/* when m_free is called on the mbuf, free()
-					 * it rather than putting it on the free list */
 
 /*
  * Mbuf statistics. XXX
  */
 
 struct mbstat {
-	int mbs_alloced;		/* Number of mbufs allocated */
-	
+	u_long mbs_alloced;		/* Number of mbufs handed out by m_get() */
+	u_long mbs_slabs;		/* Number of slabs allocated */
+	u_long mbs_ext;			/* Number of mbufs that needed external storage */
 };
 
 extern struct	mbstat mbstat;
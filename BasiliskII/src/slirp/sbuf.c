@@ -66,6 +66,36 @@ sbreserve(sb, size)
 	}
 }
 
+/*
+ * Enlarge a buffer, keeping its contents
+ */
+void
+sbgrow(sb, size)
+	struct sbuf *sb;
+	int size;
+{
+	char *data;
+	u_int n;
+
+	if (size <= (int)sb->sb_datalen)
+		return;
+	data = (char *)malloc(size);
+	if (data == NULL)
+		return;
+
+	/* Unwrap the data into the new buffer */
+	n = (sb->sb_data + sb->sb_datalen) - sb->sb_rptr;
+	if (n > sb->sb_cc)
+		n = sb->sb_cc;
+	memcpy(data, sb->sb_rptr, n);
+	memcpy(data + n, sb->sb_data, sb->sb_cc - n);
+
+	free(sb->sb_data);
+	sb->sb_data = sb->sb_rptr = data;
+	sb->sb_wptr = data + sb->sb_cc;
+	sb->sb_datalen = size;
+}
+
 /*
  * Try and write() to the socket, whatever doesn't get written
  * append to the buffer... for a host with a fast net connection,
@@ -130,6 +130,17 @@ void slirp_cleanup(void)
 }
 #endif
 
+/* Set TCP socket buffer sizes in bytes (0 = default), call before slirp_init() */
+void slirp_set_tcp_buffers(int sndspace, int rcvspace, int sndspace_max)
+{
+	if (sndspace > 0)
+		tcp_sndspace = sndspace;
+	if (rcvspace > 0)
+		tcp_rcvspace = rcvspace;
+	if (sndspace_max > 0)
+		tcp_sndspace_max = sndspace_max;
+}
+
 int slirp_init(void)
 {
     //    debug_init("/tmp/slirp.log", DEBUG_DEFAULT);
@@ -191,11 +202,20 @@ static void updtime(void)
 }
 #endif
 
+/* Socket counts as of the last slirp_select_fill(), for statistics */
+static int tcp_socket_count, udp_socket_count;
+
+void slirp_get_socket_counts(int *tcp, int *udp)
+{
+	*tcp = tcp_socket_count;
+	*udp = udp_socket_count;
+}
+
 int slirp_select_fill(int *pnfds, 
 					  fd_set *readfds, fd_set *writefds, fd_set *xfds)
 {
     struct socket *so, *so_next;
-    int nfds;
+    int nfds, ntcp = 0, nudp = 0;
     int timeout, tmp_time;
 
     /* fail safe */
@@ -218,6 +238,7 @@ int slirp_select_fill(int *pnfds,
 	
 		for (so = tcb.so_next; so != &tcb; so = so_next) {
 			so_next = so->so_next;
+			ntcp++;
 			
 			/*
 			 * See if we need a tcp_fasttimo
@@ -275,6 +296,7 @@ int slirp_select_fill(int *pnfds,
 		 */
 		for (so = udb.so_next; so != &udb; so = so_next) {
 			so_next = so->so_next;
+			nudp++;
 			
 			/*
 			 * See if it's timed out
@@ -305,7 +327,9 @@ int slirp_select_fill(int *pnfds,
 	}
 	
 	/*
-	 * Setup timeout to use minimum CPU usage, especially when idle
+	 * Setup timeout to use minimum CPU usage, especially when idle.
+	 * A timeout of -1 means nothing needs to be timed, so the caller
+	 * may sleep until a socket or the guest has something for us.
 	 */
 
 	timeout = -1;
@@ -335,13 +359,20 @@ int slirp_select_fill(int *pnfds,
 			   timeout = tmp_time;
 		}
 	}
+	/*
+	 * Retry output soon if it had to be deferred
+	 */
+	if (if_queued && link_up && (timeout < 0 || timeout > FAST_TIMO * 1000))
+		timeout = FAST_TIMO * 1000;
 	*pnfds = nfds;
+	tcp_socket_count = ntcp;
+	udp_socket_count = nudp;
 
 	/*
 	 * Adjust the timeout to make the minimum timeout
 	 * 2ms (XXX?) to lessen the CPU load
 	 */
-	if (timeout < (FAST_TIMO * 1000))
+	if (timeout >= 0 && timeout < (FAST_TIMO * 1000))
 		timeout = FAST_TIMO * 1000;
 
 	return timeout;
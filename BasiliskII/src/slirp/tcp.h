@@ -40,10 +40,12 @@ typedef	u_int32_t	tcp_seq;
 
 extern int tcp_rcvspace;
 extern int tcp_sndspace;
+extern int tcp_sndspace_max;
 extern struct socket *tcp_last_so;
 
-#define TCP_SNDSPACE 8192
-#define TCP_RCVSPACE 8192
+#define TCP_SNDSPACE 32768
+#define TCP_RCVSPACE 65536
+#define TCP_SNDSPACE_MAX (1024*1024)	/* Default for tcp_sndspace_max */
 
 /*
  * TCP header.
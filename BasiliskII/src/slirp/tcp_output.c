@@ -60,6 +60,36 @@ u_char  tcp_outflags[TCP_NSTATES] = {
 
 #define MAX_TCPOPTLEN	32	/* max # bytes that go in options */
 
+/*
+ * slirp stops reading from the host socket once so_snd is half full
+ * (see slirp_select_fill()). If the peer's window would take more than
+ * that, enlarge so_snd so the transfer isn't limited by our buffer.
+ * Called for data read from the host as well as for ACKs and window
+ * updates from the peer, since both end up in tcp_output().
+ */
+static void
+tcp_sndbuf_check(tp)
+	register struct tcpcb *tp;
+{
+	struct sbuf *sb = &tp->t_socket->so_snd;
+	
+	if (sb->sb_cc < sb->sb_datalen / 2) {
+		tp->t_flags &= ~TF_SNDBUF_FULL;
+		return;
+	}
+	if ((tp->t_flags & TF_SNDBUF_FULL) == 0) {
+		tp->t_flags |= TF_SNDBUF_FULL;
+		tcpstat.tcps_sndbuf_full++;
+	}
+	if ((int)sb->sb_datalen < tcp_sndspace_max &&
+	    tp->snd_wnd >= sb->sb_datalen / 2) {
+		sbgrow(sb, min(sb->sb_datalen * 2, tcp_sndspace_max));
+		tcpstat.tcps_sndbuf_grown++;
+		if (sb->sb_cc < sb->sb_datalen / 2)
+			tp->t_flags &= ~TF_SNDBUF_FULL;
+	}
+}
+
 /*
  * Tcp output routine: figure out what should be sent and send it.
  */
@@ -79,6 +109,8 @@ tcp_output(tp)
 	DEBUG_CALL("tcp_output");
 	DEBUG_ARG("tp = %lx", (long )tp);
 	
+	tcp_sndbuf_check(tp);
+	
 	/*
 	 * Determine length of data that should be transmitted,
 	 * and flags that will be used.
@@ -285,17 +317,15 @@ send:
 			memcpy((caddr_t)(opt + 2), (caddr_t)&mss, sizeof(mss));
 			optlen = 4;
 
-/*			if ((tp->t_flags & TF_REQ_SCALE) &&
- *			    ((flags & TH_ACK) == 0 ||
- *			    (tp->t_flags & TF_RCVD_SCALE))) {
- *				*((u_int32_t *) (opt + optlen)) = htonl(
- *					TCPOPT_NOP << 24 |
- *					TCPOPT_WINDOW << 16 |
- *					TCPOLEN_WINDOW << 8 |
- *					tp->request_r_scale);
- *				optlen += 4;
- *			}
- */
+			if ((tp->t_flags & TF_REQ_SCALE) &&
+			    ((flags & TH_ACK) == 0 ||
+			    (tp->t_flags & TF_RCVD_SCALE))) {
+				opt[optlen] = TCPOPT_NOP;
+				opt[optlen + 1] = TCPOPT_WINDOW;
+				opt[optlen + 2] = TCPOLEN_WINDOW;
+				opt[optlen + 3] = tp->request_r_scale;
+				optlen += 4;
+			}
 		}
  	}
  
@@ -441,6 +471,8 @@ send:
 		win = (long)TCP_MAXWIN << tp->rcv_scale;
 	if (win < (long)(tp->rcv_adv - tp->rcv_nxt))
 		win = (long)(tp->rcv_adv - tp->rcv_nxt);
+	if (win == 0)
+		tcpstat.tcps_rcvwin_zero++;
 	ti->ti_win = htons((u_int16_t) (win>>tp->rcv_scale));
 	
 	if (SEQ_GT(tp->snd_up, tp->snd_una)) {
@@ -45,9 +45,10 @@
 /* patchable/settable parameters for tcp */
 int 	tcp_mssdflt = TCP_MSS;
 int 	tcp_rttdflt = TCPTV_SRTTDFLT / PR_SLOWHZ;
-int	tcp_do_rfc1323 = 0;	/* Don't do rfc1323 performance enhancements */
-int	tcp_rcvspace;	/* You may want to change this */
-int	tcp_sndspace;	/* Keep small if you have an error prone link */
+int	tcp_do_rfc1323 = 1;	/* Do rfc1323 window scaling (timestamps are not supported) */
+int	tcp_rcvspace = TCP_RCVSPACE;	/* You may want to change this */
+int	tcp_sndspace = TCP_SNDSPACE;	/* Keep small if you have an error prone link */
+int	tcp_sndspace_max = TCP_SNDSPACE_MAX;	/* so_snd grows up to this if the peer's window allows */
 
 /*
  * Tcp initialization
@@ -58,13 +59,16 @@ tcp_init()
 	tcp_iss = 1;		/* wrong */
 	tcb.so_next = tcb.so_prev = &tcb;
 	
-	/* tcp_rcvspace = our Window we advertise to the remote */
-	tcp_rcvspace = TCP_RCVSPACE;
-	tcp_sndspace = TCP_SNDSPACE;
+	/*
+	 * tcp_rcvspace = our Window we advertise to the remote, the
+	 * buffer sizes may have been set by slirp_set_tcp_buffers()
+	 */
 	
 	/* Make sure tcp_sndspace is at least 2*MSS */
 	if (tcp_sndspace < 2*(min(if_mtu, if_mru) - sizeof(struct tcpiphdr)))
 		tcp_sndspace = 2*(min(if_mtu, if_mru) - sizeof(struct tcpiphdr));
+	if (tcp_sndspace_max < tcp_sndspace)
+		tcp_sndspace_max = tcp_sndspace;
 }
 
 /*
@@ -207,8 +211,13 @@ tcp_newtcpcb(so)
 	tp->seg_next = tp->seg_prev = (struct tcpiphdr*)tp;
 	tp->t_maxseg = tcp_mssdflt;
 	
-	tp->t_flags = tcp_do_rfc1323 ? (TF_REQ_SCALE|TF_REQ_TSTMP) : 0;
+	tp->t_flags = tcp_do_rfc1323 ? TF_REQ_SCALE : 0;
 	tp->t_socket = so;
+
+	/* Compute window scaling to request */
+	while (tp->request_r_scale < TCP_MAX_WINSHIFT &&
+	       (TCP_MAXWIN << tp->request_r_scale) < tcp_rcvspace)
+		tp->request_r_scale++;
 	
 	/*
 	 * Init srtt to TCPTV_SRTTBASE (0), so we can tell that we have no
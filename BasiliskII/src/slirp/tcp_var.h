@@ -60,6 +60,7 @@ struct tcpcb {
 #define	TF_REQ_TSTMP	0x0080		/* have/will request timestamps */
 #define	TF_RCVD_TSTMP	0x0100		/* a timestamp was received in SYN */
 #define	TF_SACK_PERMIT	0x0200		/* other side said I could SACK */
+#define	TF_SNDBUF_FULL	0x0400		/* so_snd was full at last tcp_output() */
 
 	/* Make it static  for now */
 /*	struct	tcpiphdr *t_template;	/ * skeletal packet for transmit */
@@ -219,6 +220,9 @@ struct tcpstat {
 	u_long	tcps_preddat;		/* times hdr predict ok for data pkts */
 	u_long	tcps_socachemiss;	/* tcp_last_so misses */
 	u_long	tcps_didnuttin;		/* Times tcp_output didn't do anything XXX */
+	u_long	tcps_sndbuf_full;	/* times so_snd became full */
+	u_long	tcps_sndbuf_grown;	/* times so_snd was enlarged */
+	u_long	tcps_rcvwin_zero;	/* zero windows advertised because so_rcv was full */
 };
 
 extern struct	tcpstat tcpstat;	/* tcp statistics */
@@ -25,6 +25,8 @@
  */
 
 #include <stdio.h>
+#include <vector>
+#include <unordered_map>
 
 #include "sysdeps.h"
 #include "cpu_emulation.h"
@@ -32,6 +34,11 @@
 #include "macos_util.h"
 #include "timer.h"
 
+#ifdef PRECISE_TIMING_POSIX
+#include <pthread.h>
+#include <errno.h>
+#endif
+
 #define DEBUG 0
 #include "debug.h"
 
@@ -49,54 +56,133 @@ enum {	// TMTask struct
 };
 
 
-// Array of additional info for each installed TMTask
+// Additional info for each installed TMTask
 struct TMDesc {
 	uint32 task;		// Mac address of associated TMTask
 	tm_time_t wakeup;	// Time this task is scheduled for execution
-	bool in_use;		// Flag: descriptor in use
+	int heap_index;		// Position in deadline heap, -1 = not scheduled
 };
 
-const int NUM_DESCS = 64;		// Maximum number of descriptors
-static TMDesc desc[NUM_DESCS];
+// Installed tasks, by TMTask address
+static std::unordered_map<uint32, TMDesc> descs;
+
+// Active tasks, ordered by wakeup time (binary min-heap)
+static std::vector<TMDesc *> deadlines;
+
+#ifdef PRECISE_TIMING_POSIX
+// Host thread that triggers a timer interrupt at the earliest deadline
+static pthread_t timer_thread;
+static bool timer_thread_active = false;
+static bool timer_thread_quit = false;
+static pthread_mutex_t wakeup_time_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wakeup_time_cond = PTHREAD_COND_INITIALIZER;
+static tm_time_t wakeup_time;			// Earliest deadline (protected by wakeup_time_lock)
+static bool wakeup_time_valid = false;	// Flag: wakeup_time is set
+static void *timer_func(void *arg);
+#endif
 
 
 /*
- *  Allocate descriptor for given TMTask in list
+ *  Find descriptor associated with given TMTask
  */
 
-static int alloc_desc(uint32 tm)
+inline static TMDesc *find_desc(uint32 tm)
 {
-	// Search for first free descriptor
-	for (int i=0; i<NUM_DESCS; i++)
-		if (!desc[i].in_use) {
-			desc[i].task = tm;
-			desc[i].in_use = true;
-			return i;
-		}
-	return -1;
+	std::unordered_map<uint32, TMDesc>::iterator i = descs.find(tm);
+	return i == descs.end() ? NULL : &i->second;
 }
 
 
 /*
- *  Free descriptor in list
+ *  Deadline heap management
  */
 
-inline static void free_desc(int i)
+static inline bool heap_less(int a, int b)
 {
-	desc[i].in_use = false;
+	return timer_cmp_time(deadlines[a]->wakeup, deadlines[b]->wakeup) < 0;
 }
 
+static inline void heap_swap(int a, int b)
+{
+	TMDesc *t = deadlines[a];
+	deadlines[a] = deadlines[b];
+	deadlines[b] = t;
+	deadlines[a]->heap_index = a;
+	deadlines[b]->heap_index = b;
+}
 
-/*
- *  Find descriptor associated with given TMTask
- */
+static void heap_sift_up(int i)
+{
+	while (i > 0) {
+		int parent = (i - 1) / 2;
+		if (!heap_less(i, parent))
+			break;
+		heap_swap(i, parent);
+		i = parent;
+	}
+}
 
-inline static int find_desc(uint32 tm)
+static void heap_sift_down(int i)
 {
-	for (int i=0; i<NUM_DESCS; i++)
-		if (desc[i].in_use && desc[i].task == tm)
-			return i;
-	return -1;
+	int n = deadlines.size();
+	for (;;) {
+		int smallest = i, l = 2 * i + 1, r = 2 * i + 2;
+		if (l < n && heap_less(l, smallest))
+			smallest = l;
+		if (r < n && heap_less(r, smallest))
+			smallest = r;
+		if (smallest == i)
+			break;
+		heap_swap(i, smallest);
+		i = smallest;
+	}
+}
+
+// Insert task into heap, or move it if it is already scheduled
+static void schedule_desc(TMDesc *desc)
+{
+	if (desc->heap_index < 0) {
+		desc->heap_index = deadlines.size();
+		deadlines.push_back(desc);
+	}
+	heap_sift_up(desc->heap_index);
+	heap_sift_down(desc->heap_index);
+}
+
+// Remove task from heap
+static void unschedule_desc(TMDesc *desc)
+{
+	int i = desc->heap_index;
+	if (i < 0)
+		return;
+	int last = deadlines.size() - 1;
+	if (i != last) {
+		heap_swap(i, last);
+		deadlines.pop_back();
+		heap_sift_up(i);
+		heap_sift_down(i);
+	} else
+		deadlines.pop_back();
+	desc->heap_index = -1;
+}
+
+// Tell timer thread about the earliest deadline
+static void update_wakeup_time(void)
+{
+#ifdef PRECISE_TIMING_POSIX
+	pthread_mutex_lock(&wakeup_time_lock);
+	if (deadlines.empty())
+		wakeup_time_valid = false;
+	else {
+		tm_time_t first = deadlines[0]->wakeup;
+		if (!wakeup_time_valid || timer_cmp_time(first, wakeup_time) != 0) {
+			wakeup_time = first;
+			wakeup_time_valid = true;
+			pthread_cond_signal(&wakeup_time_cond);
+		}
+	}
+	pthread_mutex_unlock(&wakeup_time_lock);
+#endif
 }
 
 
@@ -139,9 +225,16 @@ static void dequeue_tm(uint32 tm)
 
 void TimerInit(void)
 {
-	// Mark all descriptors as inactive
-	for (int i=0; i<NUM_DESCS; i++)
-		free_desc(i);
+	TimerReset();
+
+#ifdef PRECISE_TIMING_POSIX
+	// Start timer thread
+	timer_thread_quit = false;
+	pthread_attr_t timer_thread_attr;
+	Set_pthread_attr(&timer_thread_attr, 0);
+	timer_thread_active = (pthread_create(&timer_thread, &timer_thread_attr, timer_func, NULL) == 0);
+	pthread_attr_destroy(&timer_thread_attr);
+#endif
 }
 
 
@@ -151,6 +244,17 @@ void TimerInit(void)
 
 void TimerExit(void)
 {
+#ifdef PRECISE_TIMING_POSIX
+	// Quit timer thread
+	if (timer_thread_active) {
+		pthread_mutex_lock(&wakeup_time_lock);
+		timer_thread_quit = true;
+		pthread_cond_signal(&wakeup_time_cond);
+		pthread_mutex_unlock(&wakeup_time_lock);
+		pthread_join(timer_thread, NULL);
+		timer_thread_active = false;
+	}
+#endif
 }
 
 
@@ -160,9 +264,9 @@ void TimerExit(void)
 
 void TimerReset(void)
 {
-	// Mark all descriptors as inactive
-	for (int i=0; i<NUM_DESCS; i++)
-		free_desc(i);
+	deadlines.clear();
+	descs.clear();
+	update_wakeup_time();
 }
 
 
@@ -174,12 +278,12 @@ int16 InsTime(uint32 tm, uint16 trap)
 {
 	D(bug("InsTime %08lx, trap %04x\n", tm, trap));
 	WriteMacInt16(tm + qType, (ReadMacInt16(tm + qType) & 0x1fff) | ((trap << 4) & 0x6000));
-	if (find_desc(tm) >= 0)
+	if (find_desc(tm))
 		printf("WARNING: InsTime(): Task re-inserted\n");
 	else {
-		int i = alloc_desc(tm);
-		if (i < 0)
-			printf("FATAL: InsTime(): No free Time Manager descriptor\n");
+		TMDesc &desc = descs[tm];
+		desc.task = tm;
+		desc.heap_index = -1;
 	}
 	return 0;
 }
@@ -194,8 +298,8 @@ int16 RmvTime(uint32 tm)
 	D(bug("RmvTime %08lx\n", tm));
 
 	// Find descriptor
-	int i = find_desc(tm);
-	if (i < 0) {
+	TMDesc *desc = find_desc(tm);
+	if (!desc) {
 		printf("WARNING: RmvTime(%08x): Descriptor not found\n", tm);
 		return 0;
 	}
@@ -206,18 +310,21 @@ int16 RmvTime(uint32 tm)
 		// Yes, make task inactive and remove it from the Time Manager queue
 		WriteMacInt16(tm + qType, ReadMacInt16(tm + qType) & 0x7fff);
 		dequeue_tm(tm);
+		unschedule_desc(desc);
+		update_wakeup_time();
 
 		// Compute remaining time
 		tm_time_t remaining, current;
 		timer_current_time(current);
-		timer_sub_time(remaining, desc[i].wakeup, current);
+		timer_sub_time(remaining, desc->wakeup, current);
 		WriteMacInt32(tm + tmCount, timer_host2mac_time(remaining));
 	} else
 		WriteMacInt32(tm + tmCount, 0);
 	D(bug(" tmCount %d\n", ReadMacInt32(tm + tmCount)));
 
 	// Free descriptor
-	free_desc(i);
+	unschedule_desc(desc);
+	descs.erase(tm);
 	return 0;
 }
 
@@ -231,8 +338,8 @@ int16 PrimeTime(uint32 tm, int32 time)
 	D(bug("PrimeTime %08x, time %d\n", tm, time));
 
 	// Find descriptor
-	int i = find_desc(tm);
-	if (i < 0) {
+	TMDesc *desc = find_desc(tm);
+	if (!desc) {
 		printf("FATAL: PrimeTime(): Descriptor not found\n");
 		return 0;
 	}
@@ -254,15 +361,15 @@ int16 PrimeTime(uint32 tm, int32 time)
 
 			// Yes, calculate wakeup time relative to last scheduled time
 			tm_time_t wakeup;
-			timer_add_time(wakeup, desc[i].wakeup, delay);
-			desc[i].wakeup = wakeup;
+			timer_add_time(wakeup, desc->wakeup, delay);
+			desc->wakeup = wakeup;
 
 		} else {
 
 			// No, calculate wakeup time relative to current time
 			tm_time_t now;
 			timer_current_time(now);
-			timer_add_time(desc[i].wakeup, now, delay);
+			timer_add_time(desc->wakeup, now, delay);
 		}
 
 		// Set tmWakeUp to indicate that task was scheduled
@@ -273,44 +380,90 @@ int16 PrimeTime(uint32 tm, int32 time)
 		// Not extended task, calculate wakeup time relative to current time
 		tm_time_t delay;
 		timer_mac2host_time(delay, time);
-		timer_current_time(desc[i].wakeup);
-		timer_add_time(desc[i].wakeup, desc[i].wakeup, delay);
+		timer_current_time(desc->wakeup);
+		timer_add_time(desc->wakeup, desc->wakeup, delay);
 	}
 
 	// Make task active and enqueue it in the Time Manager queue
 	WriteMacInt16(tm + qType, ReadMacInt16(tm + qType) | 0x8000);
 	enqueue_tm(tm);
+	schedule_desc(desc);
+	update_wakeup_time();
 	return 0;
 }
 
 
 /*
- *  Timer interrupt function (executed as part of 60Hz interrupt)
+ *  Time Manager thread
+ */
+
+#ifdef PRECISE_TIMING_POSIX
+static void *timer_func(void *arg)
+{
+	pthread_mutex_lock(&wakeup_time_lock);
+	while (!timer_thread_quit) {
+		if (!wakeup_time_valid) {
+			pthread_cond_wait(&wakeup_time_cond, &wakeup_time_lock);
+			continue;
+		}
+
+		// Wait until time specified by wakeup_time, or until it changes
+		// (tm_time_t is a CLOCK_REALTIME timespec here)
+		tm_time_t wakeup = wakeup_time;
+		if (pthread_cond_timedwait(&wakeup_time_cond, &wakeup_time_lock, &wakeup) == ETIMEDOUT
+		 && wakeup_time_valid && timer_cmp_time(wakeup, wakeup_time) == 0) {
+
+			// Timer expired, trigger interrupt
+			wakeup_time_valid = false;
+			SetInterruptFlag(INTFLAG_TIMER);
+			TriggerInterrupt();
+		}
+	}
+	pthread_mutex_unlock(&wakeup_time_lock);
+	return NULL;
+}
+#endif
+
+
+/*
+ *  Timer interrupt function (executed as part of 60Hz interrupt, and
+ *  when the timer thread finds the earliest deadline expired)
  */
 
 void TimerInterrupt(void)
 {
-	// Look for active TMTasks that have expired
+	// Look for active TMTasks that have expired, tasks primed again
+	// by the timer functions will run in the next interrupt
 	tm_time_t now;
 	timer_current_time(now);
-	for (int i=0; i<NUM_DESCS; i++)
-		if (desc[i].in_use) {
-			uint32 tm = desc[i].task;
-			if ((ReadMacInt16(tm + qType) & 0x8000) && timer_cmp_time(desc[i].wakeup, now) < 0) {
-
-				// Found one, mark as inactive and remove it from the Time Manager queue
-				WriteMacInt16(tm + qType, ReadMacInt16(tm + qType) & 0x7fff);
-				dequeue_tm(tm);
-
-				// Call timer function
-				uint32 addr = ReadMacInt32(tm + tmAddr);
-				if (addr) {
-					D(bug("Calling TimeTask %08lx, addr %08lx\n", tm, addr));
-					M68kRegisters r;
-					r.a[0] = addr;
-					r.a[1] = tm;
-					Execute68k(addr, &r);
-				}
-			}
+	std::vector<uint32> expired;
+	while (!deadlines.empty() && timer_cmp_time(deadlines[0]->wakeup, now) <= 0) {
+		expired.push_back(deadlines[0]->task);
+		unschedule_desc(deadlines[0]);
+	}
+
+	for (size_t i=0; i<expired.size(); i++) {
+		uint32 tm = expired[i];
+
+		// Task may have been removed or restarted by a previous timer function
+		TMDesc *desc = find_desc(tm);
+		if (desc == NULL || desc->heap_index >= 0 || !(ReadMacInt16(tm + qType) & 0x8000))
+			continue;
+
+		// Mark as inactive and remove it from the Time Manager queue
+		WriteMacInt16(tm + qType, ReadMacInt16(tm + qType) & 0x7fff);
+		dequeue_tm(tm);
+
+		// Call timer function
+		uint32 addr = ReadMacInt32(tm + tmAddr);
+		if (addr) {
+			D(bug("Calling TimeTask %08lx, addr %08lx\n", tm, addr));
+			M68kRegisters r;
+			r.a[0] = addr;
+			r.a[1] = tm;
+			Execute68k(addr, &r);
 		}
+	}
+
+	update_wakeup_time();
 }
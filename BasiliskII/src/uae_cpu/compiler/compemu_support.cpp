@@ -6730,7 +6730,10 @@ static void compile_block(cpu_history* pc_hist, int blocklen)
 	    was_comp=1;
 
 #ifdef USE_CPU_EMUL_SERVICES
-	    raw_sub_l_mi((uintptr)&emulated_ticks,blocklen);
+	    int blockcycles=0;
+	    for (i=0;i<blocklen;i++)
+		blockcycles+=cpu_opcode_cycles[DO_GET_OPCODE(pc_hist[i].location)];
+	    raw_sub_l_mi((uintptr)&emulated_ticks,blockcycles);
 	    raw_jcc_b_oponly(NATIVE_CC_GT);
 	    uae_s8 *branchadd=(uae_s8*)get_target();
 	    emit_byte(0);
@@ -7066,7 +7069,7 @@ void exec_nostats(void)
 		m68k_record_step(m68k_getpc());
 #endif
 		(*cpufunctbl[opcode])(opcode);
-		cpu_check_ticks();
+		cpu_check_ticks(opcode);
 		if (end_block(opcode) || SPCFLAGS_TEST(SPCFLAG_ALL)) {
 			return; /* We will deal with the spcflags in the caller */
 		}
@@ -7092,7 +7095,7 @@ void execute_normal(void)
 			m68k_record_step(m68k_getpc());
 #endif
 			(*cpufunctbl[opcode])(opcode);
-			cpu_check_ticks();
+			cpu_check_ticks(opcode);
 			if (end_block(opcode) || SPCFLAGS_TEST(SPCFLAG_ALL) || blocklen>=MAXRUN) {
 				compile_block(pc_hist, blocklen);
 				return; /* We will deal with the spcflags in the caller */
@@ -249,6 +249,65 @@ static void build_cpufunctbl (void)
 	}
 }
 
+#ifdef USE_CPU_EMUL_SERVICES
+/* Estimated cycles per opcode, indexed like cpufunctbl[] */
+uae_u8 cpu_opcode_cycles[65536];
+
+/* Rough cost of an effective address calculation and operand access */
+static int ea_cycles (int mode, int size)
+{
+	int c;
+	switch (mode) {
+	case Aind: case Aipi: c = 2; break;
+	case Apdi: c = 3; break;
+	case Ad16: case PC16: case absw: c = 4; break;
+	case Ad8r: case PC8r: case absl: c = 6; break;
+	default: return 0;
+	}
+	return size == sz_long ? c + 2 : c;
+}
+
+/* Build table of cycle estimates from the instruction table. The figures
+   are averages in the spirit of a 68020 with cache hits, good enough to
+   make the virtual clock follow the work done rather than the number of
+   instructions. */
+static void build_cpu_cycles (void)
+{
+	for (unsigned long opcode = 0; opcode < 65536; opcode++) {
+		struct instr *dp = table68k + opcode;
+		int c;
+		switch (dp->mnemo) {
+		case i_MULU: case i_MULS: c = 28; break;
+		case i_MULL: c = 44; break;
+		case i_DIVU: case i_DIVS: c = 44; break;
+		case i_DIVL: c = 90; break;
+		case i_MVMEL: case i_MVMLE: c = 24; break;
+		case i_ASR: case i_ASL: case i_LSR: case i_LSL:
+		case i_ROL: case i_ROR: case i_ROXL: case i_ROXR: c = 6; break;
+		case i_Bcc: case i_BSR: case i_JMP: case i_JSR: case i_RTS:
+		case i_DBcc: case i_RTD: case i_RTR: c = 6; break;
+		case i_LINK: case i_UNLK: c = 6; break;
+		case i_TRAP: case i_TRAPV: case i_TRAPcc: case i_CHK: case i_CHK2:
+		case i_RTE: case i_ILLG: case i_BKPT: c = 20; break;
+		case i_BFTST: case i_BFEXTU: case i_BFCHG: case i_BFEXTS:
+		case i_BFCLR: case i_BFFFO: case i_BFSET: case i_BFINS: c = 12; break;
+		case i_CAS: case i_CAS2: case i_TAS: c = 12; break;
+		case i_ABCD: case i_SBCD: case i_NBCD: case i_PACK: case i_UNPK: c = 6; break;
+		case i_FPP: c = 40; break;
+		case i_FDBcc: case i_FScc: case i_FTRAPcc: case i_FBcc: c = 8; break;
+		case i_FSAVE: case i_FRESTORE: c = 30; break;
+		case i_MOVE16: c = 12; break;
+		default: c = 2; break;
+		}
+		if (dp->suse)
+			c += ea_cycles (dp->smode, dp->size);
+		if (dp->duse)
+			c += ea_cycles (dp->dmode, dp->size);
+		cpu_opcode_cycles[cft_map (opcode)] = c;
+	}
+}
+#endif
+
 void init_m68k (void)
 {
 	int i;
@@ -282,6 +341,9 @@ void init_m68k (void)
 	do_merges ();
 
 	build_cpufunctbl ();
+#ifdef USE_CPU_EMUL_SERVICES
+	build_cpu_cycles ();
+#endif
 
 #if defined(ENABLE_EXCLUSIVE_SPCFLAGS) && !defined(HAVE_HARDWARE_LOCKS)
 	spcflags_lock = B2_create_mutex();
@@ -1374,7 +1436,7 @@ void m68k_do_execute (void)
 		m68k_record_step(m68k_getpc());
 #endif
 		(*cpufunctbl[opcode])(opcode);
-		cpu_check_ticks();
+		cpu_check_ticks(opcode);
 		if (SPCFLAGS_TEST(SPCFLAG_ALL_BUT_EXEC_RETURN)) {
 			if (m68k_do_specialties())
 				return;
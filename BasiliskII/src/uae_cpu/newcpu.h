@@ -340,15 +340,17 @@ extern void m68k_compile_execute(void);
 #endif
 #ifdef USE_CPU_EMUL_SERVICES
 extern int32 emulated_ticks;
+extern uae_u8 cpu_opcode_cycles[65536];
 extern void cpu_do_check_ticks(void);
 
-static inline void cpu_check_ticks(void)
+/* Count down estimated cycles of the instruction just executed */
+static inline void cpu_check_ticks(uae_u32 opcode)
 {
-	if (--emulated_ticks <= 0)
+	if ((emulated_ticks -= cpu_opcode_cycles[opcode]) <= 0)
 		cpu_do_check_ticks();
 }
 #else
-#define cpu_check_ticks()
+#define cpu_check_ticks(opcode)
 #define cpu_do_check_ticks()
 #endif
  
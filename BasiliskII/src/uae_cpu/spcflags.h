@@ -71,6 +71,18 @@ enum {
 	regs.spcflags &= ~(m); \
 } while (0)
 
+#elif defined(__GNUC__)
+
+#define HAVE_HARDWARE_LOCKS
+
+#define SPCFLAGS_SET(m) do { \
+	__atomic_fetch_or(&regs.spcflags, (m), __ATOMIC_SEQ_CST); \
+} while (0)
+
+#define SPCFLAGS_CLEAR(m) do { \
+	__atomic_fetch_and(&regs.spcflags, ~(m), __ATOMIC_SEQ_CST); \
+} while (0)
+
 #elif defined(X86_ASSEMBLY)
 
 #define HAVE_HARDWARE_LOCKS
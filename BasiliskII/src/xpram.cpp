@@ -28,10 +28,37 @@
 #include "sysdeps.h"
 #include "xpram.h"
 
+#ifdef HAVE_PTHREADS
+#include <pthread.h>
+#include <sys/time.h>
+#include <time.h>
+#endif
+
+#define DEBUG 0
+#include "debug.h"
+
 
 // Extended parameter RAM
 uint8 XPRAM[XPRAM_SIZE];
 
+#ifdef HAVE_PTHREADS
+// XPRAM is written back by a persistence thread that sleeps until the
+// contents change, then waits for writes to settle before saving
+const int XPRAM_FLUSH_DELAY = 1;				// Seconds without changes before saving
+const int XPRAM_MAX_DELAY = 10;					// Seconds after first change to save anyway
+
+static pthread_t xpram_thread;					// Persistence thread
+static bool xpram_thread_active = false;		// Flag: Persistence thread installed
+static pthread_mutex_t xpram_lock = PTHREAD_MUTEX_INITIALIZER;	// Protects the fields below
+static pthread_cond_t xpram_cond = PTHREAD_COND_INITIALIZER;	// Signalled on change and quit
+static uint32 xpram_generation = 0;				// Incremented on every change
+static bool xpram_dirty = false;				// Flag: XPRAM differs from settings file
+static time_t xpram_dirty_since;				// Time of first change not yet saved
+static bool xpram_quit = false;					// Flag: Persistence thread should exit
+
+static void *xpram_func(void *arg);
+#endif
+
 
 /*
  *  Initialize XPRAM
@@ -44,6 +71,16 @@ void XPRAMInit(const char *vmdir)
 
 	// Load XPRAM from settings file
 	LoadXPRAM(vmdir);
+
+#ifdef HAVE_PTHREADS
+	// Start persistence thread
+	xpram_dirty = xpram_quit = false;
+	pthread_attr_t attr;
+	Set_pthread_attr(&attr, 0);
+	xpram_thread_active = (pthread_create(&xpram_thread, &attr, xpram_func, NULL) == 0);
+	pthread_attr_destroy(&attr);
+	D(bug("XPRAM persistence thread %s\n", xpram_thread_active ? "started" : "not started"));
+#endif
 }
 
 
@@ -53,6 +90,84 @@ void XPRAMInit(const char *vmdir)
 
 void XPRAMExit(void)
 {
+#ifdef HAVE_PTHREADS
+	// Stop persistence thread
+	if (xpram_thread_active) {
+		pthread_mutex_lock(&xpram_lock);
+		xpram_quit = true;
+		pthread_cond_signal(&xpram_cond);
+		pthread_mutex_unlock(&xpram_lock);
+		pthread_join(xpram_thread, NULL);
+		xpram_thread_active = false;
+	}
+#endif
+
 	// Save XPRAM to settings file
 	SaveXPRAM();
 }
+
+
+/*
+ *  Note that XPRAM has been modified and needs to be written back
+ */
+
+void XPRAMChanged(void)
+{
+#ifdef HAVE_PTHREADS
+	pthread_mutex_lock(&xpram_lock);
+	xpram_generation++;
+	if (!xpram_dirty) {
+		xpram_dirty = true;
+		xpram_dirty_since = time(NULL);
+		pthread_cond_signal(&xpram_cond);
+	}
+	pthread_mutex_unlock(&xpram_lock);
+#endif
+}
+
+
+#ifdef HAVE_PTHREADS
+/*
+ *  Persistence thread: blocks until XPRAM is dirty, waits until no change
+ *  was made for XPRAM_FLUSH_DELAY seconds (but no longer than
+ *  XPRAM_MAX_DELAY seconds after the first change), then saves it
+ */
+
+static void *xpram_func(void *arg)
+{
+	pthread_mutex_lock(&xpram_lock);
+	while (!xpram_quit) {
+
+		// Sleep until something changes
+		if (!xpram_dirty) {
+			pthread_cond_wait(&xpram_cond, &xpram_lock);
+			continue;
+		}
+
+		// Debounce: restart the delay as long as writes keep coming, up to
+		// XPRAM_MAX_DELAY seconds, so a guest that writes all the time still
+		// gets its XPRAM saved
+		uint32 generation = xpram_generation;
+		struct timeval now;
+		gettimeofday(&now, NULL);
+		struct timespec timeout;
+		timeout.tv_sec = now.tv_sec + XPRAM_FLUSH_DELAY;
+		timeout.tv_nsec = now.tv_usec * 1000;
+		while (!xpram_quit && pthread_cond_timedwait(&xpram_cond, &xpram_lock, &timeout) == 0)
+			;
+		if (xpram_quit)
+			break;
+		if (generation != xpram_generation && time(NULL) - xpram_dirty_since < XPRAM_MAX_DELAY)
+			continue;
+
+		// Save outside the lock so the emulator is never blocked on I/O
+		xpram_dirty = false;
+		pthread_mutex_unlock(&xpram_lock);
+		D(bug("Saving XPRAM\n"));
+		SaveXPRAM();
+		pthread_mutex_lock(&xpram_lock);
+	}
+	pthread_mutex_unlock(&xpram_lock);
+	return NULL;
+}
+#endif
@@ -0,0 +1 @@
+../../../BasiliskII/src/Unix/disk_cow.cpp
\ No newline at end of file
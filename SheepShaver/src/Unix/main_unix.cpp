@@ -213,11 +213,6 @@ static bool dr_emulator_area_mapped = false;// Flag: Mac DR Emulator mmap()ped
 static KernelData *kernel_data;				// Pointer to Kernel Data
 static EmulatorData *emulator_data;
 
-static uint8 last_xpram[XPRAM_SIZE];		// Buffer for monitoring XPRAM changes
-
-static bool nvram_thread_active = false;	// Flag: NVRAM watchdog installed
-static volatile bool nvram_thread_cancel;	// Flag: Cancel NVRAM thread
-static pthread_t nvram_thread;				// NVRAM watchdog
 static bool tick_thread_active = false;		// Flag: MacOS thread installed
 static volatile bool tick_thread_cancel;	// Flag: Cancel 60Hz thread
 static pthread_t tick_thread;				// 60Hz thread
@@ -253,7 +248,6 @@ static bool kernel_data_init(void);
 static bool shm_map_address(int kernel_area, uint32 addr);
 static void Quit(void);
 static void *emul_func(void *arg);
-static void *nvram_func(void *arg);
 static void *tick_func(void *arg);
 #if EMULATED_PPC
 extern void emul_ppc(uint32 start);
@@ -1061,12 +1055,6 @@ int main(int argc, char **argv)
 	tick_thread_active = (pthread_create(&tick_thread, NULL, tick_func, NULL) == 0);
 	D(bug("Tick thread installed (%ld)\n", tick_thread));
 
-	// Start NVRAM watchdog thread
-	memcpy(last_xpram, XPRAM, XPRAM_SIZE);
-	nvram_thread_cancel = false;
-	nvram_thread_active = (pthread_create(&nvram_thread, NULL, nvram_func, NULL) == 0);
-	D(bug("NVRAM thread installed (%ld)\n", nvram_thread));
-
 #if !EMULATED_PPC
 	// Install SIGILL handler
 	sigemptyset(&sigill_action.sa_mask);	// Block interrupts during ILL handling
@@ -1127,13 +1115,6 @@ static void Quit(void)
 		pthread_join(tick_thread, NULL);
 	}
 
-	// Stop NVRAM watchdog thread
-	if (nvram_thread_active) {
-		nvram_thread_cancel = true;
-		pthread_cancel(nvram_thread);
-		pthread_join(nvram_thread, NULL);
-	}
-
 #if !EMULATED_PPC
 	// Uninstall SIGSEGV and SIGBUS handlers
 	sigemptyset(&sigsegv_action.sa_mask);
@@ -1378,29 +1359,6 @@ void MakeExecutable(int dummy, uint32 start, uint32 length)
 }
 
 
-/*
- *  NVRAM watchdog thread (saves NVRAM every minute)
- */
-
-static void nvram_watchdog(void)
-{
-	if (memcmp(last_xpram, XPRAM, XPRAM_SIZE)) {
-		memcpy(last_xpram, XPRAM, XPRAM_SIZE);
-		SaveXPRAM();
-	}
-}
-
-static void *nvram_func(void *arg)
-{
-	while (!nvram_thread_cancel) {
-		for (int i=0; i<60 && !nvram_thread_cancel; i++)
-			Delay_usec(999999);		// Only wait 1 second so we quit promptly when nvram_thread_cancel becomes true
-		nvram_watchdog();
-	}
-	return NULL;
-}
-
-
 /*
  *  60Hz thread (really 60.15Hz)
  */
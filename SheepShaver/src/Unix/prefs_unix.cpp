@@ -41,6 +41,11 @@ prefs_desc platform_prefs_items[] = {
 	{"ignoresegv", TYPE_BOOLEAN, false,    "ignore illegal memory accesses"},
 #endif
 	{"idlewait", TYPE_BOOLEAN, false,      "sleep when idle"},
+	{"diskoverlaydir", TYPE_STRING, false, "directory for copy-on-write overlays of disk images"},
+	{"etherstats", TYPE_INT32, false,     "seconds between Ethernet statistics log lines (0 = off)"},
+	{"slirpsndbuf", TYPE_INT32, false,    "initial slirp TCP buffer towards MacOS in KB (0 = default)"},
+	{"slirprcvbuf", TYPE_INT32, false,    "slirp TCP buffer from MacOS in KB (0 = default)"},
+	{"slirpsndbufmax", TYPE_INT32, false, "maximum slirp TCP buffer towards MacOS in KB (0 = default)"},
 #ifdef USE_SDL_VIDEO
 	{"sdlrender", TYPE_STRING, false,      "SDL_Renderer driver (\"auto\", \"software\" (may be faster), etc.)"},
 #endif
@@ -40,6 +40,7 @@
 #include <semaphore.h>
 
 #include <algorithm>
+#include <vector>
 
 #ifdef ENABLE_FBDEV_DGA
 # include <linux/fb.h>
@@ -66,6 +67,7 @@
 #include "video.h"
 #include "video_defs.h"
 #include "video_blit.h"
+#include "video_tiles.h"
 
 #define DEBUG 0
 #include "debug.h"
@@ -2274,120 +2276,31 @@ void video_set_cursor(void)
  *  Thread for window refresh, event handling and other periodic actions
  */
 
+// Tile based display update, see video_tiles.h
+struct update_rect {
+	int x, y, w, h;
+};
+
 static void update_display(void)
 {
-	// Incremental update code
-	int wide = 0, high = 0, x1, x2, y1, y2, i, j;
-	int bytes_per_row = VModes[cur_mode].viRowBytes;
-	int bytes_per_pixel = VModes[cur_mode].viRowBytes / VModes[cur_mode].viXsize;
-	uint8 *p, *p2;
-
-	// Check for first line from top and first line from bottom that have changed
-	y1 = 0;
-	for (j=0; j<VModes[cur_mode].viYsize; j++) {
-		if (memcmp(&the_buffer[j * bytes_per_row], &the_buffer_copy[j * bytes_per_row], bytes_per_row)) {
-			y1 = j;
-			break;
-		}
-	}
-	y2 = y1 - 1;
-	for (j=VModes[cur_mode].viYsize-1; j>=y1; j--) {
-		if (memcmp(&the_buffer[j * bytes_per_row], &the_buffer_copy[j * bytes_per_row], bytes_per_row)) {
-			y2 = j;
-			break;
-		}
-	}
-	high = y2 - y1 + 1;
-
-	// Check for first column from left and first column from right that have changed
-	if (high) {
-		if (depth == 1) {
-			x1 = VModes[cur_mode].viXsize;
-			for (j=y1; j<=y2; j++) {
-				p = &the_buffer[j * bytes_per_row];
-				p2 = &the_buffer_copy[j * bytes_per_row];
-				for (i=0; i<(x1>>3); i++) {
-					if (*p != *p2) {
-						x1 = i << 3;
-						break;
-					}
-					p++;
-					p2++;
-				}
-			}
-			x2 = x1;
-			for (j=y1; j<=y2; j++) {
-				p = &the_buffer[j * bytes_per_row];
-				p2 = &the_buffer_copy[j * bytes_per_row];
-				p += bytes_per_row;
-				p2 += bytes_per_row;
-				for (i=(VModes[cur_mode].viXsize>>3); i>(x2>>3); i--) {
-					p--;
-					p2--;
-					if (*p != *p2) {
-						x2 = i << 3;
-						break;
-					}
-				}
-			}
-			wide = x2 - x1;
-
-			// Update copy of the_buffer
-			if (high && wide) {
-				for (j=y1; j<=y2; j++) {
-					i = j * bytes_per_row + (x1 >> 3);
-					memcpy(&the_buffer_copy[i], &the_buffer[i], wide >> 3);
-				}
-			}
+	const int bits_per_pixel = depth == 1 ? 1 : (VModes[cur_mode].viRowBytes / VModes[cur_mode].viXsize) * 8;
+	static std::vector<update_rect> rects;
+	rects.resize(video_max_tile_rects(VModes[cur_mode].viXsize, VModes[cur_mode].viYsize));
 
-		} else {
-			x1 = VModes[cur_mode].viXsize;
-			for (j=y1; j<=y2; j++) {
-				p = &the_buffer[j * bytes_per_row];
-				p2 = &the_buffer_copy[j * bytes_per_row];
-				for (i=0; i<x1; i++) {
-					if (memcmp(p, p2, bytes_per_pixel)) {
-						x1 = i;
-						break;
-					}
-					p += bytes_per_pixel;
-					p2 += bytes_per_pixel;
-				}
-			}
-			x2 = x1;
-			for (j=y1; j<=y2; j++) {
-				p = &the_buffer[j * bytes_per_row];
-				p2 = &the_buffer_copy[j * bytes_per_row];
-				p += bytes_per_row;
-				p2 += bytes_per_row;
-				for (i=VModes[cur_mode].viXsize; i>x2; i--) {
-					p -= bytes_per_pixel;
-					p2 -= bytes_per_pixel;
-					if (memcmp(p, p2, bytes_per_pixel)) {
-						x2 = i;
-						break;
-					}
-				}
-			}
-			wide = x2 - x1;
-
-			// Update copy of the_buffer
-			if (high && wide) {
-				for (j=y1; j<=y2; j++) {
-					i = j * bytes_per_row + x1 * bytes_per_pixel;
-					memcpy(&the_buffer_copy[i], &the_buffer[i], bytes_per_pixel * wide);
-				}
-			}
-		}
-	}
+	// The X image is the_buffer_copy, changed rows just need to be copied there
+	uint32 nr_rects = video_update_tiles(the_buffer, the_buffer_copy, VModes[cur_mode].viXsize, VModes[cur_mode].viYsize,
+		VModes[cur_mode].viRowBytes, bits_per_pixel, (uint8 *)NULL, 0, 0, &rects[0]);
 
 	// Refresh display
-	if (high && wide) {
+	if (nr_rects) {
 		XDisplayLock();
-		if (have_shm)
-			XShmPutImage(x_display, the_win, the_gc, img, x1, y1, x1, y1, wide, high, 0);
-		else
-			XPutImage(x_display, the_win, the_gc, img, x1, y1, x1, y1, wide, high);
+		for (uint32 i = 0; i < nr_rects; i++) {
+			const update_rect &r = rects[i];
+			if (have_shm)
+				XShmPutImage(x_display, the_win, the_gc, img, r.x, r.y, r.x, r.y, r.w, r.h, 0);
+			else
+				XPutImage(x_display, the_win, the_gc, img, r.x, r.y, r.x, r.y, r.w, r.h);
+		}
 		XDisplayUnlock();
 	}
 }
@@ -78,6 +78,7 @@ void EmulOp(M68kRegisters *r, uint32 pc, int selector)
 				len &= 0x7fff;
 				for (uint32 i=0; i<len; i++)
 					XPRAM[((ofs + i) & 0xff) + 0x1300] = *adr++;
+				XPRAMChanged();
 			} else {
 				for (uint32 i=0; i<len; i++)
 					*adr++ = XPRAM[((ofs + i) & 0xff) + 0x1300];
@@ -91,6 +92,7 @@ void EmulOp(M68kRegisters *r, uint32 pc, int selector)
 
 		case OP_XPRAM3:				// Write to XPRam
 			XPRAM[(r->d[1] & 0xff) + 0x1300] = r->d[2];
+			XPRAMChanged();
 			break;
 
 		case OP_NVRAM1: {			// Read from NVRAM
@@ -120,6 +122,7 @@ void EmulOp(M68kRegisters *r, uint32 pc, int selector)
 
 		case OP_NVRAM2:				// Write to NVRAM
 			XPRAM[r->d[0] & 0x1fff] = r->d[1];
+			XPRAMChanged();
 			break;
 
 		case OP_NVRAM3:				// Read/write from/to NVRAM
@@ -127,6 +130,7 @@ void EmulOp(M68kRegisters *r, uint32 pc, int selector)
 				r->d[0] = XPRAM[(r->d[4] + 0x1300) & 0x1fff];
 			} else {
 				XPRAM[(r->d[4] + 0x1300) & 0x1fff] = r->d[5];
+				XPRAMChanged();
 				r->d[0] = 0;
 			}
 			break;
@@ -47,6 +47,8 @@ prefs_desc common_prefs_items[] = {
 	{"bootdriver", TYPE_INT32, false,   "boot driver number"},
 	{"ramsize", TYPE_INT32, false,      "size of Mac RAM in bytes"},
 	{"frameskip", TYPE_INT32, false,    "number of frames to skip in refreshed video modes"},
+	{"videostats", TYPE_INT32, false,   "seconds between video statistics log lines (0 = off)"},
+	{"vosfthreads", TYPE_INT32, false,  "number of threads converting the VOSF frame buffer (0 = auto)"},
 	{"gfxaccel", TYPE_BOOLEAN, false,   "turn on QuickDraw acceleration"},
 	{"nocdrom", TYPE_BOOLEAN, false,    "don't install CD-ROM driver"},
 	{"nonet", TYPE_BOOLEAN, false,      "don't use Ethernet"},